@@ -0,0 +1,520 @@
+// AvsBench - measures how fast a script delivers frames, without a VfW host.
+//
+// Usage: AvsBench script.avs [options]
+//   -threads N      Put Prefetch(N) after the script. Default: 0, no prefetching.
+//   -pool N         Give the thread pool N workers, without prefetching. Default: one
+//                   worker per logical CPU, or the -threads of Prefetch.
+//   -pattern P      Order of the requests: seq, reverse, random, stride or seek. Default: seq.
+//   -stride K       Distance between the requests of the stride pattern. Default: 2.
+//   -run N          Frames the seek pattern plays in order after each seek. Default: 30.
+//   -start N        First frame of the range. Default: 0.
+//   -end N          Last frame of the range. Default: the last frame of the clip.
+//   -count N        Number of requests. Default: the number of frames in the range.
+//   -seed N         Seed of the random pattern. Default: 1.
+//   -checksums F    Write the checksum of every requested frame to F.
+//   -cpu LEVEL      Let filters use instruction sets up to LEVEL only, see SetMaxCPU.
+//   -replay F       Issue the requests of the access log F, see SetAccessLog, instead
+//                   of a pattern. Also reports the cache hit rates of the script.
+//   -timed          With -replay, keep the pace of the log and report the stall time,
+//                   how long requests were late against it. Default: back to back.
+//   -noelide        Keep the caches of linear filter chains, see SetCacheElision.
+//
+// Running a script once with "-cpu none" and once without, and comparing
+// the checksum files, checks the SIMD paths of its filters against their
+// C versions; the timings show what each path gains. KernelBench checks
+// and times single kernels the same way, on random frame layouts.
+//
+// The seek pattern plays a few frames in order, like a preview host, and
+// then jumps to a random frame. With -threads, Prefetch works ahead of the
+// played frames, and the time to the first frame after each seek shows how
+// much that work is in the way of the frame the host waits for.
+//
+// Replaying a log recorded from a real host, with different SetMemoryMax,
+// Prefetch or cache settings, shows how they do on its access pattern.
+//
+// Reports throughput, per-frame latency, peak frame memory, the frames
+// MakeWritable had to copy and a checksum over all requested frames.
+// Running a script with and without -noelide shows the memory and copies
+// that cache elision saves.
+//
+// scripts\threadpool.cmd runs scripts\threadpool.avs at several thread counts
+// to measure the thread pool; run it against two builds to compare them.
+// scripts\seek.cmd does the same with the seek pattern.
+//
+// With -pool instead of -threads, every frame is made by the thread that
+// requests it, and only the filters that split a frame into slices use the
+// pool, so the latencies are those of single frames. The requesting thread
+// works on slices too, so N workers make N+1 threads. scripts\slices.cmd
+// runs scripts\slices.avs at several pool sizes to see how they scale.
+//
+// The exit code is 0 on success, 1 for bad arguments and 2 if the script fails.
+
+#include <avisynth.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+enum AccessPattern
+{
+  PATTERN_SEQUENTIAL,
+  PATTERN_REVERSE,
+  PATTERN_RANDOM,
+  PATTERN_STRIDE,
+  PATTERN_SEEK,
+  PATTERN_COUNT
+};
+
+struct BenchOptions
+{
+  const char* Script;
+  int Threads;
+  int Pool;
+  AccessPattern Pattern;
+  int Stride;
+  int Run;
+  int Start;
+  int End;          // Inclusive, negative for the last frame of the clip
+  int Count;        // Negative for the number of frames in the range
+  unsigned int Seed;
+  const char* ChecksumFile;
+  const char* MaxCPU;
+  const char* ReplayFile;
+  bool Timed;
+  bool NoElision;
+
+  BenchOptions() :
+    Script(NULL),
+    Threads(0),
+    Pool(0),
+    Pattern(PATTERN_SEQUENTIAL),
+    Stride(2),
+    Run(30),
+    Start(0),
+    End(-1),
+    Count(-1),
+    Seed(1),
+    ChecksumFile(NULL),
+    MaxCPU(NULL),
+    ReplayFile(NULL),
+    Timed(false),
+    NoElision(false)
+  {}
+};
+
+// One request of the host, from a pattern or an access log
+struct BenchRequest
+{
+  __int64 Time;     // Microseconds after the first request, zero for patterns
+  bool Audio;
+  bool Seek;        // First frame after a jump of the seek pattern
+  __int64 Start;    // Frame, or first sample for audio
+  __int64 Count;    // Number of samples for audio
+};
+
+static const char* const PatternNames[PATTERN_COUNT] = { "seq", "reverse", "random", "stride", "seek" };
+
+static void PrintUsage()
+{
+  fprintf(stderr,
+    "Usage: AvsBench script.avs [-threads N | -pool N] [-pattern seq|reverse|random|stride|seek] [-stride K] [-run N]\n"
+    "                [-start N] [-end N] [-count N] [-seed N] [-checksums file] [-cpu level]\n"
+    "                [-replay log [-timed]] [-noelide]\n");
+}
+
+static bool ParseOptions(int argc, char* argv[], BenchOptions* opt)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    const char* arg = argv[i];
+    if (arg[0] != '-')
+    {
+      if (opt->Script != NULL)
+        return false;
+      opt->Script = arg;
+      continue;
+    }
+
+    if (!strcmp(arg, "-timed"))
+    {
+      opt->Timed = true;
+      continue;
+    }
+    if (!strcmp(arg, "-noelide"))
+    {
+      opt->NoElision = true;
+      continue;
+    }
+
+    if (i+1 >= argc)
+      return false;
+    const char* value = argv[++i];
+
+    if (!strcmp(arg, "-threads"))
+      opt->Threads = atoi(value);
+    else if (!strcmp(arg, "-pool"))
+      opt->Pool = atoi(value);
+    else if (!strcmp(arg, "-stride"))
+      opt->Stride = atoi(value);
+    else if (!strcmp(arg, "-run"))
+      opt->Run = atoi(value);
+    else if (!strcmp(arg, "-start"))
+      opt->Start = atoi(value);
+    else if (!strcmp(arg, "-end"))
+      opt->End = atoi(value);
+    else if (!strcmp(arg, "-count"))
+      opt->Count = atoi(value);
+    else if (!strcmp(arg, "-seed"))
+      opt->Seed = (unsigned int)strtoul(value, NULL, 10);
+    else if (!strcmp(arg, "-checksums"))
+      opt->ChecksumFile = value;
+    else if (!strcmp(arg, "-cpu"))
+      opt->MaxCPU = value;
+    else if (!strcmp(arg, "-replay"))
+      opt->ReplayFile = value;
+    else if (!strcmp(arg, "-pattern"))
+    {
+      int p = 0;
+      while ((p < PATTERN_COUNT) && strcmp(value, PatternNames[p]))
+        ++p;
+      if (p == PATTERN_COUNT)
+        return false;
+      opt->Pattern = (AccessPattern)p;
+    }
+    else
+      return false;
+  }
+
+  return (opt->Script != NULL) && (opt->Threads >= 0) && (opt->Pool >= 0) && ((opt->Threads == 0) || (opt->Pool == 0))
+    && (opt->Stride != 0) && (opt->Run > 0)
+    && (!opt->Timed || (opt->ReplayFile != NULL));
+}
+
+// The frames to request, in order
+static std::vector<BenchRequest> BuildRequests(const BenchOptions& opt, int first, int last)
+{
+  const int len = last - first + 1;
+  const int count = (opt.Count >= 0) ? opt.Count : len;
+
+  std::vector<BenchRequest> requests(count);
+  std::mt19937 rng(opt.Seed);
+  std::uniform_int_distribution<int> random_frame(first, last);
+  for (int i = 0; i < count; ++i)
+  {
+    BenchRequest& r = requests[i];
+    r.Time = 0;
+    r.Audio = false;
+    r.Seek = false;
+    r.Count = 0;
+    switch (opt.Pattern)
+    {
+    case PATTERN_SEQUENTIAL:
+      r.Start = first + i % len;
+      break;
+    case PATTERN_REVERSE:
+      r.Start = last - i % len;
+      break;
+    case PATTERN_RANDOM:
+      r.Start = random_frame(rng);
+      break;
+    case PATTERN_STRIDE:
+      {
+        // Wraps around within the range, also for negative strides
+        const __int64 offset = ((__int64)i * opt.Stride) % len;
+        r.Start = first + (offset + len) % len;
+        break;
+      }
+    case PATTERN_SEEK:
+      if (i % opt.Run == 0)
+      {
+        r.Start = random_frame(rng);
+        r.Seek = (i > 0);
+      }
+      else
+      {
+        // Plays on from the previous frame, wrapping around within the range
+        r.Start = (requests[i-1].Start < last) ? requests[i-1].Start + 1 : first;
+      }
+      break;
+    }
+  }
+  return requests;
+}
+
+// Reads the requests of a log written by SetAccessLog. Returns false if
+// the file cannot be read or has a malformed line.
+static bool LoadAccessLog(const char* path, std::vector<BenchRequest>* requests)
+{
+  FILE* f = fopen(path, "r");
+  if (f == NULL)
+    return false;
+
+  bool ok = true;
+  char line[256];
+  while (ok && (fgets(line, sizeof(line), f) != NULL))
+  {
+    if ((line[0] == '#') || (line[0] == '\n') || (line[0] == '\r'))
+      continue;
+
+    BenchRequest r;
+    char type = 0;
+    r.Seek = false;
+    r.Count = 0;
+    const int fields = sscanf(line, "%I64d %c %I64d %I64d", &r.Time, &type, &r.Start, &r.Count);
+    r.Audio = (type == 'A');
+    if ((fields >= 3) && (type == 'V'))
+      requests->push_back(r);
+    else if ((fields == 4) && r.Audio && (r.Count >= 0))
+      requests->push_back(r);
+    else
+      ok = false;
+  }
+
+  fclose(f);
+  return ok;
+}
+
+// 32-bit FNV-1a over the visible part of all planes
+static unsigned int FrameChecksum(const PVideoFrame& frame, const VideoInfo& vi)
+{
+  static const int planes[] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+  const int nPlanes = (vi.IsPlanar() && !vi.IsY8()) ? 3 : 1;
+
+  unsigned int hash = 2166136261u;
+  for (int p = 0; p < nPlanes; ++p)
+  {
+    const int plane = vi.IsPlanar() ? planes[p] : 0;
+    const BYTE* ptr = frame->GetReadPtr(plane);
+    const int pitch = frame->GetPitch(plane);
+    const int row_size = frame->GetRowSize(plane);
+    const int height = frame->GetHeight(plane);
+    for (int y = 0; y < height; ++y)
+    {
+      for (int x = 0; x < row_size; ++x)
+      {
+        hash ^= ptr[x];
+        hash *= 16777619u;
+      }
+      ptr += pitch;
+    }
+  }
+  return hash;
+}
+
+static double Percentile(const std::vector<double>& sorted, int percent)
+{
+  if (sorted.empty())
+    return 0;
+  return sorted[(sorted.size() - 1) * percent / 100];
+}
+
+static int RunBenchmark(IScriptEnvironment2* env, const BenchOptions& opt)
+{
+  std::vector<BenchRequest> requests;
+  if ((opt.ReplayFile != NULL) && !LoadAccessLog(opt.ReplayFile, &requests))
+  {
+    fprintf(stderr, "AvsBench: cannot read the access log %s.\n", opt.ReplayFile);
+    return 1;
+  }
+
+  // Has to come first, filters pick their code paths when they are created
+  if (opt.MaxCPU != NULL)
+    env->Invoke("SetMaxCPU", AVSValue(opt.MaxCPU));
+
+  if (opt.NoElision)
+    env->Invoke("SetCacheElision", AVSValue(false));
+
+  // For the hit rates of the caches
+  if (opt.ReplayFile != NULL)
+    env->Invoke("SetFilterProfiling", AVSValue(true));
+
+  // The first Prefetch() sizes the pool for the whole process. One on a
+  // clip of its own does that without prefetching the frames of the script.
+  PClip pool_clip;
+  if (opt.Pool > 0)
+  {
+    AVSValue prefetch_args[2] = { env->Invoke("BlankClip", AVSValue(NULL, 0)), opt.Pool };
+    pool_clip = env->Invoke("Prefetch", AVSValue(prefetch_args, 2)).AsClip();
+  }
+
+  AVSValue script_arg(opt.Script);
+  PClip clip = env->Invoke("Import", AVSValue(&script_arg, 1)).AsClip();
+  if (opt.Threads > 0)
+  {
+    AVSValue prefetch_args[2] = { clip, opt.Threads };
+    clip = env->Invoke("Prefetch", AVSValue(prefetch_args, 2)).AsClip();
+  }
+
+  const VideoInfo& vi = clip->GetVideoInfo();
+  if (!vi.HasVideo())
+  {
+    fprintf(stderr, "AvsBench: the script does not return video.\n");
+    return 2;
+  }
+
+  const int first = std::max(opt.Start, 0);
+  const int last = (opt.End >= 0) ? std::min(opt.End, vi.num_frames - 1) : vi.num_frames - 1;
+  if (opt.ReplayFile == NULL)
+  {
+    if (first > last)
+    {
+      fprintf(stderr, "AvsBench: the frame range is empty.\n");
+      return 1;
+    }
+    requests = BuildRequests(opt, first, last);
+  }
+
+  size_t audio_requests = 0;
+  __int64 max_samples = 0;
+  for (size_t i = 0; i < requests.size(); ++i)
+  {
+    if (requests[i].Audio)
+    {
+      ++audio_requests;
+      max_samples = std::max(max_samples, requests[i].Count);
+    }
+  }
+  if ((audio_requests > 0) && !vi.HasAudio())
+  {
+    fprintf(stderr, "AvsBench: the log requests audio, but the script does not return any.\n");
+    return 2;
+  }
+  std::vector<BYTE> audio_buffer((size_t)(max_samples * vi.BytesPerAudioSample()));
+
+  FILE* checksum_file = NULL;
+  if (opt.ChecksumFile != NULL)
+  {
+    checksum_file = fopen(opt.ChecksumFile, "w");
+    if (checksum_file == NULL)
+    {
+      fprintf(stderr, "AvsBench: cannot open %s.\n", opt.ChecksumFile);
+      return 1;
+    }
+  }
+
+  std::vector<double> latencies;
+  latencies.reserve(requests.size());
+  std::vector<double> seek_latencies;
+  unsigned int total_checksum = 2166136261u;
+  double stall_time = 0;
+
+  const std::chrono::high_resolution_clock::time_point bench_start = std::chrono::high_resolution_clock::now();
+  for (size_t i = 0; i < requests.size(); ++i)
+  {
+    const BenchRequest& r = requests[i];
+    if (opt.Timed)
+      std::this_thread::sleep_until(bench_start + std::chrono::microseconds(r.Time));
+
+    const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    if (r.Audio)
+    {
+      clip->GetAudio(audio_buffer.data(), r.Start, r.Count, env);
+    }
+    else
+    {
+      PVideoFrame frame = clip->GetFrame((int)r.Start, env);
+      const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+      latencies.push_back(elapsed.count());
+      if (r.Seek)
+        seek_latencies.push_back(elapsed.count());
+
+      // Not part of the latency, but of the total time, like the work of an encoder
+      const unsigned int checksum = FrameChecksum(frame, vi);
+      total_checksum = (total_checksum ^ checksum) * 16777619u;
+      if (checksum_file != NULL)
+        fprintf(checksum_file, "%d %08x\n", (int)r.Start, checksum);
+    }
+
+    // The part of this request that ran past the time the host made the next one
+    if (opt.Timed)
+    {
+      const std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+      const std::chrono::high_resolution_clock::time_point next_due = (i+1 < requests.size())
+        ? bench_start + std::chrono::microseconds(requests[i+1].Time) : end;
+      const std::chrono::duration<double> stall = end - std::max(start, next_due);
+      stall_time += std::max(stall.count(), 0.0);
+    }
+  }
+  const std::chrono::duration<double> total = std::chrono::high_resolution_clock::now() - bench_start;
+
+  if (checksum_file != NULL)
+    fclose(checksum_file);
+
+  std::vector<double> sorted(latencies);
+  std::sort(sorted.begin(), sorted.end());
+
+  printf("Script:     %s\n", opt.Script);
+  printf("Clip:       %dx%d, %d frames\n", vi.width, vi.height, vi.num_frames);
+  if (opt.ReplayFile != NULL)
+  {
+    printf("Requests:   %u video, %u audio, replay of %s%s", (unsigned int)latencies.size(), (unsigned int)audio_requests,
+      opt.ReplayFile, opt.Timed ? " (timed)" : "");
+  }
+  else
+  {
+    printf("Requests:   %u, frames %d-%d, pattern %s", (unsigned int)requests.size(), first, last, PatternNames[opt.Pattern]);
+    if (opt.Pattern == PATTERN_STRIDE)
+      printf(" %d", opt.Stride);
+    else if (opt.Pattern == PATTERN_SEEK)
+      printf(" every %d frames", opt.Run);
+  }
+  printf(", %d prefetch threads, %u pool workers\n", opt.Threads, (unsigned int)env->GetProperty(AEP_THREADPOOL_THREADS));
+  printf("CPU flags:  0x%x\n", env->GetCPUFlags());
+  printf("Time:       %.3f s\n", total.count());
+  printf("FPS:        %.2f\n", (total.count() > 0) ? latencies.size() / total.count() : 0.0);
+  printf("Latency:    p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+    Percentile(sorted, 50) * 1000, Percentile(sorted, 99) * 1000, (sorted.empty() ? 0 : sorted.back()) * 1000);
+  if (opt.Pattern == PATTERN_SEEK)
+  {
+    std::sort(seek_latencies.begin(), seek_latencies.end());
+    printf("Seeks:      %u, first frame after a seek p50 %.2f ms, p99 %.2f ms, max %.2f ms\n", (unsigned int)seek_latencies.size(),
+      Percentile(seek_latencies, 50) * 1000, Percentile(seek_latencies, 99) * 1000, (seek_latencies.empty() ? 0 : seek_latencies.back()) * 1000);
+  }
+  if (opt.Timed)
+    printf("Stall:      %.3f s\n", stall_time);
+  printf("Memory:     peak %.1f MB\n", env->GetProperty(AEP_MEMORY_PEAK) / 1048576.0);
+  printf("Copies:     %u frames copied by MakeWritable\n", (unsigned int)env->GetProperty(AEP_FRAME_COPIES));
+  printf("Caches:     %u elided\n", (unsigned int)env->GetProperty(AEP_CACHES_ELIDED));
+  printf("Checksum:   %08x\n", total_checksum);
+
+  if (opt.ReplayFile != NULL)
+    printf("\n%s", env->Invoke("FilterProfile", AVSValue(NULL, 0)).AsString());
+
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  BenchOptions opt;
+  if (!ParseOptions(argc, argv, &opt))
+  {
+    PrintUsage();
+    return 1;
+  }
+
+  IScriptEnvironment2* env = CreateScriptEnvironment2();
+  if (env == NULL)
+  {
+    fprintf(stderr, "AvsBench: cannot create the script environment.\n");
+    return 2;
+  }
+
+  int result;
+  try
+  {
+    result = RunBenchmark(env, opt);
+  }
+  catch (const AvisynthError& err)
+  {
+    fprintf(stderr, "AvsBench: %s\n", err.msg);
+    result = 2;
+  }
+
+  env->DeleteScriptEnvironment();
+  return result;
+}
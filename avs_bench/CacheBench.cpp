@@ -0,0 +1,250 @@
+// CacheBench - measures the LRU containers behind Cache and Prefetch,
+// without going through a filter.
+//
+// Usage: CacheBench [options]
+//   -ops N          Operations timed per measurement. Default: 1000000.
+//   -capacity N     Largest capacity measured. Default: 16384.
+//   -seed N         Seed of the random keys. Default: 1.
+//   -threads N      Most threads measured for contention. Default: the number of logical CPUs.
+//   -shards N       Shards of the partitioned cache. Default: 8.
+//
+// For capacities from 16 up to -capacity, reports the cost of a
+// SimpleLruCache lookup that hits and promotes an entry, of one that misses
+// and evicts the least recently used entry, and of removing an entry and
+// inserting it again. All three are hashed, so their cost should stay flat
+// as the capacity grows; a scan of the entry list would grow with it.
+//
+// Then, for 1 up to -threads threads, reports the lookups per second that
+// all threads together get through a ShardedLruCache with one shard, which
+// is the single mutex LruCache, and through one with -shards shards. The
+// threads run the lookup, commit protocol of Cache::GetFrame on random
+// frame numbers, with about one lookup in five a miss. Compare the numbers
+// with Prefetch(threads, shards) in a real script.
+//
+// The containers are header-only and are compiled into this tool, so it
+// needs neither the DLL nor the AVS_Linkage table.
+//
+// The exit code is 0 on success and 1 for bad arguments.
+
+#include "../avs_core/core/SimpleLruCache.h"
+#include "../avs_core/core/ShardedLruCache.h"
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+typedef SimpleLruCache<size_t, size_t> BenchLruCache;
+typedef ShardedLruCache<size_t, const size_t*> BenchShardedCache;
+
+// Frames each cache of the contention measurement holds, and the range of
+// frame numbers requested from it
+#define CONTENTION_CAPACITY 256
+#define CONTENTION_KEYS 320
+
+struct BenchOptions
+{
+  int Ops;
+  int Capacity;
+  unsigned int Seed;
+  int Threads;
+  int Shards;
+
+  BenchOptions() :
+    Ops(1000000),
+    Capacity(16384),
+    Seed(1),
+    Threads(max((int)std::thread::hardware_concurrency(), 1)),
+    Shards(8)
+  {}
+};
+
+// Nanoseconds per operation since 'start'
+static double NsPerOp(const std::chrono::high_resolution_clock::time_point& start, int ops)
+{
+  const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+  return elapsed.count() * 1e9 / ops;
+}
+
+// Fills a cache with the keys 0 to capacity-1
+static void FillCache(BenchLruCache* cache, size_t capacity)
+{
+  for (size_t key = 0; key < capacity; ++key)
+  {
+    bool found;
+    *cache->lookup(key, &found) = key;
+  }
+}
+
+static void MeasureCapacity(size_t capacity, const BenchOptions& opt, std::mt19937& rng)
+{
+  // Drawn in advance, so that the random generator is not part of the timing
+  std::uniform_int_distribution<size_t> random_key(0, capacity - 1);
+  std::vector<size_t> keys(opt.Ops);
+  for (int i = 0; i < opt.Ops; ++i)
+    keys[i] = random_key(rng);
+
+  size_t checksum = 0;
+  bool found;
+
+  // Hits on random entries, each moved to the front
+  BenchLruCache hit_cache(capacity, BenchLruCache::EvictEventType(), NULL);
+  FillCache(&hit_cache, capacity);
+  std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < opt.Ops; ++i)
+    checksum += *hit_cache.lookup(keys[i], &found);
+  const double hit_ns = NsPerOp(start, opt.Ops);
+
+  // Keys that were never stored, each evicting the oldest entry
+  BenchLruCache miss_cache(capacity, BenchLruCache::EvictEventType(), NULL);
+  FillCache(&miss_cache, capacity);
+  start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < opt.Ops; ++i)
+    *miss_cache.lookup(capacity + i, &found) = i;
+  const double miss_ns = NsPerOp(start, opt.Ops);
+
+  // Random entries removed and put back, as a rolled back frame is
+  BenchLruCache remove_cache(capacity, BenchLruCache::EvictEventType(), NULL);
+  FillCache(&remove_cache, capacity);
+  start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < opt.Ops; ++i)
+  {
+    remove_cache.remove(keys[i]);
+    *remove_cache.lookup(keys[i], &found) = keys[i];
+  }
+  const double remove_ns = NsPerOp(start, opt.Ops);
+
+  // Printed so that the lookups cannot be optimized away
+  printf("%10u %14.1f %14.1f %14.1f    %08x\n", (unsigned int)capacity, hit_ns, miss_ns, remove_ns,
+    (unsigned int)checksum);
+}
+
+// One thread of the contention measurement
+struct ContentionWorker
+{
+  BenchShardedCache* Cache;
+  const size_t* Keys;
+  int Ops;
+  const std::atomic<bool>* Go;
+
+  void operator()() const
+  {
+    // Start together, so that the threads really compete
+    while (!*Go)
+      std::this_thread::yield();
+
+    for (int i = 0; i < Ops; ++i)
+    {
+      BenchShardedCache::handle hndl;
+      switch (Cache->lookup(Keys[i], &hndl, true))
+      {
+      case LRU_LOOKUP_NOT_FOUND:
+        hndl.first->value = &Keys[i];
+        Cache->commit_value(&hndl);
+        break;
+      case LRU_LOOKUP_FOUND_AND_READY:
+      case LRU_LOOKUP_NO_CACHE:
+      default:
+        break;
+      }
+    }
+  }
+};
+
+// Millions of lookups per second through a cache with 'shards' shards
+static double MeasureContention(int threads, size_t shards, const std::vector<size_t>& keys, const BenchOptions& opt)
+{
+  BenchShardedCache cache(CONTENTION_CAPACITY, shards);
+
+  // Keeps the ghost hits from growing the cache until every frame fits
+  cache.set_limits(0, CONTENTION_CAPACITY);
+
+  const int ops = opt.Ops / threads;
+  std::atomic<bool> go(false);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t)
+  {
+    ContentionWorker worker = { &cache, &keys[t * ops], ops, &go };
+    workers.push_back(std::thread(worker));
+  }
+
+  const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+  go = true;
+  for (size_t t = 0; t < workers.size(); ++t)
+    workers[t].join();
+  const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+  return (double)ops * threads / elapsed.count() / 1e6;
+}
+
+static void PrintUsage()
+{
+  fprintf(stderr,
+    "Usage: CacheBench [-ops N] [-capacity N] [-seed N] [-threads N] [-shards N]\n");
+}
+
+static bool ParseOptions(int argc, char* argv[], BenchOptions* opt)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    const char* arg = argv[i];
+    if (i+1 >= argc)
+      return false;
+    const int value = atoi(argv[++i]);
+
+    if (!strcmp(arg, "-ops"))
+      opt->Ops = value;
+    else if (!strcmp(arg, "-capacity"))
+      opt->Capacity = value;
+    else if (!strcmp(arg, "-seed"))
+      opt->Seed = (unsigned int)value;
+    else if (!strcmp(arg, "-threads"))
+      opt->Threads = value;
+    else if (!strcmp(arg, "-shards"))
+      opt->Shards = value;
+    else
+      return false;
+  }
+
+  return (opt->Ops > 0) && (opt->Capacity >= 16) && (opt->Threads > 0) && (opt->Shards > 0)
+    && (opt->Ops >= opt->Threads);
+}
+
+int main(int argc, char* argv[])
+{
+  BenchOptions opt;
+  if (!ParseOptions(argc, argv, &opt))
+  {
+    PrintUsage();
+    return 1;
+  }
+
+  std::mt19937 rng(opt.Seed);
+
+  printf("SimpleLruCache, ns per operation over %d operations\n", opt.Ops);
+  printf("%10s %14s %14s %14s    %8s\n", "capacity", "hit", "miss+evict", "remove+insert", "checksum");
+  for (size_t capacity = 16; capacity <= (size_t)opt.Capacity; capacity *= 4)
+    MeasureCapacity(capacity, opt, rng);
+
+  std::uniform_int_distribution<size_t> random_frame(0, CONTENTION_KEYS - 1);
+  std::vector<size_t> keys(opt.Ops);
+  for (int i = 0; i < opt.Ops; ++i)
+    keys[i] = random_frame(rng);
+
+  printf("\nLruCache contention, millions of lookups per second over %d lookups\n", opt.Ops);
+  printf("%10s %14s %11d shards\n", "threads", "1 shard", opt.Shards);
+  for (int threads = 1; ; threads *= 2)
+  {
+    threads = min(threads, opt.Threads);
+    const double single = MeasureContention(threads, 1, keys, opt);
+    const double sharded = MeasureContention(threads, opt.Shards, keys, opt);
+    printf("%10d %14.2f %18.2f\n", threads, single, sharded);
+    if (threads == opt.Threads)
+      break;
+  }
+
+  return 0;
+}
@@ -0,0 +1,305 @@
+// EnvBench - measures services that the script environment shares between
+// all filters and threads, without a script.
+//
+// Usage: EnvBench [options]
+//   -threads N      Most threads measured. Default: the number of logical CPUs.
+//   -ops N          Operations timed per measurement. Default: 200000.
+//   -width N        Width of the YV12 frames allocated. Default: 1920.
+//   -height N       Height of the YV12 frames allocated. Default: 1080.
+//   -live N         Frames each thread keeps alive while it allocates. Default: 4.
+//   -pool N         Workers of the thread pool. Default: the pool the environment
+//                   starts with, one worker per logical CPU.
+//   -work N         Loop iterations of busy work per pool job. Default: 1000.
+//
+// For 1 up to -threads threads, reports how many NewVideoFrame calls per
+// second all threads together get through. Every thread keeps its last
+// -live frames, like a filter that holds on to its source frames, so that
+// most calls reuse a frame another call has just released. Compare the
+// numbers between builds to see what the frame allocator gains.
+//
+// Then reports the jobs per second of the thread pool, once for jobs queued
+// from outside the pool, which go through its shared queue, and once for
+// jobs that pool jobs queue and wait for, which land on the deque of their
+// worker and are run there or stolen by idle workers. The latency is the
+// time from queueing a job on the idle pool until a worker starts it. Like
+// Prefetch, -pool resizes the one pool of the process.
+//
+// The exit code is 0 on success, 1 for bad arguments and 2 if the
+// environment cannot be created or a call fails.
+
+#include <avisynth.h>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+struct BenchOptions
+{
+  int Threads;
+  int Ops;
+  int Width;
+  int Height;
+  int Live;
+  int Pool;
+  int Work;
+
+  BenchOptions() :
+    Threads(std::max((int)std::thread::hardware_concurrency(), 1)),
+    Ops(200000),
+    Width(1920),
+    Height(1080),
+    Live(4),
+    Pool(0),
+    Work(1000)
+  {}
+};
+
+static void DestroyCompletion(IJobCompletion* completion)
+{
+  completion->Destroy();
+}
+
+typedef std::unique_ptr<IJobCompletion, void(*)(IJobCompletion*)> CompletionPtr;
+
+static double Percentile(const std::vector<double>& sorted, int percent)
+{
+  if (sorted.empty())
+    return 0;
+  return sorted[(sorted.size() - 1) * percent / 100];
+}
+
+// One thread of the allocation measurement
+struct AllocWorker
+{
+  IScriptEnvironment2* Env;
+  const VideoInfo* Vi;
+  int Ops;
+  int Live;
+  const std::atomic<bool>* Go;
+
+  void operator()() const
+  {
+    std::vector<PVideoFrame> frames(Live);
+
+    // Start together, so that the threads really compete
+    while (!*Go)
+      std::this_thread::yield();
+
+    for (int i = 0; i < Ops; ++i)
+      frames[i % Live] = Env->NewVideoFrame(*Vi);
+  }
+};
+
+// Allocations per second of all threads together
+static double MeasureAllocation(IScriptEnvironment2* env, const VideoInfo& vi, int threads, const BenchOptions& opt)
+{
+  const int ops = opt.Ops / threads;
+  std::atomic<bool> go(false);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t)
+  {
+    AllocWorker worker = { env, &vi, ops, opt.Live, &go };
+    workers.push_back(std::thread(worker));
+  }
+
+  const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+  go = true;
+  for (size_t t = 0; t < workers.size(); ++t)
+    workers[t].join();
+  const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+  return (double)ops * threads / elapsed.count();
+}
+
+// Jobs queued at once from one thread, and the jobs each nested job queues
+#define POOL_BATCH 256
+#define POOL_CHILDREN 16
+#define POOL_LATENCY_SAMPLES 10000
+
+struct PoolJobData
+{
+  int Work;
+  std::chrono::high_resolution_clock::time_point Started;
+};
+
+static AVSValue LeafJob(IScriptEnvironment2* env, void* data)
+{
+  PoolJobData* d = reinterpret_cast<PoolJobData*>(data);
+
+  volatile int sink = 0;
+  for (int i = 0; i < d->Work; ++i)
+    sink += i;
+  return AVSValue();
+}
+
+// Queues its children from a worker, as a slice-threaded filter does
+static AVSValue ParentJob(IScriptEnvironment2* env, void* data)
+{
+  CompletionPtr completion(env->NewCompletion(POOL_CHILDREN), DestroyCompletion);
+  for (int i = 0; i < POOL_CHILDREN; ++i)
+    env->ParallelJob(LeafJob, data, completion.get());
+  completion->Wait();
+  return AVSValue();
+}
+
+static AVSValue LatencyJob(IScriptEnvironment2* env, void* data)
+{
+  reinterpret_cast<PoolJobData*>(data)->Started = std::chrono::high_resolution_clock::now();
+  return AVSValue();
+}
+
+// Jobs per second for 'jobs' jobs of 'func', queued POOL_BATCH at a time
+static double MeasurePool(IScriptEnvironment2* env, ThreadWorkerFuncPtr func, int jobs, PoolJobData* data)
+{
+  CompletionPtr completion(env->NewCompletion(POOL_BATCH), DestroyCompletion);
+
+  const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+  for (int queued = 0; queued < jobs; queued += POOL_BATCH)
+  {
+    for (int i = queued; i < std::min(queued + POOL_BATCH, jobs); ++i)
+      env->ParallelJob(func, data, completion.get());
+    completion->Wait();
+    completion->Reset();
+  }
+  const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+  return jobs / elapsed.count();
+}
+
+static void RunPoolBenchmark(IScriptEnvironment2* env, const BenchOptions& opt)
+{
+  // The first Prefetch() sizes the pool, so put one on a clip of its own
+  PClip prefetch;
+  if (opt.Pool > 0)
+  {
+    AVSValue prefetch_args[2] = { env->Invoke("BlankClip", AVSValue(NULL, 0)), opt.Pool };
+    prefetch = env->Invoke("Prefetch", AVSValue(prefetch_args, 2)).AsClip();
+  }
+
+  PoolJobData data;
+  data.Work = opt.Work;
+
+  const double flat_rate = MeasurePool(env, LeafJob, opt.Ops, &data);
+  const double nested_rate = MeasurePool(env, ParentJob, std::max(opt.Ops / POOL_CHILDREN, 1), &data) * POOL_CHILDREN;
+
+  CompletionPtr completion(env->NewCompletion(1), DestroyCompletion);
+  std::vector<double> latencies(POOL_LATENCY_SAMPLES);
+  for (int i = 0; i < POOL_LATENCY_SAMPLES; ++i)
+  {
+    const std::chrono::high_resolution_clock::time_point queued = std::chrono::high_resolution_clock::now();
+    env->ParallelJob(LatencyJob, &data, completion.get());
+    completion->Wait();
+    completion->Reset();
+    const std::chrono::duration<double> latency = data.Started - queued;
+    latencies[i] = latency.count();
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  printf("\nThread pool, %u workers, %d iterations of work per job, over %d jobs\n",
+    (unsigned int)env->GetProperty(AEP_THREADPOOL_THREADS), opt.Work, opt.Ops);
+  printf("Queued from outside:  %.0f jobs/s\n", flat_rate);
+  printf("Queued by workers:    %.0f jobs/s\n", nested_rate);
+  printf("Latency:    p50 %.1f us, p99 %.1f us, max %.1f us\n",
+    Percentile(latencies, 50) * 1e6, Percentile(latencies, 99) * 1e6, latencies.back() * 1e6);
+}
+
+static void RunBenchmark(IScriptEnvironment2* env, const BenchOptions& opt)
+{
+  VideoInfo vi;
+  memset(&vi, 0, sizeof(VideoInfo));
+  vi.width = opt.Width;
+  vi.height = opt.Height;
+  vi.pixel_type = VideoInfo::CS_YV12;
+
+  // Registers the frames of the largest run, so that every run reuses them
+  MeasureAllocation(env, vi, opt.Threads, opt);
+
+  printf("NewVideoFrame, %dx%d YV12, %d live frames per thread, over %d calls\n",
+    opt.Width, opt.Height, opt.Live, opt.Ops);
+  printf("%10s %14s %14s\n", "threads", "calls/s", "ns/call");
+  for (int threads = 1; ; threads *= 2)
+  {
+    threads = std::min(threads, opt.Threads);
+    const double rate = MeasureAllocation(env, vi, threads, opt);
+    printf("%10d %14.0f %14.1f\n", threads, rate, 1e9 / rate);
+    if (threads == opt.Threads)
+      break;
+  }
+  printf("Memory:     peak %.1f MB\n", env->GetProperty(AEP_MEMORY_PEAK) / 1048576.0);
+
+  RunPoolBenchmark(env, opt);
+}
+
+static void PrintUsage()
+{
+  fprintf(stderr,
+    "Usage: EnvBench [-threads N] [-ops N] [-width N] [-height N] [-live N] [-pool N] [-work N]\n");
+}
+
+static bool ParseOptions(int argc, char* argv[], BenchOptions* opt)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    const char* arg = argv[i];
+    if (i+1 >= argc)
+      return false;
+    const int value = atoi(argv[++i]);
+
+    if (!strcmp(arg, "-threads"))
+      opt->Threads = value;
+    else if (!strcmp(arg, "-ops"))
+      opt->Ops = value;
+    else if (!strcmp(arg, "-width"))
+      opt->Width = value;
+    else if (!strcmp(arg, "-height"))
+      opt->Height = value;
+    else if (!strcmp(arg, "-live"))
+      opt->Live = value;
+    else if (!strcmp(arg, "-pool"))
+      opt->Pool = value;
+    else if (!strcmp(arg, "-work"))
+      opt->Work = value;
+    else
+      return false;
+  }
+
+  // YV12 needs even dimensions
+  return (opt->Threads > 0) && (opt->Ops >= opt->Threads) && (opt->Live > 0) && (opt->Pool >= 0) && (opt->Work >= 0)
+    && (opt->Width > 0) && (opt->Height > 0) && (opt->Width % 2 == 0) && (opt->Height % 2 == 0);
+}
+
+int main(int argc, char* argv[])
+{
+  BenchOptions opt;
+  if (!ParseOptions(argc, argv, &opt))
+  {
+    PrintUsage();
+    return 1;
+  }
+
+  IScriptEnvironment2* env = CreateScriptEnvironment2();
+  if (env == NULL)
+  {
+    fprintf(stderr, "EnvBench: cannot create the script environment.\n");
+    return 2;
+  }
+
+  int result = 0;
+  try
+  {
+    RunBenchmark(env, opt);
+  }
+  catch (const AvisynthError& err)
+  {
+    fprintf(stderr, "EnvBench: %s\n", err.msg);
+    result = 2;
+  }
+
+  env->DeleteScriptEnvironment();
+  return result;
+}
@@ -0,0 +1,985 @@
+// KernelBench - checks the SIMD variants of single kernels against their C
+// versions and measures them, without going through a filter.
+//
+// Usage: KernelBench [options]
+//   -rounds N       Random layouts each variant is checked on. Default: 200.
+//   -seed N         Seed of the random layouts and pixels. Default: 1.
+//   -width N        Width of the frame the variants are timed on. Default: 1920.
+//   -height N       Height of the frame the variants are timed on. Default: 1080.
+//   -iterations N   Runs per timing; the fastest one counts. Default: 50.
+//
+// Each round picks a width, height, pitches and buffer offsets at random,
+// within what the frame allocator guarantees: pitches are multiples of
+// FRAME_ALIGN at least as wide as the rows, and planes start on a 16 byte
+// boundary. The C and the SIMD variant run on the same random pixels, and
+// only the visible bytes of the outputs are compared, since the SIMD
+// variants may write into the padding of the rows. Kernels that return a
+// value instead of writing pixels must return exactly the C result.
+//
+// Some SIMD kernels work with less precise weights or sums than their C
+// versions (Blur/Sharpen with 7 bit, Merge with 15 bit weights, the SSSE3
+// vertical resizer with 16 bit sums), so their outputs may be off by the
+// tolerance printed after the timing.
+//
+// Timings are reported in CPU cycles per pixel of the frame, together with
+// the speedup over the C variant.
+//
+// The kernels are compiled into this tool from their kernel source files, so
+// that they can be called directly. The resizers take their resampling
+// programs from the core, which is why the tool links to AviSynth.dll.
+//
+// The exit code is 0 if all variants match, 1 for bad arguments or if the
+// environment cannot be created, and 2 if a variant differs from the C version.
+
+#include <avisynth.h>
+#include <avs/cpuid.h>
+#include <avs/alignment.h>
+#include "../avs_core/convert/convert_yv12.h"
+#include "../avs_core/filters/resample_kernels.h"
+#include "../avs_core/filters/focus_kernels.h"
+#include "../avs_core/filters/merge_kernels.h"
+#include "../avs_core/filters/conditional/conditional_kernels.h"
+#include "../avs_core/core/internal.h"
+#include <intrin.h>
+#include <vector>
+#include <memory>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+typedef void (*Yv12ToYuy2Func)(const BYTE* srcY, const BYTE* srcU, const BYTE* srcV, int src_width, int src_pitch_y, int src_pitch_uv, BYTE *dstp, int dst_pitch, int height);
+typedef void (*Yuy2ToYv12Func)(const BYTE* src, int src_width, int src_pitch, BYTE* dstY, BYTE* dstU, BYTE* dstV, int dst_pitchY, int dst_pitchUV, int height);
+typedef void (*ResizeVFunc)(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int target_height, const int* pitch_table, const void* storage);
+
+// The Blur/Sharpen kernels clip through the table the core defines in avisynth.cpp
+const _PixelClip PixelClip;
+
+// Variants of a kernel, in the order of the function tables below
+enum KernelVariant
+{
+  VARIANT_C,
+  VARIANT_MMX,
+  VARIANT_ISSE,
+  VARIANT_SSE2,
+  VARIANT_SSSE3,
+  VARIANT_COUNT
+};
+
+static const char* const VariantNames[VARIANT_COUNT] = { "c", "mmx", "isse", "sse2", "ssse3" };
+static const int VariantFlags[VARIANT_COUNT] = { 0, CPUF_MMX, CPUF_INTEGER_SSE, CPUF_SSE2, CPUF_SSSE3 };
+
+// The MMX and ISSE kernels only exist in 32 bit builds
+#ifdef X86_32
+#define X86_VARIANT(f) f
+#else
+#define X86_VARIANT(f) NULL
+#endif
+
+struct BenchOptions
+{
+  int Rounds;
+  unsigned int Seed;
+  int Width;
+  int Height;
+  int Iterations;
+
+  BenchOptions() :
+    Rounds(200),
+    Seed(1),
+    Width(1920),
+    Height(1080),
+    Iterations(50)
+  {}
+};
+
+// Rows of RowSize visible bytes, Pitch bytes apart, laid out like a plane of a frame
+class Plane
+{
+  std::vector<BYTE> Store;
+
+public:
+  BYTE* Data;
+  int RowSize;
+  int Height;
+  int Pitch;
+  int Offset;
+
+  Plane() : Data(NULL), RowSize(0), Height(0), Pitch(0), Offset(0) {}
+
+  // Puts the first row 'offset' bytes after a FRAME_ALIGN boundary. The
+  // slack after the last row covers reads past the rows of the SIMD variants.
+  void Allocate(int row_size, int height, int pitch, int offset)
+  {
+    RowSize = row_size;
+    Height = height;
+    Pitch = pitch;
+    Offset = offset;
+    Store.assign((size_t)pitch * height + offset + FRAME_ALIGN * 3, 0);
+    BYTE* base = &Store[0];
+    Data = base + (AlignNumber((size_t)base, (size_t)FRAME_ALIGN) - (size_t)base) + offset;
+  }
+
+  // A random layout as the frame allocator could hand it out, or the
+  // tightest one if random_layout is not set
+  void Allocate(int row_size, int height, bool random_layout, std::mt19937& rng)
+  {
+    if (random_layout)
+      Allocate(row_size, height, AlignNumber(row_size, FRAME_ALIGN) + FRAME_ALIGN * (int)(rng() % 4), 16 * (int)(rng() % 4));
+    else
+      Allocate(row_size, height, AlignNumber(row_size, FRAME_ALIGN), 0);
+  }
+
+  // Same layout and contents, padding included
+  void CopyFrom(const Plane& other)
+  {
+    Allocate(other.RowSize, other.Height, other.Pitch, other.Offset);
+    memcpy(Data, other.Data, (size_t)Pitch * Height + FRAME_ALIGN * 2);
+  }
+
+  void Randomize(std::mt19937& rng)
+  {
+    for (size_t i = 0; i < Store.size(); ++i)
+      Store[i] = (BYTE)rng();
+  }
+
+  void Fill(BYTE value)
+  {
+    memset(&Store[0], value, Store.size());
+  }
+
+  BYTE* Row(int y) const
+  {
+    return Data + (size_t)y * Pitch;
+  }
+
+  // Returns false and the first position that differs by more than
+  // tolerance if the visible bytes differ
+  bool Equals(const Plane& other, int tolerance, int* diff_x, int* diff_y) const
+  {
+    for (int y = 0; y < Height; ++y)
+    {
+      const BYTE* a = Row(y);
+      const BYTE* b = other.Row(y);
+      for (int x = 0; x < RowSize; ++x)
+      {
+        if (abs(a[x] - b[x]) > tolerance)
+        {
+          *diff_x = x;
+          *diff_y = y;
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+};
+
+struct Yv12Image
+{
+  Plane Y, U, V;
+
+  // U and V get half the pitch of Y, as in frames
+  void Allocate(int width, int height, bool random_layout, std::mt19937& rng)
+  {
+    Y.Allocate(width, height, random_layout, rng);
+    U.Allocate(width / 2, height / 2, Y.Pitch / 2, Y.Offset);
+    V.Allocate(width / 2, height / 2, Y.Pitch / 2, Y.Offset);
+  }
+
+  void Randomize(std::mt19937& rng)
+  {
+    Y.Randomize(rng);
+    U.Randomize(rng);
+    V.Randomize(rng);
+  }
+
+  void Fill(BYTE value)
+  {
+    Y.Fill(value);
+    U.Fill(value);
+    V.Fill(value);
+  }
+};
+
+// A kernel with its C and SIMD variants, and the buffers to run them on.
+// Width and Height are in pixels of the frame the kernel works on.
+class KernelTest
+{
+public:
+  const char* const Name;
+  // Limits of the random frames the variants are checked on
+  const int WidthMod, HeightMod, MinWidth, MinHeight;
+
+  // Outputs compared against those of the C variant, set up by Setup()
+  std::vector<Plane*> Outputs;
+  // Value returned by kernels that compute a statistic of their inputs
+  __int64 Result;
+
+  KernelTest(const char* name, int width_mod, int height_mod, int min_width, int min_height, int tolerance) :
+    Name(name), WidthMod(width_mod), HeightMod(height_mod), MinWidth(min_width), MinHeight(min_height),
+    Result(0), SimdTolerance(tolerance)
+  {}
+
+  virtual ~KernelTest() {}
+
+  virtual bool HasVariant(int variant) const = 0;
+
+  // Largest difference to the C output the variant may have
+  virtual int Tolerance(int variant) const { return (variant == VARIANT_C) ? 0 : SimdTolerance; }
+
+  // Allocates the buffers for a width x height frame and fills the inputs with random pixels
+  virtual void Setup(int width, int height, bool random_layout, std::mt19937& rng) = 0;
+
+  // Restores the inputs the kernel works on in place, and fills the other outputs with 'fill'
+  virtual void Reset(BYTE fill) = 0;
+
+  virtual void Run(int variant) = 0;
+
+protected:
+  const int SimdTolerance;
+
+private:
+  KernelTest(const KernelTest&);
+  KernelTest& operator=(const KernelTest&);
+};
+
+
+/* YV12 <-> YUY2 conversions */
+
+class Yv12ToYuy2Test : public KernelTest
+{
+  Yv12ToYuy2Func Variants[VARIANT_COUNT];
+  Yv12Image Src;
+  Plane Dst;
+  int Width, Height;
+
+public:
+  Yv12ToYuy2Test(const char* name, int height_mod, Yv12ToYuy2Func c, Yv12ToYuy2Func isse, Yv12ToYuy2Func sse2) :
+    KernelTest(name, 2, height_mod, 2, 8, 0), Width(0), Height(0)
+  {
+    Yv12ToYuy2Func variants[VARIANT_COUNT] = { c, NULL, isse, sse2, NULL };
+    memcpy(Variants, variants, sizeof(Variants));
+    Outputs.push_back(&Dst);
+  }
+
+  bool HasVariant(int variant) const { return Variants[variant] != NULL; }
+
+  void Setup(int width, int height, bool random_layout, std::mt19937& rng)
+  {
+    Width = width;
+    Height = height;
+    Src.Allocate(width, height, random_layout, rng);
+    Src.Randomize(rng);
+    Dst.Allocate(width * 2, height, random_layout, rng);
+  }
+
+  void Reset(BYTE fill) { Dst.Fill(fill); }
+
+  void Run(int variant)
+  {
+    Variants[variant](Src.Y.Data, Src.U.Data, Src.V.Data, Width, Src.Y.Pitch, Src.U.Pitch, Dst.Data, Dst.Pitch, Height);
+  }
+};
+
+class Yuy2ToYv12Test : public KernelTest
+{
+  Yuy2ToYv12Func Variants[VARIANT_COUNT];
+  Plane Src;
+  Yv12Image Dst;
+  int Width, Height;
+
+public:
+  Yuy2ToYv12Test(const char* name, int height_mod, Yuy2ToYv12Func c, Yuy2ToYv12Func isse, Yuy2ToYv12Func sse2) :
+    KernelTest(name, 2, height_mod, 2, 8, 0), Width(0), Height(0)
+  {
+    Yuy2ToYv12Func variants[VARIANT_COUNT] = { c, NULL, isse, sse2, NULL };
+    memcpy(Variants, variants, sizeof(Variants));
+    Outputs.push_back(&Dst.Y);
+    Outputs.push_back(&Dst.U);
+    Outputs.push_back(&Dst.V);
+  }
+
+  bool HasVariant(int variant) const { return Variants[variant] != NULL; }
+
+  void Setup(int width, int height, bool random_layout, std::mt19937& rng)
+  {
+    Width = width;
+    Height = height;
+    Src.Allocate(width * 2, height, random_layout, rng);
+    Src.Randomize(rng);
+    Dst.Allocate(width, height, random_layout, rng);
+  }
+
+  void Reset(BYTE fill) { Dst.Fill(fill); }
+
+  void Run(int variant)
+  {
+    Variants[variant](Src.Data, Width * 2, Src.Pitch, Dst.Y.Data, Dst.U.Data, Dst.V.Data, Dst.Y.Pitch, Dst.U.Pitch, Height);
+  }
+};
+
+
+/* Resizers */
+
+// Random checks scale by up to 2 either way, timings from 1080 to 720 lines
+static int ResizeTarget(int source, bool random_layout, int mod, std::mt19937& rng)
+{
+  int target = source * 2 / 3;
+  if (random_layout)
+    target = source / 2 + (int)(rng() % (unsigned int)(source * 3 / 2 + 1));
+  target = target / mod * mod;
+  return target < mod ? mod : target;
+}
+
+class ResizeVTest : public KernelTest
+{
+  ResizeVFunc Variants[VARIANT_COUNT];
+  ResamplingFunction* Func;
+  IScriptEnvironment2* Env;
+  std::unique_ptr<ResamplingProgram> Program;
+  std::vector<int> PitchTable;
+  Plane Src, Dst;
+  int Width, TargetHeight;
+
+public:
+  ResizeVTest(const char* name, ResamplingFunction* func, IScriptEnvironment2* env) :
+    KernelTest(name, 1, 1, 1, 32, 0), Func(func), Env(env), Width(0), TargetHeight(0)
+  {
+    // The aligned loads, as the core picks them for its own frames
+    ResizeVFunc variants[VARIANT_COUNT] = {
+      resize_v_c_planar, X86_VARIANT(resize_v_mmx_planar), NULL,
+      resize_v_sse2_planar<simd_load_aligned>, resize_v_ssse3_planar<simd_load_aligned> };
+    memcpy(Variants, variants, sizeof(Variants));
+    Outputs.push_back(&Dst);
+  }
+
+  bool HasVariant(int variant) const { return Variants[variant] != NULL; }
+
+  // The SSSE3 kernel sums with 16 bit precision and may round differently
+  int Tolerance(int variant) const { return (variant == VARIANT_SSSE3) ? 1 : 0; }
+
+  void Setup(int width, int height, bool random_layout, std::mt19937& rng)
+  {
+    Width = width;
+    TargetHeight = ResizeTarget(height, random_layout, 1, rng);
+    Program.reset(Func->GetResamplingProgram(height, 0.0, height, TargetHeight, Env));
+    Src.Allocate(width, height, random_layout, rng);
+    Src.Randomize(rng);
+    Dst.Allocate(width, TargetHeight, random_layout, rng);
+    PitchTable.resize(height);
+    resize_v_create_pitch_table(&PitchTable[0], Src.Pitch, height);
+  }
+
+  void Reset(BYTE fill) { Dst.Fill(fill); }
+
+  void Run(int variant)
+  {
+    Variants[variant](Dst.Data, Src.Data, Dst.Pitch, Src.Pitch, Program.get(), Width, TargetHeight, &PitchTable[0], NULL);
+  }
+};
+
+class ResizeHTest : public KernelTest
+{
+  ResamplingFunction* Func;
+  IScriptEnvironment2* Env;
+  // The SSSE3 kernels need the coefficients padded to 8 per pixel
+  std::unique_ptr<ResamplingProgram> Program, PaddedProgram;
+  Plane Src, Dst;
+  int TargetWidth, Height;
+
+public:
+  // The core only takes the SSSE3 path for target widths that are multiples of 4
+  ResizeHTest(const char* name, ResamplingFunction* func, IScriptEnvironment2* env) :
+    KernelTest(name, 1, 1, 32, 1, 0), Func(func), Env(env), TargetWidth(0), Height(0)
+  {
+    Outputs.push_back(&Dst);
+  }
+
+  bool HasVariant(int variant) const { return (variant == VARIANT_C) || (variant == VARIANT_SSSE3); }
+
+  void Setup(int width, int height, bool random_layout, std::mt19937& rng)
+  {
+    TargetWidth = ResizeTarget(width, random_layout, 4, rng);
+    Height = height;
+    Program.reset(Func->GetResamplingProgram(width, 0.0, width, TargetWidth, Env));
+    PaddedProgram.reset(Func->GetResamplingProgram(width, 0.0, width, TargetWidth, Env));
+    resize_h_prepare_coeff_8(PaddedProgram.get(), Env);
+    Src.Allocate(width, height, random_layout, rng);
+    Src.Randomize(rng);
+    Dst.Allocate(TargetWidth, height, random_layout, rng);
+  }
+
+  void Reset(BYTE fill) { Dst.Fill(fill); }
+
+  void Run(int variant)
+  {
+    if (variant == VARIANT_C)
+      resize_h_c_planar(Dst.Data, Src.Data, Dst.Pitch, Src.Pitch, Program.get(), TargetWidth, Height);
+    else if (PaddedProgram->filter_size > 8)
+      resizer_h_ssse3_generic(Dst.Data, Src.Data, Dst.Pitch, Src.Pitch, PaddedProgram.get(), TargetWidth, Height);
+    else
+      resizer_h_ssse3_8(Dst.Data, Src.Data, Dst.Pitch, Src.Pitch, PaddedProgram.get(), TargetWidth, Height);
+  }
+};
+
+
+/* Blur/Sharpen */
+
+// Amount of AdjustFocusV/H for Sharpen(a), or Blur(-a). Whole numbers
+// give amounts the 7 bit weights of the SIMD kernels represent exactly.
+static int AfAmount(double a)
+{
+  return int(32768*pow(2.0, a)+0.5);
+}
+
+#ifdef X86_32
+// The core runs the MMX kernel on the mod 8 columns and C on the rest
+static void af_vertical_mmx_c(BYTE* line_buf, BYTE* dstp, int height, int pitch, int width, int amount)
+{
+  const int mod8_width = width / 8 * 8;
+  af_vertical_mmx(line_buf, dstp, height, pitch, mod8_width, amount);
+  if (mod8_width != width)
+    af_vertical_c(line_buf + mod8_width, dstp + mod8_width, height, pitch, width - mod8_width, amount);
+}
+#endif
+
+class AfVerticalTest : public KernelTest
+{
+  typedef void (*AfVerticalFunc)(BYTE* line_buf, BYTE* dstp, int height, int pitch, int width, int amount);
+
+  AfVerticalFunc Variants[VARIANT_COUNT];
+  const int Amount;
+  Plane Src, Dst, LineBuf;
+
+public:
+  AfVerticalTest(const char* name, int amount) :
+    KernelTest(name, 1, 1, 16, 2, 2), Amount(amount)
+  {
+    AfVerticalFunc variants[VARIANT_COUNT] = { af_vertical_c, X86_VARIANT(af_vertical_mmx_c), NULL, af_vertical_sse2, NULL };
+    memcpy(Variants, variants, sizeof(Variants));
+    Outputs.push_back(&Dst);
+  }
+
+  bool HasVariant(int variant) const { return Variants[variant] != NULL; }
+
+  void Setup(int width, int height, bool random_layout, std::mt19937& rng)
+  {
+    Src.Allocate(width, height, random_layout, rng);
+    Src.Randomize(rng);
+    LineBuf.Allocate(width, 1, false, rng);
+  }
+
+  // The line buffer starts as a copy of the first row, as in the filter
+  void Reset(BYTE)
+  {
+    Dst.CopyFrom(Src);
+    memcpy(LineBuf.Data, Dst.Data, Dst.RowSize);
+  }
+
+  void Run(int variant)
+  {
+    Variants[variant](LineBuf.Data, Dst.Data, Dst.Height, Dst.Pitch, Dst.RowSize, Amount);
+  }
+};
+
+enum AfFormat
+{
+  AF_PLANAR,
+  AF_YUY2,
+  AF_RGB32
+};
+
+// The planar kernels and the C ones for YUY2 and RGB32 work in place, the
+// SIMD ones for YUY2 and RGB32 read Src and write Dst
+class AfHorizontalTest : public KernelTest
+{
+  const AfFormat Format;
+  const int Amount;
+  Plane Src, Dst;
+  int Width;
+
+public:
+  AfHorizontalTest(const char* name, AfFormat format, int amount) :
+    KernelTest(name, format == AF_YUY2 ? 2 : 1, 1, 16, 1, 2), Format(format), Amount(amount), Width(0)
+  {
+    Outputs.push_back(&Dst);
+  }
+
+  bool HasVariant(int variant) const
+  {
+    switch (variant)
+    {
+    case VARIANT_C:
+    case VARIANT_SSE2:
+      return true;
+#ifdef X86_32
+    case VARIANT_MMX:
+      return true;
+#endif
+    default:
+      return false;
+    }
+  }
+
+  void Setup(int width, int height, bool random_layout, std::mt19937& rng)
+  {
+    const int bytes_per_pixel = (Format == AF_RGB32) ? 4 : (Format == AF_YUY2) ? 2 : 1;
+    Width = width;
+    Src.Allocate(width * bytes_per_pixel, height, random_layout, rng);
+    Src.Randomize(rng);
+  }
+
+  void Reset(BYTE)
+  {
+    Dst.CopyFrom(Src);
+  }
+
+  void Run(int variant)
+  {
+    switch (Format)
+    {
+    case AF_PLANAR:
+      if (variant == VARIANT_C)
+        af_horizontal_yv12_c(Dst.Data, Dst.Height, Dst.Pitch, Dst.RowSize, Amount);
+      else if (variant == VARIANT_SSE2)
+        af_horizontal_yv12_sse2(Dst.Data, Dst.Height, Dst.Pitch, Dst.RowSize, Amount);
+#ifdef X86_32
+      else
+        af_horizontal_yv12_mmx(Dst.Data, Dst.Height, Dst.Pitch, Dst.RowSize, Amount);
+#endif
+      break;
+    case AF_YUY2:
+      if (variant == VARIANT_C)
+        af_horizontal_yuy2_c(Dst.Data, Dst.Height, Dst.Pitch, Width, Amount);
+      else if (variant == VARIANT_SSE2)
+        af_horizontal_yuy2_sse2(Dst.Data, Src.Data, Dst.Pitch, Src.Pitch, Dst.Height, Width, Amount);
+#ifdef X86_32
+      else
+        af_horizontal_yuy2_mmx(Dst.Data, Src.Data, Dst.Pitch, Src.Pitch, Dst.Height, Width, Amount);
+#endif
+      break;
+    case AF_RGB32:
+      if (variant == VARIANT_C)
+        af_horizontal_rgb32_c(Dst.Data, Dst.Height, Dst.Pitch, Width, Amount);
+      else if (variant == VARIANT_SSE2)
+        af_horizontal_rgb32_sse2(Dst.Data, Src.Data, Dst.Pitch, Src.Pitch, Dst.Height, Width, Amount);
+#ifdef X86_32
+      else
+        af_horizontal_rgb32_mmx(Dst.Data, Src.Data, Dst.Pitch, Src.Pitch, Dst.Height, Width, Amount);
+#endif
+      break;
+    }
+  }
+};
+
+
+/* Merge */
+
+class WeightedMergeTest : public KernelTest
+{
+  typedef void (*MergeFunc)(BYTE *p1, const BYTE *p2, int p1_pitch, int p2_pitch, int rowsize, int height, int weight, int invweight);
+
+  MergeFunc Variants[VARIANT_COUNT];
+  const float Weight;
+  Plane Src1, Src2, Dst;
+
+public:
+  WeightedMergeTest(const char* name, float weight) :
+    KernelTest(name, 1, 1, 1, 1, 1), Weight(weight)
+  {
+    MergeFunc variants[VARIANT_COUNT] = { weighted_merge_planar_c, X86_VARIANT(weighted_merge_planar_mmx), NULL, weighted_merge_planar_sse2, NULL };
+    memcpy(Variants, variants, sizeof(Variants));
+    Outputs.push_back(&Dst);
+  }
+
+  bool HasVariant(int variant) const { return Variants[variant] != NULL; }
+
+  void Setup(int width, int height, bool random_layout, std::mt19937& rng)
+  {
+    Src1.Allocate(width, height, random_layout, rng);
+    Src1.Randomize(rng);
+    Src2.Allocate(width, height, random_layout, rng);
+    Src2.Randomize(rng);
+  }
+
+  void Reset(BYTE)
+  {
+    Dst.CopyFrom(Src1);
+  }
+
+  // Weights as merge_plane computes them for each variant
+  void Run(int variant)
+  {
+    const int scale = (variant == VARIANT_C) ? 65535 : 32767;
+    const int weight = (int)(Weight * scale);
+    Variants[variant](Dst.Data, Src2.Data, Dst.Pitch, Src2.Pitch, Dst.RowSize, Dst.Height, weight, scale - weight);
+  }
+};
+
+
+/* TemporalSoften */
+
+class AccumulateLineTest : public KernelTest
+{
+  typedef void (*AccumulateFunc)(BYTE* c_plane, const BYTE** planeP, int planes, size_t width, int threshold, int div);
+
+  static const int PLANES = 4;  // radius 2
+
+  AccumulateFunc Variants[VARIANT_COUNT];
+  const bool Yuy2;
+  const BYTE LumaThreshold, ChromaThreshold;
+  Plane Src, Dst;
+  Plane Others[PLANES];
+
+public:
+  AccumulateLineTest(const char* name, bool yuy2, BYTE luma_threshold, BYTE chroma_threshold) :
+    KernelTest(name, 1, 1, 16, 1, 0), Yuy2(yuy2), LumaThreshold(luma_threshold), ChromaThreshold(chroma_threshold)
+  {
+    AccumulateFunc variants[VARIANT_COUNT] = { NULL, X86_VARIANT(accumulate_line_mmx), NULL, accumulate_line_sse2, NULL };
+    memcpy(Variants, variants, sizeof(Variants));
+    Outputs.push_back(&Dst);
+  }
+
+  bool HasVariant(int variant) const { return (variant == VARIANT_C) || (Variants[variant] != NULL); }
+
+  // The neighbour frames differ from the current one by up to +-64, so
+  // that both sides of the thresholds are taken
+  void Setup(int width, int height, bool random_layout, std::mt19937& rng)
+  {
+    const int row_size = Yuy2 ? width * 2 : width;
+    Src.Allocate(row_size, height, random_layout, rng);
+    Src.Randomize(rng);
+    for (int i = 0; i < PLANES; ++i)
+    {
+      Others[i].Allocate(row_size, height, random_layout, rng);
+      Others[i].Randomize(rng);
+      for (int y = 0; y < height; ++y)
+      {
+        for (int x = 0; x < row_size; ++x)
+        {
+          const int p = Src.Row(y)[x] + (int)(rng() % 129) - 64;
+          Others[i].Row(y)[x] = (BYTE)(p < 0 ? 0 : p > 255 ? 255 : p);
+        }
+      }
+    }
+  }
+
+  void Reset(BYTE)
+  {
+    Dst.CopyFrom(Src);
+  }
+
+  void Run(int variant)
+  {
+    const int div = 32768 / (PLANES + 1);
+    const BYTE* planeP[PLANES];
+    for (int y = 0; y < Dst.Height; ++y)
+    {
+      for (int i = 0; i < PLANES; ++i)
+        planeP[i] = Others[i].Row(y);
+
+      if (variant != VARIANT_C)
+        Variants[variant](Dst.Row(y), planeP, PLANES, Dst.RowSize, LumaThreshold | ((Yuy2 ? ChromaThreshold : LumaThreshold) << 8), div);
+      else if (Yuy2)
+        accumulate_line_yuy2_c(Dst.Row(y), planeP, PLANES, Dst.RowSize, LumaThreshold, ChromaThreshold, div);
+      else
+        accumulate_line_c(Dst.Row(y), planeP, PLANES, 0, Dst.RowSize, LumaThreshold, div);
+    }
+  }
+};
+
+
+/* Sums of absolute differences */
+
+enum SadKind
+{
+  SAD_TEMPORAL_SOFTEN,   // calculate_sad of TemporalSoften's scene change detection
+  SAD_PLANE,             // get_sad of the YDifference* functions
+  SAD_RGB                // get_sad_rgb of RGBDifference*
+};
+
+class SadTest : public KernelTest
+{
+  const SadKind Kind;
+  Plane Src, Other;
+  int RowSize;
+
+public:
+  SadTest(const char* name, SadKind kind) :
+    KernelTest(name, 1, 1, 16, 1, 0), Kind(kind), RowSize(0)
+  {}
+
+  bool HasVariant(int variant) const
+  {
+    switch (variant)
+    {
+    case VARIANT_C:
+    case VARIANT_SSE2:
+      return true;
+#ifdef X86_32
+    case VARIANT_ISSE:
+      return true;
+#endif
+    default:
+      return false;
+    }
+  }
+
+  void Setup(int width, int height, bool random_layout, std::mt19937& rng)
+  {
+    RowSize = (Kind == SAD_RGB) ? width * 4 : width;
+    Src.Allocate(RowSize, height, random_layout, rng);
+    Src.Randomize(rng);
+    Other.Allocate(RowSize, height, random_layout, rng);
+    Other.Randomize(rng);
+  }
+
+  void Reset(BYTE) { Result = -1; }
+
+  void Run(int variant)
+  {
+    const BYTE* a = Src.Data;
+    const BYTE* b = Other.Data;
+    const size_t h = Src.Height;
+    switch (Kind)
+    {
+    case SAD_TEMPORAL_SOFTEN:
+      if (variant == VARIANT_C)
+        Result = calculate_sad_c(a, b, Src.Pitch, Other.Pitch, RowSize, h);
+      else if (variant == VARIANT_SSE2)
+        Result = calculate_sad_sse2(a, b, Src.Pitch, Other.Pitch, RowSize, h);
+#ifdef X86_32
+      else
+        Result = calculate_sad_isse(a, b, Src.Pitch, Other.Pitch, RowSize, h);
+#endif
+      break;
+    case SAD_PLANE:
+      if (variant == VARIANT_C)
+        Result = get_sad_c(a, b, h, RowSize, Src.Pitch, Other.Pitch);
+      else if (variant == VARIANT_SSE2)
+        Result = get_sad_sse2(a, b, h, RowSize, Src.Pitch, Other.Pitch);
+#ifdef X86_32
+      else
+        Result = get_sad_isse(a, b, h, RowSize, Src.Pitch, Other.Pitch);
+#endif
+      break;
+    case SAD_RGB:
+      if (variant == VARIANT_C)
+        Result = get_sad_rgb_c(a, b, h, RowSize, Src.Pitch, Other.Pitch);
+      else if (variant == VARIANT_SSE2)
+        Result = get_sad_rgb_sse2(a, b, h, RowSize, Src.Pitch, Other.Pitch);
+#ifdef X86_32
+      else
+        Result = get_sad_rgb_isse(a, b, h, RowSize, Src.Pitch, Other.Pitch);
+#endif
+      break;
+    }
+  }
+};
+
+
+/* Harness */
+
+static const int MAX_OUTPUTS = 3;
+
+static int RandomDimension(int minimum, int range, int mod, std::mt19937& rng)
+{
+  const int n = minimum + (int)(rng() % (unsigned int)(range + 1));
+  return (n / mod) * mod;
+}
+
+// Returns the number of rounds in which the variant differed from C
+static int CheckVariant(KernelTest& test, int variant, const BenchOptions& opt, std::mt19937& rng)
+{
+  Plane expected[MAX_OUTPUTS];
+  int failures = 0;
+  for (int round = 0; round < opt.Rounds; ++round)
+  {
+    const int width = RandomDimension(test.MinWidth, 700, test.WidthMod, rng);
+    const int height = RandomDimension(test.MinHeight, 64, test.HeightMod, rng);
+    test.Setup(width, height, true, rng);
+
+    test.Reset(0xA5);
+    test.Run(VARIANT_C);
+    for (size_t i = 0; i < test.Outputs.size(); ++i)
+      expected[i].CopyFrom(*test.Outputs[i]);
+    const __int64 expected_result = test.Result;
+
+    test.Reset(0x5A);
+    test.Run(variant);
+
+    bool differs = (test.Result != expected_result);
+    if (differs && (failures == 0))
+      printf("  MISMATCH %s/%s: %dx%d, %lld instead of %lld\n", test.Name, VariantNames[variant],
+        width, height, (long long)test.Result, (long long)expected_result);
+
+    for (size_t i = 0; i < test.Outputs.size() && !differs; ++i)
+    {
+      const Plane& actual = *test.Outputs[i];
+      int x, y;
+      if (!actual.Equals(expected[i], test.Tolerance(variant), &x, &y))
+      {
+        differs = true;
+        if (failures == 0)
+          printf("  MISMATCH %s/%s: %dx%d, pitch %d offset %d, byte %d of row %d of output %d is %d instead of %d\n",
+            test.Name, VariantNames[variant], width, height, actual.Pitch, actual.Offset,
+            x, y, (int)i, actual.Row(y)[x], expected[i].Row(y)[x]);
+      }
+    }
+
+    if (differs)
+      ++failures;
+  }
+  return failures;
+}
+
+// Returns the cycles per pixel of the fastest of opt.Iterations runs on the frame set up last
+static double TimeVariant(KernelTest& test, int variant, int width, int height, const BenchOptions& opt)
+{
+  unsigned __int64 best = ~0ull;
+  for (int i = 0; i < opt.Iterations; ++i)
+  {
+    test.Reset(0);
+    const unsigned __int64 start = __rdtsc();
+    test.Run(variant);
+    const unsigned __int64 cycles = __rdtsc() - start;
+    if (cycles < best)
+      best = cycles;
+  }
+  return (double)best / ((double)width * height);
+}
+
+static void PrintTiming(const char* kernel, int variant, double cycles, double c_cycles, int tolerance)
+{
+  printf("%-28s %-6s %10.3f cycles/pixel %8.2fx", kernel, VariantNames[variant], cycles, c_cycles / cycles);
+  if (tolerance > 0)
+    printf("  (+-%d)", tolerance);
+  printf("\n");
+}
+
+static void PrintUsage()
+{
+  fprintf(stderr,
+    "Usage: KernelBench [-rounds N] [-seed N] [-width N] [-height N] [-iterations N]\n");
+}
+
+static bool ParseOptions(int argc, char* argv[], BenchOptions* opt)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    const char* arg = argv[i];
+    if (i+1 >= argc)
+      return false;
+    const int value = atoi(argv[++i]);
+
+    if (!strcmp(arg, "-rounds"))
+      opt->Rounds = value;
+    else if (!strcmp(arg, "-seed"))
+      opt->Seed = (unsigned int)value;
+    else if (!strcmp(arg, "-width"))
+      opt->Width = value;
+    else if (!strcmp(arg, "-height"))
+      opt->Height = value;
+    else if (!strcmp(arg, "-iterations"))
+      opt->Iterations = value;
+    else
+      return false;
+  }
+
+  // Large enough for the minimum frame of every kernel
+  return (opt->Rounds >= 0) && (opt->Iterations > 0)
+    && (opt->Width >= 32) && (opt->Height >= 32);
+}
+
+int main(int argc, char* argv[])
+{
+  BenchOptions opt;
+  if (!ParseOptions(argc, argv, &opt))
+  {
+    PrintUsage();
+    return 1;
+  }
+
+  // Only the resampling programs use the environment
+  IScriptEnvironment2* env = CreateScriptEnvironment2();
+  if (env == NULL)
+  {
+    fprintf(stderr, "Could not create the script environment\n");
+    return 1;
+  }
+
+  LanczosFilter lanczos(3);
+  MitchellNetravaliFilter bicubic(1.0/3.0, 1.0/3.0);
+
+  std::vector<std::unique_ptr<KernelTest> > tests;
+  tests.push_back(std::unique_ptr<KernelTest>(new Yv12ToYuy2Test("yv12_to_yuy2_progressive", 2,
+    convert_yv12_to_yuy2_progressive_c, X86_VARIANT(convert_yv12_to_yuy2_progressive_isse), convert_yv12_to_yuy2_progressive_sse2)));
+  tests.push_back(std::unique_ptr<KernelTest>(new Yv12ToYuy2Test("yv12_to_yuy2_interlaced", 4,
+    convert_yv12_to_yuy2_interlaced_c, X86_VARIANT(convert_yv12_to_yuy2_interlaced_isse), convert_yv12_to_yuy2_interlaced_sse2)));
+  tests.push_back(std::unique_ptr<KernelTest>(new Yuy2ToYv12Test("yuy2_to_yv12_progressive", 2,
+    convert_yuy2_to_yv12_progressive_c, X86_VARIANT(convert_yuy2_to_yv12_progressive_isse), convert_yuy2_to_yv12_progressive_sse2)));
+  tests.push_back(std::unique_ptr<KernelTest>(new Yuy2ToYv12Test("yuy2_to_yv12_interlaced", 4,
+    convert_yuy2_to_yv12_interlaced_c, X86_VARIANT(convert_yuy2_to_yv12_interlaced_isse), convert_yuy2_to_yv12_interlaced_sse2)));
+  tests.push_back(std::unique_ptr<KernelTest>(new ResizeVTest("resize_v_bicubic", &bicubic, env)));
+  tests.push_back(std::unique_ptr<KernelTest>(new ResizeVTest("resize_v_lanczos3", &lanczos, env)));
+  tests.push_back(std::unique_ptr<KernelTest>(new ResizeHTest("resize_h_bicubic", &bicubic, env)));
+  tests.push_back(std::unique_ptr<KernelTest>(new ResizeHTest("resize_h_lanczos3", &lanczos, env)));
+  tests.push_back(std::unique_ptr<KernelTest>(new AfVerticalTest("af_vertical_blur", AfAmount(-0.5))));
+  tests.push_back(std::unique_ptr<KernelTest>(new AfVerticalTest("af_vertical_sharpen", AfAmount(0.5))));
+  tests.push_back(std::unique_ptr<KernelTest>(new AfHorizontalTest("af_horizontal_yv12_blur", AF_PLANAR, AfAmount(-0.5))));
+  tests.push_back(std::unique_ptr<KernelTest>(new AfHorizontalTest("af_horizontal_yv12_sharpen", AF_PLANAR, AfAmount(0.5))));
+  tests.push_back(std::unique_ptr<KernelTest>(new AfHorizontalTest("af_horizontal_yuy2_blur", AF_YUY2, AfAmount(-0.5))));
+  tests.push_back(std::unique_ptr<KernelTest>(new AfHorizontalTest("af_horizontal_yuy2_sharpen", AF_YUY2, AfAmount(0.5))));
+  tests.push_back(std::unique_ptr<KernelTest>(new AfHorizontalTest("af_horizontal_rgb32_blur", AF_RGB32, AfAmount(-0.5))));
+  tests.push_back(std::unique_ptr<KernelTest>(new AfHorizontalTest("af_horizontal_rgb32_sharpen", AF_RGB32, AfAmount(0.5))));
+  tests.push_back(std::unique_ptr<KernelTest>(new WeightedMergeTest("weighted_merge_planar", 0.3f)));
+  tests.push_back(std::unique_ptr<KernelTest>(new AccumulateLineTest("accumulate_line", false, 24, 24)));
+  tests.push_back(std::unique_ptr<KernelTest>(new AccumulateLineTest("accumulate_line_yuy2", true, 24, 40)));
+  tests.push_back(std::unique_ptr<KernelTest>(new SadTest("calculate_sad", SAD_TEMPORAL_SOFTEN)));
+  tests.push_back(std::unique_ptr<KernelTest>(new SadTest("get_sad", SAD_PLANE)));
+  tests.push_back(std::unique_ptr<KernelTest>(new SadTest("get_sad_rgb", SAD_RGB)));
+
+  std::mt19937 rng(opt.Seed);
+  const int cpu = GetCPUFlags();
+  int failures = 0;
+
+  printf("Timing on %dx%d, best of %d runs\n", opt.Width, opt.Height, opt.Iterations);
+
+  for (size_t k = 0; k < tests.size(); ++k)
+  {
+    KernelTest& test = *tests[k];
+    const int width = opt.Width / test.WidthMod * test.WidthMod;
+    const int height = opt.Height / test.HeightMod * test.HeightMod;
+
+    double cycles[VARIANT_COUNT];
+    test.Setup(width, height, false, rng);
+    for (int v = VARIANT_C; v < VARIANT_COUNT; ++v)
+    {
+      if (!test.HasVariant(v) || ((cpu & VariantFlags[v]) != VariantFlags[v]))
+        continue;
+      cycles[v] = TimeVariant(test, v, width, height, opt);
+    }
+
+    PrintTiming(test.Name, VARIANT_C, cycles[VARIANT_C], cycles[VARIANT_C], 0);
+    for (int v = VARIANT_C + 1; v < VARIANT_COUNT; ++v)
+    {
+      if (!test.HasVariant(v) || ((cpu & VariantFlags[v]) != VariantFlags[v]))
+        continue;
+      failures += CheckVariant(test, v, opt, rng);
+      PrintTiming(test.Name, v, cycles[v], cycles[VARIANT_C], test.Tolerance(v));
+    }
+  }
+
+  tests.clear();
+  env->DeleteScriptEnvironment();
+
+  if (failures > 0)
+  {
+    printf("%d of the random layouts differed from the C version\n", failures);
+    return 2;
+  }
+  printf("All variants match the C version on %d random layouts each\n", opt.Rounds);
+  return 0;
+}
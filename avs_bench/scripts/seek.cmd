@@ -0,0 +1,17 @@
+@echo off
+rem Measures how long the first frame after a seek takes with threadpool.avs
+rem at several Prefetch thread counts. Without prefetching there is no stale
+rem work, so the run with 0 threads is the baseline the others should come close to.
+rem
+rem Usage: seek.cmd [path of AvsBench.exe]
+
+setlocal
+set BENCH=%~1
+if "%BENCH%"=="" set BENCH=AvsBench.exe
+set SCRIPT=%~dp0threadpool.avs
+
+for %%t in (0 1 2 4 8 16) do (
+  echo === threads %%t
+  "%BENCH%" "%SCRIPT%" -threads %%t -pattern seek -run 30 -count 600
+  if errorlevel 1 exit /b 1
+)
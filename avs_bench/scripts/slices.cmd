@@ -0,0 +1,17 @@
+@echo off
+rem Measures the latency of single frames with slices.avs at several thread
+rem pool sizes. AvsBench makes every frame on the thread that requests it, so
+rem only the slices run on the pool. Run it against two builds to compare them.
+rem
+rem Usage: slices.cmd [path of AvsBench.exe]
+
+setlocal
+set BENCH=%~1
+if "%BENCH%"=="" set BENCH=AvsBench.exe
+set SCRIPT=%~dp0slices.avs
+
+for %%p in (1 2 4 8 16) do (
+  echo === pool %%p
+  "%BENCH%" "%SCRIPT%" -pool %%p -count 200
+  if errorlevel 1 exit /b 1
+)
@@ -0,0 +1,20 @@
+@echo off
+rem Measures the thread pool with threadpool.avs at several Prefetch thread
+rem counts, with sequential and random access. Run it once with the build
+rem under test and once with an older AviSynth.dll next to AvsBench.exe to
+rem compare the two schedulers; the checksums must match between runs.
+rem
+rem Usage: threadpool.cmd [path of AvsBench.exe]
+
+setlocal
+set BENCH=%~1
+if "%BENCH%"=="" set BENCH=AvsBench.exe
+set SCRIPT=%~dp0threadpool.avs
+
+for %%p in (seq random) do (
+  for %%t in (0 1 2 4 8 16) do (
+    echo === pattern %%p, threads %%t
+    "%BENCH%" "%SCRIPT%" -threads %%t -pattern %%p -count 1000
+    if errorlevel 1 exit /b 1
+  )
+)
@@ -40,6 +40,7 @@
 #include "../filters/resample.h"
 #include "../filters/planeswap.h"
 #include "../filters/field.h"
+#include "../core/SliceThreading.h"
 #include <avs/win.h>
 #include <avs/minmax.h>
 #include <avs/alignment.h>
@@ -855,71 +856,97 @@ static void convert_rgb24_to_yv24_mmx(BYTE* dstY, BYTE* dstU, BYTE* dstV, const
 #endif
 
 
-PVideoFrame __stdcall ConvertRGBToYV24::GetFrame(int n, IScriptEnvironment* env)
-{
-  PVideoFrame src = child->GetFrame(n, env);
-  PVideoFrame dst = env->NewVideoFrame(vi);
-
-  const BYTE* srcp = src->GetReadPtr();
-
-  BYTE* dstY = dst->GetWritePtr(PLANAR_Y);
-  BYTE* dstU = dst->GetWritePtr(PLANAR_U);
-  BYTE* dstV = dst->GetWritePtr(PLANAR_V);
-
-  const int Spitch = src->GetPitch();
-
-  const int Ypitch = dst->GetPitch(PLANAR_Y);
-  const int UVpitch = dst->GetPitch(PLANAR_U);
-
-  const int awidth = dst->GetRowSize(PLANAR_Y_ALIGNED);
-
-  if (pixel_step != 4 && pixel_step != 3) {
-    env->ThrowError("Invalid pixel step. This is a bug.");
+static void convert_rgb_to_yv24_c(BYTE* dstY, BYTE* dstU, BYTE* dstV, const BYTE*srcp, size_t Ypitch, size_t UVpitch, size_t Spitch, size_t width, size_t height, int pixel_step, const ConversionMatrix &m) {
+  srcp += Spitch * (height-1);  // We start at last line
+  const int Sstep = Spitch + (width * pixel_step);
+  for (size_t y = 0; y < height; y++) {
+    for (size_t x = 0; x < width; x++) {
+      int b = srcp[0];
+      int g = srcp[1];
+      int r = srcp[2];
+      int Y = m.offset_y + (((int)m.y_b * b + (int)m.y_g * g + (int)m.y_r * r + 16384)>>15);
+      int U = 128+(((int)m.u_b * b + (int)m.u_g * g + (int)m.u_r * r + 16384)>>15);
+      int V = 128+(((int)m.v_b * b + (int)m.v_g * g + (int)m.v_r * r + 16384)>>15);
+      *dstY++ = PixelClip(Y);  // All the safety we can wish for.
+      *dstU++ = PixelClip(U);
+      *dstV++ = PixelClip(V);
+      srcp += pixel_step;
+    }
+    srcp -= Sstep;
+    dstY += Ypitch - width;
+    dstU += UVpitch - width;
+    dstV += UVpitch - width;
   }
+}
+
+struct RGBToYV24Slice
+{
+  BYTE *dstY, *dstU, *dstV;
+  const BYTE* srcp;
+  int Ypitch, UVpitch, Spitch;
+  int width, height;
+  int pixel_step;
+  const ConversionMatrix* matrix;
+};
+
+// Converts destination rows [begin, end). RGB is stored upside down, so they
+// come from the source rows [height-end, height-begin).
+static void convert_rgb_to_yv24_slice(int begin, int end, void* data, IScriptEnvironment* env) {
+  const RGBToYV24Slice* d = reinterpret_cast<const RGBToYV24Slice*>(data);
+
+  BYTE* dstY = d->dstY + begin * d->Ypitch;
+  BYTE* dstU = d->dstU + begin * d->UVpitch;
+  BYTE* dstV = d->dstV + begin * d->UVpitch;
+  const BYTE* srcp = d->srcp + (d->height - end) * d->Spitch;
+  const int height = end - begin;
 
   if ((env->GetCPUFlags() & CPUF_SSE2) && IsPtrAligned(srcp, 16)) {
-    if (pixel_step == 4) {
-      convert_rgb32_to_yv24_sse2(dstY, dstU, dstV, srcp, Ypitch, UVpitch, Spitch, vi.width, vi.height, matrix);
+    if (d->pixel_step == 4) {
+      convert_rgb32_to_yv24_sse2(dstY, dstU, dstV, srcp, d->Ypitch, d->UVpitch, d->Spitch, d->width, height, *d->matrix);
     } else {
-      convert_rgb24_to_yv24_sse2(dstY, dstU, dstV, srcp, Ypitch, UVpitch, Spitch, vi.width, vi.height, matrix);
+      convert_rgb24_to_yv24_sse2(dstY, dstU, dstV, srcp, d->Ypitch, d->UVpitch, d->Spitch, d->width, height, *d->matrix);
     }
-    return dst;
+    return;
   }
 
 #ifdef X86_32
   if ((env->GetCPUFlags() & CPUF_MMX)) {
-    if (pixel_step == 4) {
-      convert_rgb32_to_yv24_mmx(dstY, dstU, dstV, srcp, Ypitch, UVpitch, Spitch, vi.width, vi.height, matrix);
+    if (d->pixel_step == 4) {
+      convert_rgb32_to_yv24_mmx(dstY, dstU, dstV, srcp, d->Ypitch, d->UVpitch, d->Spitch, d->width, height, *d->matrix);
     } else {
-      convert_rgb24_to_yv24_mmx(dstY, dstU, dstV, srcp, Ypitch, UVpitch, Spitch, vi.width, vi.height, matrix);
+      convert_rgb24_to_yv24_mmx(dstY, dstU, dstV, srcp, d->Ypitch, d->UVpitch, d->Spitch, d->width, height, *d->matrix);
     }
-    return dst;
+    return;
   }
 #endif
 
   //Slow C-code.
+  convert_rgb_to_yv24_c(dstY, dstU, dstV, srcp, d->Ypitch, d->UVpitch, d->Spitch, d->width, height, d->pixel_step, *d->matrix);
+}
 
-  ConversionMatrix &m = matrix;
-  srcp += Spitch * (vi.height-1);  // We start at last line
-  const int Sstep = Spitch + (vi.width * pixel_step);
-  for (int y = 0; y < vi.height; y++) {
-    for (int x = 0; x < vi.width; x++) {
-      int b = srcp[0];
-      int g = srcp[1];
-      int r = srcp[2];
-      int Y = m.offset_y + (((int)m.y_b * b + (int)m.y_g * g + (int)m.y_r * r + 16384)>>15);
-      int U = 128+(((int)m.u_b * b + (int)m.u_g * g + (int)m.u_r * r + 16384)>>15);
-      int V = 128+(((int)m.v_b * b + (int)m.v_g * g + (int)m.v_r * r + 16384)>>15);
-      *dstY++ = PixelClip(Y);  // All the safety we can wish for.
-      *dstU++ = PixelClip(U);
-      *dstV++ = PixelClip(V);
-      srcp += pixel_step;
-    }
-    srcp -= Sstep;
-    dstY += Ypitch - vi.width;
-    dstU += UVpitch - vi.width;
-    dstV += UVpitch - vi.width;
+PVideoFrame __stdcall ConvertRGBToYV24::GetFrame(int n, IScriptEnvironment* env)
+{
+  PVideoFrame src = child->GetFrame(n, env);
+  PVideoFrame dst = env->NewVideoFrame(vi);
+
+  if (pixel_step != 4 && pixel_step != 3) {
+    env->ThrowError("Invalid pixel step. This is a bug.");
   }
+
+  RGBToYV24Slice d;
+  d.dstY = dst->GetWritePtr(PLANAR_Y);
+  d.dstU = dst->GetWritePtr(PLANAR_U);
+  d.dstV = dst->GetWritePtr(PLANAR_V);
+  d.srcp = src->GetReadPtr();
+  d.Ypitch = dst->GetPitch(PLANAR_Y);
+  d.UVpitch = dst->GetPitch(PLANAR_U);
+  d.Spitch = src->GetPitch();
+  d.width = vi.width;
+  d.height = vi.height;
+  d.pixel_step = pixel_step;
+  d.matrix = &matrix;
+
+  ParallelSlices(vi.height, 1, vi.width * (pixel_step + 3), convert_rgb_to_yv24_slice, &d, env);
   return dst;
 }
 
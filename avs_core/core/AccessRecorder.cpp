@@ -0,0 +1,49 @@
+#include "AccessRecorder.h"
+
+AccessRecorder::AccessRecorder(const PClip& child, const char* path, IScriptEnvironment* env) :
+  NonCachedGenericVideoFilter(child),
+  Log(NULL),
+  Started(false)
+{
+  Log = fopen(path, "w");
+  if (Log == NULL)
+    env->ThrowError("SetAccessLog: cannot open \"%s\" for writing.", path);
+
+  fprintf(Log, "# AviSynth access log\n");
+  fprintf(Log, "# frames %d, samples %I64d\n", vi.num_frames, vi.num_audio_samples);
+}
+
+AccessRecorder::~AccessRecorder()
+{
+  fclose(Log);
+}
+
+// Called with the mutex held
+__int64 AccessRecorder::Timestamp()
+{
+  const std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+  if (!Started)
+  {
+    Start = now;
+    Started = true;
+  }
+  return std::chrono::duration_cast<std::chrono::microseconds>(now - Start).count();
+}
+
+PVideoFrame __stdcall AccessRecorder::GetFrame(int n, IScriptEnvironment* env)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    fprintf(Log, "%I64d V %d\n", Timestamp(), n);
+  }
+  return child->GetFrame(n, env);
+}
+
+void __stdcall AccessRecorder::GetAudio(void* buf, __int64 start, __int64 count, IScriptEnvironment* env)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    fprintf(Log, "%I64d A %I64d %I64d\n", Timestamp(), start, count);
+  }
+  child->GetAudio(buf, start, count, env);
+}
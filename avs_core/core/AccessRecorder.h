@@ -0,0 +1,34 @@
+#ifndef _AVS_ACCESSRECORDER_H
+#define _AVS_ACCESSRECORDER_H
+
+#include "internal.h"
+#include <mutex>
+#include <chrono>
+#include <cstdio>
+
+// Placed by Import() on top of the main script when SetAccessLog() was
+// called, to log the frame and audio requests of the host with their time.
+// Each line of the log is one request:
+//   <microseconds since the first request> V <frame>
+//   <microseconds since the first request> A <first sample> <sample count>
+// Lines starting with '#' are comments. AvsBench -replay issues the
+// requests of a log again.
+class AccessRecorder : public NonCachedGenericVideoFilter
+{
+private:
+  FILE* Log;
+  bool Started;
+  std::chrono::high_resolution_clock::time_point Start;
+  std::mutex mutex;
+
+  __int64 Timestamp();
+
+public:
+  AccessRecorder(const PClip& child, const char* path, IScriptEnvironment* env);
+  ~AccessRecorder();
+
+  PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
+  void __stdcall GetAudio(void* buf, __int64 start, __int64 count, IScriptEnvironment* env);
+};
+
+#endif // _AVS_ACCESSRECORDER_H
@@ -0,0 +1,138 @@
+#include "AsyncFrameRequest.h"
+
+AsyncFrameRequest::AsyncFrameRequest(const PClip& _clip, int _n, FrameReadyCallback _callback, void* _user_data) :
+  clip(_clip),
+  n(_n),
+  callback(_callback),
+  user_data(_user_data),
+  state(REQUEST_PENDING),
+  error(NULL),
+  callback_done(false),
+  refs(2)   // One for the host, one for the pool job
+{
+}
+
+AsyncFrameRequest::~AsyncFrameRequest()
+{
+}
+
+IFrameRequest* AsyncFrameRequest::Submit(const PClip& clip, int n, FrameReadyCallback callback, void* user_data, IScriptEnvironment2* env)
+{
+  AsyncFrameRequest* request = new AsyncFrameRequest(clip, n, callback, user_data);
+  env->ParallelJob(Run, request, NULL);
+  return request;
+}
+
+void AsyncFrameRequest::Release()
+{
+  if (--refs == 0)
+    delete this;
+}
+
+AVSValue AsyncFrameRequest::Run(IScriptEnvironment2* env, void* data)
+{
+  AsyncFrameRequest* request = reinterpret_cast<AsyncFrameRequest*>(data);
+
+  bool start;
+  {
+    std::lock_guard<std::mutex> lock(request->mutex);
+    start = (request->state == REQUEST_PENDING);
+    if (start)
+      request->state = REQUEST_RUNNING;
+  }
+
+  if (start)
+  {
+    PVideoFrame result;
+    const char* result_error = NULL;
+    try
+    {
+      result = request->clip->GetFrame(request->n, env);
+    }
+    catch (const AvisynthError& err)
+    {
+      result_error = err.msg;
+    }
+    catch (...)
+    {
+      result_error = "GetFrameAsync: An unknown exception occurred while producing the frame.";
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(request->mutex);
+      request->frame = result;
+      request->error = result_error;
+      request->state = REQUEST_DONE;
+      request->callback_thread = std::this_thread::get_id();
+    }
+    request->finished.notify_all();
+
+    if (request->callback != NULL)
+      request->callback(request, request->user_data);
+
+    {
+      std::lock_guard<std::mutex> lock(request->mutex);
+      request->callback_done = true;
+    }
+    request->finished.notify_all();
+  }
+
+  request->Release();
+  return AVSValue();
+}
+
+bool __stdcall AsyncFrameRequest::IsReady()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return (state == REQUEST_DONE) || (state == REQUEST_CANCELLED);
+}
+
+void __stdcall AsyncFrameRequest::Wait()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while ((state != REQUEST_DONE) && (state != REQUEST_CANCELLED))
+    finished.wait(lock);
+}
+
+PVideoFrame __stdcall AsyncFrameRequest::GetResult()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while ((state != REQUEST_DONE) && (state != REQUEST_CANCELLED))
+    finished.wait(lock);
+
+  if (state == REQUEST_CANCELLED)
+    throw AvisynthError("GetFrameAsync: The request was cancelled.");
+  if (error != NULL)
+    throw AvisynthError(error);
+  return frame;
+}
+
+bool __stdcall AsyncFrameRequest::Cancel()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (state != REQUEST_PENDING)
+      return false;
+    state = REQUEST_CANCELLED;
+  }
+  finished.notify_all();
+  return true;
+}
+
+void __stdcall AsyncFrameRequest::Destroy()
+{
+  Cancel();
+
+  // The host may free what the callback uses as soon as this returns,
+  // so wait for the callback too, unless it is the one destroying us.
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while ((state != REQUEST_CANCELLED) &&
+      !((state == REQUEST_DONE) && (callback_done || (callback_thread == std::this_thread::get_id()))))
+    {
+      finished.wait(lock);
+    }
+  }
+
+  Release();
+}
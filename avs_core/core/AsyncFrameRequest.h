@@ -0,0 +1,56 @@
+#ifndef _AVS_ASYNCFRAMEREQUEST_H
+#define _AVS_ASYNCFRAMEREQUEST_H
+
+#include <avisynth.h>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+
+// A frame request that is served by the thread pool. It is shared between the
+// host and the pool job and freed when both are done with it.
+class AsyncFrameRequest : public IFrameRequest
+{
+private:
+
+  enum RequestState
+  {
+    REQUEST_PENDING,
+    REQUEST_RUNNING,
+    REQUEST_DONE,
+    REQUEST_CANCELLED
+  };
+
+  const PClip clip;
+  const int n;
+  const FrameReadyCallback callback;
+  void* const user_data;
+
+  // Guarded by mutex
+  std::mutex mutex;
+  std::condition_variable finished;
+  RequestState state;
+  PVideoFrame frame;
+  const char* error;
+  bool callback_done;
+  std::thread::id callback_thread;
+
+  std::atomic<int> refs;
+
+  AsyncFrameRequest(const PClip& _clip, int _n, FrameReadyCallback _callback, void* _user_data);
+  void Release();
+  static AVSValue Run(IScriptEnvironment2* env, void* data);
+
+public:
+  virtual __stdcall ~AsyncFrameRequest();
+
+  static IFrameRequest* Submit(const PClip& clip, int n, FrameReadyCallback callback, void* user_data, IScriptEnvironment2* env);
+
+  virtual bool __stdcall IsReady();
+  virtual void __stdcall Wait();
+  virtual PVideoFrame __stdcall GetResult();
+  virtual bool __stdcall Cancel();
+  virtual void __stdcall Destroy();
+};
+
+#endif // _AVS_ASYNCFRAMEREQUEST_H
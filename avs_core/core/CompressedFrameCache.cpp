@@ -0,0 +1,399 @@
+#include "CompressedFrameCache.h"
+#include <avs/minmax.h>
+#include <cstring>
+
+// Parameters of the LZ coder
+#define LZ_HASH_BITS    14
+#define LZ_MIN_MATCH    4
+#define LZ_MAX_OFFSET   65535
+
+// Frames that don't shrink below this fraction of their raw size (in 1/16ths) are not kept
+#define MAX_PACKED_SIXTEENTHS 15
+
+
+/* -----------------------------------------------------------
+ *   Frame codec
+ *
+ *   Each plane is stored without padding, with every byte replaced
+ *   by its difference to the same component of the pixel to its
+ *   left. Smooth image areas turn into runs of small, repeating
+ *   values, which are then compressed with a byte oriented LZ77
+ *   coder using the LZ4 sequence layout:
+ *     token (4 bits literal length, 4 bits match length - 4),
+ *     extra literal length bytes, literals,
+ *     2 bytes match offset, extra match length bytes.
+ *   The last sequence has no match.
+ * -----------------------------------------------------------
+ */
+
+static int GetPlanes(const VideoInfo& vi, int* planes)
+{
+  if (vi.IsPlanar() && !vi.IsY8())
+  {
+    planes[0] = PLANAR_Y;
+    planes[1] = PLANAR_U;
+    planes[2] = PLANAR_V;
+    return 3;
+  }
+
+  planes[0] = 0;
+  return 1;
+}
+
+// Distance in bytes to the same component of the previous pixel
+static int GetPredictionStep(const VideoInfo& vi)
+{
+  if (vi.IsPlanar())
+    return 1;
+  if (vi.IsYUY2())
+    return 4;
+  return vi.BytesFromPixels(1);
+}
+
+static inline unsigned int Read32(const BYTE* p)
+{
+  unsigned int v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline size_t LzHash(unsigned int v)
+{
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static void LzWriteLength(std::vector<BYTE>& dst, size_t len)
+{
+  while (len >= 255)
+  {
+    dst.push_back(255);
+    len -= 255;
+  }
+  dst.push_back((BYTE)len);
+}
+
+static void LzWriteSequence(std::vector<BYTE>& dst, const BYTE* literals, size_t nLiterals, size_t offset, size_t match_len)
+{
+  const size_t match_code = (match_len > 0) ? match_len - LZ_MIN_MATCH : 0;
+  dst.push_back((BYTE)((min(nLiterals, (size_t)15) << 4) | min(match_code, (size_t)15)));
+  if (nLiterals >= 15)
+    LzWriteLength(dst, nLiterals - 15);
+  dst.insert(dst.end(), literals, literals + nLiterals);
+
+  if (match_len > 0)
+  {
+    dst.push_back((BYTE)(offset & 0xFF));
+    dst.push_back((BYTE)(offset >> 8));
+    if (match_code >= 15)
+      LzWriteLength(dst, match_code - 15);
+  }
+}
+
+static void LzCompress(const BYTE* src, size_t size, std::vector<BYTE>& dst, std::vector<unsigned int>& table)
+{
+  table.assign(1 << LZ_HASH_BITS, 0);
+
+  size_t anchor = 0;
+  size_t i = 0;
+  const size_t limit = (size > LZ_MIN_MATCH) ? size - LZ_MIN_MATCH : 0;
+  while (i < limit)
+  {
+    const unsigned int seq = Read32(src + i);
+    unsigned int& slot = table[LzHash(seq)];
+    const size_t candidate = slot;
+    slot = (unsigned int)i;
+
+    if ((candidate < i) && (i - candidate <= LZ_MAX_OFFSET) && (Read32(src + candidate) == seq))
+    {
+      size_t len = LZ_MIN_MATCH;
+      while ((i + len < size) && (src[candidate + len] == src[i + len]))
+        ++len;
+
+      LzWriteSequence(dst, src + anchor, i - anchor, i - candidate, len);
+      i += len;
+      anchor = i;
+    }
+    else
+    {
+      // Skip faster through data that doesn't compress
+      i += 1 + ((i - anchor) >> 6);
+    }
+  }
+
+  LzWriteSequence(dst, src + anchor, size - anchor, 0, 0);
+}
+
+static bool LzReadLength(const BYTE*& src, const BYTE* src_end, size_t* len)
+{
+  BYTE b;
+  do
+  {
+    if (src == src_end)
+      return false;
+    b = *src++;
+    *len += b;
+  } while (b == 255);
+  return true;
+}
+
+static bool LzDecompress(const BYTE* src, size_t size, BYTE* dst, size_t dst_size)
+{
+  const BYTE* src_end = src + size;
+  BYTE* const dst_begin = dst;
+  BYTE* const dst_end = dst + dst_size;
+
+  while (src < src_end)
+  {
+    const BYTE token = *src++;
+
+    size_t nLiterals = token >> 4;
+    if ((nLiterals == 15) && !LzReadLength(src, src_end, &nLiterals))
+      return false;
+    if (((size_t)(src_end - src) < nLiterals) || ((size_t)(dst_end - dst) < nLiterals))
+      return false;
+    memcpy(dst, src, nLiterals);
+    src += nLiterals;
+    dst += nLiterals;
+
+    if (src == src_end)
+      break;    // Last sequence
+
+    if (src_end - src < 2)
+      return false;
+    const size_t offset = src[0] | (src[1] << 8);
+    src += 2;
+
+    size_t len = token & 0x0F;
+    if ((len == 15) && !LzReadLength(src, src_end, &len))
+      return false;
+    len += LZ_MIN_MATCH;
+
+    if ((offset == 0) || ((size_t)(dst - dst_begin) < offset) || ((size_t)(dst_end - dst) < len))
+      return false;
+
+    // Source and destination may overlap
+    const BYTE* match = dst - offset;
+    for (size_t k = 0; k < len; ++k)
+      dst[k] = match[k];
+    dst += len;
+  }
+
+  return dst == dst_end;
+}
+
+static void DeltaEncodePlane(const BYTE* src, int pitch, int row_size, int height, int step, BYTE* dst)
+{
+  for (int y = 0; y < height; ++y)
+  {
+    const int head = min(step, row_size);
+    for (int x = 0; x < head; ++x)
+      dst[x] = src[x];
+    for (int x = head; x < row_size; ++x)
+      dst[x] = (BYTE)(src[x] - src[x - step]);
+
+    src += pitch;
+    dst += row_size;
+  }
+}
+
+static void DeltaDecodePlane(const BYTE* src, int row_size, int height, int step, BYTE* dst, int pitch)
+{
+  for (int y = 0; y < height; ++y)
+  {
+    const int head = min(step, row_size);
+    for (int x = 0; x < head; ++x)
+      dst[x] = src[x];
+    for (int x = head; x < row_size; ++x)
+      dst[x] = (BYTE)(src[x] + dst[x - step]);
+
+    src += row_size;
+    dst += pitch;
+  }
+}
+
+
+/* -----------------------------------------------------------
+ *   CompressedFrameCache
+ * -----------------------------------------------------------
+ */
+
+CompressedFrameCache::CompressedFrameCache() :
+  UsedBytes(0),
+  MaxBytes(0)
+{
+}
+
+size_t CompressedFrameCache::GetMaxBytes() const
+{
+  return MaxBytes;
+}
+
+void CompressedFrameCache::SetMaxBytes(size_t bytes)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  MaxBytes = bytes;
+  Trim(bytes);
+}
+
+size_t CompressedFrameCache::GetUsedBytes()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return UsedBytes;
+}
+
+void CompressedFrameCache::Shrink(size_t bytes)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  Trim(bytes);
+}
+
+void CompressedFrameCache::Trim(size_t max_bytes)
+{
+  // Must be called with mutex held
+
+  while ((UsedBytes > max_bytes) && !Entries.empty())
+  {
+    Entry& e = Entries.back();
+    UsedBytes -= e.data.size();
+    Map.erase(Key(e.owner, e.n));
+    Entries.pop_back();
+  }
+}
+
+bool CompressedFrameCache::Store(const void* owner, int n, const PVideoFrame& frame, const VideoInfo& vi, size_t* raw_bytes, size_t* packed_bytes)
+{
+  // Early out only, the budget may change while we compress
+  if (!frame || (MaxBytes == 0))
+    return false;
+
+  // Compress without holding the lock
+  Entry entry;
+  entry.owner = owner;
+  entry.n = n;
+
+  int planes[3];
+  entry.nPlanes = GetPlanes(vi, planes);
+  const int step = GetPredictionStep(vi);
+
+  std::vector<BYTE> delta;
+  std::vector<unsigned int> table;
+  size_t raw_bytes_total = 0;
+  for (int p = 0; p < entry.nPlanes; ++p)
+  {
+    PlaneDesc& desc = entry.planes[p];
+    desc.row_size = frame->GetRowSize(planes[p]);
+    desc.height = frame->GetHeight(planes[p]);
+
+    const size_t plane_bytes = (size_t)desc.row_size * desc.height;
+    delta.resize(plane_bytes);
+    if (plane_bytes > 0)
+      DeltaEncodePlane(frame->GetReadPtr(planes[p]), frame->GetPitch(planes[p]), desc.row_size, desc.height, step, &delta[0]);
+
+    const size_t before = entry.data.size();
+    LzCompress(delta.empty() ? NULL : &delta[0], plane_bytes, entry.data, table);
+    desc.packed_size = entry.data.size() - before;
+    raw_bytes_total += plane_bytes;
+  }
+
+  const size_t nBytes = entry.data.size();
+  if (nBytes * 16 > raw_bytes_total * MAX_PACKED_SIXTEENTHS)
+    return false;
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  // SetMaxBytes() changes the budget under the lock, so this is the one that counts
+  const size_t max_bytes = MaxBytes;
+  if (nBytes > max_bytes)
+    return false;
+  *raw_bytes = raw_bytes_total;
+  *packed_bytes = nBytes;
+
+  // Replace an older copy of the same frame
+  MapType::iterator it = Map.find(Key(owner, n));
+  if (it != Map.end())
+  {
+    UsedBytes -= it->second->data.size();
+    Entries.erase(it->second);
+    Map.erase(it);
+  }
+
+  Trim(max_bytes - nBytes);
+  Entries.push_front(Entry());
+  Entries.front().owner = entry.owner;
+  Entries.front().n = entry.n;
+  Entries.front().nPlanes = entry.nPlanes;
+  memcpy(Entries.front().planes, entry.planes, sizeof(entry.planes));
+  Entries.front().data.swap(entry.data);
+  Map[Key(owner, n)] = Entries.begin();
+  UsedBytes += nBytes;
+  return true;
+}
+
+PVideoFrame CompressedFrameCache::Fetch(const void* owner, int n, const VideoInfo& vi, IScriptEnvironment* env)
+{
+  Entry entry;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    MapType::iterator it = Map.find(Key(owner, n));
+    if (it == Map.end())
+      return NULL;
+
+    // Take the entry out, it will be decompressed without holding the lock
+    Entry& e = *(it->second);
+    entry.owner = e.owner;
+    entry.n = e.n;
+    entry.nPlanes = e.nPlanes;
+    memcpy(entry.planes, e.planes, sizeof(e.planes));
+    entry.data.swap(e.data);
+    UsedBytes -= entry.data.size();
+    Entries.erase(it->second);
+    Map.erase(it);
+  }
+
+  PVideoFrame frame = env->NewVideoFrame(vi);
+
+  int planes[3];
+  if (GetPlanes(vi, planes) != entry.nPlanes)
+    return NULL;
+  const int step = GetPredictionStep(vi);
+
+  std::vector<BYTE> delta;
+  const BYTE* src = entry.data.empty() ? NULL : &entry.data[0];
+  for (int p = 0; p < entry.nPlanes; ++p)
+  {
+    const PlaneDesc& desc = entry.planes[p];
+    if ((desc.row_size != frame->GetRowSize(planes[p])) || (desc.height != frame->GetHeight(planes[p])))
+      return NULL;
+
+    const size_t plane_bytes = (size_t)desc.row_size * desc.height;
+    delta.resize(plane_bytes);
+    if (!LzDecompress(src, desc.packed_size, delta.empty() ? NULL : &delta[0], plane_bytes))
+      return NULL;
+    if (plane_bytes > 0)
+      DeltaDecodePlane(&delta[0], desc.row_size, desc.height, step, frame->GetWritePtr(planes[p]), frame->GetPitch(planes[p]));
+
+    src += desc.packed_size;
+  }
+
+  return frame;
+}
+
+void CompressedFrameCache::Remove(const void* owner)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  for (ListType::iterator it = Entries.begin(); it != Entries.end(); )
+  {
+    if (it->owner == owner)
+    {
+      UsedBytes -= it->data.size();
+      Map.erase(Key(it->owner, it->n));
+      it = Entries.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
@@ -0,0 +1,96 @@
+#ifndef _AVS_COMPRESSEDFRAMECACHE_H
+#define _AVS_COMPRESSEDFRAMECACHE_H
+
+#include <avisynth.h>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+
+// Second cache tier that holds frames evicted from Cache instances,
+// losslessly compressed, within a global byte budget. A frame leaves
+// this tier when it is fetched, because it is going back to the cache
+// it came from.
+class CompressedFrameCache
+{
+private:
+
+  struct PlaneDesc
+  {
+    int row_size;
+    int height;
+    size_t packed_size;
+  };
+
+  struct Entry
+  {
+    const void* owner;
+    int n;
+    int nPlanes;
+    PlaneDesc planes[3];
+    std::vector<BYTE> data;
+  };
+
+  struct Key
+  {
+    const void* owner;
+    int n;
+
+    Key(const void* o, int n) : owner(o), n(n) {}
+
+    bool operator==(const Key& other) const
+    {
+      return (owner == other.owner) && (n == other.n);
+    }
+  };
+
+  struct KeyHash
+  {
+    size_t operator()(const Key& key) const
+    {
+      return std::hash<const void*>()(key.owner) ^ (std::hash<int>()(key.n) * 31);
+    }
+  };
+
+  typedef std::list<Entry> ListType;
+  typedef std::unordered_map<Key, ListType::iterator, KeyHash> MapType;
+
+  ListType Entries;   // Most recently stored first
+  MapType Map;
+  size_t UsedBytes;
+  std::atomic<size_t> MaxBytes;
+  std::mutex mutex;
+
+  void Trim(size_t max_bytes);
+
+  CompressedFrameCache(const CompressedFrameCache&);
+  CompressedFrameCache& operator=(const CompressedFrameCache&);
+
+public:
+
+  CompressedFrameCache();
+
+  size_t GetMaxBytes() const;
+  void SetMaxBytes(size_t bytes);
+  size_t GetUsedBytes();
+
+  // Drops the oldest frames until at most 'bytes' bytes are used,
+  // without changing the budget
+  void Shrink(size_t bytes);
+
+  // Compresses and stores frame n of 'owner'. Returns false if the frame
+  // was not stored, because it did not compress well or did not fit.
+  // On success, *raw_bytes and *packed_bytes receive the size of the
+  // frame's pixel data before and after compression.
+  bool Store(const void* owner, int n, const PVideoFrame& frame, const VideoInfo& vi, size_t* raw_bytes, size_t* packed_bytes);
+
+  // Returns a new frame with the contents of frame n of 'owner',
+  // or NULL if that frame is not in this tier.
+  PVideoFrame Fetch(const void* owner, int n, const VideoInfo& vi, IScriptEnvironment* env);
+
+  // Drops all frames of 'owner'
+  void Remove(const void* owner);
+};
+
+#endif  // _AVS_COMPRESSEDFRAMECACHE_H
@@ -0,0 +1,446 @@
+#include "DiskCache.h"
+#include "internal.h"
+#include <avs/minmax.h>
+#include <cstring>
+
+#define DISKCACHE_MAGIC   "AVSDCACH"
+#define DISKCACHE_VERSION 1
+
+extern const AVSFunction DiskCache_filters[] = {
+  { "DiskCache", "cs[max_gb]f[key]s", DiskCache::Create },
+  { 0 }
+};
+
+
+/* -----------------------------------------------------------
+ *   File layout
+ *
+ *   The file starts with a FileHeader, followed by one SlotEntry
+ *   per slot. Frame data starts at DataOffset, and every slot takes
+ *   SlotSize bytes. Both are multiples of the allocation granularity,
+ *   so that each slot can be mapped on its own. A slot holds the
+ *   planes of one frame without padding. Its entry records which frame
+ *   it holds and a checksum of its data. The entry is invalidated
+ *   before the data is overwritten and only set again afterwards, so
+ *   a slot that was being written when the process died is
+ *   recognized as invalid.
+ * -----------------------------------------------------------
+ */
+
+struct DiskCache::FileHeader
+{
+  char magic[8];
+  unsigned int version;
+  unsigned int slot_count;
+  unsigned __int64 key;         // Identifies the child, see the constructor
+  unsigned __int64 slot_size;
+  unsigned __int64 data_offset;
+};
+
+struct DiskCache::SlotEntry
+{
+  int frame;                    // -1 if the slot is empty
+  unsigned int reserved;
+  unsigned __int64 checksum;
+};
+
+static unsigned __int64 HashBytes(const BYTE* p, size_t n, unsigned __int64 h)
+{
+  while (n >= 8)
+  {
+    unsigned __int64 w;
+    memcpy(&w, p, sizeof(w));
+    h = (h ^ w) * 0x9E3779B97F4A7C15ull;
+    h ^= h >> 32;
+    p += 8;
+    n -= 8;
+  }
+  while (n > 0)
+  {
+    h = (h ^ *p++) * 0x100000001B3ull;
+    --n;
+  }
+  return h;
+}
+
+static unsigned __int64 RoundUp(unsigned __int64 n, unsigned __int64 align)
+{
+  return (n + align - 1) / align * align;
+}
+
+
+DiskCache::DiskCache(PClip _child, const char* path, double max_gb, const char* key, IScriptEnvironment* env) :
+  GenericVideoFilter(_child),
+  hFile(INVALID_HANDLE_VALUE),
+  hMapping(NULL),
+  Header(NULL),
+  Slots(NULL),
+  DataOffset(0),
+  SlotSize(0),
+  SlotCount(0),
+  FrameBytes(0),
+  nPlanes(1),
+  NextSlot(0),
+  Verified(false)
+{
+  if (!vi.HasVideo())
+    env->ThrowError("DiskCache: clip has no video");
+  if (max_gb <= 0)
+    env->ThrowError("DiskCache: 'max_gb' must be positive");
+
+  Planes[0] = 0;
+  if (vi.IsPlanar() && !vi.IsY8())
+  {
+    nPlanes = 3;
+    Planes[0] = PLANAR_Y;
+    Planes[1] = PLANAR_U;
+    Planes[2] = PLANAR_V;
+  }
+  for (int p = 0; p < nPlanes; ++p)
+    FrameBytes += (size_t)vi.RowSize(Planes[p]) * (vi.height >> vi.GetPlaneHeightSubsampling(Planes[p]));
+
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  const unsigned __int64 granularity = si.dwAllocationGranularity;
+
+  SlotSize = RoundUp(FrameBytes, granularity);
+  const unsigned __int64 max_bytes = (unsigned __int64)(max_gb * 1073741824.0);
+  SlotCount = (unsigned int)min((unsigned __int64)vi.num_frames, max_bytes / SlotSize);
+  if (SlotCount == 0)
+    env->ThrowError("DiskCache: 'max_gb' is too small to hold a single frame");
+  DataOffset = RoundUp(sizeof(FileHeader) + SlotCount * sizeof(SlotEntry), granularity);
+  SlotUsers.assign(SlotCount, 0);
+
+  // The file can only be reused with the same clip properties, layout
+  // and user supplied key. Whether the frames are still the same is
+  // verified once, on the first disk hit, see GetFrame().
+  unsigned __int64 file_key = HashBytes((const BYTE*)key, strlen(key), 0xCBF29CE484222325ull);
+  const int props[] = { vi.width, vi.height, vi.pixel_type, vi.num_frames, (int)vi.fps_numerator, (int)vi.fps_denominator, vi.image_type };
+  file_key = HashBytes((const BYTE*)props, sizeof(props), file_key);
+
+  hFile = CreateFile(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (hFile == INVALID_HANDLE_VALUE)
+    env->ThrowError("DiskCache: cannot open '%s'", path);
+
+  FileHeader existing;
+  DWORD nRead = 0;
+  const bool reuse = ReadFile(hFile, &existing, sizeof(existing), &nRead, NULL)
+    && (nRead == sizeof(existing))
+    && (memcmp(existing.magic, DISKCACHE_MAGIC, sizeof(existing.magic)) == 0)
+    && (existing.version == DISKCACHE_VERSION)
+    && (existing.key == file_key)
+    && (existing.slot_count == SlotCount)
+    && (existing.slot_size == SlotSize)
+    && (existing.data_offset == DataOffset);
+
+  const unsigned __int64 file_size = DataOffset + SlotCount * SlotSize;
+  if (!reuse)
+  {
+    LARGE_INTEGER li;
+    li.QuadPart = (LONGLONG)file_size;
+    if (!SetFilePointerEx(hFile, li, NULL, FILE_BEGIN) || !SetEndOfFile(hFile))
+    {
+      Close();
+      env->ThrowError("DiskCache: cannot allocate %I64u bytes for '%s'", file_size, path);
+    }
+  }
+
+  hMapping = CreateFileMapping(hFile, NULL, PAGE_READWRITE, (DWORD)(file_size >> 32), (DWORD)file_size, NULL);
+  if (hMapping != NULL)
+    Header = reinterpret_cast<FileHeader*>(MapViewOfFile(hMapping, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)DataOffset));
+  if (Header == NULL)
+  {
+    Close();
+    env->ThrowError("DiskCache: cannot map '%s'", path);
+  }
+  Slots = reinterpret_cast<SlotEntry*>(Header + 1);
+
+  if (reuse)
+  {
+    for (unsigned int i = 0; i < SlotCount; ++i)
+    {
+      if ((Slots[i].frame >= 0) && (Slots[i].frame < vi.num_frames))
+        FrameSlots[Slots[i].frame] = i;
+      else
+        Slots[i].frame = -1;
+    }
+  }
+  else
+  {
+    memcpy(Header->magic, DISKCACHE_MAGIC, sizeof(Header->magic));
+    Header->version = DISKCACHE_VERSION;
+    Header->slot_count = SlotCount;
+    Header->key = file_key;
+    Header->slot_size = SlotSize;
+    Header->data_offset = DataOffset;
+    ClearSlots();
+    Verified = true;
+  }
+}
+
+DiskCache::~DiskCache()
+{
+  Close();
+}
+
+void DiskCache::Close()
+{
+  if (Header != NULL)
+  {
+    FlushViewOfFile(Header, 0);
+    UnmapViewOfFile(Header);
+    Header = NULL;
+    Slots = NULL;
+  }
+  if (hMapping != NULL)
+  {
+    CloseHandle(hMapping);
+    hMapping = NULL;
+  }
+  if (hFile != INVALID_HANDLE_VALUE)
+  {
+    CloseHandle(hFile);
+    hFile = INVALID_HANDLE_VALUE;
+  }
+}
+
+void DiskCache::ClearSlots()
+{
+  // Must be called with mutex held. Slots that are being written are
+  // filled in by EndWrite() as usual.
+  for (unsigned int i = 0; i < SlotCount; ++i)
+  {
+    Slots[i].frame = -1;
+    Slots[i].reserved = 0;
+    Slots[i].checksum = 0;
+  }
+  FrameSlots.clear();
+  NextSlot = 0;
+}
+
+// Returns a slot that nobody is using, preferring empty ones and otherwise
+// replacing in round robin order, or SlotCount if all are in use.
+// Must be called with mutex held.
+unsigned int DiskCache::ChooseSlot()
+{
+  unsigned int slot = SlotCount;
+  if (FrameSlots.size() < SlotCount)
+  {
+    for (unsigned int i = 0; i < SlotCount; ++i)
+    {
+      const unsigned int candidate = (NextSlot + i) % SlotCount;
+      if ((Slots[candidate].frame < 0) && (SlotUsers[candidate] == 0))
+      {
+        slot = candidate;
+        break;
+      }
+    }
+  }
+  for (unsigned int i = 0; (i < SlotCount) && (slot == SlotCount); ++i)
+  {
+    const unsigned int candidate = (NextSlot + i) % SlotCount;
+    if (SlotUsers[candidate] == 0)
+      slot = candidate;
+  }
+
+  if (slot != SlotCount)
+    NextSlot = (slot + 1) % SlotCount;
+  return slot;
+}
+
+// Takes the slot out of the index before its data is overwritten, see the
+// description of the file layout. Must be called with mutex held.
+void DiskCache::BeginWrite(unsigned int slot)
+{
+  const int old_frame = Slots[slot].frame;
+  if (old_frame >= 0)
+  {
+    std::unordered_map<int, unsigned int>::iterator it = FrameSlots.find(old_frame);
+    if ((it != FrameSlots.end()) && (it->second == slot))
+      FrameSlots.erase(it);
+  }
+  Slots[slot].frame = -1;
+  SlotUsers[slot] = -1;
+}
+
+// Puts the slot back into the index, holding frame n if it was written.
+// Must be called with mutex held.
+void DiskCache::EndWrite(unsigned int slot, int n, bool written, unsigned __int64 checksum)
+{
+  SlotUsers[slot] = 0;
+
+  // Another thread may have stored the same frame in the meantime
+  if (!written || (FrameSlots.find(n) != FrameSlots.end()))
+    return;
+
+  Slots[slot].checksum = checksum;
+  Slots[slot].frame = n;
+  FrameSlots[n] = slot;
+}
+
+// Every read is checked against the checksum of the slot, which catches
+// slots that were damaged or only partly written
+bool DiskCache::ReadSlot(unsigned int slot, const PVideoFrame& frame, IScriptEnvironment* env)
+{
+  const unsigned __int64 offset = DataOffset + slot * SlotSize;
+  const BYTE* data = reinterpret_cast<const BYTE*>(MapViewOfFile(hMapping, FILE_MAP_READ, (DWORD)(offset >> 32), (DWORD)offset, FrameBytes));
+  if (data == NULL)
+    return false;
+
+  bool valid = (HashBytes(data, FrameBytes, 0xCBF29CE484222325ull) == Slots[slot].checksum);
+  if (valid)
+  {
+    const BYTE* src = data;
+    for (int p = 0; p < nPlanes; ++p)
+    {
+      const int row_size = frame->GetRowSize(Planes[p]);
+      const int height = frame->GetHeight(Planes[p]);
+      env->BitBlt(frame->GetWritePtr(Planes[p]), frame->GetPitch(Planes[p]), src, row_size, row_size, height);
+      src += (size_t)row_size * height;
+    }
+  }
+
+  UnmapViewOfFile(data);
+  return valid;
+}
+
+// Writes the frame to the data of a slot taken with BeginWrite()
+bool DiskCache::WriteSlot(unsigned int slot, const PVideoFrame& frame, unsigned __int64* checksum, IScriptEnvironment* env)
+{
+  // Frames of unexpected geometry are not stored
+  size_t nBytes = 0;
+  for (int p = 0; p < nPlanes; ++p)
+    nBytes += (size_t)frame->GetRowSize(Planes[p]) * frame->GetHeight(Planes[p]);
+  if (nBytes != FrameBytes)
+    return false;
+
+  const unsigned __int64 offset = DataOffset + slot * SlotSize;
+  BYTE* data = reinterpret_cast<BYTE*>(MapViewOfFile(hMapping, FILE_MAP_WRITE, (DWORD)(offset >> 32), (DWORD)offset, FrameBytes));
+  if (data == NULL)
+    return false;
+
+  BYTE* dst = data;
+  for (int p = 0; p < nPlanes; ++p)
+  {
+    const int row_size = frame->GetRowSize(Planes[p]);
+    const int height = frame->GetHeight(Planes[p]);
+    env->BitBlt(dst, row_size, frame->GetReadPtr(Planes[p]), frame->GetPitch(Planes[p]), row_size, height);
+    dst += (size_t)row_size * height;
+  }
+
+  *checksum = HashBytes(data, FrameBytes, 0xCBF29CE484222325ull);
+  UnmapViewOfFile(data);
+  return true;
+}
+
+PVideoFrame __stdcall DiskCache::GetFrame(int n, IScriptEnvironment* env)
+{
+  n = clamp(n, 0, vi.num_frames-1);
+
+  // Find the frame on disk and pin its slot, so that it is not overwritten while we read it
+  bool on_disk = false;
+  unsigned int slot = SlotCount;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::unordered_map<int, unsigned int>::iterator it = FrameSlots.find(n);
+    if (it != FrameSlots.end())
+    {
+      on_disk = true;
+      if (Verified)
+      {
+        slot = it->second;
+        ++SlotUsers[slot];
+      }
+    }
+  }
+
+  if (slot != SlotCount)
+  {
+    PVideoFrame frame;
+    bool valid = false;
+    try
+    {
+      frame = env->NewVideoFrame(vi);
+      valid = ReadSlot(slot, frame, env);
+    }
+    catch(...)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      --SlotUsers[slot];
+      throw;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    --SlotUsers[slot];
+    if (valid)
+      return frame;
+
+    // Damaged slot, compute the frame again
+    if ((Slots[slot].frame == n) && (SlotUsers[slot] == 0))
+    {
+      Slots[slot].frame = -1;
+      FrameSlots.erase(n);
+    }
+    on_disk = false;
+  }
+
+  PVideoFrame frame = child->GetFrame(n, env);
+
+  std::unique_lock<std::mutex> lock(mutex);
+
+  std::unordered_map<int, unsigned int>::iterator it = FrameSlots.find(n);
+  if (!Verified && on_disk && (it != FrameSlots.end()))
+  {
+    // The file comes from an earlier run. Compare the frame that we had to
+    // compute with the stored one, to find out if the child still produces
+    // the same frames. If not, everything in the file is stale.
+    // Later hits are trusted without recomputing them: the file key already
+    // ties the file to the clip properties and the user supplied key, and
+    // this check catches a script that changed behind an unchanged key.
+    // Nothing is read from the file before this, so the lock is held throughout.
+    slot = it->second;
+    const unsigned __int64 stored_checksum = Slots[slot].checksum;
+    unsigned __int64 checksum = 0;
+    Verified = true;
+    BeginWrite(slot);
+    const bool written = WriteSlot(slot, frame, &checksum, env);
+    EndWrite(slot, n, written, checksum);
+    if (written && (checksum == stored_checksum))
+      return frame;
+
+    ClearSlots();
+  }
+
+  if (FrameSlots.find(n) != FrameSlots.end())
+    return frame;   // Another thread stored it in the meantime
+
+  slot = ChooseSlot();
+  if (slot == SlotCount)
+    return frame;   // All slots are busy, this frame is not stored
+
+  BeginWrite(slot);
+  lock.unlock();
+
+  unsigned __int64 checksum = 0;
+  bool written = false;
+  try
+  {
+    written = WriteSlot(slot, frame, &checksum, env);
+  }
+  catch(...)
+  {
+    lock.lock();
+    EndWrite(slot, n, false, 0);
+    throw;
+  }
+
+  lock.lock();
+  EndWrite(slot, n, written, checksum);
+  return frame;
+}
+
+AVSValue __cdecl DiskCache::Create(AVSValue args, void*, IScriptEnvironment* env)
+{
+  return new DiskCache(args[0].AsClip(), args[1].AsString(), args[2].AsFloat(10.0f), args[3].AsString(""), env);
+}
@@ -0,0 +1,61 @@
+#ifndef _AVS_DISKCACHE_H
+#define _AVS_DISKCACHE_H
+
+#include <avisynth.h>
+#include <avs/win.h>
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+
+// Keeps the frames of its child in a memory-mapped file, so that they can
+// be served from the OS page cache or from disk instead of being
+// recomputed, within the same run as well as in later runs of the same
+// script. The in-memory cache in front of this filter stays the first tier.
+class DiskCache : public GenericVideoFilter
+{
+private:
+
+  struct FileHeader;
+  struct SlotEntry;
+
+  HANDLE hFile;
+  HANDLE hMapping;
+  FileHeader* Header;     // Mapped view of the header and the slot index
+  SlotEntry* Slots;
+  unsigned __int64 DataOffset;
+  unsigned __int64 SlotSize;
+  unsigned int SlotCount;
+  size_t FrameBytes;
+
+  int nPlanes;
+  int Planes[3];
+
+  // The mutex only guards the members below and the slot index. Slots are
+  // read and written without it, a slot in use is pinned in SlotUsers.
+  std::unordered_map<int, unsigned int> FrameSlots;
+  std::vector<int> SlotUsers;   // Threads reading each slot, -1 while it is written
+  unsigned int NextSlot;  // Next slot to reuse once all slots are taken
+  bool Verified;          // Whether the contents of the file are known to match the child
+  std::mutex mutex;
+
+  void Close();
+  void ClearSlots();
+  unsigned int ChooseSlot();
+  void BeginWrite(unsigned int slot);
+  void EndWrite(unsigned int slot, int n, bool written, unsigned __int64 checksum);
+  bool ReadSlot(unsigned int slot, const PVideoFrame& frame, IScriptEnvironment* env);
+  bool WriteSlot(unsigned int slot, const PVideoFrame& frame, unsigned __int64* checksum, IScriptEnvironment* env);
+
+public:
+  DiskCache(PClip _child, const char* path, double max_gb, const char* key, IScriptEnvironment* env);
+  ~DiskCache();
+  PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
+
+  int __stdcall SetCacheHints(int cachehints, int frame_range) override {
+    return cachehints == CACHE_GET_MTMODE ? MT_NICE_FILTER : 0;
+  }
+
+  static AVSValue __cdecl Create(AVSValue args, void*, IScriptEnvironment* env);
+};
+
+#endif  // _AVS_DISKCACHE_H
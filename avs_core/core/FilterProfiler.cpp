@@ -0,0 +1,192 @@
+#include "FilterProfiler.h"
+#include "internal.h"
+#include <avs/win.h>
+#include <algorithm>
+#include <cstdio>
+
+FilterProfile::FilterProfile(const char* name) :
+  Name(name),
+  Calls(0),
+  InclusiveTime(0),
+  ExclusiveTime(0),
+  Hits(0),
+  Misses(0),
+  LockWaitTime(0)
+{
+}
+
+ProfileScope::ProfileScope(FilterProfile* profile, IScriptEnvironment* env) :
+  Profile(profile),
+  Top(NULL),
+  Parent(NULL),
+  UpstreamTime(0)
+{
+  if (Profile == NULL)
+    return;
+
+  Top = reinterpret_cast<ProfileScope**>(env->ManageCache(MC_GetProfileStack, NULL));
+  Parent = *Top;
+  *Top = this;
+  Start = std::chrono::high_resolution_clock::now();
+}
+
+ProfileScope::~ProfileScope()
+{
+  if (Profile == NULL)
+    return;
+
+  const __int64 elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - Start).count();
+  ++Profile->Calls;
+  Profile->InclusiveTime += elapsed;
+  Profile->ExclusiveTime += elapsed - UpstreamTime;
+
+  if (Parent != NULL)
+    Parent->UpstreamTime += elapsed;
+  *Top = Parent;
+}
+
+void ProfiledLock(std::unique_lock<std::mutex>& lock, FilterProfile* profile)
+{
+  if (profile == NULL)
+  {
+    lock.lock();
+    return;
+  }
+
+  // Only time the lock when someone else holds it
+  if (lock.try_lock())
+    return;
+
+  const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+  lock.lock();
+  profile->LockWaitTime += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+FilterProfiler::FilterProfiler() :
+  Enabled(false),
+  TlsIndex(TlsAlloc())
+{
+}
+
+FilterProfiler::~FilterProfiler()
+{
+  if (TlsIndex != TLS_OUT_OF_INDEXES)
+    TlsFree(TlsIndex);
+}
+
+void FilterProfiler::SetLogPath(const char* path)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  LogPath = (path != NULL) ? path : "";
+}
+
+FilterProfile* FilterProfiler::AddProfile(const char* name)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  Profiles.push_back(std::unique_ptr<FilterProfile>(new FilterProfile(name)));
+  return Profiles.back().get();
+}
+
+ProfileScope** FilterProfiler::GetThreadStack()
+{
+  if (TlsIndex == TLS_OUT_OF_INDEXES)
+    throw AvisynthError("FilterProfiler: Out of thread local storage indexes.");
+
+  ProfileScope** top = reinterpret_cast<ProfileScope**>(TlsGetValue(TlsIndex));
+  if (top == NULL)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ThreadStacks.push_back(std::unique_ptr<ProfileScope*>(new ProfileScope*(NULL)));
+    top = ThreadStacks.back().get();
+    TlsSetValue(TlsIndex, top);
+  }
+  return top;
+}
+
+static bool ByExclusiveTime(const FilterProfile* a, const FilterProfile* b)
+{
+  return a->ExclusiveTime > b->ExclusiveTime;
+}
+
+std::string FilterProfiler::Report()
+{
+  std::vector<const FilterProfile*> sorted;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    sorted.reserve(Profiles.size());
+    for (size_t i = 0; i < Profiles.size(); ++i)
+      sorted.push_back(Profiles[i].get());
+  }
+  std::stable_sort(sorted.begin(), sorted.end(), ByExclusiveTime);
+
+  __int64 total = 0;
+  __int64 hits = 0;
+  __int64 misses = 0;
+  for (size_t i = 0; i < sorted.size(); ++i)
+  {
+    total += sorted[i]->ExclusiveTime;
+    hits += sorted[i]->Hits;
+    misses += sorted[i]->Misses;
+  }
+
+  char line[256];
+  std::string report;
+  _snprintf(line, sizeof(line), "%-24s %10s %12s %12s %7s %10s %10s %10s\n",
+    "Filter", "Calls", "Incl ms", "Excl ms", "Excl %", "Hits", "Misses", "Lock ms");
+  report += line;
+
+  for (size_t i = 0; i < sorted.size(); ++i)
+  {
+    const FilterProfile* p = sorted[i];
+    if (p->Calls == 0)
+      continue;
+
+    _snprintf(line, sizeof(line), "%-24.24s %10I64d %12.2f %12.2f %7.1f %10I64d %10I64d %10.2f\n",
+      p->Name.c_str(),
+      (__int64)p->Calls,
+      p->InclusiveTime / 1e6,
+      p->ExclusiveTime / 1e6,
+      (total > 0) ? 100.0 * p->ExclusiveTime / total : 0.0,
+      (__int64)p->Hits,
+      (__int64)p->Misses,
+      p->LockWaitTime / 1e6);
+    line[sizeof(line)-1] = 0;
+    report += line;
+  }
+
+  if (hits + misses > 0)
+  {
+    _snprintf(line, sizeof(line), "Cache hit rate: %.1f %% (%I64d of %I64d lookups)\n",
+      100.0 * hits / (hits + misses), hits, hits + misses);
+    line[sizeof(line)-1] = 0;
+    report += line;
+  }
+
+  return report;
+}
+
+void FilterProfiler::Dump()
+{
+  std::string path;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (Profiles.empty())
+      return;
+    path = LogPath;
+  }
+
+  const std::string report = Report();
+
+  if (path.empty())
+  {
+    OutputDebugStringA(report.c_str());
+    return;
+  }
+
+  FILE* f = fopen(path.c_str(), "w");
+  if (f != NULL)
+  {
+    fputs(report.c_str(), f);
+    fclose(f);
+  }
+}
@@ -0,0 +1,88 @@
+#ifndef _AVS_FILTERPROFILER_H
+#define _AVS_FILTERPROFILER_H
+
+#include <avisynth.h>
+#include <avs/win.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+// Counters of one filter instance. Times are in nanoseconds.
+struct FilterProfile
+{
+  const std::string Name;
+  std::atomic<__int64> Calls;
+  std::atomic<__int64> InclusiveTime;  // Spent in GetFrame, the filters upstream included
+  std::atomic<__int64> ExclusiveTime;  // InclusiveTime less the time spent in other profiled filters
+  std::atomic<__int64> Hits;           // Frames served from the cache, either tier
+  std::atomic<__int64> Misses;         // Frames the filter had to produce
+  std::atomic<__int64> LockWaitTime;   // Spent waiting for the mutex of the filter's MTGuard
+
+  FilterProfile(const char* name);
+};
+
+// Measures one call into a profiled filter. Scopes of the same thread form
+// a stack, so that a filter's time is taken out of its consumer's exclusive
+// time. Time spent waiting for frames that other threads produce counts as
+// exclusive. Does nothing if 'profile' is NULL.
+class ProfileScope
+{
+private:
+  FilterProfile* Profile;
+  ProfileScope** Top;
+  ProfileScope* Parent;
+  std::chrono::high_resolution_clock::time_point Start;
+  __int64 UpstreamTime;
+
+  ProfileScope(const ProfileScope&);
+  ProfileScope& operator=(const ProfileScope&);
+
+public:
+  ProfileScope(FilterProfile* profile, IScriptEnvironment* env);
+  ~ProfileScope();
+};
+
+// Locks 'lock', adding the time it had to wait to profile->LockWaitTime
+// if 'profile' is not NULL
+void ProfiledLock(std::unique_lock<std::mutex>& lock, FilterProfile* profile);
+
+// Owns the profiles of an environment. Profiles outlive their filters,
+// so that the report at teardown still covers every filter of the script.
+class FilterProfiler
+{
+private:
+  bool Enabled;
+  std::string LogPath;
+  std::vector<std::unique_ptr<FilterProfile> > Profiles;
+
+  // Scope stacks of the threads that use the main environment. A thread
+  // finds its own through the TLS slot, so that only its first call has to
+  // take the mutex. Threads of the pool keep theirs in their own environment.
+  DWORD TlsIndex;
+  std::vector<std::unique_ptr<ProfileScope*> > ThreadStacks;
+
+  std::mutex mutex;
+
+public:
+  FilterProfiler();
+  ~FilterProfiler();
+
+  // Filters created while enabled are profiled
+  bool IsEnabled() const { return Enabled; }
+  void SetEnabled(bool enabled) { Enabled = enabled; }
+
+  // Where Dump() writes the report. Empty for the debugger output.
+  void SetLogPath(const char* path);
+
+  FilterProfile* AddProfile(const char* name);
+  ProfileScope** GetThreadStack();
+
+  // A table of all profiles, the most expensive ones by exclusive time first
+  std::string Report();
+  void Dump();
+};
+
+#endif // _AVS_FILTERPROFILER_H
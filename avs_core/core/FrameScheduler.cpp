@@ -0,0 +1,58 @@
+#include "FrameScheduler.h"
+#include "SliceThreading.h"
+#include "cache.h"
+
+// Requests whose frames take less than this many seconds to produce are not
+// worth handing to another thread
+#define FRAME_REQUEST_MIN_COST 0.0005
+
+struct FrameRequestBatch
+{
+  const FrameRequest* requests;
+  PVideoFrame* frames;
+};
+
+static void FetchFrames(int begin, int end, void* data, IScriptEnvironment* env)
+{
+  const FrameRequestBatch* batch = reinterpret_cast<const FrameRequestBatch*>(data);
+  for (int i = begin; i < end; ++i)
+    batch->frames[i] = batch->requests[i].clip->GetFrame(batch->requests[i].n, env);
+}
+
+// Every clip returned by Invoke() is behind a Cache, which knows what its
+// frames cost. Other clips are filters used internally and assumed to be expensive.
+static bool IsExpensive(const PClip& clip)
+{
+  if (!Cache::IsCache(clip))
+    return true;
+
+  double seconds;
+  size_t bytes;
+  static_cast<Cache*>(clip.operator->())->GetFrameCost(&seconds, &bytes);
+  return (seconds == 0) || (seconds >= FRAME_REQUEST_MIN_COST);
+}
+
+void GetFrames(const FrameRequest* requests, PVideoFrame* frames, int count, IScriptEnvironment* env)
+{
+  FrameRequestBatch batch = { requests, frames };
+
+  // Only fan out when the MTGuards are enabled. Without them, two branches
+  // that share a filter which is not thread-safe could enter it concurrently.
+  IScriptEnvironment2* env2 = static_cast<IScriptEnvironment2*>(env);
+  bool concurrent = (count > 1) && (env2->GetProperty(AEP_FILTERCHAIN_THREADS) > 1);
+  if (concurrent)
+  {
+    int nExpensive = 0;
+    for (int i = 0; i < count; ++i)
+    {
+      if (IsExpensive(requests[i].clip))
+        ++nExpensive;
+    }
+    concurrent = (nExpensive > 1);
+  }
+
+  if (concurrent)
+    ParallelTasks(count, FetchFrames, &batch, env);
+  else
+    FetchFrames(0, count, &batch, env);
+}
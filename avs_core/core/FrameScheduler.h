@@ -0,0 +1,19 @@
+#ifndef _AVS_FRAMESCHEDULER_H
+#define _AVS_FRAMESCHEDULER_H
+
+#include <avisynth.h>
+
+struct FrameRequest
+{
+  PClip clip;
+  int n;
+};
+
+// Fetches the frames of independent child requests, e.g. all inputs of a
+// filter with several clips. When the filter graph runs multithreaded,
+// requests that are expensive enough are evaluated concurrently on the thread
+// pool and joined before returning. Otherwise, or when at most one of them is
+// expensive, they are fetched one after the other in order.
+void GetFrames(const FrameRequest* requests, PVideoFrame* frames, int count, IScriptEnvironment* env);
+
+#endif // _AVS_FRAMESCHEDULER_H
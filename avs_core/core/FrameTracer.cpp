@@ -0,0 +1,164 @@
+#include "FrameTracer.h"
+#include <avs/win.h>
+#include <cstdio>
+
+FrameTracer::FrameTracer() :
+  Enabled(false),
+  Epoch(std::chrono::high_resolution_clock::now()),
+  Dropped(0)
+{
+  for (int i = 0; i < TRACE_MAX_THREADS; ++i)
+  {
+    Buffers[i].Owner = 0;
+    Buffers[i].Events = NULL;
+    Buffers[i].Head = 0;
+  }
+}
+
+FrameTracer::~FrameTracer()
+{
+  for (int i = 0; i < TRACE_MAX_THREADS; ++i)
+    delete [] Buffers[i].Events.load();
+}
+
+__int64 FrameTracer::Now() const
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - Epoch).count();
+}
+
+static bool IsThreadAlive(unsigned long tid)
+{
+  HANDLE thread = OpenThread(SYNCHRONIZE, FALSE, tid);
+  if (thread == NULL)
+    return false;
+
+  const bool alive = (WaitForSingleObject(thread, 0) == WAIT_TIMEOUT);
+  CloseHandle(thread);
+  return alive;
+}
+
+// Takes over the buffer of a thread that has exited, e.g. a worker of a
+// thread pool that was replaced. Its events are lost. Returns NULL if all
+// owners are still running.
+FrameTracer::ThreadBuffer* FrameTracer::ReclaimBuffer(unsigned long tid)
+{
+  for (int i = 0; i < TRACE_MAX_THREADS; ++i)
+  {
+    ThreadBuffer& buffer = Buffers[(tid + i) & (TRACE_MAX_THREADS - 1)];
+    unsigned long owner = buffer.Owner.load(std::memory_order_acquire);
+    if ((owner == 0) || (owner == tid) || IsThreadAlive(owner))
+      continue;
+
+    if (buffer.Owner.compare_exchange_strong(owner, tid))
+    {
+      buffer.Head.store(0, std::memory_order_release);
+      return &buffer;
+    }
+  }
+  return NULL;
+}
+
+// Finds the buffer of the calling thread by open addressing on its id,
+// and claims a free one on the first call. Returns NULL if all are taken.
+FrameTracer::ThreadBuffer* FrameTracer::GetThreadBuffer()
+{
+  const unsigned long tid = GetCurrentThreadId();
+  for (int i = 0; i < TRACE_MAX_THREADS; ++i)
+  {
+    ThreadBuffer& buffer = Buffers[(tid + i) & (TRACE_MAX_THREADS - 1)];
+    const unsigned long owner = buffer.Owner.load(std::memory_order_acquire);
+    if (owner == tid)
+      return &buffer;
+
+    if (owner == 0)
+    {
+      unsigned long expected = 0;
+      if (buffer.Owner.compare_exchange_strong(expected, tid))
+      {
+        buffer.Events.store(new TraceEvent[TRACE_BUFFER_EVENTS], std::memory_order_release);
+        return &buffer;
+      }
+    }
+  }
+
+  // Looking for exited owners asks the OS about every one of them,
+  // so threads without a buffer only try once in a while
+  if ((Dropped.load(std::memory_order_relaxed) & (TRACE_MAX_THREADS - 1)) != 0)
+    return NULL;
+  return ReclaimBuffer(tid);
+}
+
+void FrameTracer::Record(const char* name, const char* category, __int64 start, __int64 duration, __int64 arg)
+{
+  ThreadBuffer* buffer = GetThreadBuffer();
+  if (buffer == NULL)
+  {
+    Dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  // Only the owning thread writes, so the head needs no read-modify-write
+  const __int64 head = buffer->Head.load(std::memory_order_relaxed);
+  TraceEvent& event = buffer->Events.load(std::memory_order_relaxed)[head & (TRACE_BUFFER_EVENTS - 1)];
+  event.Name = name;
+  event.Category = category;
+  event.Start = start;
+  event.Duration = duration;
+  event.Arg = arg;
+  buffer->Head.store(head + 1, std::memory_order_release);
+}
+
+static void WriteJsonString(FILE* f, const char* s)
+{
+  fputc('"', f);
+  for (; *s; ++s)
+  {
+    if ((*s == '"') || (*s == '\\'))
+      fputc('\\', f);
+    if ((unsigned char)*s >= 0x20)
+      fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+bool FrameTracer::Export(const char* path)
+{
+  FILE* f = fopen(path, "w");
+  if (f == NULL)
+    return false;
+
+  fputs("{\"traceEvents\":[\n", f);
+  bool first = true;
+  for (int i = 0; i < TRACE_MAX_THREADS; ++i)
+  {
+    const ThreadBuffer& buffer = Buffers[i];
+    const TraceEvent* events = buffer.Events.load(std::memory_order_acquire);
+    if (events == NULL)
+      continue;
+
+    const unsigned long tid = buffer.Owner.load(std::memory_order_relaxed);
+    const __int64 head = buffer.Head.load(std::memory_order_acquire);
+    const __int64 begin = (head > TRACE_BUFFER_EVENTS) ? head - TRACE_BUFFER_EVENTS : 0;
+    for (__int64 e = begin; e < head; ++e)
+    {
+      const TraceEvent& event = events[e & (TRACE_BUFFER_EVENTS - 1)];
+
+      fputs(first ? "{\"name\":" : ",\n{\"name\":", f);
+      first = false;
+      WriteJsonString(f, event.Name);
+      fputs(",\"cat\":", f);
+      WriteJsonString(f, event.Category);
+      if (event.Duration >= 0)
+        fprintf(f, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f", event.Start / 1000.0, event.Duration / 1000.0);
+      else
+        fprintf(f, ",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f", event.Start / 1000.0);
+      fprintf(f, ",\"pid\":1,\"tid\":%lu", tid);
+      if (event.Arg >= 0)
+        fprintf(f, ",\"args\":{\"n\":%I64d}", event.Arg);
+      fputc('}', f);
+    }
+  }
+  fprintf(f, "\n],\"otherData\":{\"dropped_events\":%I64d}}\n", Dropped.load());
+
+  return fclose(f) == 0;
+}
@@ -0,0 +1,105 @@
+#ifndef _AVS_FRAMETRACER_H
+#define _AVS_FRAMETRACER_H
+
+#include <avisynth.h>
+#include <atomic>
+#include <chrono>
+
+// Maximum number of threads that can record events, and the number of
+// most recent events kept per thread. Must be a power of two.
+#define TRACE_MAX_THREADS 256
+#define TRACE_BUFFER_EVENTS (64*1024)
+
+struct TraceEvent
+{
+  const char* Name;       // Must stay valid until the trace is exported
+  const char* Category;
+  __int64 Start;          // Nanoseconds since the tracer was created
+  __int64 Duration;       // Negative for events without a duration
+  __int64 Arg;            // Frame number or size, negative if none
+};
+
+// Records a timeline of what every thread does, e.g. GetFrame calls and
+// waits for locks, and exports it in the Chrome trace event format
+// (chrome://tracing, Perfetto).
+// Each thread writes to a ring buffer of its own, so recording takes
+// no locks. When disabled, recording costs a single flag check.
+class FrameTracer
+{
+private:
+  struct ThreadBuffer
+  {
+    std::atomic<unsigned long> Owner;     // Thread id, zero if the buffer is free
+    std::atomic<TraceEvent*> Events;
+    std::atomic<__int64> Head;            // Number of events ever written
+  };
+
+  std::atomic<bool> Enabled;
+  const std::chrono::high_resolution_clock::time_point Epoch;
+  ThreadBuffer Buffers[TRACE_MAX_THREADS];
+  std::atomic<__int64> Dropped;           // Events of threads that found no free buffer
+
+  ThreadBuffer* GetThreadBuffer();
+  ThreadBuffer* ReclaimBuffer(unsigned long tid);
+
+  FrameTracer(const FrameTracer&);
+  FrameTracer& operator=(const FrameTracer&);
+
+public:
+  FrameTracer();
+  ~FrameTracer();
+
+  bool IsEnabled() const { return Enabled.load(std::memory_order_relaxed); }
+  void SetEnabled(bool enabled) { Enabled = enabled; }
+
+  __int64 Now() const;
+  void Record(const char* name, const char* category, __int64 start, __int64 duration, __int64 arg);
+
+  // Writes all recorded events as Chrome trace JSON, along with the number
+  // of events that were dropped. Threads that are still recording may
+  // overwrite events while they are written.
+  bool Export(const char* path);
+};
+
+// Records the time from construction to destruction as one event,
+// if 'tracer' is not NULL and enabled
+class TraceScope
+{
+private:
+  FrameTracer* Tracer;
+  const char* Name;
+  const char* Category;
+  __int64 Arg;
+  __int64 Start;
+
+  TraceScope(const TraceScope&);
+  TraceScope& operator=(const TraceScope&);
+
+public:
+  TraceScope(FrameTracer* tracer, const char* name, const char* category, __int64 arg) :
+    Tracer(((tracer != NULL) && tracer->IsEnabled()) ? tracer : NULL)
+  {
+    if (Tracer == NULL)
+      return;
+
+    Name = name;
+    Category = category;
+    Arg = arg;
+    Start = Tracer->Now();
+  }
+
+  ~TraceScope()
+  {
+    if (Tracer != NULL)
+      Tracer->Record(Name, Category, Start, Tracer->Now() - Start, Arg);
+  }
+};
+
+// Records an event without a duration, if 'tracer' is not NULL and enabled
+static __inline void TraceInstant(FrameTracer* tracer, const char* name, const char* category, __int64 arg)
+{
+  if ((tracer != NULL) && tracer->IsEnabled())
+    tracer->Record(name, category, tracer->Now(), -1, arg);
+}
+
+#endif // _AVS_FRAMETRACER_H
@@ -5,6 +5,7 @@
 #include <condition_variable>
 #include <memory>
 #include <cassert>
+#include <vector>
 #include "ObjectPool.h"
 #include "SimpleLruCache.h"
 
@@ -16,6 +17,12 @@ enum LruLookupResult
   LRU_LOOKUP_NO_CACHE            // Item will not be cached, no storage is returned
 };
 
+enum LruPolicy
+{
+  LRU_POLICY_LRU,   // Plain least recently used replacement
+  LRU_POLICY_ARC    // Adaptive replacement, balancing recently and frequently used entries
+};
+
 template<typename K, typename V>
 class LruCache : public std::enable_shared_from_this<LruCache<K, V> >
 {
@@ -31,14 +38,15 @@ private:
   {
     K key;
     size_t ghosted;
+    bool frequent;     // whether the entry was frequently used when it was evicted
 
     LruGhostEntry() :
-      key(0), ghosted(0)
+      key(0), ghosted(0), frequent(false)
     {
     }
 
-    LruGhostEntry(K key, size_t ghosted) :
-      key(key), ghosted(ghosted)
+    LruGhostEntry(K key, size_t ghosted, bool frequent) :
+      key(key), ghosted(ghosted), frequent(frequent)
     {
     }
   };
@@ -49,6 +57,7 @@ private:
     V value;
     size_t locks;      // the number of threads waiting on this entry. used to prevent eviction when readers are waiting on it
     size_t ghosted;    // the number of times this entry has entered the ghost list
+    bool frequent;     // whether the entry has been used more than once since it was (re)inserted
     std::condition_variable ready_cond;
     enum LruEntryState state;
 
@@ -63,6 +72,7 @@ private:
       value = v;
       locks = 0;
       ghosted = 0;
+      frequent = false;
       state = LRU_ENTRY_EMPTY;
     }
 
@@ -84,6 +94,53 @@ private:
   ObjectPool<entry_type> EntryPool;
   mutable std::mutex mutex;
 
+  // Keys in the range [WindowFirst, WindowLast] are pinned and never evicted
+  bool WindowEnabled;
+  K WindowFirst;
+  K WindowLast;
+
+  // Adaptive replacement state. The main cache holds both recently used
+  // entries (used once) and frequently used entries (used more than once)
+  // in a single list. Because the list is in LRU order, the LRU entry of either
+  // kind is found by walking it from the back and skipping entries of the
+  // other kind. Ghosts remember which kind an entry was when it was
+  // evicted. Ghost hits move RecentTarget, the number of recently used
+  // entries we aim to keep, towards the kind that would have hit.
+  // The counters are kept up to date under both policies, so that the
+  // policy can be switched at any time.
+  LruPolicy Policy;
+  size_t RecentCount;         // Number of recently used entries in MainCache
+  size_t RecentTarget;
+  size_t GhostRecentCount;    // Number of ghosts of evicted recently used entries
+  size_t GhostFrequentCount;  // Number of ghosts of evicted frequently used entries
+  bool ArcStrict;             // While set, eviction only takes entries of the kind chosen by RecentTarget
+
+  // When enabled, evicted values are kept here until the owner takes them
+  bool SpillEnabled;
+  std::vector<std::pair<K, V> > Spilled;
+
+  void count_ghost(const LruGhostEntry& g, int delta)
+  {
+    if (g.ghosted == 0)
+      return;
+
+    size_t& counter = g.frequent ? GhostFrequentCount : GhostRecentCount;
+    counter += delta;
+  }
+
+  // Trims the main cache, first following the adaptive policy, then, if
+  // entries of the preferred kind were all pinned, regardless of it.
+  void trim_main()
+  {
+    MainCache.trim();
+    if ((Policy == LRU_POLICY_ARC) && (MainCache.size() > MainCache.capacity()))
+    {
+      ArcStrict = false;
+      MainCache.trim();
+      ArcStrict = true;
+    }
+  }
+
   static bool MainEvictEvent(CacheType* cache, typename const CacheType::Entry& entry, void* userData)
   {
     if (entry.value->locks > 0)
@@ -91,22 +148,49 @@ private:
 
     LruCache* me = reinterpret_cast<LruCache*>(userData);
 
+    if (me->WindowEnabled && (entry.key >= me->WindowFirst) && (entry.key <= me->WindowLast))
+      return false;
+
+    if ((me->Policy == LRU_POLICY_ARC) && me->ArcStrict)
+    {
+      const size_t nFrequent = me->MainCache.size() - me->RecentCount;
+      const bool evict_recent = (me->RecentCount > me->RecentTarget) || (nFrequent == 0);
+      if (entry.value->frequent == evict_recent)
+        return false;
+    }
+
     bool ghost_found;
     GhostCacheType::value_type* g = me->Ghosts.lookup(entry.key, &ghost_found);
     if (!ghost_found)
     {
-      *g = LruGhostEntry(entry.key, entry.value->ghosted+1);
+      *g = LruGhostEntry(entry.key, entry.value->ghosted+1, entry.value->frequent);
     }
     else
     {
+      me->count_ghost(*g, -1);
       g->ghosted++;
+      g->frequent = entry.value->frequent;
     }
+    me->count_ghost(*g, +1);
+
+    if (!entry.value->frequent)
+      --(me->RecentCount);
+
+    if (me->SpillEnabled)
+      me->Spilled.push_back(std::make_pair(entry.key, entry.value->value));
 
     entry.value->reset(0, NULL);
     me->EntryPool.Destruct(entry.value);
     return true;
   }
 
+  static bool GhostEvictEvent(GhostCacheType* cache, typename const GhostCacheType::Entry& entry, void* userData)
+  {
+    LruCache* me = reinterpret_cast<LruCache*>(userData);
+    me->count_ghost(entry.value, -1);
+    return true;
+  }
+
 public:
 
   typedef std::pair<entry_ptr, std::shared_ptr<LruCache> > handle;
@@ -114,7 +198,17 @@ public:
   LruCache(size_type capacity) :
     GHOSTS_MIN_CAPACITY(50),
     MainCache(capacity, &MainEvictEvent, reinterpret_cast<void*>(this)),
-    Ghosts(GHOSTS_MIN_CAPACITY, GhostCacheType::EvictEventType(), reinterpret_cast<void*>(this))
+    Ghosts(GHOSTS_MIN_CAPACITY, &GhostEvictEvent, reinterpret_cast<void*>(this)),
+    WindowEnabled(false),
+    WindowFirst(0),
+    WindowLast(0),
+    Policy(LRU_POLICY_LRU),
+    RecentCount(0),
+    RecentTarget(0),
+    GhostRecentCount(0),
+    GhostFrequentCount(0),
+    ArcStrict(true),
+    SpillEnabled(false)
   {
   }
 
@@ -145,6 +239,62 @@ public:
     std::unique_lock<std::mutex> global_lock(mutex);
 
     MainCache.set_limits(min, max);
+    trim_main();
+  }
+
+  LruPolicy policy() const
+  {
+    std::unique_lock<std::mutex> global_lock(mutex);
+
+    return Policy;
+  }
+
+  void set_policy(LruPolicy policy)
+  {
+    std::unique_lock<std::mutex> global_lock(mutex);
+
+    Policy = policy;
+  }
+
+  // While enabled, values that are evicted are not released, but
+  // collected for the owner to pick up with take_spilled().
+  void set_spill(bool enabled)
+  {
+    std::unique_lock<std::mutex> global_lock(mutex);
+
+    SpillEnabled = enabled;
+    if (!enabled)
+      Spilled.clear();
+  }
+
+  // Moves the values collected since the last call to 'out'
+  void take_spilled(std::vector<std::pair<K, V> >* out)
+  {
+    std::unique_lock<std::mutex> global_lock(mutex);
+
+    out->insert(out->end(), Spilled.begin(), Spilled.end());
+    Spilled.clear();
+  }
+
+  // Pins all entries with keys in [first, last]. Entries that have moved
+  // out of the window since the last call become regular LRU entries again,
+  // and because pinned entries are skipped during eviction, they are the
+  // first ones to go.
+  void set_window(const K& first, const K& last)
+  {
+    std::unique_lock<std::mutex> global_lock(mutex);
+
+    WindowEnabled = true;
+    WindowFirst = first;
+    WindowLast = last;
+    trim_main();
+  }
+
+  void clear_window()
+  {
+    std::unique_lock<std::mutex> global_lock(mutex);
+
+    WindowEnabled = false;
   }
 
   LruLookupResult lookup(const K& key, handle *hndl, bool block_for_completion)
@@ -159,6 +309,14 @@ public:
       entry_ptr entry = *entryp;
       *hndl = handle(entry, this->shared_from_this());
 
+      // Only a hit on a value that has already been delivered is a reuse.
+      // Threads that wait for a pending entry are after its first use.
+      if (!entry->frequent && (entry->state == LRU_ENTRY_AVAILABLE))
+      {
+        entry->frequent = true;
+        --RecentCount;
+      }
+
       if (!block_for_completion && (entry->state != LRU_ENTRY_AVAILABLE))
       {
         return LRU_LOOKUP_FOUND_BUT_NOTAVAIL;
@@ -191,11 +349,31 @@ public:
       bool ghost_found;
       GhostCacheType::value_type* g = Ghosts.lookup(key, &ghost_found);
       assert(g != NULL);
+      const bool ghost_hit = ghost_found && (g->ghosted > 0);
       if (!ghost_found)
       {
-        *g = LruGhostEntry(key, 0);
+        *g = LruGhostEntry(key, 0, false);
       }
-      else if (g->ghosted > 0)
+      else if (ghost_hit && (Policy == LRU_POLICY_ARC))
+      {
+        // Had the cache been larger or balanced differently, this would have been a hit.
+        // Shift the balance towards the kind of entry the ghost was, and grow by the
+        // same amount so that the cache warms up quickly under re-references.
+        size_t delta;
+        if (g->frequent)
+        {
+          delta = max((size_t)1, GhostRecentCount / max((size_t)1, GhostFrequentCount));
+          RecentTarget = (RecentTarget > delta) ? RecentTarget - delta : 0;
+        }
+        else
+        {
+          delta = max((size_t)1, GhostFrequentCount / max((size_t)1, GhostRecentCount));
+          RecentTarget = min(RecentTarget + delta, MainCache.capacity() + delta);
+        }
+        MainCache.resize(MainCache.capacity() + delta);
+        Ghosts.resize(GHOSTS_MIN_CAPACITY + MainCache.capacity()*2);
+      }
+      else if (ghost_hit)
       {
         MainCache.resize(MainCache.capacity() + 1);
         Ghosts.resize(GHOSTS_MIN_CAPACITY + MainCache.capacity()*2);
@@ -208,17 +386,34 @@ public:
 
       if (entryp != NULL)
       {
+        const size_t ghosted = g->ghosted;
         *entryp = EntryPool.Construct(key);
         entry_ptr entry = *entryp;
         *hndl = handle(entry, this->shared_from_this());
         entry->locks = 1;
-        entry->ghosted = g->ghosted;
+        entry->ghosted = ghosted;
         entry->value = NULL;
+
+        // Entries that come back from the ghost list have proven to be reused
+        entry->frequent = ghost_hit && (Policy == LRU_POLICY_ARC);
+        if (!entry->frequent)
+          ++RecentCount;
+
+        // Under ARC, a ghost is forgotten once its entry is back in the cache
+        if (ghost_hit && (Policy == LRU_POLICY_ARC))
+        {
+          count_ghost(*g, -1);
+          Ghosts.remove(key);
+        }
+
+        trim_main();
         return LRU_LOOKUP_NOT_FOUND;
       }
       else
       {
+        count_ghost(*g, -1);
         g->ghosted++;
+        count_ghost(*g, +1);
         return LRU_LOOKUP_NO_CACHE;
       }
     } // if
@@ -249,7 +444,11 @@ public:
 
     if (e->locks == 1)
     {
+      if (!e->frequent)
+        --RecentCount;
       MainCache.remove(e->key);
+      e->reset(0, NULL);
+      EntryPool.Destruct(e);
     }
     else
     {
@@ -35,15 +35,65 @@
 #include "MTGuard.h"
 #include "cache.h"
 #include "internal.h"
+#include "FilterProfiler.h"
+#include "FrameTracer.h"
 #include <cassert>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <map>
+#include <exception>
 
 #ifdef X86_32
 #include <mmintrin.h>
 #endif
 
+// How long the thread serving MT_SERIALIZED_ORDERED requests waits for
+// the frame it expects next, before it skips ahead
+#define ORDERED_GATHER_TIME std::chrono::milliseconds(2)
+
+// How many requests that arrived later may be served before an older one,
+// so that a request behind the current position (a seek back) is served
+// even while requests keep arriving ahead of it
+#define ORDERED_MAX_PASSED 8
+
+struct MTGuard::OrderedState
+{
+  struct Request
+  {
+    PVideoFrame frame;
+    std::exception_ptr error;
+    bool done;
+    unsigned int seq;     // Arrival order
+    int passed;           // Requests served before this one that arrived later
+
+    Request() : done(false), seq(0), passed(0) {}
+  };
+
+  std::mutex mutex;
+  std::condition_variable cond;
+
+  // Frames waited for, in ascending order. Several threads may wait for the same frame.
+  std::multimap<int, Request*> Pending;
+
+  // Whether a thread is currently serving the requests
+  bool Busy;
+
+  // The frame that was served last, and the distance to the one before it
+  int LastFrame;
+  int Stride;
+
+  // Sequence number of the next request
+  unsigned int NextSeq;
+
+  OrderedState() : Busy(false), LastFrame(-1), Stride(1), NextSeq(0) {}
+};
+
 MTGuard::MTGuard(PClip firstChild, MtMode mtmode, const AVSFunction* func, std::vector<AVSValue>* args2, std::vector<AVSValue>* args3, IScriptEnvironment2* env) :
   FilterMutex(NULL),
+  Ordered(NULL),
+  Profile(NULL),
+  Tracer(NULL),
   MTMode(mtmode),
   nThreads(1),
   FilterFunction(func),
@@ -56,6 +106,7 @@ MTGuard::MTGuard(PClip firstChild, MtMode mtmode, const AVSFunction* func, std::
   ChildFilters.emplace_back(firstChild);
   vi = ChildFilters[0]->GetVideoInfo();
 
+  Tracer = reinterpret_cast<FrameTracer*>(Env->ManageCache(MC_GetTracer, NULL));
   Env->ManageCache(MC_RegisterMTGuard, reinterpret_cast<void*>(this));
 }
 
@@ -63,6 +114,7 @@ MTGuard::~MTGuard()
 {
   Env->ManageCache(MC_UnRegisterMTGuard, reinterpret_cast<void*>(this));
   delete FilterMutex;
+  delete Ordered;
 }
 
 void MTGuard::EnableMT(size_t nThreads)
@@ -95,6 +147,12 @@ void MTGuard::EnableMT(size_t nThreads)
         this->FilterMutex = new std::mutex();
         break;
       }
+    case MT_SERIALIZED_ORDERED:
+      {
+        this->FilterMutex = new std::mutex();
+        this->Ordered = new OrderedState();
+        break;
+      }
     default:
       {
         assert(0);
@@ -109,6 +167,21 @@ void MTGuard::EnableMT(size_t nThreads)
   std::vector<AVSValue>().swap(FilterArgsArrStore);
 }
 
+void MTGuard::SetProfile(FilterProfile* profile)
+{
+  Profile = profile;
+}
+
+// Only waits that actually happen are traced and profiled
+void MTGuard::LockFilter(std::unique_lock<std::mutex>& lock)
+{
+  if (lock.try_lock())
+    return;
+
+  TraceScope trace(Tracer, FilterFunction->name, "lock", -1);
+  ProfiledLock(lock, Profile);
+}
+
 PVideoFrame __stdcall MTGuard::GetFrame(int n, IScriptEnvironment* env)
 {
   assert(nThreads > 0);
@@ -133,10 +206,16 @@ PVideoFrame __stdcall MTGuard::GetFrame(int n, IScriptEnvironment* env)
     }
   case MT_SERIALIZED:
     {
-      std::lock_guard<std::mutex> lock(*FilterMutex);
+      std::unique_lock<std::mutex> lock(*FilterMutex, std::defer_lock);
+      LockFilter(lock);
       frame = ChildFilters[0]->GetFrame(n, env);
       break;
     }
+  case MT_SERIALIZED_ORDERED:
+    {
+      frame = GetFrameOrdered(n, env);
+      break;
+    }
   default:
     {
       assert(0);
@@ -152,6 +231,179 @@ PVideoFrame __stdcall MTGuard::GetFrame(int n, IScriptEnvironment* env)
   return frame;
 }
 
+// Queues the request for frame n. One of the waiting threads at a time
+// serves the queue, calling the filter in ascending frame order starting
+// after the last frame served, and wrapping around to the lowest frame
+// when nothing is left ahead. That way a source that decodes sequentially
+// is not made to seek back and forth by requests that arrive slightly
+// out of order. A request that has been passed over ORDERED_MAX_PASSED
+// times is served next regardless of its position.
+PVideoFrame MTGuard::GetFrameOrdered(int n, IScriptEnvironment* env)
+{
+  OrderedState::Request request;
+
+  std::unique_lock<std::mutex> lock(Ordered->mutex);
+  request.seq = Ordered->NextSeq++;
+  Ordered->Pending.insert(std::make_pair(n, &request));
+  if (Ordered->Busy)
+    Ordered->cond.notify_all();   // The serving thread may be waiting for this frame
+
+  while (!request.done)
+  {
+    if (Ordered->Busy)
+    {
+      Ordered->cond.wait(lock);
+      continue;
+    }
+
+    // Serve requests until our own one is done, then let another waiter take over
+    Ordered->Busy = true;
+    while (!request.done)
+    {
+      // If only frames past the one we expect next are queued, give the
+      // request for the expected frame a moment to arrive
+      if (Ordered->LastFrame >= 0)
+      {
+        const int expected = Ordered->LastFrame + Ordered->Stride;
+        std::multimap<int, OrderedState::Request*>::iterator next = Ordered->Pending.upper_bound(Ordered->LastFrame);
+        if ((next != Ordered->Pending.end()) && (next->first > expected))
+          Ordered->cond.wait_for(lock, ORDERED_GATHER_TIME);
+      }
+
+      std::multimap<int, OrderedState::Request*>::iterator it = Ordered->Pending.upper_bound(Ordered->LastFrame);
+      if (it == Ordered->Pending.end())
+        it = Ordered->Pending.begin();
+
+      // The oldest request that was passed over too often goes first
+      std::multimap<int, OrderedState::Request*>::iterator starved = Ordered->Pending.end();
+      for (std::multimap<int, OrderedState::Request*>::iterator p = Ordered->Pending.begin(); p != Ordered->Pending.end(); ++p)
+      {
+        if ((p->second->passed >= ORDERED_MAX_PASSED)
+          && ((starved == Ordered->Pending.end()) || ((int)(p->second->seq - starved->second->seq) < 0)))
+          starved = p;
+      }
+      if (starved != Ordered->Pending.end())
+        it = starved;
+      const int frame_n = it->first;
+
+      PVideoFrame frame;
+      std::exception_ptr error;
+      lock.unlock();
+      try
+      {
+        std::unique_lock<std::mutex> filter_lock(*FilterMutex, std::defer_lock);
+        LockFilter(filter_lock);
+        frame = ChildFilters[0]->GetFrame(frame_n, env);
+      }
+      catch(...)
+      {
+        error = std::current_exception();
+      }
+      lock.lock();
+
+      std::pair<std::multimap<int, OrderedState::Request*>::iterator, std::multimap<int, OrderedState::Request*>::iterator>
+        served = Ordered->Pending.equal_range(frame_n);
+      unsigned int served_seq = served.first->second->seq;
+      for (it = served.first; it != served.second; ++it)
+      {
+        it->second->frame = frame;
+        it->second->error = error;
+        it->second->done = true;
+        if ((int)(it->second->seq - served_seq) < 0)
+          served_seq = it->second->seq;
+      }
+      Ordered->Pending.erase(served.first, served.second);
+      for (it = Ordered->Pending.begin(); it != Ordered->Pending.end(); ++it)
+      {
+        if ((int)(it->second->seq - served_seq) < 0)
+          ++it->second->passed;
+      }
+      if ((Ordered->LastFrame >= 0) && (frame_n > Ordered->LastFrame))
+        Ordered->Stride = frame_n - Ordered->LastFrame;
+      else
+        Ordered->Stride = 1;
+      Ordered->LastFrame = frame_n;
+      Ordered->cond.notify_all();
+    }
+    Ordered->Busy = false;
+    Ordered->cond.notify_all();
+  }
+
+  lock.unlock();
+  if (request.error)
+    std::rethrow_exception(request.error);
+  return request.frame;
+}
+
+void __stdcall MTGuard::GetFrames(int start, int count, int stride, PVideoFrame* frames, IScriptEnvironment* env)
+{
+  assert(nThreads > 0);
+
+  if (nThreads == 1)
+  {
+    GetFrameBatch(ChildFilters[0], start, count, stride, frames, env);
+    return;
+  }
+
+  IScriptEnvironment2 *env2 = static_cast<IScriptEnvironment2*>(env);
+
+  switch (MTMode)
+  {
+  case MT_NICE_FILTER:
+    {
+      GetFrameBatch(ChildFilters[0], start, count, stride, frames, env);
+      break;
+    }
+  case MT_MULTI_INSTANCE:
+    {
+      GetFrameBatch(ChildFilters[env2->GetProperty(AEP_THREAD_ID)], start, count, stride, frames, env);
+      break;
+    }
+  case MT_SERIALIZED:
+    {
+      // One lock for the whole batch instead of one per frame
+      std::unique_lock<std::mutex> lock(*FilterMutex, std::defer_lock);
+      LockFilter(lock);
+      GetFrameBatch(ChildFilters[0], start, count, stride, frames, env);
+      break;
+    }
+  case MT_SERIALIZED_ORDERED:
+    {
+      // A filter that produces batches itself gets them in one piece, since
+      // it orders their frames on its own. The queue then continues after
+      // the batch. For other filters the frames go through the queue.
+      if (GetFrameBatchInterface(ChildFilters[0]) != NULL)
+      {
+        {
+          std::unique_lock<std::mutex> lock(*FilterMutex, std::defer_lock);
+          LockFilter(lock);
+          GetFrameBatch(ChildFilters[0], start, count, stride, frames, env);
+        }
+        const int last = start + (count-1)*stride;
+        std::lock_guard<std::mutex> lock(Ordered->mutex);
+        Ordered->LastFrame = (stride > 0) ? last : start;
+        Ordered->Stride = (stride > 0) ? stride : -stride;
+      }
+      else
+      {
+        for (int i = 0; i < count; ++i)
+          frames[i] = GetFrameOrdered(start + i*stride, env);
+      }
+      break;
+    }
+  default:
+    {
+      assert(0);
+      env2->ThrowError("Invalid Avisynth logic.");
+      break;
+    }
+  } // switch
+
+#ifdef X86_32
+  _mm_empty();
+#endif
+}
+
 void __stdcall MTGuard::GetAudio(void* buf, __int64 start, __int64 count, IScriptEnvironment* env)
 {
   assert(nThreads > 0);
@@ -176,7 +428,8 @@ void __stdcall MTGuard::GetAudio(void* buf, __int64 start, __int64 count, IScrip
       ChildFilters[env2->GetProperty(AEP_THREAD_ID)]->GetAudio(buf, start, count, env);
       break;
     }
-  case MT_SERIALIZED:
+  case MT_SERIALIZED:           // Fall-through intentional
+  case MT_SERIALIZED_ORDERED:
     {
       std::lock_guard<std::mutex> lock(*FilterMutex);
       ChildFilters[0]->GetAudio(buf, start, count, env);
@@ -207,9 +460,25 @@ bool __stdcall MTGuard::GetParity(int n)
 
 int __stdcall MTGuard::SetCacheHints(int cachehints, int frame_range)
 {
+  // By returning IS_MTGUARD_ANS to IS_MTGUARD_REQ, we tell the caller we are an MTGuard
+  if (cachehints == CACHE_IS_MTGUARD_REQ)
+    return CACHE_IS_MTGUARD_ANS;
+
+  // All instances have the same dependencies, so the first one answers for all
+  if (cachehints == CACHE_HAS_FRAME_DEPENDENCIES_REQ)
+    return (GetFrameDependencyInterface(ChildFilters[0]) != NULL) ? CACHE_HAS_FRAME_DEPENDENCIES_ANS : 0;
+  if (cachehints == CACHE_HAS_FRAME_BATCHES_REQ)
+    return (GetFrameBatchInterface(ChildFilters[0]) != NULL) ? CACHE_HAS_FRAME_BATCHES_ANS : 0;
+
   return 0;
 }
 
+int __stdcall MTGuard::GetFrameDependencies(int n, FrameDependency* deps, int max_deps)
+{
+  IFrameDependencies* child_deps = GetFrameDependencyInterface(ChildFilters[0]);
+  return (child_deps != NULL) ? child_deps->GetFrameDependencies(n, deps, max_deps) : 0;
+}
+
 bool __stdcall MTGuard::IsMTGuard(const PClip& p)
 {
   return ((p->GetVersion() >= 5) && (p->SetCacheHints(CACHE_IS_MTGUARD_REQ, 0) == CACHE_IS_MTGUARD_ANS));
@@ -240,7 +509,8 @@ AVSValue MTGuard::Create(const AVSFunction* func, std::vector<AVSValue>* args2,
         return func_result;
       }
     case MT_MULTI_INSTANCE: // Fall-through intentional
-    case MT_SERIALIZED:
+    case MT_SERIALIZED:     // Fall-through intentional
+    case MT_SERIALIZED_ORDERED:
       {
         return new MTGuard(filter_instance, mode, func, args2, args3, env);
         // args2 and args3 are not valid after this point anymore
@@ -7,15 +7,24 @@
 namespace std
 {
   class mutex;
+  template<class _Mutex> class unique_lock;
 }
 
-class MTGuard : public IClip
+struct FilterProfile;
+class FrameTracer;
+
+class MTGuard : public IClip, public IFrameDependencies, public IFrameBatch
 {
 private:
   IScriptEnvironment2* Env;
 
+  struct OrderedState;
+
   std::vector<PClip> ChildFilters; 
   std::mutex *FilterMutex;
+  OrderedState *Ordered;      // Request queue of MT_SERIALIZED_ORDERED
+  FilterProfile *Profile;     // NULL unless profiling
+  FrameTracer *Tracer;
   size_t nThreads;
   VideoInfo vi;
 
@@ -24,17 +33,22 @@ private:
   std::vector<AVSValue> FilterArgs;
   const MtMode MTMode;
 
+  PVideoFrame GetFrameOrdered(int n, IScriptEnvironment* env);
+  void LockFilter(std::unique_lock<std::mutex>& lock);
 
 public:
   ~MTGuard();
   MTGuard(PClip firstChild, MtMode mtmode, const AVSFunction* func, std::vector<AVSValue>* args2, std::vector<AVSValue>* args3, IScriptEnvironment2* env);
   void EnableMT(size_t nThreads);
+  void SetProfile(FilterProfile* profile);
 
   PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
   void __stdcall GetAudio(void* buf, __int64 start, __int64 count, IScriptEnvironment* env);
   const VideoInfo& __stdcall GetVideoInfo();
   bool __stdcall GetParity(int n);
   int __stdcall SetCacheHints(int cachehints,int frame_range);
+  int __stdcall GetFrameDependencies(int n, FrameDependency* deps, int max_deps);
+  void __stdcall GetFrames(int start, int count, int stride, PVideoFrame* frames, IScriptEnvironment* env);
 
   static bool __stdcall IsMTGuard(const PClip& p);
   static AVSValue Create(const AVSFunction* func, std::vector<AVSValue>* args2, std::vector<AVSValue>* args3, IScriptEnvironment2* env);
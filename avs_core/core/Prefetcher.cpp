@@ -2,17 +2,106 @@
 
 #include <mutex>
 #include <atomic>
+#include <condition_variable>
+#include <unordered_map>
+#include <chrono>
+#include <cmath>
 #include <avisynth.h>
-#include "ThreadPool.h"
+#include <avs/minmax.h>
 #include "ObjectPool.h"
-#include "LruCache.h"
+#include "ShardedLruCache.h"
 #include "ScriptEnvironmentTLS.h"
+#include "internal.h"
+#include "cache.h"
+
+typedef ShardedLruCache<size_t, PVideoFrame> PrefetcherCacheType;
+
+// The number of intervals a pattern has to repeat itself to become (un)locked
+#define PATTERN_LOCK_LENGTH 3
+
+// The number of access streams that are tracked at the same time
+#define PREFETCH_MAX_STREAMS 4
+
+// The share of recent requests a stream keeps after each request to any stream,
+// and the share under which it is dropped
+#define PREFETCH_STREAM_DECAY 0.875
+#define PREFETCH_STREAM_MIN_WEIGHT 0.1
+
+// Prefetch depth per thread before any latency was measured, and at most
+#define PREFETCH_INITIAL_DEPTH 3
+#define PREFETCH_MAX_DEPTH 4
+
+// Weight of a new sample in the latency and request interval averages
+#define PREFETCH_TIMING_WEIGHT 0.125
+
+// How many filters deep, and how many child frames per filter,
+// declared frame dependencies are requested ahead
+#define PREFETCH_DEPENDENCY_LEVELS 4
+#define PREFETCH_MAX_DEPENDENCIES 16
+
+// A sequence of requests, like playback, a second consumer of the
+// same clip, or a lookahead pass, that moves with a constant stride
+struct PrefetchStream
+{
+  bool Active;
+  int Position;     // Frame that was requested last from this stream
+  int Stride;       // Current stride, never zero
+  int Hits;         // The number of consecutive requests Stride has repeated itself
+  int Misses;       // The number of consecutive requests that did not match a locked Stride
+  double Weight;    // Decaying count of the requests that went to this stream
+
+  PrefetchStream() :
+    Active(false), Position(0), Stride(1), Hits(0), Misses(0), Weight(0)
+  {}
+
+  bool IsLocked() const
+  {
+    return Hits >= PATTERN_LOCK_LENGTH;
+  }
+
+  // The distance between the frames we prefetch for this stream
+  int Step() const
+  {
+    if (IsLocked())
+      return Stride;
+    return (Stride > 0) ? 1 : -1;
+  }
+
+  void Update(int n)
+  {
+    const int delta = n - Position;
+    Position = n;
+    if (delta == 0)
+      return;
+
+    if (delta == Stride)
+    {
+      ++Hits;
+      Misses = 0;
+    }
+    else if (IsLocked() && (++Misses < PATTERN_LOCK_LENGTH))
+    {
+      // Keep a locked stride through a few odd requests
+    }
+    else
+    {
+      Stride = delta;
+      Hits = 0;
+      Misses = 0;
+    }
+  }
+};
 
 struct PrefetcherJobParams
 {
   int frame;
+  int stream;       // Index of the stream the frame was prefetched for
   Prefetcher* prefetcher;
-  LruCache<size_t, PVideoFrame>::handle cache_handle;
+  PrefetcherCacheType::handle cache_handle;
+
+  // Set when the job was cancelled or taken over before a worker started it.
+  // The worker then only releases the job. Guarded by params_pool_mutex.
+  bool cancelled;
 };
 
 struct PrefetcherPimpl
@@ -26,103 +115,270 @@ struct PrefetcherPimpl
   // Maximum number of frames to prefetch
   const int nPrefetchFrames;
 
-  ThreadPool ThreadPool;
+  // The number of independently locked partitions of the frame caches
+  const size_t nCacheShards;
 
   ObjectPool<PrefetcherJobParams> JobParamsPool;
   std::mutex params_pool_mutex;
 
-  // Contains the pattern we are locked on to
-  int LockedPattern;
+  // Jobs that are queued but have not been started by a worker yet
+  std::unordered_map<int, PrefetcherJobParams*> PendingJobs;
 
-  // The number of consecutive frames Pattern has repeated itself
-  int PatternHits;
+  // Number of jobs that are still in the thread pool, cancelled ones included.
+  // Guarded by params_pool_mutex.
+  size_t outstanding_jobs;
+  std::condition_variable jobs_done;
 
-  // The number of consecutive frames LockedPattern was invalid
-  int PatternMisses;
+  // Access streams we have detected in the requests.
+  // Prefetchers placed inside the graph are called from several threads,
+  // so the request state is guarded by request_mutex.
+  PrefetchStream Streams[PREFETCH_MAX_STREAMS];
+  std::mutex request_mutex;
 
-  // The current pattern that we are not locked on to
-  int Pattern;
+  // Number of frames to keep in flight, over all streams. Guarded by params_pool_mutex.
+  int PrefetchDepth;
 
-  // True if we have found a pattern to lock onto
-  bool IsLocked;
+  // Average time a worker needs to produce a frame, in seconds. Guarded by params_pool_mutex.
+  double FrameLatency;
 
-  // The frame number that GetFrame() has been called with the last time
-  int LastRequestedFrame;
+  // Average time between two GetFrame() calls, in seconds
+  double RequestInterval;
+  std::chrono::high_resolution_clock::time_point LastRequestTime;
+  bool HasRequested;
 
-  std::shared_ptr<LruCache<size_t, PVideoFrame> > VideoCache;
-  std::atomic<int> running_workers;  
+  std::shared_ptr<PrefetcherCacheType> VideoCache;
+  std::atomic<int> running_workers;  // Jobs that are queued or running and not cancelled
   std::mutex worker_exception_mutex;
   std::exception_ptr worker_exception;
   bool worker_exception_present;
 
-  PrefetcherPimpl(const PClip& _child, size_t _nThreads) :
+  PrefetcherPimpl(const PClip& _child, size_t _nThreads, size_t _nCacheShards) :
     child(_child),
     vi(_child->GetVideoInfo()),
     nThreads(_nThreads),
-    nPrefetchFrames(_nThreads * 3),
-    ThreadPool(_nThreads),
-    LockedPattern(1),
-    PatternHits(0),
-    Pattern(1),
-    LastRequestedFrame(0),
+    nPrefetchFrames(_nThreads * PREFETCH_MAX_DEPTH),
+    nCacheShards(_nCacheShards),
+    PrefetchDepth(_nThreads * PREFETCH_INITIAL_DEPTH),
+    FrameLatency(0),
+    RequestInterval(0),
+    HasRequested(false),
     VideoCache(NULL),
+    outstanding_jobs(0),
     running_workers(0),
-    worker_exception_present(0),
-    IsLocked(false),
-    PatternMisses(0)
+    worker_exception_present(0)
+  {
+  }
+
+  // Cancels the prefetch jobs of a stream that no worker has started yet.
+  // A negative stream cancels the jobs of all streams.
+  void CancelPendingJobs(int stream)
+  {
+    std::vector<PrefetcherCacheType::handle> handles;
+    {
+      std::lock_guard<std::mutex> lock(params_pool_mutex);
+      for (std::unordered_map<int, PrefetcherJobParams*>::iterator it = PendingJobs.begin(); it != PendingJobs.end(); )
+      {
+        if ((stream < 0) || (it->second->stream == stream))
+        {
+          it->second->cancelled = true;
+          handles.push_back(it->second->cache_handle);
+          it = PendingJobs.erase(it);
+        }
+        else
+        {
+          ++it;
+        }
+      }
+    }
+
+    // Anybody already waiting for one of these frames takes over its computation
+    for (size_t i = 0; i < handles.size(); ++i)
+    {
+      VideoCache->rollback(&handles[i]);
+      --running_workers;
+    }
+  }
+
+  // If frame n is queued for prefetching but not started yet, takes the job
+  // over so that the caller can compute the frame right away.
+  bool ClaimPendingJob(int n, PrefetcherCacheType::handle* cache_handle)
   {
+    std::lock_guard<std::mutex> lock(params_pool_mutex);
+    std::unordered_map<int, PrefetcherJobParams*>::iterator it = PendingJobs.find(n);
+    if (it == PendingJobs.end())
+      return false;
+
+    it->second->cancelled = true;
+    *cache_handle = it->second->cache_handle;
+    PendingJobs.erase(it);
+    --running_workers;
+    return true;
   }
 };
 
 
-// The number of intervals a pattern has to repeat itself to become (un)locked
-#define PATTERN_LOCK_LENGTH 3
+struct DependencyJobParams
+{
+  FrameDependency dep;
+  int levels;
+};
+
+static void RequestDependencies(PClip clip, int n, int levels, IScriptEnvironment2* env);
+
+static AVSValue DependencyWorker(IScriptEnvironment2* env, void* data)
+{
+  DependencyJobParams* params = (DependencyJobParams*)data;
+  try
+  {
+    RequestDependencies(params->dep.clip, params->dep.n, params->levels, env);
+    params->dep.clip->GetFrame(params->dep.n, env);
+  }
+  catch(...)
+  {
+    // The filter that needs this frame will request it again and report the error
+  }
+  return AVSValue();
+}
+
+// Requests the child frames that frame n of clip is made of in parallel,
+// for filters that declare them, so that GetFrame(n) finds them in the caches.
+// Chains of filters that need a single child frame are followed upstream.
+static void RequestDependencies(PClip clip, int n, int levels, IScriptEnvironment2* env)
+{
+  for ( ; levels > 0; --levels)
+  {
+    IFrameDependencies* fd = GetFrameDependencyInterface(clip);
+    if (fd == NULL)
+      return;
+
+    FrameDependency deps[PREFETCH_MAX_DEPENDENCIES];
+    const int nDeps = min(fd->GetFrameDependencies(n, deps, PREFETCH_MAX_DEPENDENCIES), PREFETCH_MAX_DEPENDENCIES);
+
+    // Frames are only worth requesting ahead if they stay in a cache until they are needed
+    DependencyJobParams params[PREFETCH_MAX_DEPENDENCIES];
+    int nJobs = 0;
+    for (int i = 0; i < nDeps; ++i)
+    {
+      PClip dep_clip = deps[i].clip;
+      if ((deps[i].n < 0) || (deps[i].n >= dep_clip->GetVideoInfo().num_frames) || !Cache::IsCache(dep_clip))
+        continue;
+
+      params[nJobs].dep = deps[i];
+      params[nJobs].levels = levels - 1;
+      ++nJobs;
+    }
+
+    // An elided cache or one without capacity would not keep the frames,
+    // which would then be computed once here and once more by the filter.
+    // The others must be able to hold all frames we request from them.
+    int nKept = 0;
+    for (int i = 0; i < nJobs; ++i)
+    {
+      size_t nSameCache = 0;
+      for (int j = 0; j < nJobs; ++j)
+      {
+        if (params[j].dep.clip == params[i].dep.clip)
+          ++nSameCache;
+      }
+
+      if (static_cast<Cache*>(params[i].dep.clip)->ReserveFrames(nSameCache))
+        params[nKept++] = params[i];
+    }
+    nJobs = nKept;
+
+    if (nJobs == 0)
+      return;
+
+    if (nJobs == 1)
+    {
+      clip = params[0].dep.clip;
+      n = params[0].dep.n;
+      continue;
+    }
+
+    IJobCompletion* completion = env->NewCompletion(nJobs);
+    for (int i = 0; i < nJobs; ++i)
+      env->ParallelJob(DependencyWorker, &params[i], completion);
+    completion->Wait();
+    completion->Destroy();
+    return;
+  }
+}
+
 
 AVSValue Prefetcher::ThreadWorker(IScriptEnvironment2* env, void* data)
 {
   PrefetcherJobParams *ptr = (PrefetcherJobParams*)data;
   Prefetcher *prefetcher = ptr->prefetcher;
   int n = ptr->frame;
-  LruCache<size_t, PVideoFrame>::handle cache_handle = ptr->cache_handle;
+  PrefetcherCacheType::handle cache_handle = ptr->cache_handle;
+  bool cancelled;
 
   {
     std::lock_guard<std::mutex> lock(prefetcher->_pimpl->params_pool_mutex);
+    cancelled = ptr->cancelled;
+    if (!cancelled)
+      prefetcher->_pimpl->PendingJobs.erase(n);
     prefetcher->_pimpl->JobParamsPool.Destruct(ptr);
   }
 
-  try
+  double latency = -1;
+  if (!cancelled)
   {
-    cache_handle.first->value = prefetcher->_pimpl->child->GetFrame(n, env);
-    #ifdef X86_32
-          _mm_empty();
-    #endif
+    try
+    {
+      const std::chrono::high_resolution_clock::time_point t_start = std::chrono::high_resolution_clock::now();
+      RequestDependencies(prefetcher->_pimpl->child, n, PREFETCH_DEPENDENCY_LEVELS, env);
+      cache_handle.first->value = prefetcher->_pimpl->child->GetFrame(n, env);
+      latency = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t_start).count();
+      #ifdef X86_32
+            _mm_empty();
+      #endif
+
+      prefetcher->_pimpl->VideoCache->commit_value(&cache_handle);
+      --(prefetcher->_pimpl->running_workers);
+    }
+    catch(...)
+    {
+      prefetcher->_pimpl->VideoCache->rollback(&cache_handle);
 
-    prefetcher->_pimpl->VideoCache->commit_value(&cache_handle);
-    --(prefetcher->_pimpl->running_workers);
+      std::lock_guard<std::mutex> lock(prefetcher->_pimpl->worker_exception_mutex);
+      prefetcher->_pimpl->worker_exception = std::current_exception();
+      prefetcher->_pimpl->worker_exception_present = true;
+      --(prefetcher->_pimpl->running_workers);
+    }
   }
-  catch(...)
-  {
-    prefetcher->_pimpl->VideoCache->rollback(&cache_handle);
 
-    std::lock_guard<std::mutex> lock(prefetcher->_pimpl->worker_exception_mutex);
-    prefetcher->_pimpl->worker_exception = std::current_exception();
-    prefetcher->_pimpl->worker_exception_present = true;
-    --(prefetcher->_pimpl->running_workers);
+  {
+    std::lock_guard<std::mutex> lock(prefetcher->_pimpl->params_pool_mutex);
+    if (latency >= 0)
+    {
+      double& avg = prefetcher->_pimpl->FrameLatency;
+      avg = (avg > 0) ? avg + (latency - avg) * PREFETCH_TIMING_WEIGHT : latency;
+    }
+    --(prefetcher->_pimpl->outstanding_jobs);
+    prefetcher->_pimpl->jobs_done.notify_all();
   }
 
   return AVSValue();
 }
 
-Prefetcher::Prefetcher(const PClip& _child, size_t _nThreads, IScriptEnvironment2 *env) :
+Prefetcher::Prefetcher(const PClip& _child, size_t _nThreads, size_t _nCacheShards, IScriptEnvironment2 *env) :
   _pimpl(NULL)
 {
-  _pimpl = new PrefetcherPimpl(_child, _nThreads);
-  _pimpl->VideoCache = std::make_shared<LruCache<size_t, PVideoFrame> >(_pimpl->nPrefetchFrames*2);
+  _pimpl = new PrefetcherPimpl(_child, _nThreads, _nCacheShards);
+  _pimpl->VideoCache = std::make_shared<PrefetcherCacheType>(_pimpl->nPrefetchFrames*2, _nCacheShards);
 }
 
 Prefetcher::~Prefetcher()
 {
-  while(_pimpl->running_workers > 0);
+  // Jobs that have not started yet are dropped, running ones are waited for
+  _pimpl->CancelPendingJobs(-1);
+  {
+    std::unique_lock<std::mutex> lock(_pimpl->params_pool_mutex);
+    while (_pimpl->outstanding_jobs > 0)
+      _pimpl->jobs_done.wait(lock);
+  }
   delete _pimpl;
 }
 
@@ -131,110 +387,180 @@ size_t Prefetcher::NumPrefetchThreads() const
   return _pimpl->nThreads;
 }
 
-int __stdcall Prefetcher::SchedulePrefetch(int current_n, int prefetch_start, IScriptEnvironment2* env)
+size_t Prefetcher::NumCacheShards() const
+{
+  return _pimpl->nCacheShards;
+}
+
+void __stdcall Prefetcher::SchedulePrefetch(IScriptEnvironment2* env)
 {
-  int n = prefetch_start;
-  while ((_pimpl->running_workers < _pimpl->nPrefetchFrames) && (std::abs(n - current_n) < _pimpl->nPrefetchFrames) )
+  int depth;
   {
-    n += _pimpl->IsLocked ? _pimpl->LockedPattern : 1;
-    if (n >= _pimpl->vi.num_frames)
-      break;
+    std::lock_guard<std::mutex> lock(_pimpl->params_pool_mutex);
+    depth = _pimpl->PrefetchDepth;
+  }
+
+  PrefetchStream streams[PREFETCH_MAX_STREAMS];
+  {
+    std::lock_guard<std::mutex> lock(_pimpl->request_mutex);
+    for (int s = 0; s < PREFETCH_MAX_STREAMS; ++s)
+      streams[s] = _pimpl->Streams[s];
+  }
+
+  double total_weight = 0;
+  for (int s = 0; s < PREFETCH_MAX_STREAMS; ++s)
+  {
+    if (streams[s].Active)
+      total_weight += streams[s].Weight;
+  }
+  if (total_weight <= 0)
+    return;
 
-    PVideoFrame result;
-    LruCache<size_t, PVideoFrame>::handle cache_handle;
-    switch(_pimpl->VideoCache->lookup(n, &cache_handle, false))
+  // Every stream gets a part of the depth according to its share of the recent requests
+  for (int s = 0; s < PREFETCH_MAX_STREAMS; ++s)
+  {
+    const PrefetchStream& stream = streams[s];
+    if (!stream.Active)
+      continue;
+
+    const int budget = max(1, (int)(depth * stream.Weight / total_weight + 0.5));
+    const int step = stream.Step();
+    int n = stream.Position;
+    for (int i = 0; (i < budget) && (_pimpl->running_workers < depth); ++i)
     {
-    case LRU_LOOKUP_NOT_FOUND:
+      n += step;
+      if ((n < 0) || (n >= _pimpl->vi.num_frames))
+        break;
+
+      PrefetcherCacheType::handle cache_handle;
+      switch(_pimpl->VideoCache->lookup(n, &cache_handle, false))
       {
-        PrefetcherJobParams *p = NULL;
+      case LRU_LOOKUP_NOT_FOUND:
         {
-          std::lock_guard<std::mutex> lock(_pimpl->params_pool_mutex);
-          p = _pimpl->JobParamsPool.Construct();
+          PrefetcherJobParams *p = NULL;
+          {
+            std::lock_guard<std::mutex> lock(_pimpl->params_pool_mutex);
+            p = _pimpl->JobParamsPool.Construct();
+            p->frame = n;
+            p->stream = s;
+            p->prefetcher = this;
+            p->cache_handle = cache_handle;
+            p->cancelled = false;
+            _pimpl->PendingJobs[n] = p;
+            ++_pimpl->outstanding_jobs;
+          }
+          ++_pimpl->running_workers;
+          env->ParallelJob(ThreadWorker, p, NULL);
+          break;
+        }
+      case LRU_LOOKUP_FOUND_AND_READY:      // Fall-through intentional
+      case LRU_LOOKUP_NO_CACHE:             // Fall-through intentional
+      case LRU_LOOKUP_FOUND_BUT_NOTAVAIL:
+        {
+          break;
+        }
+      default:
+        {
+          assert(0);
+          break;
         }
-        p->frame = n;
-        p->prefetcher = this;
-        p->cache_handle = cache_handle;
-        ++_pimpl->running_workers;
-        _pimpl->ThreadPool.QueueJob(ThreadWorker, p, env, NULL);
-        break;
-      }
-    case LRU_LOOKUP_FOUND_AND_READY:      // Fall-through intentional
-    case LRU_LOOKUP_NO_CACHE:             // Fall-through intentional
-    case LRU_LOOKUP_FOUND_BUT_NOTAVAIL:
-      {
-        break;
-      }
-    default:
-      {
-        assert(0);
-        break;
       }
     }
-  } // switch
-
-  return n;
+  }
 }
 
 PVideoFrame __stdcall Prefetcher::GetFrame(int n, IScriptEnvironment* env)
 {
   IScriptEnvironment2 *env2 = static_cast<IScriptEnvironment2*>(env);
 
-  int pattern = n - _pimpl->LastRequestedFrame;
-  _pimpl->LastRequestedFrame = n;
-  if (pattern == 0)
-    pattern = 1;
+  std::unique_lock<std::mutex> request_lock(_pimpl->request_mutex);
 
-  if (_pimpl->IsLocked)
+  // Measure how fast frames are consumed
+  const std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+  if (_pimpl->HasRequested)
   {
-    if (_pimpl->LockedPattern == pattern)
-    {
-      _pimpl->PatternHits = 0;    // Tracks Pattern
-      _pimpl->PatternMisses = 0;  // Tracks LockedPattern
-    }
-    else if (_pimpl->Pattern == pattern)
-    {
-      _pimpl->PatternHits++;    // Tracks Pattern
-      _pimpl->PatternMisses++;  // Tracks LockedPattern
-    }
-    else
+    const double interval = std::chrono::duration<double>(now - _pimpl->LastRequestTime).count();
+    double& avg = _pimpl->RequestInterval;
+    avg = (avg > 0) ? avg + (interval - avg) * PREFETCH_TIMING_WEIGHT : interval;
+  }
+  _pimpl->LastRequestTime = now;
+  _pimpl->HasRequested = true;
+
+  // Find the stream this request belongs to. A stream that predicted
+  // this frame wins, otherwise the closest one within the prefetch window.
+  int stream_idx = -1;
+  int best_distance = _pimpl->nPrefetchFrames;
+  for (int s = 0; s < PREFETCH_MAX_STREAMS; ++s)
+  {
+    const PrefetchStream& stream = _pimpl->Streams[s];
+    if (!stream.Active)
+      continue;
+
+    if (stream.Position + stream.Stride == n)
     {
-      _pimpl->PatternHits = 0;  // Tracks Pattern
-      _pimpl->PatternMisses++;  // Tracks LockedPattern
+      stream_idx = s;
+      break;
     }
-    _pimpl->Pattern = pattern;
 
-    if ((_pimpl->PatternMisses >= PATTERN_LOCK_LENGTH) && (_pimpl->PatternHits >= PATTERN_LOCK_LENGTH))
+    const int distance = std::abs(n - stream.Position);
+    if (distance < best_distance)
     {
-      _pimpl->LockedPattern = _pimpl->Pattern;
-      _pimpl->PatternHits = 0;    // Tracks Pattern
-      _pimpl->PatternMisses = 0;  // Tracks LockedPattern
+      best_distance = distance;
+      stream_idx = s;
     }
-    else if ((_pimpl->PatternMisses >= PATTERN_LOCK_LENGTH) && (_pimpl->PatternHits < PATTERN_LOCK_LENGTH))
+  }
+
+  // A request that fits no stream is a seek or a new consumer.
+  // It starts a new stream, and the queued frames of the stream it
+  // replaces are dropped so that this frame does not wait behind them.
+  // The frames queued for the other streams are still wanted.
+  const bool seek = (stream_idx < 0);
+  if (seek)
+  {
+    // Take a free slot, or replace the stream with the least recent requests
+    stream_idx = 0;
+    for (int s = 0; s < PREFETCH_MAX_STREAMS; ++s)
     {
-      _pimpl->IsLocked = false;
+      if (!_pimpl->Streams[s].Active)
+      {
+        stream_idx = s;
+        break;
+      }
+      if (_pimpl->Streams[s].Weight < _pimpl->Streams[stream_idx].Weight)
+        stream_idx = s;
     }
+
+    _pimpl->CancelPendingJobs(stream_idx);
+    _pimpl->Streams[stream_idx] = PrefetchStream();
+    _pimpl->Streams[stream_idx].Active = true;
+    _pimpl->Streams[stream_idx].Position = n;
   }
   else
   {
-    if (_pimpl->Pattern == pattern)
-    {
-      _pimpl->PatternHits++;      // Tracks Pattern
-      _pimpl->PatternMisses = 0;  // Tracks Pattern
-    }
-    else
-    {
-      _pimpl->PatternHits = 0;    // Tracks Pattern
-      _pimpl->PatternMisses++;    // Tracks Pattern
-    }
+    _pimpl->Streams[stream_idx].Update(n);
+  }
 
-    if (_pimpl->PatternHits >= PATTERN_LOCK_LENGTH)
+  for (int s = 0; s < PREFETCH_MAX_STREAMS; ++s)
+  {
+    PrefetchStream& stream = _pimpl->Streams[s];
+    stream.Weight *= PREFETCH_STREAM_DECAY;
+    if (s == stream_idx)
+      stream.Weight += 1.0;
+    else if (stream.Weight < PREFETCH_STREAM_MIN_WEIGHT)
+      stream.Active = false;
+  }
+
+  // Keep as many frames in flight as are consumed while a worker produces one,
+  // plus one for each worker so that none of them runs idle.
+  {
+    std::lock_guard<std::mutex> lock(_pimpl->params_pool_mutex);
+    if ((_pimpl->FrameLatency > 0) && (_pimpl->RequestInterval > 0))
     {
-      _pimpl->LockedPattern = pattern;
-      _pimpl->PatternMisses = 0;  // Tracks Pattern
-      _pimpl->IsLocked = true;
+      const double needed = std::ceil(_pimpl->FrameLatency / _pimpl->RequestInterval) + _pimpl->nThreads;
+      _pimpl->PrefetchDepth = (int)clamp(needed, (double)_pimpl->nThreads, (double)_pimpl->nPrefetchFrames);
     }
   }
-
+  request_lock.unlock();
 
   {
     std::lock_guard<std::mutex> lock(_pimpl->worker_exception_mutex);
@@ -245,19 +571,25 @@ PVideoFrame __stdcall Prefetcher::GetFrame(int n, IScriptEnvironment* env)
   }
 
 
+  // If the requested frame is still waiting in the queue, compute it
+  // here instead of waiting until a worker gets to it.
+  PrefetcherCacheType::handle cache_handle;
+  const bool claimed = _pimpl->ClaimPendingJob(n, &cache_handle);
+
   // Prefetch 1
-  size_t scheduled_Frames = 0;
-  int prefetch_pos = SchedulePrefetch(n, n, env2);
+  // Right after a seek, the requested frame gets all threads to itself.
+  if (!seek)
+    SchedulePrefetch(env2);
 
   // Get requested frame
   PVideoFrame result;
-  LruCache<size_t, PVideoFrame>::handle cache_handle;
-  switch(_pimpl->VideoCache->lookup(n, &cache_handle, true))
+  switch(claimed ? LRU_LOOKUP_NOT_FOUND : _pimpl->VideoCache->lookup(n, &cache_handle, true))
   {
   case LRU_LOOKUP_NOT_FOUND:
     {
       try
       {
+        RequestDependencies(_pimpl->child, n, PREFETCH_DEPENDENCY_LEVELS, env2);
         cache_handle.first->value = _pimpl->child->GetFrame(n, env);
   #ifdef X86_32
         _mm_empty();
@@ -291,11 +623,42 @@ PVideoFrame __stdcall Prefetcher::GetFrame(int n, IScriptEnvironment* env)
   }
 
   // Prefetch 2
-  SchedulePrefetch(n, prefetch_pos, env2);
+  SchedulePrefetch(env2);
 
   return result;
 }
 
+// A batch tells us the stride of the requests to come, so the stream
+// is locked to it right away instead of after PATTERN_LOCK_LENGTH frames.
+void __stdcall Prefetcher::GetFrames(int start, int count, int stride, PVideoFrame* frames, IScriptEnvironment* env)
+{
+  if (count <= 0)
+    return;
+
+  frames[0] = GetFrame(start, env);
+  if (count == 1)
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(_pimpl->request_mutex);
+    for (int s = 0; s < PREFETCH_MAX_STREAMS; ++s)
+    {
+      PrefetchStream& stream = _pimpl->Streams[s];
+      if (stream.Active && (stream.Position == start))
+      {
+        stream.Stride = stride;
+        stream.Hits = PATTERN_LOCK_LENGTH;
+        stream.Misses = 0;
+        break;
+      }
+    }
+  }
+  SchedulePrefetch(static_cast<IScriptEnvironment2*>(env));
+
+  for (int i = 1; i < count; ++i)
+    frames[i] = GetFrame(start + i*stride, env);
+}
+
 bool __stdcall Prefetcher::GetParity(int n)
 {
   return _pimpl->child->GetParity(n);
@@ -308,6 +671,9 @@ void __stdcall Prefetcher::GetAudio(void* buf, __int64 start, __int64 count, ISc
 
 int __stdcall Prefetcher::SetCacheHints(int cachehints, int frame_range)
 {
+  if (cachehints == CACHE_HAS_FRAME_BATCHES_REQ)
+    return CACHE_HAS_FRAME_BATCHES_ANS;
+
   return _pimpl->child->SetCacheHints(cachehints, frame_range);
 }
 
@@ -322,10 +688,18 @@ AVSValue Prefetcher::Create(AVSValue args, void*, IScriptEnvironment* env)
   PClip child = args[0].AsClip();
 
   int PrefetchThreads = args[1].AsInt(env2->GetProperty(AEP_PHYSICAL_CPUS)+1);
+  int CacheShards = args[2].AsInt(1);
+  if (CacheShards < 1)
+    env->ThrowError("Prefetch: 'shards' must be at least 1.");
   
+  // Prefetch points after the first one share its workers
+  const int SharedThreads = (int)env2->GetProperty(AEP_FILTERCHAIN_THREADS) - 1;
+  if (SharedThreads > 0)
+    PrefetchThreads = min(PrefetchThreads, SharedThreads);
+
   if (PrefetchThreads > 0)
   {
-    Prefetcher* prefetcher = new Prefetcher(child, PrefetchThreads, env2);
+    Prefetcher* prefetcher = new Prefetcher(child, PrefetchThreads, CacheShards, env2);
     try
     {
       env2->SetPrefetcher(prefetcher);
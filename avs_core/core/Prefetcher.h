@@ -5,22 +5,24 @@
 
 struct PrefetcherPimpl;
 
-class Prefetcher : public IClip
+class Prefetcher : public IClip, public IFrameBatch
 {
 private:
 
   PrefetcherPimpl * _pimpl;
 
   static AVSValue ThreadWorker(IScriptEnvironment2* env, void* data);
-  int __stdcall SchedulePrefetch(int current_n, int prefetch_start, IScriptEnvironment2* env);
-  Prefetcher(const PClip& _child, size_t _nThreads, IScriptEnvironment2 *env);
+  void __stdcall SchedulePrefetch(IScriptEnvironment2* env);
+  Prefetcher(const PClip& _child, size_t _nThreads, size_t _nCacheShards, IScriptEnvironment2 *env);
 
 public:
   ~Prefetcher();
   size_t NumPrefetchThreads() const;
+  size_t NumCacheShards() const;
   virtual PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
   virtual bool __stdcall GetParity(int n);
   virtual void __stdcall GetAudio(void* buf, __int64 start, __int64 count, IScriptEnvironment* env);
+  virtual void __stdcall GetFrames(int start, int count, int stride, PVideoFrame* frames, IScriptEnvironment* env);
   virtual int __stdcall SetCacheHints(int cachehints, int frame_range);
   virtual const VideoInfo& __stdcall GetVideoInfo();
 
@@ -6,6 +6,9 @@
 #include "vartable.h"
 #include "ThreadPool.h"
 #include "BufferPool.h"
+#include "internal.h"
+
+class ProfileScope;
 
 class ScriptEnvironmentTLS : public IScriptEnvironment2
 {
@@ -15,6 +18,7 @@ private:
   VarTable* global_var_table;
   VarTable* var_table;
   BufferPool BufferPool;
+  ProfileScope* ProfileTop;   // Innermost profiled call on this thread
 
 public:
   ScriptEnvironmentTLS(size_t _thread_id) : 
@@ -22,7 +26,8 @@ public:
     thread_id(_thread_id),
     global_var_table(NULL),
     var_table(NULL),
-    BufferPool(this)
+    BufferPool(this),
+    ProfileTop(NULL)
   {
     global_var_table = new VarTable(0, 0);
     var_table = new VarTable(0, global_var_table);
@@ -242,6 +247,8 @@ public:
 
   void* __stdcall ManageCache(int key, void* data)
   {
+    if (key == MC_GetProfileStack)
+      return reinterpret_cast<void*>(&ProfileTop);
     return core->ManageCache(key, data);
   }
 
@@ -347,6 +354,11 @@ public:
     core->SetPrefetcher(p);
   }
 
+  virtual IFrameRequest* __stdcall GetFrameAsync(const PClip& clip, int n, FrameReadyCallback callback, void* user_data)
+  {
+    return core->GetFrameAsync(clip, n, callback, user_data);
+  }
+
 
 };
 
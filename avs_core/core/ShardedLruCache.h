@@ -0,0 +1,161 @@
+#ifndef AVS_SHARDEDLRUCACHE_H
+#define AVS_SHARDEDLRUCACHE_H
+
+#include <vector>
+#include <memory>
+#include <limits>
+#include "LruCache.h"
+
+// Partitions the key space over a number of independent LruCache instances,
+// each guarded by its own mutex. Threads requesting different keys will
+// therefore only contend if their keys map to the same shard.
+// The lookup/commit/rollback protocol is the same as that of LruCache,
+// and handles are interchangeable with it, because a handle always
+// refers to the shard that the entry belongs to.
+template<typename K, typename V>
+class ShardedLruCache
+{
+public:
+  typedef LruCache<K, V> ShardType;
+  typedef typename ShardType::handle handle;
+
+private:
+  std::vector<std::shared_ptr<ShardType> > Shards;
+
+  ShardType* shard_for(const K& key) const
+  {
+    return Shards[key % Shards.size()].get();
+  }
+
+  // Distributes 'total' as evenly as possible over 'n' shards
+  static size_t shard_share(size_t total, size_t shard, size_t n)
+  {
+    if (total == std::numeric_limits<size_t>::max())
+      return total;
+
+    return total / n + ((shard < total % n) ? 1 : 0);
+  }
+
+  static size_t saturating_add(size_t a, size_t b)
+  {
+    return (std::numeric_limits<size_t>::max() - a < b) ? std::numeric_limits<size_t>::max() : a + b;
+  }
+
+  ShardedLruCache(const ShardedLruCache&);
+  ShardedLruCache& operator=(const ShardedLruCache&);
+
+public:
+
+  ShardedLruCache(size_t capacity, size_t nShards)
+  {
+    if (nShards == 0)
+      nShards = 1;
+
+    Shards.reserve(nShards);
+    for (size_t i = 0; i < nShards; ++i)
+      Shards.emplace_back(std::make_shared<ShardType>(shard_share(capacity, i, nShards)));
+  }
+
+  size_t num_shards() const
+  {
+    return Shards.size();
+  }
+
+  size_t size() const
+  {
+    size_t ret = 0;
+    for (size_t i = 0; i < Shards.size(); ++i)
+      ret += Shards[i]->size();
+    return ret;
+  }
+
+  size_t requested_capacity() const
+  {
+    size_t ret = 0;
+    for (size_t i = 0; i < Shards.size(); ++i)
+      ret = saturating_add(ret, Shards[i]->requested_capacity());
+    return ret;
+  }
+
+  size_t capacity() const
+  {
+    size_t ret = 0;
+    for (size_t i = 0; i < Shards.size(); ++i)
+      ret = saturating_add(ret, Shards[i]->capacity());
+    return ret;
+  }
+
+  void limits(size_t* min, size_t* max) const
+  {
+    *min = 0;
+    *max = 0;
+    for (size_t i = 0; i < Shards.size(); ++i)
+    {
+      size_t smin, smax;
+      Shards[i]->limits(&smin, &smax);
+      *min = saturating_add(*min, smin);
+      *max = saturating_add(*max, smax);
+    }
+  }
+
+  void set_limits(size_t min, size_t max)
+  {
+    for (size_t i = 0; i < Shards.size(); ++i)
+      Shards[i]->set_limits(shard_share(min, i, Shards.size()), shard_share(max, i, Shards.size()));
+  }
+
+  LruPolicy policy() const
+  {
+    return Shards[0]->policy();
+  }
+
+  void set_policy(LruPolicy policy)
+  {
+    for (size_t i = 0; i < Shards.size(); ++i)
+      Shards[i]->set_policy(policy);
+  }
+
+  void set_spill(bool enabled)
+  {
+    for (size_t i = 0; i < Shards.size(); ++i)
+      Shards[i]->set_spill(enabled);
+  }
+
+  void take_spilled(std::vector<std::pair<K, V> >* out)
+  {
+    for (size_t i = 0; i < Shards.size(); ++i)
+      Shards[i]->take_spilled(out);
+  }
+
+  void set_window(const K& first, const K& last)
+  {
+    for (size_t i = 0; i < Shards.size(); ++i)
+      Shards[i]->set_window(first, last);
+  }
+
+  void clear_window()
+  {
+    for (size_t i = 0; i < Shards.size(); ++i)
+      Shards[i]->clear_window();
+  }
+
+  LruLookupResult lookup(const K& key, handle *hndl, bool block_for_completion)
+  {
+    return shard_for(key)->lookup(key, hndl, block_for_completion);
+  }
+
+  void commit_value(handle *hndl)
+  {
+    // The shard resets the handle, so keep the shard alive in a local
+    std::shared_ptr<ShardType> shard = hndl->second;
+    shard->commit_value(hndl);
+  }
+
+  void rollback(handle *hndl)
+  {
+    std::shared_ptr<ShardType> shard = hndl->second;
+    shard->rollback(hndl);
+  }
+};
+
+#endif  // AVS_SHARDEDLRUCACHE_H
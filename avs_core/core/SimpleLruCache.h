@@ -2,6 +2,7 @@
 #define AVS_SIMPLELRUCACHE_H
 
 #include <list>
+#include <unordered_map>
 #include <functional>
 #include <limits>
 #include <avs/minmax.h>
@@ -27,6 +28,8 @@ public:
   typedef std::function<bool(SimpleLruCache*, const Entry&, void*)> EvictEventType;
 
 private:
+  typedef std::unordered_map<K, entry_type> MapType;
+
   size_t MinCapacity;
   size_t MaxCapacity;
   size_t RequestedCapacity;
@@ -34,6 +37,12 @@ private:
   std::list<Entry> Cache;
   std::list<Entry> Pool;
 
+  // Indexes every element of Cache by its key, so that lookups,
+  // promotions and removals don't have to walk the list.
+  // List iterators stay valid across splices, so only insertion
+  // and eviction need to touch the map.
+  MapType Map;
+
   void* EventUserData;
   const EvictEventType EvictEvent;
 
@@ -80,22 +89,17 @@ public:
   {
     // Look for an existing cache entry,
     // and return it when found
-    const entry_type it_end =  Cache.end();
-    for (
-      entry_type it = Cache.begin();
-      it != it_end;
-      ++it
-    )
+    typename MapType::iterator mit = Map.find(key);
+    if (mit != Map.end())
     {
-      if (it->key == key)
-      {
-        // Move found element to the front of the list
-        if (it != Cache.begin())
-          Cache.splice(Cache.begin(), Cache, it);
+      entry_type it = mit->second;
 
-        *found = true;
-        return &(Cache.front().value);
-      }
+      // Move found element to the front of the list
+      if (it != Cache.begin())
+        Cache.splice(Cache.begin(), Cache, it);
+
+      *found = true;
+      return &(Cache.front().value);
     }
 
     // Nothing found
@@ -117,6 +121,7 @@ public:
         Cache.emplace_front(key);
       }
 
+      Map[key] = Cache.begin();
       return &(Cache.front().value);
     }
 
@@ -126,18 +131,11 @@ public:
 
   void remove(const K& key)
   {
-    const entry_type it_end =  Cache.end();
-    for (
-      entry_type it = Cache.begin();
-      it != it_end;
-      ++it
-    )
+    typename MapType::iterator mit = Map.find(key);
+    if (mit != Map.end())
     {
-      if (it->key == key)
-      {
-        Pool.splice(Pool.begin(), Cache, it);
-        break;
-      }
+      Pool.splice(Pool.begin(), Cache, mit->second);
+      Map.erase(mit);
     }
   }
 
@@ -145,29 +143,28 @@ public:
   {
     if (Cache.size() > RealCapacity)
     {
+      // Walk from the least recently used end. Entries that the consumer
+      // refuses to evict are skipped, and we continue with the next one
+      // until enough entries were evicted or we have seen the whole list.
       size_t nItemsToDelete = Cache.size() - RealCapacity;
-      std::list<Entry>::iterator it = --Cache.end();
-      for (size_t i = 0; i < nItemsToDelete; ++i)
+      entry_type it = --Cache.end();
+      bool end = false;
+      while ((nItemsToDelete > 0) && !end)
       {
-        std::list<Entry>::iterator prev_it;
-        bool end = (it == Cache.begin());
+        entry_type prev_it;
+        end = (it == Cache.begin());
         if (!end)
         {
           prev_it = it;
           --prev_it;
         }
 
-        if (EvictEvent != NULL)
-        {
-          if (EvictEvent(this, *it, EventUserData))
-          {
-            Pool.splice(Pool.begin(), Cache, it);
-          }
-        }
-        else
+        // TODO: Do we want the consumer to always define EvictItem?
+        if ((EvictEvent == NULL) || EvictEvent(this, *it, EventUserData))
         {
-          // TODO: Do we want the consumer to always define EvictItem?
+          Map.erase(it->key);
           Pool.splice(Pool.begin(), Cache, it);
+          --nItemsToDelete;
         }
 
         if (!end)
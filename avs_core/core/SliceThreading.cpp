@@ -0,0 +1,140 @@
+#include "SliceThreading.h"
+#include <avs/minmax.h>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+
+// Below this many bytes of work per slice the hand-off costs more than it saves
+#define SLICE_MIN_COST (64*1024)
+
+struct SliceState
+{
+  SliceWorkerFuncPtr Func;
+  void* Data;
+  int Count;
+  int Granularity;
+  int nSlices;
+
+  std::atomic<int> NextSlice;
+
+  // Guarded by mutex
+  std::mutex mutex;
+  std::condition_variable SlicesDone;
+  int nDone;
+  std::exception_ptr Error;
+
+  SliceState() :
+    NextSlice(0),
+    nDone(0)
+  {}
+
+  void GetSlice(int slice, int* begin, int* end) const
+  {
+    const int units = (Count + Granularity - 1) / Granularity;
+    *begin = (int)((__int64)units * slice / nSlices) * Granularity;
+    *end = min((int)((__int64)units * (slice+1) / nSlices) * Granularity, Count);
+  }
+
+  // Claims and runs slices until none are left
+  void Run(IScriptEnvironment* env)
+  {
+    for(;;)
+    {
+      const int slice = NextSlice++;
+      if (slice >= nSlices)
+        break;
+
+      int begin, end;
+      GetSlice(slice, &begin, &end);
+
+      std::exception_ptr error;
+      try
+      {
+        if (begin < end)
+          Func(begin, end, Data, env);
+      }
+      catch(...)
+      {
+        error = std::current_exception();
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (error && !Error)
+        Error = error;
+      if (++nDone == nSlices)
+        SlicesDone.notify_all();
+    }
+  }
+};
+
+// Jobs can start after the caller has already finished all slices and returned,
+// so they only hold on to the shared state and never to the caller's data.
+static AVSValue SliceJob(IScriptEnvironment2* env, void* data)
+{
+  std::shared_ptr<SliceState>* state = reinterpret_cast<std::shared_ptr<SliceState>*>(data);
+  (*state)->Run(env);
+  delete state;
+  return AVSValue();
+}
+
+// Runs nSlices slices on at most nThreads threads, the calling one included
+static void RunSlices(int count, int granularity, int nSlices, int nThreads, SliceWorkerFuncPtr func, void* data, IScriptEnvironment* env)
+{
+  if ((nSlices <= 1) || (nThreads <= 1))
+  {
+    func(0, count, data, env);
+    return;
+  }
+
+  IScriptEnvironment2* env2 = static_cast<IScriptEnvironment2*>(env);
+
+  std::shared_ptr<SliceState> state = std::make_shared<SliceState>();
+  state->Func = func;
+  state->Data = data;
+  state->Count = count;
+  state->Granularity = granularity;
+  state->nSlices = nSlices;
+
+  for (int i = 1; i < min(nSlices, nThreads); ++i)
+    env2->ParallelJob(SliceJob, new std::shared_ptr<SliceState>(state), NULL);
+
+  // Work along instead of blocking, so that progress never depends on an idle worker
+  state->Run(env);
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  while (state->nDone < nSlices)
+    state->SlicesDone.wait(lock);
+
+  if (state->Error)
+    std::rethrow_exception(state->Error);
+}
+
+void ParallelSlices(int count, int granularity, size_t cost_per_item, SliceWorkerFuncPtr func, void* data, IScriptEnvironment* env)
+{
+  if (count <= 0)
+    return;
+  if (granularity < 1)
+    granularity = 1;
+
+  IScriptEnvironment2* env2 = static_cast<IScriptEnvironment2*>(env);
+
+  const int units = (count + granularity - 1) / granularity;
+  const __int64 total_cost = (__int64)count * cost_per_item;
+  int nSlices = (int)min((__int64)env2->GetProperty(AEP_THREADPOOL_THREADS) + 1, total_cost / SLICE_MIN_COST);
+  nSlices = min(nSlices, units);
+
+  RunSlices(count, granularity, nSlices, nSlices, func, data, env);
+}
+
+void ParallelTasks(int count, SliceWorkerFuncPtr func, void* data, IScriptEnvironment* env)
+{
+  if (count <= 0)
+    return;
+
+  IScriptEnvironment2* env2 = static_cast<IScriptEnvironment2*>(env);
+  const int nThreads = (int)env2->GetProperty(AEP_THREADPOOL_THREADS) + 1;
+
+  RunSlices(count, 1, count, nThreads, func, data, env);
+}
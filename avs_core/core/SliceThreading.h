@@ -0,0 +1,22 @@
+#ifndef _AVS_SLICETHREADING_H
+#define _AVS_SLICETHREADING_H
+
+#include <avisynth.h>
+
+// Processes items [begin, end) of a frame, e.g. rows or columns of a plane.
+// 'env' is the environment of the thread that runs the slice.
+typedef void (*SliceWorkerFuncPtr)(int begin, int end, void* data, IScriptEnvironment* env);
+
+// Splits 'count' items into slices and runs them on the thread pool, with the
+// calling thread processing slices too. Slice borders are multiples of
+// 'granularity', and no slice is made smaller than roughly SLICE_MIN_COST bytes
+// of work as estimated by 'cost_per_item'. Small frames run inline.
+// Returns when all slices are done. The first exception thrown by a slice is
+// rethrown in the calling thread.
+void ParallelSlices(int count, int granularity, size_t cost_per_item, SliceWorkerFuncPtr func, void* data, IScriptEnvironment* env);
+
+// Like ParallelSlices, but for a few items that are each worth a thread of their
+// own, e.g. frame requests. Items are handed out one at a time in order.
+void ParallelTasks(int count, SliceWorkerFuncPtr func, void* data, IScriptEnvironment* env);
+
+#endif // _AVS_SLICETHREADING_H
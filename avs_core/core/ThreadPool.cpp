@@ -1,120 +1,195 @@
 #include "ThreadPool.h"
 #include "ScriptEnvironmentTLS.h"
+#include "FrameTracer.h"
 #include <cassert>
 #include <thread>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 
 struct ThreadPoolGenericItemData
 {
   ThreadWorkerFuncPtr Func;
   void* Params;
   IScriptEnvironment2* Environment;
+  JobCompletion* Completion;
   AVSPromise* Promise;
 };
 
-enum ThreadMessagesType{
-  INVALID_MSG,
-  QUEUE_GENERIC_ITEM,
-  THREAD_STOP
-};
+typedef std::deque<ThreadPoolGenericItemData> JobQueue;
 
-struct ThreadMessage
+struct ThreadPoolWorker
 {
-  ThreadMessagesType Type;
-  ThreadPoolGenericItemData GenericWorkItemData;
+  std::mutex mutex;
+  JobQueue Jobs;                      // Own jobs are taken from the back, stolen ones from the front
+  std::thread::id ThreadId;
+  ScriptEnvironmentTLS* EnvTLS;
 
-  ThreadMessage() :
-    Type(INVALID_MSG)
-  {}
-  ThreadMessage(ThreadMessagesType type) :
-    Type(type)
-  {}
-  ThreadMessage(ThreadMessagesType type, const ThreadPoolGenericItemData &data) :
-    Type(type), GenericWorkItemData(data)
+  ThreadPoolWorker() :
+    EnvTLS(NULL)
   {}
 };
 
-#include "mpmc_bounded_queue.h"
-typedef mpmc_bounded_queue<ThreadMessage> MessageQueue;
-
-static void ThreadFunc(size_t thread_id, MessageQueue *msgQueue)
+class ThreadPoolPimpl
 {
-  ScriptEnvironmentTLS EnvTLS(thread_id);
+public:
+  std::vector<std::thread> Threads;
+  std::vector<ThreadPoolWorker*> Workers;
+
+  // Jobs queued from threads outside of the pool
+  std::mutex SharedMutex;
+  JobQueue SharedJobs;
+
+  // Idle workers sleep here. Guarded by SharedMutex.
+  std::condition_variable WorkAvailable;
+  std::atomic<size_t> nQueued;        // Jobs in all queues
+  bool Stopping;
 
-  bool runThread = true;
-  while(runThread)
+  FrameTracer* Tracer;
+
+  ThreadPoolPimpl(FrameTracer* tracer) :
+    nQueued(0),
+    Stopping(false),
+    Tracer(tracer)
+  {}
+
+  // Index of the worker running on this thread, or -1 for other threads
+  int CurrentWorker() const
   {
-    ThreadMessage msg;
-    msgQueue->pop_back(&msg);
+    const std::thread::id me = std::this_thread::get_id();
+    for (size_t i = 0; i < Workers.size(); ++i)
+    {
+      if (Workers[i]->ThreadId == me)
+        return (int)i;
+    }
+    return -1;
+  }
 
-    switch(msg.Type)
+  bool TakeJob(size_t worker, ThreadPoolGenericItemData* job)
+  {
+    if (nQueued == 0)
+      return false;
+
+    // Own jobs first, newest first
     {
-    case THREAD_STOP:
+      ThreadPoolWorker* w = Workers[worker];
+      std::lock_guard<std::mutex> lock(w->mutex);
+      if (!w->Jobs.empty())
       {
-        runThread = false;
-        break;
+        *job = w->Jobs.back();
+        w->Jobs.pop_back();
+        --nQueued;
+        return true;
       }
-    case QUEUE_GENERIC_ITEM:
+    }
+
+    // Then jobs from outside, oldest first
+    {
+      std::lock_guard<std::mutex> lock(SharedMutex);
+      if (!SharedJobs.empty())
       {
-        ThreadPoolGenericItemData &data = msg.GenericWorkItemData;
-        EnvTLS.Specialize(data.Environment);
-        if (data.Promise != NULL)
-        {
-          try
-          {
-            data.Promise->set_value(data.Func(&EnvTLS, data.Params));
-          }
-          catch(const AvisynthError&)
-          {
-            data.Promise->set_exception(std::current_exception());
-          }
-          catch(const std::exception&)
-          {
-            data.Promise->set_exception(std::current_exception());
-          }
-          catch(...)
-          {
-            data.Promise->set_exception(std::current_exception());
-            //data.Promise->set_value(AVSValue("An unknown exception was thrown in the thread pool."));
-          }
-        }
-        else
-        {
-          try
-          {
-            data.Func(&EnvTLS, data.Params);
-          } catch(...){}
-        }
-        break;
+        *job = SharedJobs.front();
+        SharedJobs.pop_front();
+        --nQueued;
+        return true;
       }
-    default:
+    }
+
+    // Then steal the oldest job of another worker
+    for (size_t i = 1; i < Workers.size(); ++i)
+    {
+      ThreadPoolWorker* victim = Workers[(worker + i) % Workers.size()];
+      std::lock_guard<std::mutex> lock(victim->mutex);
+      if (!victim->Jobs.empty())
       {
-        assert(0);
-        break;
+        *job = victim->Jobs.front();
+        victim->Jobs.pop_front();
+        --nQueued;
+        return true;
       }
-    } // switch
-  } //while
-}
+    }
 
-class ThreadPoolPimpl
-{
-public:
-  std::vector<std::thread> Threads;
-  MessageQueue MsgQueue;
+    return false;
+  }
 
-  ThreadPoolPimpl(size_t nThreads) :
-    Threads(),
-    MsgQueue(nThreads * 6)
-  {}
+  void RunJob(ThreadPoolGenericItemData& data, ScriptEnvironmentTLS* EnvTLS)
+  {
+    TraceScope trace(Tracer, "Job", "threadpool", -1);
+    EnvTLS->Specialize(data.Environment);
+    if (data.Promise != NULL)
+    {
+      try
+      {
+        data.Promise->set_value(data.Func(EnvTLS, data.Params));
+      }
+      catch(const AvisynthError&)
+      {
+        data.Promise->set_exception(std::current_exception());
+      }
+      catch(const std::exception&)
+      {
+        data.Promise->set_exception(std::current_exception());
+      }
+      catch(...)
+      {
+        data.Promise->set_exception(std::current_exception());
+        //data.Promise->set_value(AVSValue("An unknown exception was thrown in the thread pool."));
+      }
+    }
+    else
+    {
+      try
+      {
+        data.Func(EnvTLS, data.Params);
+      } catch(...){}
+    }
+  }
 };
 
-ThreadPool::ThreadPool(size_t nThreads) :
-  _pimpl(new ThreadPoolPimpl(nThreads))
+static void ThreadFunc(size_t thread_id, ThreadPoolPimpl *pool, ThreadPoolWorker *worker)
+{
+  ScriptEnvironmentTLS EnvTLS(thread_id);
+  worker->EnvTLS = &EnvTLS;
+
+  const size_t index = thread_id - 1;
+  for(;;)
+  {
+    ThreadPoolGenericItemData job;
+    if (pool->TakeJob(index, &job))
+    {
+      pool->RunJob(job, &EnvTLS);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(pool->SharedMutex);
+    while (!pool->Stopping && (pool->nQueued == 0))
+      pool->WorkAvailable.wait(lock);
+
+    // Finish all queued work before stopping
+    if (pool->Stopping && (pool->nQueued == 0))
+      break;
+  }
+
+  worker->EnvTLS = NULL;
+}
+
+ThreadPool::ThreadPool(size_t nThreads, FrameTracer* tracer) :
+  _pimpl(new ThreadPoolPimpl(tracer))
 {
   _pimpl->Threads.reserve(nThreads);
+  _pimpl->Workers.reserve(nThreads);
+  for (size_t i = 0; i < nThreads; ++i)
+    _pimpl->Workers.push_back(new ThreadPoolWorker());
 
   // i is used as the thread id. Skip id zero because that is reserved for the main thread.
+  // Nothing can be queued before the constructor returns, so the workers
+  // never look at thread ids that are not assigned yet.
   for (size_t i = 1; i <= nThreads; ++i)
-    _pimpl->Threads.emplace_back(ThreadFunc, i, &(_pimpl->MsgQueue));
+  {
+    _pimpl->Threads.emplace_back(ThreadFunc, i, _pimpl, _pimpl->Workers[i-1]);
+    _pimpl->Workers[i-1]->ThreadId = _pimpl->Threads.back().get_id();
+  }
 }
 
 void ThreadPool::QueueJob(ThreadWorkerFuncPtr clb, void* params, IScriptEnvironment2 *env, JobCompletion *tc)
@@ -123,13 +198,34 @@ void ThreadPool::QueueJob(ThreadWorkerFuncPtr clb, void* params, IScriptEnvironm
   itemData.Func = clb;
   itemData.Params = params;
   itemData.Environment = env;
+  itemData.Completion = tc;
 
   if (tc != NULL)
     itemData.Promise = tc->Add();
   else
     itemData.Promise = NULL;
 
-  _pimpl->MsgQueue.push_front(ThreadMessage(QUEUE_GENERIC_ITEM, itemData));
+  const int worker = _pimpl->CurrentWorker();
+  if (worker >= 0)
+  {
+    ThreadPoolWorker* w = _pimpl->Workers[worker];
+    std::lock_guard<std::mutex> lock(w->mutex);
+    w->Jobs.push_back(itemData);
+    ++(_pimpl->nQueued);
+  }
+  else
+  {
+    std::lock_guard<std::mutex> lock(_pimpl->SharedMutex);
+    _pimpl->SharedJobs.push_back(itemData);
+    ++(_pimpl->nQueued);
+  }
+
+  // Taking the lock makes sure that a worker that is about to sleep
+  // either sees the new job or is already waiting to be woken up.
+  {
+    std::lock_guard<std::mutex> lock(_pimpl->SharedMutex);
+  }
+  _pimpl->WorkAvailable.notify_one();
 }
 
 size_t ThreadPool::NumThreads() const
@@ -137,17 +233,52 @@ size_t ThreadPool::NumThreads() const
   return _pimpl->Threads.size();
 }
 
+bool ThreadPool::InWorkerThread() const
+{
+  return _pimpl->CurrentWorker() >= 0;
+}
+
+bool ThreadPool::RunPendingJob(JobCompletion* tc)
+{
+  const int worker = _pimpl->CurrentWorker();
+  if ((worker < 0) || (tc == NULL))
+    return false;
+
+  ThreadPoolWorker* w = _pimpl->Workers[worker];
+  ThreadPoolGenericItemData job;
+  {
+    std::lock_guard<std::mutex> lock(w->mutex);
+    JobQueue::reverse_iterator it = w->Jobs.rbegin();
+    while ((it != w->Jobs.rend()) && (it->Completion != tc))
+      ++it;
+    if (it == w->Jobs.rend())
+      return false;
+
+    job = *it;
+    w->Jobs.erase(--(it.base()));
+    --(_pimpl->nQueued);
+  }
+
+  _pimpl->RunJob(job, w->EnvTLS);
+  return true;
+}
+
 ThreadPool::~ThreadPool()
 {
-  for (size_t i = 0; i < _pimpl->Threads.size(); ++i)
   {
-    _pimpl->MsgQueue.push_front(THREAD_STOP);
+    std::lock_guard<std::mutex> lock(_pimpl->SharedMutex);
+    _pimpl->Stopping = true;
   }
+  _pimpl->WorkAvailable.notify_all();
+
   for (size_t i = 0; i < _pimpl->Threads.size(); ++i)
   {
     if (_pimpl->Threads[i].joinable())
       _pimpl->Threads[i].join();
   }
 
+  for (size_t i = 0; i < _pimpl->Workers.size(); ++i)
+    delete _pimpl->Workers[i];
+
   delete _pimpl;
 }
@@ -3,23 +3,32 @@
 
 #include <avisynth.h>
 #include <future>
+#include <atomic>
 
 typedef std::future<AVSValue> AVSFuture;
 typedef std::promise<AVSValue> AVSPromise;
 
+class ThreadPool;
+
 class JobCompletion : public IJobCompletion
 {
 private:
   const size_t max_jobs;
   size_t nJobs;
 
+  // Pool whose jobs a waiting worker thread runs while it waits. This is
+  // the environment's pool pointer rather than the pool itself, because
+  // the first Prefetch() replaces the pool, possibly after we were created.
+  const std::atomic<ThreadPool*>* const pool;
+
 public:
   typedef std::pair<AVSPromise, AVSFuture> PromFutPair;
   PromFutPair *pairs;
 
-  JobCompletion(size_t _max_jobs) :
+  JobCompletion(size_t _max_jobs, const std::atomic<ThreadPool*>* _pool = NULL) :
     max_jobs(_max_jobs),
     nJobs(0),
+    pool(_pool),
     pairs(NULL)
   {
     pairs = new PromFutPair[max_jobs];
@@ -44,11 +53,7 @@ public:
     delete [] pairs;
   }
 
-  void __stdcall Wait()
-  {
-    for (size_t i = 0; i < nJobs; ++i)
-      pairs[i].second.wait();
-  }
+  void __stdcall Wait();
   size_t __stdcall Size() const
   {
     return nJobs;
@@ -76,18 +81,52 @@ public:
   }
 };
 
+// Work-stealing thread pool. Every worker has its own deque of jobs.
+// Jobs queued by a worker go to its own deque and are run last-in first-out,
+// so that they find the data of the job that queued them still in the CPU cache.
+// Jobs queued from other threads go to a shared queue. Idle workers take
+// jobs from the shared queue first, then steal the oldest jobs of other workers.
 class ThreadPoolPimpl;
+class FrameTracer;
 class ThreadPool
 {
 private:
   ThreadPoolPimpl * const _pimpl;
 
 public:
-  ThreadPool(size_t nThreads);
+  ThreadPool(size_t nThreads, FrameTracer* tracer);
   ~ThreadPool();
 
   void QueueJob(ThreadWorkerFuncPtr clb, void* params, IScriptEnvironment2 *env, JobCompletion *tc);
   size_t NumThreads() const;
+
+  // Whether the calling thread is one of our workers
+  bool InWorkerThread() const;
+
+  // Runs one job of 'tc' that the calling worker queued and nobody has started yet.
+  // Returns false if there is no such job or if not called from one of our workers.
+  bool RunPendingJob(JobCompletion* tc);
 };
 
+inline void __stdcall JobCompletion::Wait()
+{
+  ThreadPool* current_pool = (pool != NULL) ? pool->load() : NULL;
+  for (size_t i = 0; i < nJobs; ++i)
+  {
+    // A worker that waits for its own jobs runs those that nobody has
+    // stolen yet, instead of blocking a thread that the jobs might need.
+    // Jobs of other filters are not run here, since the waiting worker
+    // is still inside the GetFrame call of its own filter.
+    if ((current_pool != NULL) && current_pool->InWorkerThread())
+    {
+      while (pairs[i].second.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+      {
+        if (!current_pool->RunPendingJob(this))
+          pairs[i].second.wait_for(std::chrono::milliseconds(1));
+      }
+    }
+    pairs[i].second.wait();
+  }
+}
+
 #endif  // _AVS_THREADPOOL_H
@@ -41,14 +41,30 @@
 
 #include "avisynth.h"
 #include "alignplanar.h"
+#include "internal.h"
 
 
 AlignPlanar::AlignPlanar(PClip _clip) : GenericVideoFilter(_clip) {}
 
 PVideoFrame __stdcall AlignPlanar::GetFrame(int n, IScriptEnvironment* env) {
-  int plane = (env->PlanarChromaAlignment(IScriptEnvironment::PlanarChromaAlignmentTest)) ? PLANAR_U_ALIGNED : PLANAR_Y_ALIGNED;
+  return Align(child->GetFrame(n, env), env);
+}
+
+// Passes batches on, so that a source below us still decodes them in one go
+void __stdcall AlignPlanar::GetFrames(int start, int count, int stride, PVideoFrame* frames, IScriptEnvironment* env) {
+  GetFrameBatch(child, start, count, stride, frames, env);
+  for (int i = 0; i < count; ++i)
+    frames[i] = Align(frames[i], env);
+}
 
-  PVideoFrame src = child->GetFrame(n, env);
+int __stdcall AlignPlanar::SetCacheHints(int cachehints, int frame_range) {
+  if (cachehints == CACHE_HAS_FRAME_BATCHES_REQ)
+    return (GetFrameBatchInterface(child) != NULL) ? CACHE_HAS_FRAME_BATCHES_ANS : 0;
+  return GenericVideoFilter::SetCacheHints(cachehints, frame_range);
+}
+
+PVideoFrame AlignPlanar::Align(const PVideoFrame& src, IScriptEnvironment* env) {
+  int plane = (env->PlanarChromaAlignment(IScriptEnvironment::PlanarChromaAlignmentTest)) ? PLANAR_U_ALIGNED : PLANAR_Y_ALIGNED;
 
   if (!(src->GetRowSize(plane)&(FRAME_ALIGN-1)))
     return src;
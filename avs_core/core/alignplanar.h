@@ -36,12 +36,16 @@
 #define __Align_Planar_H__
 
 
-class AlignPlanar : public GenericVideoFilter
+class AlignPlanar : public GenericVideoFilter, public IFrameBatch
 {
+  PVideoFrame Align(const PVideoFrame& src, IScriptEnvironment* env);
+
 public:
   AlignPlanar(PClip _clip);
   static PClip Create(PClip clip);
   PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
+  void __stdcall GetFrames(int start, int count, int stride, PVideoFrame* frames, IScriptEnvironment* env);
+  int __stdcall SetCacheHints(int cachehints, int frame_range);
 };
 
 
@@ -53,6 +53,7 @@
 #include <cassert>
 #include "MTGuard.h"
 #include "cache.h"
+#include "AsyncFrameRequest.h"
 
 #ifdef _MSC_VER
   #define strnicmp(a,b,c) _strnicmp(a,b,c)
@@ -74,7 +75,7 @@ extern const AVSFunction Audio_filters[], Combine_filters[], Convert_filters[],
                    Debug_filters[], Turn_filters[],
                    Conditional_filters[], Conditional_funtions_filters[],
                    Cache_filters[], Greyscale_filters[],
-                   Swap_filters[], Overlay_filters[];
+                   Swap_filters[], Overlay_filters[], DiskCache_filters[];
 
 
 const AVSFunction* builtin_functions[] = {
@@ -88,7 +89,8 @@ const AVSFunction* builtin_functions[] = {
                    Debug_filters, Turn_filters,
                    Conditional_filters, Conditional_funtions_filters,
                    Plugin_functions, Cache_filters,
-                   Overlay_filters, Greyscale_filters, Swap_filters};
+                   Overlay_filters, Greyscale_filters, Swap_filters,
+                   DiskCache_filters};
 
 // Global statistics counters
 struct {
@@ -497,8 +499,13 @@ const char* MTMapState::DEFAULT_MODE = NULL;
 #include "ThreadPool.h"
 #include <map>
 #include <atomic>
+#include <thread>
+#include <algorithm>
 #include "Prefetcher.h"
 #include "BufferPool.h"
+#include "CompressedFrameCache.h"
+#include "FilterProfiler.h"
+#include "FrameTracer.h"
 class ScriptEnvironment : public IScriptEnvironment2 {
 public:
   ScriptEnvironment();
@@ -555,6 +562,7 @@ public:
   virtual MtMode __stdcall GetFilterMTMode(const char* filter, bool* is_forced) const;
   virtual void __stdcall ParallelJob(ThreadWorkerFuncPtr jobFunc, void* jobData, IJobCompletion* completion);
   virtual IJobCompletion* __stdcall NewCompletion(size_t capacity);
+  virtual IFrameRequest* __stdcall GetFrameAsync(const PClip& clip, int n, FrameReadyCallback callback, void* user_data);
   virtual size_t  __stdcall GetProperty(AvsEnvProperty prop);
   virtual void* __stdcall Allocate(size_t nBytes, size_t alignment, AvsAllocType type);
   virtual void __stdcall Free(void* ptr);
@@ -571,7 +579,7 @@ private:
   size_t vsprintf_len;
 
   AtExiter at_exit;
-  ThreadPool * thread_pool;
+  std::atomic<ThreadPool*> thread_pool;   // Replaced by the first Prefetch(), see JobCompletion
 
   PluginManager *plugin_manager;
 
@@ -585,6 +593,17 @@ private:
   void EnsureMemoryLimit(size_t request);
   unsigned __int64 memory_max;
   std::atomic<unsigned __int64> memory_used;
+  std::atomic<unsigned __int64> memory_peak;
+
+  // Set by SetMaxCPU() to keep filters from using some instruction sets.
+  // Read by filters on every frame, from any thread.
+  std::atomic<int> CPUFlagsMask;
+  // Set by SetCacheElision(). Whether Import() lets caches of linear chains store nothing.
+  bool CacheElision;
+  bool CachesElided;      // Whether the elision pass has run; it runs only once
+  size_t CachesCreated;   // Serial number of the next cache
+  std::atomic<size_t> frame_copies;   // Frames MakeWritable() had to copy
+  void AddMemoryUsed(size_t amount);
 
   void ExportBuiltinFilters();
 
@@ -596,21 +615,80 @@ private:
 
   bool closing;                 // Used to avoid deadlock, if vartable is being accessed while shutting down (Popcontext)
 
-  typedef std::multimap<size_t, VideoFrame*> FrameRegistryType;
+  // All frames we have ever allocated, grouped by their exact buffer size.
+  // A frame is free for reuse if neither it nor its buffer is referenced.
+  // We never get notified when that happens, so each size class keeps
+  // a clock hand that remembers where the last search for a free frame
+  // stopped, and the next search continues from there.
+  struct FrameSizeClass
+  {
+    std::vector<VideoFrame*> frames;
+    size_t clock;
+
+    FrameSizeClass() : clock(0) {}
+  };
+  typedef std::map<size_t, FrameSizeClass> FrameRegistryType;
+
+  // Free frames reserved for the threads that map to this magazine, by size.
+  // Reserved frames have their buffer's refcount raised to 1, so nobody
+  // else will consider them free. Magazines are refilled from the registry
+  // in batches, so that a thread only needs to take memory_mutex once for
+  // every FRAME_MAGAZINE_BATCH allocations.
+  struct FrameMagazine
+  {
+    std::mutex mutex;
+    std::unordered_map<size_t, std::vector<VideoFrame*> > frames;
+  };
+  enum { FRAME_MAGAZINE_COUNT = 16, FRAME_MAGAZINE_BATCH = 4 };
+
+  // A cache that EnsureMemoryLimit may take frames from
+  struct EvictionCandidate
+  {
+    Cache* cache;
+    int size;             // Number of frames in the cache
+    size_t frame_bytes;   // Size of one of its frames
+    double cost_per_byte; // Seconds it takes to regenerate one byte of its frames
+
+    bool operator<(const EvictionCandidate& other) const
+    {
+      return cost_per_byte < other.cost_per_byte;
+    }
+  };
+
   typedef mapped_list<Cache*> CacheRegistryType;
   FrameRegistryType FrameRegistry;
+  FrameMagazine FrameMagazines[FRAME_MAGAZINE_COUNT];
   CacheRegistryType CacheRegistry;
   Cache* FrontCache;
   VideoFrame* GetNewFrame(size_t vfb_size);
   VideoFrame* AllocateFrame(size_t vfb_size);
+  size_t ReserveFreeFrames(FrameSizeClass* size_class, VideoFrame** frames, size_t max_frames);
+  void DrainFrameMagazines();
+  void FreeUnusedFrames();
   std::mutex memory_mutex;
 
+  // Caches that the memory governor shrank while holding memory_mutex. Their
+  // evicted frames are compressed by SpillPendingCaches() after it is released.
+  std::vector<Cache*> SpillPending;       // Guarded by memory_mutex
+  std::atomic<bool> SpillRequested;
+  std::mutex spill_mutex;                 // Held while spilling, so that the caches stay alive
+  void SpillPendingCaches();
+
   BufferPool BufferPool;
+  CompressedFrameCache CompressedCache;
+  FilterProfiler Profiler;
+  FrameTracer Tracer;
+  std::string TracePath;    // Where the trace is written at teardown, empty if not tracing
+  std::string AccessLogPath;  // Where the requests to the main script are logged, empty if not
 
   MTMapState MTMap;
   typedef std::vector<MTGuard*> MTGuardRegistryType;
   MTGuardRegistryType MTGuardRegistry;
-  Prefetcher *prefetcher;
+
+  // Set by the first prefetcher and shared by all prefetch points of the script.
+  // Zero until then.
+  size_t PrefetchThreads;
+  size_t PrefetchShards;
 };
 
 
@@ -646,7 +724,7 @@ static unsigned __int64 ConstrainMemoryRequest(unsigned __int64 requested)
 
 IJobCompletion* __stdcall ScriptEnvironment::NewCompletion(size_t capacity)
 {
-  return new JobCompletion(capacity);
+  return new JobCompletion(capacity, &thread_pool);
 }
 
 ScriptEnvironment::ScriptEnvironment()
@@ -659,8 +737,14 @@ ScriptEnvironment::ScriptEnvironment()
     PlanarChromaAlignmentState(true),   // Change to "true" for 2.5.7
     ImportDepth(0),
     thread_pool(NULL),
-    prefetcher(NULL),
+    PrefetchThreads(0),
+    PrefetchShards(1),
+    CPUFlagsMask(~0),
+    CacheElision(true),
+    CachesElided(false),
+    CachesCreated(0),
     FrontCache(NULL),
+    SpillRequested(false),
     BufferPool(this)
 {
   try {
@@ -682,6 +766,8 @@ ScriptEnvironment::ScriptEnvironment()
     memory_max = ConstrainMemoryRequest(memstatus.ullTotalPhys / 4);
     memory_max = min(memory_max, 1024*1024*1024ull);  // at start, cap memory usage to 1GB
     memory_used = 0ull;
+    memory_peak = 0ull;
+    frame_copies = 0;
 
     global_var_table = new VarTable(0, 0);
     var_table = new VarTable(0, global_var_table);
@@ -698,6 +784,7 @@ ScriptEnvironment::ScriptEnvironment()
     global_var_table->Set("MT_NICE_FILTER",     (int)MT_NICE_FILTER);
     global_var_table->Set("MT_MULTI_INSTANCE",  (int)MT_MULTI_INSTANCE);
     global_var_table->Set("MT_SERIALIZED",      (int)MT_SERIALIZED);
+    global_var_table->Set("MT_SERIALIZED_ORDERED", (int)MT_SERIALIZED_ORDERED);
 
     plugin_manager = new PluginManager(this);
     plugin_manager->AddAutoloadDir("USER_PLUS_PLUGINS", false);
@@ -705,7 +792,7 @@ ScriptEnvironment::ScriptEnvironment()
     plugin_manager->AddAutoloadDir("USER_CLASSIC_PLUGINS", false);
     plugin_manager->AddAutoloadDir("MACHINE_CLASSIC_PLUGINS", false);
 
-    thread_pool = new ThreadPool(std::thread::hardware_concurrency());
+    thread_pool = new ThreadPool(std::thread::hardware_concurrency(), &Tracer);
 
     ExportBuiltinFilters();
   }
@@ -724,11 +811,18 @@ ScriptEnvironment::~ScriptEnvironment() {
 
   closing = true;
 
+  // All frames have been delivered, so the numbers are final
+  Profiler.Dump();
+
   // Before we start to pull the world apart
   // give every one their last wish.
   at_exit.Execute(this);
 
-  delete thread_pool;
+  delete thread_pool.load();
+
+  // No other thread records events any more
+  if (!TracePath.empty())
+    Tracer.Export(TracePath.c_str());
 
   while (var_table)
     PopContext();
@@ -736,19 +830,25 @@ ScriptEnvironment::~ScriptEnvironment() {
   while (global_var_table)
     PopContextGlobal();
 
+  DrainFrameMagazines();
+
   const FrameRegistryType::iterator end_it = FrameRegistry.end();
   for (
     FrameRegistryType::iterator it = FrameRegistry.begin();
     it != end_it;
     ++it)
   {
-    VideoFrame *frame = it->second;
-    assert(frame->refcount == 0);
+    std::vector<VideoFrame*>& frames = it->second.frames;
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+      VideoFrame *frame = frames[i];
+      assert(frame->refcount == 0);
 
-    if (frame->vfb->refcount == 0)
-      delete frame->vfb;
+      if (frame->vfb->refcount == 0)
+        delete frame->vfb;
 
-    delete frame;
+      delete frame;
+    }
   }
 
   delete plugin_manager;
@@ -764,20 +864,42 @@ ScriptEnvironment::~ScriptEnvironment() {
 
 void __stdcall ScriptEnvironment::SetPrefetcher(Prefetcher *p)
 {
-  if (prefetcher != NULL)
-    throw AvisynthError("Only a single prefetcher is allowed per script.");
-
-  // Make this the active prefetcher
-  prefetcher = p;
+  // Further prefetch points share the workers of the first one.
+  // Prefetcher::Create has already limited them to that budget.
+  if (PrefetchThreads > 0)
+    return;
+
+  PrefetchThreads = p->NumPrefetchThreads();
+  PrefetchShards = p->NumCacheShards();
+
+  // The prefetchers run their jobs on our pool, so the pool's worker count
+  // becomes the thread budget of the whole process. It also has to match
+  // the thread ids the MTGuards are sized for below.
+  // Completions look the pool up on every wait, so none of them keeps
+  // using the old one after it is deleted. Its queued jobs still run.
+  if (thread_pool.load()->NumThreads() != PrefetchThreads)
+  {
+    ThreadPool* old_pool = thread_pool.exchange(new ThreadPool(PrefetchThreads, &Tracer));
+    delete old_pool;
+  }
 
   // Since this method basically enables MT operation,
   // upgrade all MTGuards to MT-mode.
-  size_t nTotalThreads = 1 + p->NumPrefetchThreads();
+  // Guards created later are upgraded when they register.
+  size_t nTotalThreads = 1 + PrefetchThreads;
   for (MTGuard* guard : MTGuardRegistry)
   {
     if (guard != NULL)
       guard->EnableMT(nTotalThreads);
   }
+
+  // Likewise, partition the frame caches so that
+  // the prefetch threads don't contend on a single lock.
+  size_t nShards = PrefetchShards;
+  if (FrontCache != NULL)
+    FrontCache->SetShards(nShards);
+  for (Cache* cache : CacheRegistry)
+    cache->SetShards(nShards);
 }
 
 void __stdcall ScriptEnvironment::AdjustMemoryConsumption(size_t amount, bool minus)
@@ -785,12 +907,30 @@ void __stdcall ScriptEnvironment::AdjustMemoryConsumption(size_t amount, bool mi
   if (minus)
     memory_used -= amount;
   else
-    memory_used += amount;
+    AddMemoryUsed(amount);
+}
+
+void ScriptEnvironment::AddMemoryUsed(size_t amount)
+{
+  const unsigned __int64 used = (memory_used += amount);
+  unsigned __int64 peak = memory_peak;
+  while ((used > peak) && !memory_peak.compare_exchange_weak(peak, used))
+  {}
 }
 
 void __stdcall ScriptEnvironment::ParallelJob(ThreadWorkerFuncPtr jobFunc, void* jobData, IJobCompletion* completion)
 {
-  thread_pool->QueueJob(jobFunc, jobData, this, static_cast<JobCompletion*>(completion));
+  thread_pool.load()->QueueJob(jobFunc, jobData, this, static_cast<JobCompletion*>(completion));
+}
+
+IFrameRequest* __stdcall ScriptEnvironment::GetFrameAsync(const PClip& clip, int n, FrameReadyCallback callback, void* user_data)
+{
+  // The host keeps calling GetFrame directly, and without Prefetch() nothing
+  // guards the filters against that running next to a pool thread
+  if (PrefetchThreads == 0)
+    ThrowError("GetFrameAsync: The script must call Prefetch() first.");
+
+  return AsyncFrameRequest::Submit(clip, n, callback, user_data, this);
 }
 
 void __stdcall ScriptEnvironment::SetFilterMTMode(const char* filter, MtMode mode, bool force)
@@ -860,7 +1000,7 @@ size_t  __stdcall ScriptEnvironment::GetProperty(AvsEnvProperty prop)
   switch(prop)
   {
   case AEP_FILTERCHAIN_THREADS:
-    return (prefetcher != NULL) ? prefetcher->NumPrefetchThreads()+1 : 1;
+    return PrefetchThreads+1;
   case AEP_PHYSICAL_CPUS:
     return GetNumPhysicalCPUs();
   case AEP_LOGICAL_CPUS:
@@ -868,9 +1008,26 @@ size_t  __stdcall ScriptEnvironment::GetProperty(AvsEnvProperty prop)
   case AEP_THREAD_ID:
     return 0;
   case AEP_THREADPOOL_THREADS:
-    return thread_pool->NumThreads();
+    return thread_pool.load()->NumThreads();
   case AEP_VERSION:
     return AVS_SEQREV;
+  case AEP_MEMORY_USED:
+    return (size_t)memory_used;
+  case AEP_MEMORY_PEAK:
+    return (size_t)memory_peak;
+  case AEP_FRAME_COPIES:
+    return frame_copies;
+  case AEP_CACHES_ELIDED:
+  {
+    std::unique_lock<std::mutex> env_lock(memory_mutex);
+    size_t elided = ((FrontCache != NULL) && FrontCache->IsElided()) ? 1 : 0;
+    for (Cache* cache : CacheRegistry)
+    {
+      if (cache->IsElided())
+        ++elided;
+    }
+    return elided;
+  }
   default:
     this->ThrowError("Invalid property request.");
     return std::numeric_limits<size_t>::max();
@@ -931,7 +1088,7 @@ void ScriptEnvironment::CheckVersion(int version) {
     ThrowError("Plugin was designed for a later version of Avisynth (%d)", version);
 }
 
-int ScriptEnvironment::GetCPUFlags() { return ::GetCPUFlags(); }
+int ScriptEnvironment::GetCPUFlags() { return ::GetCPUFlags() & CPUFlagsMask; }
 
 void ScriptEnvironment::AddFunction(const char* name, const char* params, ApplyFunc apply, void* user_data) {
   this->AddFunction(name, params, apply, user_data, NULL);
@@ -1040,78 +1197,156 @@ VideoFrame* ScriptEnvironment::AllocateFrame(size_t vfb_size)
     return NULL;
   }
 
-  memory_used+=vfb_size;
+  AddMemoryUsed(vfb_size);
 
-  FrameRegistry.insert(FrameRegistryType::value_type(vfb_size, newFrame));
+  FrameRegistry[vfb_size].frames.push_back(newFrame);
 
   return newFrame;
 }
 
-VideoFrame* ScriptEnvironment::GetNewFrame(size_t vfb_size)
+size_t ScriptEnvironment::ReserveFreeFrames(FrameSizeClass* size_class, VideoFrame** frames, size_t max_frames)
 {
-  std::unique_lock<std::mutex> env_lock(memory_mutex);
+  // Must be called with memory_mutex held
 
-  /* -----------------------------------------------------------
-   *   Try to return an unused but already allocated instance
-   * -----------------------------------------------------------
-   */
-  for (
-    FrameRegistryType::iterator it = FrameRegistry.lower_bound(vfb_size), end_it = FrameRegistry.end();
-    it != end_it;
-  ++it)
+  std::vector<VideoFrame*>& candidates = size_class->frames;
+  const size_t nCandidates = candidates.size();
+  size_t nFound = 0;
+  for (size_t i = 0; (i < nCandidates) && (nFound < max_frames); ++i)
   {
-    VideoFrame *frame = it->second;
-    assert((size_t)frame->vfb->GetDataSize() >= vfb_size);
+    size_t& clock = size_class->clock;
+    if (clock >= nCandidates)
+      clock = 0;
+
+    VideoFrame *frame = candidates[clock];
+    ++clock;
 
     if ( (frame->refcount == 0)        // Nobody is using the frame
       && (frame->vfb->refcount == 0))  // And only this frame is using its vfb
     {
       InterlockedIncrement(&(frame->vfb->refcount));
-      return frame;
-      break;
+      frames[nFound++] = frame;
     }
   }
 
+  return nFound;
+}
 
-  /* -----------------------------------------------------------
-   *   No unused instance was found, try to allocate a new one
-   * -----------------------------------------------------------
-   */
-  VideoFrame* frame = AllocateFrame(vfb_size);
-  if ( frame != NULL)
-    return frame;
+void ScriptEnvironment::DrainFrameMagazines()
+{
+  // Return all frames reserved in magazines, so that they can be reused or freed.
+  for (size_t m = 0; m < FRAME_MAGAZINE_COUNT; ++m)
+  {
+    FrameMagazine& magazine = FrameMagazines[m];
+    std::lock_guard<std::mutex> magazine_lock(magazine.mutex);
+    for (auto& size_frames : magazine.frames)
+    {
+      for (VideoFrame* frame : size_frames.second)
+        InterlockedDecrement(&(frame->vfb->refcount));
+      size_frames.second.clear();
+    }
+  }
+}
 
+void ScriptEnvironment::FreeUnusedFrames()
+{
+  // Must be called with memory_mutex held
 
-  /* -----------------------------------------------------------
-   * Couldn't allocate, try to free up unused frames of any size
-   * -----------------------------------------------------------
-   */
   for (
       FrameRegistryType::iterator it = FrameRegistry.begin(), end_it = FrameRegistry.end();
-      (it != end_it) && (size_t(it->second->vfb->data_size) < vfb_size);
+      it != end_it;
       )
   {
-    VideoFrame *frame = it->second;
-    assert((size_t)frame->vfb->GetDataSize() < vfb_size);
-
-    if (frame->refcount == 0)
+    std::vector<VideoFrame*>& frames = it->second.frames;
+    for (size_t i = 0; i < frames.size(); )
     {
-      if (frame->vfb->refcount == 0)
+      VideoFrame *frame = frames[i];
+
+      // A frame whose buffer is still referenced is either shared by a live
+      // subframe, or was taken from a magazine and is about to be handed out
+      // without memory_mutex. Either way it is not ours to delete.
+      if ((frame->refcount == 0) && (frame->vfb->refcount == 0))
       {
         memory_used -= frame->vfb->GetDataSize();
         delete frame->vfb;
+        delete frame;
+        frames[i] = frames.back();
+        frames.pop_back();
+      }
+      else
+      {
+        ++i;
       }
+    }
 
-      delete frame;
+    if (frames.empty())
       FrameRegistry.erase(it++);
-    }
     else
-    {
       ++it;
+  }
+}
+
+VideoFrame* ScriptEnvironment::GetNewFrame(size_t vfb_size)
+{
+  TraceScope trace(&Tracer, "NewVideoFrame", "memory", vfb_size);
+
+  /* -----------------------------------------------------------
+   *   Try to take a frame reserved for this thread
+   * -----------------------------------------------------------
+   */
+  FrameMagazine& magazine = FrameMagazines[std::hash<std::thread::id>()(std::this_thread::get_id()) % FRAME_MAGAZINE_COUNT];
+  {
+    std::lock_guard<std::mutex> magazine_lock(magazine.mutex);
+    std::vector<VideoFrame*>& reserved = magazine.frames[vfb_size];
+    if (!reserved.empty())
+    {
+      VideoFrame *frame = reserved.back();
+      reserved.pop_back();
+      return frame;
+    }
+  }
+
+  std::unique_lock<std::mutex> env_lock(memory_mutex);
+
+  /* -----------------------------------------------------------
+   *   Try to return an unused but already allocated instance,
+   *   and refill the magazine while we are at it
+   * -----------------------------------------------------------
+   */
+  FrameRegistryType::iterator size_it = FrameRegistry.find(vfb_size);
+  if (size_it != FrameRegistry.end())
+  {
+    VideoFrame* found[FRAME_MAGAZINE_BATCH];
+    size_t nFound = ReserveFreeFrames(&(size_it->second), found, FRAME_MAGAZINE_BATCH);
+    if (nFound > 0)
+    {
+      if (nFound > 1)
+      {
+        std::lock_guard<std::mutex> magazine_lock(magazine.mutex);
+        std::vector<VideoFrame*>& reserved = magazine.frames[vfb_size];
+        reserved.insert(reserved.end(), found+1, found+nFound);
+      }
+      return found[0];
     }
   }
 
 
+  /* -----------------------------------------------------------
+   *   No unused instance was found, try to allocate a new one
+   * -----------------------------------------------------------
+   */
+  VideoFrame* frame = AllocateFrame(vfb_size);
+  if ( frame != NULL)
+    return frame;
+
+
+  /* -----------------------------------------------------------
+   * Couldn't allocate, try to free up unused frames of any size
+   * -----------------------------------------------------------
+   */
+  DrainFrameMagazines();
+  FreeUnusedFrames();
+
+
   /* -----------------------------------------------------------
    *   Try to allocate again
    * -----------------------------------------------------------
@@ -1129,65 +1364,110 @@ VideoFrame* ScriptEnvironment::GetNewFrame(size_t vfb_size)
   return NULL;
 }
 
+void ScriptEnvironment::SpillPendingCaches()
+{
+  // Another thread is at it already and will see our caches next time
+  std::unique_lock<std::mutex> spill_lock(spill_mutex, std::try_to_lock);
+  if (!spill_lock.owns_lock())
+    return;
+
+  std::vector<Cache*> caches;
+  {
+    std::lock_guard<std::mutex> env_lock(memory_mutex);
+    caches.swap(SpillPending);
+    SpillRequested = false;
+  }
+
+  // A cache may be listed more than once, spilling it again does nothing
+  for (size_t i = 0; i < caches.size(); ++i)
+    caches[i]->SpillEvicted();
+}
+
 void ScriptEnvironment::EnsureMemoryLimit(size_t request)
 {
+  // Must be called with memory_mutex held
 
   /* -----------------------------------------------------------
    *             Ensure SetMemoryMax limit is kept
    * -----------------------------------------------------------
    */
 
-  // We reserve 15% for unaccounted stuff
-  size_t memory_need = size_t((memory_used + request) / 0.85f);
-
-  const CacheRegistryType::iterator end_cit = CacheRegistry.end();
-  for (
-        CacheRegistryType::iterator cit = CacheRegistry.begin();
-        (memory_need > memory_max) && (cit != end_cit);
-        ++cit
-      )
+  // We reserve 15% for unaccounted stuff. Frames in the compressed tier
+  // count against the same limit.
+  size_t memory_need = size_t((memory_used + CompressedCache.GetUsedBytes() + request) / 0.85f);
+  if (memory_need <= memory_max)
+    return;
+
+  // Frames sitting in magazines cannot be freed, give them back first
+  DrainFrameMagazines();
+  FreeUnusedFrames();
+  memory_need = size_t((memory_used + CompressedCache.GetUsedBytes() + request) / 0.85f);
+  if (memory_need <= memory_max)
+    return;
+
+  // Frames in the compressed tier have already been evicted once, so they go next
+  const size_t compressed_bytes = CompressedCache.GetUsedBytes();
+  if (compressed_bytes > 0)
   {
-    // Oh darn. We'd need more memory than we are allowed to use.
-    // Let's reduce the amount of caching.
-    
-    // We try to shrink least recently used caches first.
+    const size_t compressed_excess = size_t((memory_need - memory_max) * 0.85f) + 1;
+    CompressedCache.Shrink((compressed_bytes > compressed_excess) ? compressed_bytes - compressed_excess : 0);
+    memory_need = size_t((memory_used + CompressedCache.GetUsedBytes() + request) / 0.85f);
+    if (memory_need <= memory_max)
+      return;
+  }
 
-    Cache* cache = *cit;
-    int cache_size = cache->SetCacheHints(CACHE_GET_SIZE, 0);
-    if (cache_size != 0)
-    {
-      cache->SetCacheHints(CACHE_SET_MAX_CAPACITY, cache_size-1);
-
-      /* -----------------------------------------------------------
-       * Try to free up memory that we've just released from a cache
-       * -----------------------------------------------------------
-       */
-      const FrameRegistryType::iterator end_fit = FrameRegistry.end();
-      for (
-          FrameRegistryType::iterator fit = FrameRegistry.begin();
-          fit != end_fit;
-          )
-      {
-        VideoFrame *frame = fit->second;
+  // Oh darn. We'd need more memory than we are allowed to use.
+  // Let's reduce the amount of caching.
 
-        if (frame->refcount == 0)
-        {
-          if (frame->vfb->refcount == 0)
-          {
-            memory_used -= frame->vfb->GetDataSize();
-            delete frame->vfb;
-          }
+  // Frames that are the cheapest to regenerate for every byte they occupy
+  // are evicted first. Caches are visited least recently used first, and
+  // the stable sort keeps that order between caches of equal cost.
+  std::vector<EvictionCandidate> candidates;
+  candidates.reserve(CacheRegistry.size());
+  for (Cache* cache : CacheRegistry)
+  {
+    int cache_size = cache->SetCacheHints(CACHE_GET_SIZE, 0);
+    if (cache_size == 0)
+      continue;
+
+    EvictionCandidate c;
+    c.cache = cache;
+    c.size = cache_size;
+    cache->GetFrameCost(&c.cost_per_byte, &c.frame_bytes);
+    if (c.frame_bytes == 0)
+      continue;
+    c.cost_per_byte /= c.frame_bytes;
+    candidates.push_back(c);
+  }
+  std::stable_sort(candidates.begin(), candidates.end());
 
-          delete frame;
-          FrameRegistry.erase(fit++);
-        }
-        else
-        {
-          ++fit;
-        }
-      } // for fit
-    } // if
-  } // for cit
+  // A shrink evicts frames, but pinned, locked and in-flight frames stay
+  // alive, so the usage is measured again after every cache and the next
+  // one only has to make up for what is still missing.
+  for (size_t i = 0; (i < candidates.size()) && (memory_need > memory_max); ++i)
+  {
+    const EvictionCandidate& c = candidates[i];
+    const size_t excess = size_t((memory_need - memory_max) * 0.85f) + 1;
+    const int drop = (int)min((size_t)c.size, (excess + c.frame_bytes - 1) / c.frame_bytes);
+    c.cache->SetCacheHints(CACHE_SET_MAX_CAPACITY, c.size - drop);
+    FreeUnusedFrames();
+    memory_need = size_t((memory_used + CompressedCache.GetUsedBytes() + request) / 0.85f);
+
+    // Frames evicted to the compressed tier are only released once
+    // SpillPendingCaches() has compressed them, which cannot happen while
+    // memory_mutex is held. If their memory is needed now they are dropped.
+    if (memory_need <= memory_max)
+    {
+      SpillPending.push_back(c.cache);
+    }
+    else if (c.cache->DropSpilled())
+    {
+      FreeUnusedFrames();
+      memory_need = size_t((memory_used + CompressedCache.GetUsedBytes() + request) / 0.85f);
+    }
+  }
+  if (!SpillPending.empty())
+    SpillRequested = true;
 }
 
 PVideoFrame ScriptEnvironment::NewPlanarVideoFrame(int row_size, int height, int row_sizeUV, int heightUV, int align, bool U_first)
@@ -1217,6 +1497,8 @@ PVideoFrame ScriptEnvironment::NewPlanarVideoFrame(int row_size, int height, int
   size = size + align -1;
 
   VideoFrame *res = GetNewFrame(size);
+  if (SpillRequested)
+    SpillPendingCaches();
 
   int  offsetU, offsetV;
   const int offsetY = AlignPointer(res->vfb->GetWritePtr(), align) - res->vfb->GetWritePtr(); // first line offset for proper alignment
@@ -1259,6 +1541,8 @@ PVideoFrame ScriptEnvironment::NewVideoFrame(int row_size, int height, int align
   size = size + align - 1;
 
   VideoFrame *res = GetNewFrame(size);
+  if (SpillRequested)
+    SpillPendingCaches();
 
   const int offset = AlignPointer(res->vfb->GetWritePtr(), align) - res->vfb->GetWritePtr(); // first line offset for proper alignment
 
@@ -1350,6 +1634,7 @@ bool ScriptEnvironment::MakeWritable(PVideoFrame* pvf) {
          vf->GetPitch(PLANAR_U), vf->GetRowSize(PLANAR_U), vf->GetHeight(PLANAR_U));
 
   *pvf = dst;
+  ++frame_copies;
   return true;
 }
 
@@ -1402,15 +1687,23 @@ void* ScriptEnvironment::ManageCache(int key, void* data) {
   case MC_RegisterCache:
   {
     Cache* cache = reinterpret_cast<Cache*>(data);
+    cache->SetSerial(CachesCreated++);
     if (FrontCache != NULL)
       CacheRegistry.push_back(FrontCache);     
     FrontCache = cache;
+    if (PrefetchShards > 1)
+      cache->SetShards(PrefetchShards);
     break;
   }
   // Called by Cache instances upon destruction
   case MC_UnRegisterCache:
   {
     Cache* cache = reinterpret_cast<Cache*>(data);
+    {
+      std::lock_guard<std::mutex> spill_lock(spill_mutex);
+      std::lock_guard<std::mutex> env_lock(memory_mutex);
+      SpillPending.erase(std::remove(SpillPending.begin(), SpillPending.end(), cache), SpillPending.end());
+    }
     if (FrontCache == cache)
       FrontCache = NULL;
     else
@@ -1449,6 +1742,8 @@ void* ScriptEnvironment::ManageCache(int key, void* data) {
         if (osize != 0)
         {
           old_cache->SetCacheHints(CACHE_SET_MAX_CAPACITY, osize-1);
+          SpillPending.push_back(old_cache);
+          SpillRequested = true;
           break;
         }
       } // for cit
@@ -1473,6 +1768,10 @@ void* ScriptEnvironment::ManageCache(int key, void* data) {
   {
     MTGuard* guard = reinterpret_cast<MTGuard*>(data);
     MTGuardRegistry.push_back(guard);
+
+    // Filters placed after a prefetch point can be called from its workers
+    if (PrefetchThreads > 0)
+      guard->EnableMT(1 + PrefetchThreads);
     break;
   }
   case MC_UnRegisterMTGuard:
@@ -1488,6 +1787,108 @@ void* ScriptEnvironment::ManageCache(int key, void* data) {
     }
     break;
   }
+  // Called by Cache instances upon creation
+  case MC_GetCompressedCache:
+  {
+    return reinterpret_cast<void*>(&CompressedCache);
+  }
+  // Called by SetCacheCompression(). Sets the budget of the compressed
+  // tier in megabytes if positive, disables it if negative,
+  // and returns the current setting.
+  case MC_SetCompressedCacheMax:
+  {
+    const int mb = (int)reinterpret_cast<intptr_t>(data);
+    if (mb > 0)
+      CompressedCache.SetMaxBytes((size_t)ConstrainMemoryRequest(mb * 1048576ull));
+    else if (mb < 0)
+      CompressedCache.SetMaxBytes(0);
+    return reinterpret_cast<void*>(CompressedCache.GetMaxBytes() / 1048576);
+  }
+  // Called by SetFilterProfiling(). Filters created from then on are profiled.
+  case MC_SetProfiling:
+  {
+    Profiler.SetEnabled(data != NULL);
+    break;
+  }
+  case MC_SetProfileLog:
+  {
+    Profiler.SetLogPath(reinterpret_cast<const char*>(data));
+    break;
+  }
+  // Called by FilterProfile()
+  case MC_GetProfileReport:
+  {
+    return SaveString(Profiler.Report().c_str());
+  }
+  // Called by ProfileScope. Threads of the pool answer this themselves.
+  case MC_GetProfileStack:
+  {
+    return reinterpret_cast<void*>(Profiler.GetThreadStack());
+  }
+  // Called by SetFrameTracing() with the file to write the trace to,
+  // or NULL to stop recording
+  case MC_SetTracing:
+  {
+    const char* path = reinterpret_cast<const char*>(data);
+    TracePath = (path != NULL) ? path : "";
+    Tracer.SetEnabled(!TracePath.empty());
+    break;
+  }
+  // Called by SetAccessLog(), and by Import() to find out whether to log
+  case MC_SetAccessLog:
+  {
+    const char* path = reinterpret_cast<const char*>(data);
+    AccessLogPath = (path != NULL) ? path : "";
+    break;
+  }
+  case MC_GetAccessLog:
+  {
+    return AccessLogPath.empty() ? NULL : const_cast<char*>(AccessLogPath.c_str());
+  }
+  // Called by SetMaxCPU() with the flags that filters may still see
+  case MC_SetCPUFlagsMask:
+  {
+    CPUFlagsMask = (int)reinterpret_cast<intptr_t>(data);
+    return reinterpret_cast<void*>((intptr_t)GetCPUFlags());
+  }
+  // Called by SetCacheElision()
+  case MC_SetCacheElision:
+  {
+    CacheElision = (data != NULL);
+    break;
+  }
+  // Called by Import() before it loads the main script. Returns the serial
+  // number the first cache of the script will get.
+  case MC_MarkCaches:
+  {
+    return reinterpret_cast<void*>(CachesCreated);
+  }
+  // Called by Import() once the main script is loaded, with what
+  // MC_MarkCaches returned. Caches of the script whose frames only one other
+  // filter asks for, and only once, store nothing. Only the first script
+  // gets this, since the Imports of runtime scripts run while frames are
+  // served. Returns the number of elided caches.
+  case MC_ElideCaches:
+  {
+    if (!CacheElision || CachesElided)
+      return 0;
+    CachesElided = true;
+
+    const size_t first = reinterpret_cast<size_t>(data);
+    std::unique_lock<std::mutex> env_lock(memory_mutex);
+    size_t elided = ((FrontCache != NULL) && (FrontCache->GetSerial() >= first) && FrontCache->Elide()) ? 1 : 0;
+    for (Cache* cache : CacheRegistry)
+    {
+      if ((cache->GetSerial() >= first) && cache->Elide())
+        ++elided;
+    }
+    return reinterpret_cast<void*>(elided);
+  }
+  // Called by Cache and MTGuard instances upon creation
+  case MC_GetTracer:
+  {
+    return reinterpret_cast<void*>(&Tracer);
+  }
   } // switch
   return 0;
 }
@@ -1535,6 +1936,43 @@ static size_t Flatten(const AVSValue& src, AVSValue* dst, size_t index, const ch
   return index;
 }
 
+// Appends the clips among the (possibly nested) arguments in 'src' to 'clips'
+static void CollectClips(const AVSValue& src, std::vector<PClip>* clips)
+{
+  if (src.IsArray()) {
+    const int array_size = src.ArraySize();
+    for (int i=0; i<array_size; ++i)
+      CollectClips(src[i], clips);
+  } else if (src.IsClip()) {
+    clips->push_back(src.AsClip());
+  }
+}
+
+// Tells the caches among the inputs of a filter that it takes frames from them.
+// A filter that returned one of its inputs takes nothing. The graph built this
+// way lets Import() find the caches that do not need to store frames.
+static void CountConsumers(const std::vector<PClip>& inputs, const PClip& output)
+{
+  for (size_t i = 0; i < inputs.size(); ++i)
+  {
+    if (inputs[i].operator->() == output.operator->())
+      return;
+  }
+
+  // Frames a filter declares as dependencies are prefetched into our caches
+  const bool keep_frames = (GetFrameDependencyInterface(output) != NULL);
+  for (size_t i = 0; i < inputs.size(); ++i)
+  {
+    Cache* cache = dynamic_cast<Cache*>(inputs[i].operator->());
+    if (cache == NULL)
+      continue;
+
+    cache->AddConsumer();
+    if (keep_frames)
+      cache->KeepFrames();
+  }
+}
+
 const AVSFunction* ScriptEnvironment::Lookup(const char* search_name, const AVSValue* args, size_t num_args,
                     bool &pstrict, size_t args_names_count, const char* const* arg_names)
 {
@@ -1690,8 +2128,30 @@ success:;
   }
   else
   {
-    *result = Cache::Create(MTGuard::Create(f, &args2, &args3, this), NULL, this);
+    std::vector<PClip> inputs;
+    CollectClips(AVSValue(args3.data(), (int)args3.size()), &inputs);
+
+    AVSValue guarded = MTGuard::Create(f, &args2, &args3, this);
     // args2 and args3 are not valid after this point anymore
+    *result = Cache::Create(guarded, NULL, this);
+
+    if (result->IsClip())
+      CountConsumers(inputs, result->AsClip());
+
+    // Label the cache that was created for this filter. A filter that
+    // returned one of its inputs, or does not want a cache, has none.
+    if (result->IsClip() && (result->AsClip().operator->() != guarded.AsClip().operator->()))
+    {
+      Cache* cache = static_cast<Cache*>(result->AsClip().operator->());
+      cache->SetName(f->name);
+      if (Profiler.IsEnabled())
+      {
+        FilterProfile* profile = Profiler.AddProfile(f->name);
+        cache->SetProfile(profile);
+        if (MTGuard::IsMTGuard(guarded.AsClip()))
+          static_cast<MTGuard*>(guarded.AsClip().operator->())->SetProfile(profile);
+      }
+    }
   }
   
   return true;
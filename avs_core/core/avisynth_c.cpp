@@ -12,6 +12,7 @@
 #include <avs/win.h>
 #include <algorithm>
 #include <cstdarg>
+#include <atomic>
 
 
 struct AVS_Clip 
@@ -22,6 +23,16 @@ struct AVS_Clip
 	AVS_Clip() : env(0), error(0) {}
 };
 
+struct AVS_FrameRequest
+{
+	// Also stored by the callback, which can run before avs_get_frame_async returns
+	std::atomic<IFrameRequest *> request;
+	AVS_FrameReadyCallback callback;
+	void * user_data;
+	const char * error;
+	AVS_FrameRequest() : request(0), callback(0), user_data(0), error(0) {}
+};
+
 class C_VideoFilter : public IClip {
 public: // but don't use
 	AVS_Clip child;
@@ -177,6 +188,71 @@ AVS_VideoFrame * AVSC_CC avs_get_frame(AVS_Clip * p, int n)
 	} 
 }
 
+static void __stdcall avs_frame_ready(IFrameRequest * request, void * user_data)
+{
+	AVS_FrameRequest * r = (AVS_FrameRequest *)user_data;
+	r->request = request;
+	r->callback(r, r->user_data);
+}
+
+extern "C"
+AVS_FrameRequest * AVSC_CC avs_get_frame_async(AVS_Clip * p, int n, AVS_FrameReadyCallback callback, void * user_data)
+{
+	p->error = 0;
+	AVS_FrameRequest * r = new AVS_FrameRequest;
+	r->callback = callback;
+	r->user_data = user_data;
+	try {
+		IScriptEnvironment2 * env2 = static_cast<IScriptEnvironment2 *>(p->env);
+		r->request = env2->GetFrameAsync(p->clip, n, callback ? avs_frame_ready : 0, r);
+		return r;
+	} catch (const AvisynthError &err) {
+		p->error = err.msg;
+		delete r;
+		return 0;
+	}
+}
+
+extern "C"
+int AVSC_CC avs_frame_request_is_ready(AVS_FrameRequest * r)
+{
+	return r->request.load()->IsReady();
+}
+
+extern "C"
+AVS_VideoFrame * AVSC_CC avs_frame_request_get_frame(AVS_FrameRequest * r)
+{
+	r->error = 0;
+	try {
+		PVideoFrame f0 = r->request.load()->GetResult();
+		AVS_VideoFrame * f;
+		new((PVideoFrame *)&f) PVideoFrame(f0);
+		return f;
+	} catch (const AvisynthError &err) {
+		r->error = err.msg;
+		return 0;
+	}
+}
+
+extern "C"
+const char * AVSC_CC avs_frame_request_get_error(AVS_FrameRequest * r) // return 0 if no error
+{
+	return r->error;
+}
+
+extern "C"
+int AVSC_CC avs_cancel_frame_request(AVS_FrameRequest * r)
+{
+	return r->request.load()->Cancel();
+}
+
+extern "C"
+void AVSC_CC avs_release_frame_request(AVS_FrameRequest * r)
+{
+	r->request.load()->Destroy();
+	delete r;
+}
+
 extern "C"
 int AVSC_CC avs_get_parity(AVS_Clip * p, int n) // return field parity if field_based, else parity of first field in frame
 {
@@ -34,14 +34,33 @@
 
 #include "cache.h"
 #include "internal.h"
-#include "LruCache.h"
+#include "ShardedLruCache.h"
+#include "CompressedFrameCache.h"
+#include "FilterProfiler.h"
+#include "FrameTracer.h"
 #include <cassert>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <vector>
 
 #ifdef X86_32
 #include <mmintrin.h>
 #endif
 
 
+// Auto mode turns the audio cache on after this many consecutive overlapping requests ...
+#define AUDIO_AUTO_ENABLE_OVERLAPS 2
+// ... and off again after this many consecutive requests that could not use it.
+#define AUDIO_AUTO_DISABLE_MISSES 64
+// Auto mode will not grow the audio cache beyond this many bytes.
+#define AUDIO_AUTO_MAX_BYTES (8*1024*1024)
+// Weight of the newest sample in the moving average of frame costs
+#define FRAME_COST_WEIGHT 0.125
+// An elided cache starts storing frames again when one of its last
+// this many requests is repeated
+#define ELISION_REUSE_HISTORY 8
+
 extern const AVSFunction Cache_filters[] = {
   { "Cache", "c", Cache::Create },
   { "InternalCache", "c", Cache::Create },
@@ -55,23 +74,418 @@ struct CachePimpl
   VideoInfo vi;
 
   // Video cache
-  std::shared_ptr<LruCache<size_t, PVideoFrame> > VideoCache;
+  typedef ShardedLruCache<size_t, PVideoFrame> VideoCacheType;
+  std::shared_ptr<VideoCacheType> VideoCache;
+  CachePolicyHint VideoPolicy;
+  int WindowSpan;     // Number of frames in the window of our consumer, 0 if none
+  std::atomic<int> PinnedFirst;   // Frames currently pinned, empty if PinnedFirst > PinnedLast
+  std::atomic<int> PinnedLast;
+  int GenericRange;   // Number of frames guaranteed to be cached by CACHE_GENERIC
+
+  // Moving averages of what it takes to regenerate a frame, used by
+  // the memory governor to decide which frames to evict first
+  double FrameCost;   // Seconds spent in child->GetFrame()
+  size_t FrameBytes;  // Size of the frame buffer
+
+  // Compressed tier, shared by all caches of the environment
+  CompressedFrameCache* ColdCache;
+  bool ColdEnabled;
+  size_t ColdHits;
+  size_t ColdStores;
+  unsigned __int64 ColdRawBytes;
+  unsigned __int64 ColdPackedBytes;
+  double ColdDecodeTime;  // Total seconds spent restoring frames
+
+  std::mutex StatsMutex;  // Guards the statistics above
+
+  // Counters of the filter behind us, NULL unless profiling
+  FilterProfile* Profile;
+
+  // Name of the filter behind us, for traces
+  const char* Name;
+  FrameTracer* Tracer;
+
+  // Elision: with a single consumer that does not look at a frame twice,
+  // storing frames only costs memory and makes MakeWritable() copy them
+  std::atomic<int> Consumers;     // Filters that were created with us as input
+  std::atomic<bool> KeepFrames;   // Set if a consumer needs frames to stay, e.g. to prefetch them
+  std::atomic<bool> Elided;       // Frames are passed through without being stored
+  std::atomic<bool> Served;       // Set by the first frame request; after that we are never elided
+  size_t Serial;                  // Order of creation in the environment, see MC_ElideCaches
+  int RecentFrames[ELISION_REUSE_HISTORY];  // Last frames passed through, to catch reuse
+  size_t RecentPos;
+  std::mutex ElisionMutex;        // Guards the two members above
 
   // Audio cache
+  // AudioCache is a ring buffer of MaxSampleCount samples. Sample s is always
+  // stored at ring position (s % MaxSampleCount), and the samples that are
+  // valid form the contiguous range [AudioCacheStart, AudioCacheStart+AudioCacheCount).
   CachePolicyHint AudioPolicy;
   char* AudioCache;
   size_t SampleSize;
   size_t MaxSampleCount;
+  __int64 AudioCacheStart;
+  size_t AudioCacheCount;
+  std::mutex AudioMutex;
+
+  // Used by auto mode to decide whether caching is worth it
+  __int64 LastAudioStart;
+  __int64 LastAudioEnd;
+  size_t AudioOverlaps;
+  size_t AudioMissStreak;
+
+  // Statistics
+  size_t AudioHits;
+  size_t AudioPartialHits;
+  size_t AudioMisses;
 
   CachePimpl(const PClip& _child) :
     child(_child),
     vi(_child->GetVideoInfo()),
-    VideoCache(std::make_shared<LruCache<size_t, PVideoFrame> >(0)),
-    AudioPolicy(CACHE_AUDIO),
+    VideoCache(std::make_shared<VideoCacheType>(0, 1)),
+    VideoPolicy(CACHE_GENERIC),
+    WindowSpan(0),
+    PinnedFirst(1),
+    PinnedLast(0),
+    GenericRange(0),
+    FrameCost(0),
+    FrameBytes(0),
+    ColdCache(NULL),
+    ColdEnabled(false),
+    ColdHits(0),
+    ColdStores(0),
+    ColdRawBytes(0),
+    ColdPackedBytes(0),
+    ColdDecodeTime(0),
+    Profile(NULL),
+    Name("Cache"),
+    Tracer(NULL),
+    Consumers(0),
+    KeepFrames(false),
+    Elided(false),
+    Served(false),
+    Serial(0),
+    RecentPos(0),
+    AudioPolicy(CACHE_AUDIO_NONE),
     AudioCache(NULL),
     SampleSize(0),
-    MaxSampleCount(0)
+    MaxSampleCount(0),
+    AudioCacheStart(0),
+    AudioCacheCount(0),
+    LastAudioStart(0),
+    LastAudioEnd(0),
+    AudioOverlaps(0),
+    AudioMissStreak(0),
+    AudioHits(0),
+    AudioPartialHits(0),
+    AudioMisses(0)
+  {
+    if (vi.HasAudio())
+      SampleSize = vi.BytesPerAudioSample();
+  }
+
+  ~CachePimpl()
+  {
+    free(AudioCache);
+  }
+
+  void CountLookup(int n, bool hit)
+  {
+    TraceInstant(Tracer, hit ? "Hit" : "Miss", "cache", n);
+    if (Profile == NULL)
+      return;
+    if (hit)
+      ++Profile->Hits;
+    else
+      ++Profile->Misses;
+  }
+
+  void UpdateFrameCost(double seconds, const PVideoFrame& frame)
+  {
+    if (!frame)
+      return;
+
+    const size_t bytes = (size_t)frame->GetFrameBuffer()->GetDataSize();
+
+    std::lock_guard<std::mutex> lock(StatsMutex);
+    if (FrameBytes == 0)
+    {
+      FrameCost = seconds;
+      FrameBytes = bytes;
+    }
+    else
+    {
+      FrameCost += (seconds - FrameCost) * FRAME_COST_WEIGHT;
+      FrameBytes = bytes;
+    }
+  }
+
+  // Frames passed through are timed like misses, so that consumers still
+  // see what our frames cost, see FrameScheduler
+  PVideoFrame FetchPassedThrough(int n, IScriptEnvironment* env)
+  {
+    const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    PVideoFrame frame = child->GetFrame(n, env);
+#ifdef X86_32
+    _mm_empty();
+#endif
+    const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    UpdateFrameCost(elapsed.count(), frame);
+    return frame;
+  }
+
+  // Returns whether frame n is to bypass the video cache. Turns the
+  // elision off if n was requested recently, so that it is stored from now on.
+  bool PassThrough(int n)
+  {
+    std::lock_guard<std::mutex> lock(ElisionMutex);
+    if (!Elided)
+      return false;
+
+    const size_t nRecent = min(RecentPos, (size_t)ELISION_REUSE_HISTORY);
+    for (size_t i = 0; i < nRecent; ++i)
+    {
+      if (RecentFrames[i] == n)
+      {
+        Elided = false;
+        return false;
+      }
+    }
+
+    RecentFrames[RecentPos % ELISION_REUSE_HISTORY] = n;
+    ++RecentPos;
+    return true;
+  }
+
+  // Replaces the video cache by an empty one with the same limits.
+  // Only safe while no frames are requested from us.
+  void ResetVideoCache(size_t nShards)
+  {
+    size_t min, max;
+    VideoCache->limits(&min, &max);
+    std::shared_ptr<VideoCacheType> NewCache = std::make_shared<VideoCacheType>(0, nShards);
+    NewCache->set_limits(min, max);
+    NewCache->set_policy(VideoCache->policy());
+    NewCache->set_spill(ColdEnabled);
+    VideoCache = NewCache;
+    UnpinWindow();
+  }
+
+  // Pins the frames within WindowSpan-1 of the requested ones. A consumer
+  // with a window of WindowSpan frames that contains the frame it asked for
+  // can only ask for frames that close to it, whichever edge of its window
+  // that frame is on. While [first, last] stays inside the pinned range the
+  // pin is left alone, so that the video cache is only locked and trimmed
+  // when the window actually has to move.
+  void SlideWindow(int first, int last)
   {
+    if (WindowSpan <= 0)
+      return;
+    if ((first >= PinnedFirst) && (last <= PinnedLast))
+      return;
+
+    const int radius = WindowSpan - 1;
+    const int center = first + (last - first) / 2;
+    const int pin_first = max(center - radius, 0);
+    const int pin_last = center + radius;
+    VideoCache->set_window(pin_first, pin_last);
+    PinnedFirst = pin_first;
+    PinnedLast = pin_last;
+  }
+
+  // Makes the next SlideWindow() pin a window again
+  void UnpinWindow()
+  {
+    PinnedFirst = 1;
+    PinnedLast = 0;
+  }
+
+  // Starts or stops handing evicted frames to the compressed tier,
+  // following whether the tier has been given a budget
+  void UpdateColdTier()
+  {
+    const bool enabled = (ColdCache != NULL) && (ColdCache->GetMaxBytes() > 0);
+    if (enabled != ColdEnabled)
+    {
+      ColdEnabled = enabled;
+      VideoCache->set_spill(enabled);
+    }
+  }
+
+  // Returns frame n from the compressed tier, or NULL if it isn't there
+  PVideoFrame FetchCold(const void* owner, int n, IScriptEnvironment* env)
+  {
+    if (!ColdEnabled)
+      return NULL;
+
+    const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    PVideoFrame frame = ColdCache->Fetch(owner, n, vi, env);
+    if (frame)
+    {
+      const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+      std::lock_guard<std::mutex> lock(StatsMutex);
+      ++ColdHits;
+      ColdDecodeTime += elapsed.count();
+    }
+    return frame;
+  }
+
+  // Moves frames that were evicted from the video cache to the compressed tier.
+  // Frames that are quicker to regenerate than to decompress are dropped.
+  void SpillEvicted(const void* owner)
+  {
+    if (!ColdEnabled)
+      return;
+
+    std::vector<std::pair<size_t, PVideoFrame> > evicted;
+    VideoCache->take_spilled(&evicted);
+    if (evicted.empty())
+      return;
+
+    {
+      std::lock_guard<std::mutex> lock(StatsMutex);
+      if ((ColdHits > 0) && (FrameCost < ColdDecodeTime / ColdHits))
+        return;
+    }
+
+    for (size_t i = 0; i < evicted.size(); ++i)
+    {
+      size_t raw_bytes, packed_bytes;
+      if (ColdCache->Store(owner, (int)evicted[i].first, evicted[i].second, vi, &raw_bytes, &packed_bytes))
+      {
+        std::lock_guard<std::mutex> lock(StatsMutex);
+        ++ColdStores;
+        ColdRawBytes += raw_bytes;
+        ColdPackedBytes += packed_bytes;
+      }
+    }
+  }
+
+  // Releases the frames waiting to be spilled without compressing them.
+  // Returns true if there were any.
+  bool DropSpilled()
+  {
+    std::vector<std::pair<size_t, PVideoFrame> > evicted;
+    VideoCache->take_spilled(&evicted);
+    return !evicted.empty();
+  }
+
+  // Makes sure the video cache can hold at least 'frames' frames without having to warm up first
+  void RaiseMinCapacity(size_t frames)
+  {
+    size_t min, max;
+    VideoCache->limits(&min, &max);
+    if (min < frames)
+      VideoCache->set_limits(frames, max);
+  }
+
+  // Makes room for at least 'bytes' bytes of audio. Never shrinks the cache.
+  void GrowAudioCache(size_t bytes)
+  {
+    if (bytes/SampleSize <= MaxSampleCount)
+      return;
+
+    char * NewAudioCache = (char*)realloc(AudioCache, bytes);
+    if (NewAudioCache == NULL)
+    {
+      throw std::bad_alloc();
+    }
+    AudioCache = NewAudioCache;
+    MaxSampleCount = bytes/SampleSize;
+
+    // Ring positions depend on the cache size, so the old contents are lost
+    AudioCacheCount = 0;
+  }
+
+  void FreeAudioCache()
+  {
+    free(AudioCache);
+    AudioCache = NULL;
+    MaxSampleCount = 0;
+    AudioCacheCount = 0;
+  }
+
+  // Copies samples between 'samples' and the ring buffer, wrapping around as needed
+  void AudioRingCopy(char* samples, __int64 start, size_t count, bool store)
+  {
+    while (count > 0)
+    {
+      const size_t pos = (size_t)(start % MaxSampleCount);
+      const size_t n = min(count, MaxSampleCount - pos);
+      char* ring = AudioCache + pos*SampleSize;
+      if (store)
+        memcpy(ring, samples, n*SampleSize);
+      else
+        memcpy(samples, ring, n*SampleSize);
+
+      samples += n*SampleSize;
+      start += n;
+      count -= n;
+    }
+  }
+
+  // Adds freshly fetched samples to the cache. If they are adjacent to or overlap
+  // the cached range, the range is extended, dropping samples from the far end
+  // when the ring is full. Otherwise the cache restarts with the new samples.
+  void StoreAudio(const char* samples, __int64 start, size_t count)
+  {
+    if (count > MaxSampleCount)
+    {
+      samples += (count - MaxSampleCount)*SampleSize;
+      start += count - MaxSampleCount;
+      count = MaxSampleCount;
+    }
+
+    const __int64 end = start + count;
+    const __int64 cache_end = AudioCacheStart + AudioCacheCount;
+    if ((AudioCacheCount == 0) || (start > cache_end) || (end < AudioCacheStart))
+    {
+      AudioCacheStart = start;
+      AudioCacheCount = count;
+    }
+    else
+    {
+      __int64 new_start = min(AudioCacheStart, start);
+      __int64 new_end = max(cache_end, end);
+      if (new_end - new_start > (__int64)MaxSampleCount)
+      {
+        if (end >= cache_end)
+          new_start = new_end - MaxSampleCount;   // Appended at the tail, drop the head
+        else
+          new_end = new_start + MaxSampleCount;   // Prepended at the head, drop the tail
+      }
+      AudioCacheStart = new_start;
+      AudioCacheCount = (size_t)(new_end - new_start);
+    }
+
+    AudioRingCopy(const_cast<char*>(samples), start, count, true);
+  }
+
+  // Implements the CACHE_AUDIO_NONE/CACHE_AUDIO_AUTO state changes
+  void UpdateAudioAutoPolicy(__int64 start, __int64 count)
+  {
+    const __int64 end = start + count;
+    const bool overlaps = (start < LastAudioEnd) && (end > LastAudioStart);
+    LastAudioStart = start;
+    LastAudioEnd = end;
+
+    if (AudioPolicy == CACHE_AUDIO_NONE)
+    {
+      AudioOverlaps = overlaps ? AudioOverlaps+1 : 0;
+      if ((AudioOverlaps >= AUDIO_AUTO_ENABLE_OVERLAPS) && (count*SampleSize <= AUDIO_AUTO_MAX_BYTES/2))
+      {
+        GrowAudioCache(max((size_t)(256*1024), (size_t)(2*count*SampleSize)));
+        AudioPolicy = CACHE_AUDIO_AUTO;
+        AudioOverlaps = 0;
+        AudioMissStreak = 0;
+      }
+    }
+    else if (AudioPolicy == CACHE_AUDIO_AUTO)
+    {
+      // Requests got larger than what we can hold
+      if (overlaps && ((size_t)count > MaxSampleCount) && (count*SampleSize <= AUDIO_AUTO_MAX_BYTES/2))
+        GrowAudioCache((size_t)(2*count*SampleSize));
+    }
   }
 };
 
@@ -81,12 +495,16 @@ Cache::Cache(const PClip& _child, IScriptEnvironment* env) :
   _pimpl(NULL)
 {
   _pimpl = new CachePimpl(_child);
+  _pimpl->ColdCache = reinterpret_cast<CompressedFrameCache*>(env->ManageCache(MC_GetCompressedCache, NULL));
+  _pimpl->Tracer = reinterpret_cast<FrameTracer*>(env->ManageCache(MC_GetTracer, NULL));
   env->ManageCache(MC_RegisterCache, reinterpret_cast<void*>(this));
 }
 
 Cache::~Cache()
 {
   Env->ManageCache(MC_UnRegisterCache, reinterpret_cast<void*>(this));
+  if (_pimpl->ColdCache != NULL)
+    _pimpl->ColdCache->Remove(this);
   delete _pimpl;
 }
 
@@ -95,24 +513,60 @@ PVideoFrame __stdcall Cache::GetFrame(int n, IScriptEnvironment* env)
   // Protect plugins that cannot handle out-of-bounds frame indices
   n = clamp(n, 0, GetVideoInfo().num_frames-1);
 
+  ProfileScope profile_scope(_pimpl->Profile, env);
+  TraceScope trace(_pimpl->Tracer, _pimpl->Name, "filter", n);
+
+  if (!_pimpl->Served)
+    _pimpl->Served = true;
+
+  if (_pimpl->Elided && _pimpl->PassThrough(n))
+  {
+    _pimpl->CountLookup(n, false);
+    return _pimpl->FetchPassedThrough(n, env);
+  }
+
   if (_pimpl->VideoCache->requested_capacity() > _pimpl->VideoCache->capacity())
     env->ManageCache(MC_NodAndExpandCache, reinterpret_cast<void*>(this));
   else
     env->ManageCache(MC_NodCache, reinterpret_cast<void*>(this));
 
+  // Slide the window along, so that the frames around n are pinned
+  // before the lookup below has a chance to evict any of them
+  _pimpl->SlideWindow(n, n);
+
+  _pimpl->UpdateColdTier();
+
   PVideoFrame result;
-  LruCache<size_t, PVideoFrame>::handle cache_handle;
-  
-  switch(_pimpl->VideoCache->lookup(n, &cache_handle, true))
+  CachePimpl::VideoCacheType::handle cache_handle;
+
+  // When tracing, find out whether we have to wait for another thread
+  // to finish the frame, so that the wait shows up in the trace
+  const bool tracing = (_pimpl->Tracer != NULL) && _pimpl->Tracer->IsEnabled();
+  LruLookupResult lookup_result = _pimpl->VideoCache->lookup(n, &cache_handle, !tracing);
+  if (lookup_result == LRU_LOOKUP_FOUND_BUT_NOTAVAIL)
+  {
+    TraceScope wait_trace(_pimpl->Tracer, "Wait", "cache", n);
+    lookup_result = _pimpl->VideoCache->lookup(n, &cache_handle, true);
+  }
+
+  switch(lookup_result)
   {
   case LRU_LOOKUP_NOT_FOUND:
     {
       try
       {
-        cache_handle.first->value = _pimpl->child->GetFrame(n, env);
-  #ifdef X86_32
-        _mm_empty();
-  #endif
+        cache_handle.first->value = _pimpl->FetchCold(this, n, env);
+        _pimpl->CountLookup(n, cache_handle.first->value);
+        if (!cache_handle.first->value)
+        {
+          const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+          cache_handle.first->value = _pimpl->child->GetFrame(n, env);
+    #ifdef X86_32
+          _mm_empty();
+    #endif
+          const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+          _pimpl->UpdateFrameCost(elapsed.count(), cache_handle.first->value);
+        }
         _pimpl->VideoCache->commit_value(&cache_handle);
       }
       catch(...)
@@ -125,12 +579,16 @@ PVideoFrame __stdcall Cache::GetFrame(int n, IScriptEnvironment* env)
     }
   case LRU_LOOKUP_FOUND_AND_READY:
     {
+      _pimpl->CountLookup(n, true);
       result = cache_handle.first->value;
       break;
     }
   case LRU_LOOKUP_NO_CACHE:
     {
-      result = _pimpl->child->GetFrame(n, env);
+      result = _pimpl->FetchCold(this, n, env);
+      _pimpl->CountLookup(n, result);
+      if (!result)
+        result = _pimpl->child->GetFrame(n, env);
       break;
     }
   case LRU_LOOKUP_FOUND_BUT_NOTAVAIL:    // Fall-through intentional
@@ -141,13 +599,337 @@ PVideoFrame __stdcall Cache::GetFrame(int n, IScriptEnvironment* env)
     }
   }
 
+  _pimpl->SpillEvicted(this);
+
   return result;
 }
 
+static bool IsMiss(LruLookupResult result)
+{
+  return (result == LRU_LOOKUP_NOT_FOUND) || (result == LRU_LOOKUP_NO_CACHE);
+}
+
+void __stdcall Cache::GetFrames(int start, int count, int stride, PVideoFrame* frames, IScriptEnvironment* env)
+{
+  if (count <= 0)
+    return;
+
+  // Leave clamping of out-of-bounds indices to GetFrame()
+  const int last = start + (count-1) * stride;
+  if ((start < 0) || (last < 0) || (start >= GetVideoInfo().num_frames) || (last >= GetVideoInfo().num_frames))
+  {
+    for (int i = 0; i < count; ++i)
+      frames[i] = GetFrame(start + i*stride, env);
+    return;
+  }
+
+  ProfileScope profile_scope(_pimpl->Profile, env);
+
+  if (!_pimpl->Served)
+    _pimpl->Served = true;
+
+  if (_pimpl->Elided)
+  {
+    bool pass = true;
+    for (int i = 0; i < count; ++i)
+      pass = _pimpl->PassThrough(start + i*stride) && pass;
+
+    if (pass)
+    {
+      for (int i = 0; i < count; ++i)
+        _pimpl->CountLookup(start + i*stride, false);
+      const std::chrono::high_resolution_clock::time_point t_start = std::chrono::high_resolution_clock::now();
+      GetFrameBatch(_pimpl->child, start, count, stride, frames, env);
+#ifdef X86_32
+      _mm_empty();
+#endif
+      const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - t_start;
+      for (int i = 0; i < count; ++i)
+        _pimpl->UpdateFrameCost(elapsed.count() / count, frames[i]);
+      return;
+    }
+  }
+
+  // The bookkeeping of GetFrame() is done once for the whole run
+  if (_pimpl->VideoCache->requested_capacity() > _pimpl->VideoCache->capacity())
+    env->ManageCache(MC_NodAndExpandCache, reinterpret_cast<void*>(this));
+  else
+    env->ManageCache(MC_NodCache, reinterpret_cast<void*>(this));
+
+  _pimpl->SlideWindow(min(start, last), max(start, last));
+
+  _pimpl->UpdateColdTier();
+
+  // Look up all frames without waiting for any of them. Frames that another
+  // thread is producing are fetched with GetFrame() after we have committed
+  // our own slots, so that two batches never wait for each other.
+  std::vector<CachePimpl::VideoCacheType::handle> handles(count);
+  std::vector<LruLookupResult> results(count);
+  for (int i = 0; i < count; ++i)
+  {
+    results[i] = _pimpl->VideoCache->lookup(start + i*stride, &handles[i], false);
+    if (results[i] == LRU_LOOKUP_FOUND_AND_READY)
+    {
+      _pimpl->CountLookup(start + i*stride, true);
+      frames[i] = handles[i].first->value;
+    }
+  }
+
+  try
+  {
+    for (int i = 0; i < count; ++i)
+    {
+      if (IsMiss(results[i]))
+      {
+        frames[i] = _pimpl->FetchCold(this, start + i*stride, env);
+        _pimpl->CountLookup(start + i*stride, frames[i]);
+      }
+    }
+
+    // Runs of frames that are still missing go to the child in one batch each
+    int i = 0;
+    while (i < count)
+    {
+      if (!IsMiss(results[i]) || frames[i])
+      {
+        ++i;
+        continue;
+      }
+
+      int run = 1;
+      while ((i+run < count) && IsMiss(results[i+run]) && !frames[i+run])
+        ++run;
+
+      const std::chrono::high_resolution_clock::time_point t_start = std::chrono::high_resolution_clock::now();
+      GetFrameBatch(_pimpl->child, start + i*stride, run, stride, frames + i, env);
+#ifdef X86_32
+      _mm_empty();
+#endif
+      const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - t_start;
+      for (int k = 0; k < run; ++k)
+        _pimpl->UpdateFrameCost(elapsed.count() / run, frames[i+k]);
+
+      i += run;
+    }
+  }
+  catch(...)
+  {
+    for (int i = 0; i < count; ++i)
+    {
+      if (results[i] == LRU_LOOKUP_NOT_FOUND)
+        _pimpl->VideoCache->rollback(&handles[i]);
+    }
+    throw;
+  }
+
+  for (int i = 0; i < count; ++i)
+  {
+    if (results[i] == LRU_LOOKUP_NOT_FOUND)
+    {
+      handles[i].first->value = frames[i];
+      _pimpl->VideoCache->commit_value(&handles[i]);
+    }
+  }
+
+  for (int i = 0; i < count; ++i)
+  {
+    if (results[i] == LRU_LOOKUP_FOUND_BUT_NOTAVAIL)
+      frames[i] = GetFrame(start + i*stride, env);
+  }
+
+  _pimpl->SpillEvicted(this);
+}
+
+void Cache::SetName(const char* name)
+{
+  _pimpl->Name = name;
+}
+
+FilterProfile* Cache::GetProfile() const
+{
+  return _pimpl->Profile;
+}
+
+void Cache::SetProfile(FilterProfile* profile)
+{
+  _pimpl->Profile = profile;
+}
+
+void Cache::SpillEvicted()
+{
+  _pimpl->SpillEvicted(this);
+}
+
+bool Cache::DropSpilled()
+{
+  return _pimpl->DropSpilled();
+}
+
+void Cache::AddConsumer()
+{
+  if (++_pimpl->Consumers > 1)
+    _pimpl->Elided = false;
+}
+
+void Cache::KeepFrames()
+{
+  _pimpl->KeepFrames = true;
+  _pimpl->Elided = false;
+}
+
+// Stops storing frames if we have a single consumer that did not ask
+// for any caching. Returns whether we are elided. A cache that has served
+// frames is left alone: another thread may be inside GetFrame, and elision
+// may already have been turned off because frames were reused.
+bool Cache::Elide()
+{
+  if ( _pimpl->Served || (_pimpl->Consumers != 1) || _pimpl->KeepFrames
+    || (_pimpl->VideoPolicy != CACHE_GENERIC) || (_pimpl->GenericRange > 0) || (_pimpl->WindowSpan > 0) )
+    return false;
+
+  _pimpl->Elided = true;
+  return true;
+}
+
+bool Cache::IsElided() const
+{
+  return _pimpl->Elided;
+}
+
+// Makes room for 'frames' frames that are requested ahead of their consumer.
+// Returns false if we would not keep them until the consumer asks for them,
+// because we are elided or are not allowed to store any frames.
+bool Cache::ReserveFrames(size_t frames)
+{
+  if (_pimpl->Elided)
+    return false;
+
+  size_t min_frames, max_frames;
+  _pimpl->VideoCache->limits(&min_frames, &max_frames);
+  if (max_frames == 0)
+    return false;
+
+  _pimpl->RaiseMinCapacity(min(frames, max_frames));
+  return true;
+}
+
+void Cache::SetSerial(size_t serial)
+{
+  _pimpl->Serial = serial;
+}
+
+size_t Cache::GetSerial() const
+{
+  return _pimpl->Serial;
+}
+
+void Cache::GetFrameCost(double* seconds, size_t* bytes)
+{
+  std::lock_guard<std::mutex> lock(_pimpl->StatsMutex);
+  *seconds = _pimpl->FrameCost;
+  *bytes = _pimpl->FrameBytes;
+}
+
+void Cache::SetShards(size_t nShards)
+{
+  if (nShards == _pimpl->VideoCache->num_shards())
+    return;
+
+  // Cached frames are dropped, but this is only called while the filter
+  // graph is being set up
+  _pimpl->ResetVideoCache(nShards);
+}
+
 void __stdcall Cache::GetAudio(void* buf, __int64 start, __int64 count, IScriptEnvironment* env)
 {
-  // TODO: implement audio cache
-  _pimpl->child->GetAudio(buf, start, count, env);
+  if ((count <= 0) || (_pimpl->SampleSize == 0))
+  {
+    _pimpl->child->GetAudio(buf, start, count, env);
+    return;
+  }
+
+  // The lock is released while the child fetches samples, so that other
+  // threads can be served from the cache in the meantime
+  std::unique_lock<std::mutex> lock(_pimpl->AudioMutex);
+
+  _pimpl->UpdateAudioAutoPolicy(start, count);
+
+  if ((_pimpl->AudioCache == NULL) || (start < 0) || ((size_t)count > _pimpl->MaxSampleCount))
+  {
+    ++(_pimpl->AudioMisses);
+    lock.unlock();
+    _pimpl->child->GetAudio(buf, start, count, env);
+    return;
+  }
+
+  char* samples = reinterpret_cast<char*>(buf);
+  const size_t SampleSize = _pimpl->SampleSize;
+  const __int64 end = start + count;
+  const __int64 cache_start = _pimpl->AudioCacheStart;
+  const __int64 cache_end = cache_start + _pimpl->AudioCacheCount;
+  bool used_cache = true;
+
+  // The samples that have to come from the child
+  char* fetch_buf = NULL;
+  __int64 fetch_start = 0;
+  size_t fetch_count = 0;
+
+  if ((_pimpl->AudioCacheCount > 0) && (start >= cache_start) && (end <= cache_end))
+  {
+    // Full hit
+    _pimpl->AudioRingCopy(samples, start, (size_t)count, false);
+    ++(_pimpl->AudioHits);
+  }
+  else if ((_pimpl->AudioCacheCount > 0) && (start >= cache_start) && (start < cache_end))
+  {
+    // Head is cached, fetch only the tail
+    const size_t nCached = (size_t)(cache_end - start);
+    _pimpl->AudioRingCopy(samples, start, nCached, false);
+    fetch_buf = samples + nCached*SampleSize;
+    fetch_start = cache_end;
+    fetch_count = (size_t)(count - nCached);
+    ++(_pimpl->AudioPartialHits);
+  }
+  else if ((_pimpl->AudioCacheCount > 0) && (end > cache_start) && (end <= cache_end))
+  {
+    // Tail is cached, fetch only the head
+    const size_t nMissing = (size_t)(cache_start - start);
+    _pimpl->AudioRingCopy(samples + nMissing*SampleSize, cache_start, (size_t)(end - cache_start), false);
+    fetch_buf = samples;
+    fetch_start = start;
+    fetch_count = nMissing;
+    ++(_pimpl->AudioPartialHits);
+  }
+  else
+  {
+    fetch_buf = samples;
+    fetch_start = start;
+    fetch_count = (size_t)count;
+    ++(_pimpl->AudioMisses);
+    used_cache = false;
+  }
+
+  // Give the memory back if auto mode turned out to be useless
+  if (used_cache)
+    _pimpl->AudioMissStreak = 0;
+  else if ( (_pimpl->AudioPolicy == CACHE_AUDIO_AUTO)
+         && (++(_pimpl->AudioMissStreak) >= AUDIO_AUTO_DISABLE_MISSES) )
+  {
+    _pimpl->FreeAudioCache();
+    _pimpl->AudioPolicy = CACHE_AUDIO_NONE;
+    _pimpl->AudioMissStreak = 0;
+  }
+
+  if (fetch_count > 0)
+  {
+    lock.unlock();
+    _pimpl->child->GetAudio(fetch_buf, fetch_start, fetch_count, env);
+    lock.lock();
+
+    // Another thread may have freed the ring in the meantime
+    if (_pimpl->AudioCache != NULL)
+      _pimpl->StoreAudio(fetch_buf, fetch_start, fetch_count);
+  }
 }
 
 const VideoInfo& __stdcall Cache::GetVideoInfo()
@@ -160,6 +942,12 @@ bool __stdcall Cache::GetParity(int n)
   return _pimpl->child->GetParity(n);
 }
 
+int __stdcall Cache::GetFrameDependencies(int n, FrameDependency* deps, int max_deps)
+{
+  IFrameDependencies* child_deps = GetFrameDependencyInterface(_pimpl->child);
+  return (child_deps != NULL) ? child_deps->GetFrameDependencies(n, deps, max_deps) : 0;
+}
+
 int __stdcall Cache::SetCacheHints(int cachehints, int frame_range)
 {
   switch(cachehints)
@@ -172,8 +960,16 @@ int __stdcall Cache::SetCacheHints(int cachehints, int frame_range)
     case CACHE_IS_CACHE_REQ:
       return CACHE_IS_CACHE_ANS;
 
+    // Runs of frames are forwarded to the child as batches
+    case CACHE_HAS_FRAME_BATCHES_REQ:
+      return CACHE_HAS_FRAME_BATCHES_ANS;
+
+    // We know the dependencies of our frames if our child does
+    case CACHE_HAS_FRAME_DEPENDENCIES_REQ:
+      return (GetFrameDependencyInterface(_pimpl->child) != NULL) ? CACHE_HAS_FRAME_DEPENDENCIES_ANS : 0;
+
     case CACHE_GET_POLICY: // Get the current policy.
-      return CACHE_GENERIC;
+      return _pimpl->VideoPolicy;
 
     case CACHE_DONT_CACHE_ME:
       return 1;
@@ -232,6 +1028,9 @@ int __stdcall Cache::SetCacheHints(int cachehints, int frame_range)
       _pimpl->VideoCache->limits(&min, &max);
       max = frame_range;
       _pimpl->VideoCache->set_limits(min, max);
+      // Evicted frames are compressed by SpillEvicted() later. The memory
+      // governor calls this with memory_mutex held, which must not be
+      // held while compressing.
       break;
     }
 
@@ -258,65 +1057,157 @@ int __stdcall Cache::SetCacheHints(int cachehints, int frame_range)
     case CACHE_GET_CAPACITY:
       return _pimpl->VideoCache->capacity();
 
+    case CACHE_SET_REPLACEMENT_POLICY:
+      if (frame_range == CACHE_REPLACEMENT_ARC)
+        _pimpl->VideoCache->set_policy(LRU_POLICY_ARC);
+      else if (frame_range == CACHE_REPLACEMENT_LRU)
+        _pimpl->VideoCache->set_policy(LRU_POLICY_LRU);
+      break;
+
+    case CACHE_GET_REPLACEMENT_POLICY:
+      return (_pimpl->VideoCache->policy() == LRU_POLICY_ARC) ? CACHE_REPLACEMENT_ARC : CACHE_REPLACEMENT_LRU;
+
+    case CACHE_GET_COMPRESSED_HITS:
+    {
+      std::lock_guard<std::mutex> lock(_pimpl->StatsMutex);
+      return (int)_pimpl->ColdHits;
+    }
+
+    case CACHE_GET_COMPRESSED_STORES:
+    {
+      std::lock_guard<std::mutex> lock(_pimpl->StatsMutex);
+      return (int)_pimpl->ColdStores;
+    }
+
+    case CACHE_GET_COMPRESSION_RATIO:
+    {
+      std::lock_guard<std::mutex> lock(_pimpl->StatsMutex);
+      return (_pimpl->ColdRawBytes == 0) ? 0 : (int)(_pimpl->ColdPackedBytes * 100 / _pimpl->ColdRawBytes);
+    }
+
+    case CACHE_GET_DECOMPRESSION_TIME:
+    {
+      std::lock_guard<std::mutex> lock(_pimpl->StatsMutex);
+      return (_pimpl->ColdHits == 0) ? 0 : (int)(_pimpl->ColdDecodeTime * 1000000 / _pimpl->ColdHits);
+    }
+
     case CACHE_GET_WINDOW: // Get the current window h_span.
+      return _pimpl->WindowSpan;
+
     case CACHE_GET_RANGE: // Get the current generic frame range.
-      return 2;
+      return _pimpl->GenericRange;
+
+    case CACHE_WINDOW:
+      // A window cannot override an explicit request for generic caching
+      if ((_pimpl->VideoPolicy == CACHE_FORCE_GENERIC) || (frame_range <= 0))
+        break;
+
+      // If multiple consumers ask for a window, satisfy the largest one
+      _pimpl->WindowSpan = max(_pimpl->WindowSpan, frame_range);
+      _pimpl->UnpinWindow();
+      _pimpl->VideoPolicy = CACHE_WINDOW;
+      _pimpl->Elided = false;
+      _pimpl->RaiseMinCapacity(_pimpl->WindowSpan);
       break;
 
     case CACHE_GENERIC:
+      if (frame_range <= 0)
+        break;
+
+      _pimpl->GenericRange = max(_pimpl->GenericRange, frame_range);
+      _pimpl->RaiseMinCapacity(_pimpl->GenericRange);
+      if (_pimpl->VideoPolicy != CACHE_WINDOW)
+        _pimpl->VideoPolicy = CACHE_GENERIC;
+      _pimpl->Elided = false;
+      break;
+
     case CACHE_FORCE_GENERIC:
+      _pimpl->VideoPolicy = CACHE_FORCE_GENERIC;
+      _pimpl->Elided = false;
+      _pimpl->WindowSpan = 0;
+      _pimpl->VideoCache->clear_window();
+      _pimpl->UnpinWindow();
+      if (frame_range > 0)
+      {
+        _pimpl->GenericRange = max(_pimpl->GenericRange, frame_range);
+        _pimpl->RaiseMinCapacity(_pimpl->GenericRange);
+      }
+      break;
+
     case CACHE_NOTHING:
-    case CACHE_WINDOW:
     case CACHE_PREFETCH_FRAME:          // Queue request to prefetch frame N.
     case CACHE_PREFETCH_GO:             // Action video prefetches.
       break;
 
     /*********************************************
-        TODO AUDIO
+        AUDIO
     *********************************************/
 
     case CACHE_AUDIO:
     case CACHE_AUDIO_AUTO:
+    {
       if (!_pimpl->vi.HasAudio())
         break;
 
+      std::lock_guard<std::mutex> lock(_pimpl->AudioMutex);
+
       // Range means for audio.
       // 0 == Create a default buffer (256kb).
       // Positive. Allocate X bytes for cache.
       if (frame_range == 0) {
-        if (_pimpl->AudioPolicy != CACHE_AUDIO_NONE)   // We already have a policy - no need for a default one.
-          break;
-
-        frame_range=256*1024;
-      }
-
-      if (frame_range/_pimpl->SampleSize > _pimpl->MaxSampleCount) { // Only make bigger
-        char * NewAudioCache = (char*)realloc(_pimpl->AudioCache, frame_range);
-        if (NewAudioCache == NULL)
+        if (_pimpl->AudioCache != NULL)   // We already have a buffer - no need for a default one.
         {
-          throw std::bad_alloc();
+          _pimpl->AudioPolicy = (CachePolicyHint)cachehints;
+          break;
         }
-        _pimpl->AudioCache = NewAudioCache;
 
-        _pimpl->MaxSampleCount = frame_range/_pimpl->SampleSize;
+        frame_range=256*1024;
       }
 
+      _pimpl->GrowAudioCache(frame_range);  // Only make bigger
       _pimpl->AudioPolicy = (CachePolicyHint)cachehints;
       break;
+    }
 
     case CACHE_AUDIO_NONE:
     case CACHE_AUDIO_NOTHING:
-      free(_pimpl->AudioCache);
-      _pimpl->AudioCache = NULL;
-      _pimpl->MaxSampleCount = 0;
+    {
+      std::lock_guard<std::mutex> lock(_pimpl->AudioMutex);
+      _pimpl->FreeAudioCache();
       _pimpl->AudioPolicy = (CachePolicyHint)cachehints;
       break;
+    }
 
+    // GetAudio() updates these under the audio lock, from any thread
     case CACHE_GET_AUDIO_POLICY: // Get the current audio policy.
+    {
+      std::lock_guard<std::mutex> lock(_pimpl->AudioMutex);
       return _pimpl->AudioPolicy;
+    }
 
     case CACHE_GET_AUDIO_SIZE: // Get the current audio cache size.
-      return _pimpl->SampleSize * _pimpl->MaxSampleCount;
+    {
+      std::lock_guard<std::mutex> lock(_pimpl->AudioMutex);
+      return (int)(_pimpl->SampleSize * _pimpl->MaxSampleCount);
+    }
+
+    case CACHE_GET_AUDIO_HITS:
+    {
+      std::lock_guard<std::mutex> lock(_pimpl->AudioMutex);
+      return (int)_pimpl->AudioHits;
+    }
+
+    case CACHE_GET_AUDIO_PARTIAL_HITS:
+    {
+      std::lock_guard<std::mutex> lock(_pimpl->AudioMutex);
+      return (int)_pimpl->AudioPartialHits;
+    }
+
+    case CACHE_GET_AUDIO_MISSES:
+    {
+      std::lock_guard<std::mutex> lock(_pimpl->AudioMutex);
+      return (int)_pimpl->AudioMisses;
+    }
 
     case CACHE_PREFETCH_AUDIO_BEGIN:    // Begin queue request to prefetch audio (take critical section).
     case CACHE_PREFETCH_AUDIO_STARTLO:  // Set low 32 bits of start.
@@ -38,8 +38,9 @@
 #include <avisynth.h>
 
 struct CachePimpl;
+struct FilterProfile;
 
-class Cache : public IClip
+class Cache : public IClip, public IFrameDependencies, public IFrameBatch
 {
 private:
 
@@ -54,6 +55,22 @@ public:
   const VideoInfo& __stdcall GetVideoInfo();
   bool __stdcall GetParity(int n);
   int __stdcall SetCacheHints(int cachehints,int frame_range);
+  int __stdcall GetFrameDependencies(int n, FrameDependency* deps, int max_deps);
+  void __stdcall GetFrames(int start, int count, int stride, PVideoFrame* frames, IScriptEnvironment* env);
+  void SetShards(size_t nShards);
+  void GetFrameCost(double* seconds, size_t* bytes);
+  void SpillEvicted();
+  bool DropSpilled();
+  void SetName(const char* name);
+  FilterProfile* GetProfile() const;
+  void SetProfile(FilterProfile* profile);
+  void AddConsumer();
+  void KeepFrames();
+  bool Elide();
+  bool IsElided() const;
+  bool ReserveFrames(size_t frames);
+  void SetSerial(size_t serial);
+  size_t GetSerial() const;
 
   static AVSValue __cdecl Create(AVSValue args, void*, IScriptEnvironment* env);
   static bool __stdcall IsCache(const PClip& c);
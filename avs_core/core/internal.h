@@ -58,13 +58,57 @@ enum MANAGE_CACHE_KEYS
   MC_NodCache          = 0xFFFF0007,
   MC_NodAndExpandCache = 0xFFFF0008,
   MC_RegisterMTGuard,
-  MC_UnRegisterMTGuard
+  MC_UnRegisterMTGuard,
+  MC_GetCompressedCache,
+  MC_SetCompressedCacheMax,
+  MC_SetProfiling,
+  MC_SetProfileLog,
+  MC_GetProfileReport,
+  MC_GetProfileStack,
+  MC_SetTracing,
+  MC_GetTracer,
+  MC_SetCPUFlagsMask,
+  MC_SetAccessLog,
+  MC_GetAccessLog,
+  MC_SetCacheElision,
+  MC_ElideCaches,
+  MC_MarkCaches
 };
 
 #include <avisynth.h>
 #include <cstring>
 #include "parser/script.h" // TODO we only need ScriptFunction from here
 
+// Returns the frame dependency extension of a clip, or NULL if it does not implement one
+static __inline IFrameDependencies* GetFrameDependencyInterface(const PClip& clip)
+{
+  if ((clip->GetVersion() < 5) || (clip->SetCacheHints(CACHE_HAS_FRAME_DEPENDENCIES_REQ, 0) != CACHE_HAS_FRAME_DEPENDENCIES_ANS))
+    return NULL;
+  return dynamic_cast<IFrameDependencies*>(clip.operator->());
+}
+
+// Returns the frame batch extension of a clip, or NULL if it does not implement one
+static __inline IFrameBatch* GetFrameBatchInterface(const PClip& clip)
+{
+  if ((clip->GetVersion() < 5) || (clip->SetCacheHints(CACHE_HAS_FRAME_BATCHES_REQ, 0) != CACHE_HAS_FRAME_BATCHES_ANS))
+    return NULL;
+  return dynamic_cast<IFrameBatch*>(clip.operator->());
+}
+
+// Fetches frames start, start+stride, ... of clip, as one batch if the clip supports it
+static __inline void GetFrameBatch(const PClip& clip, int start, int count, int stride, PVideoFrame* frames, IScriptEnvironment* env)
+{
+  IFrameBatch* batch = GetFrameBatchInterface(clip);
+  if (batch != NULL)
+  {
+    batch->GetFrames(start, count, stride, frames, env);
+    return;
+  }
+
+  for (int i = 0; i < count; ++i)
+    frames[i] = clip->GetFrame(start + i*stride, env);
+}
+
 struct AVSFunction {
   const char* name;
   const char* param_types;
@@ -45,6 +45,7 @@
 #include <new>
 #include "../internal.h"
 #include "../Prefetcher.h"
+#include "../AccessRecorder.h"
 
 
 /********************************************************************
@@ -191,6 +192,13 @@ extern const AVSFunction Script_functions[] = {
   { "Assert", "s", AssertEval },
 
   { "SetMemoryMax", "[]i", SetMemoryMax },
+  { "SetCacheCompression", "[]i", SetCacheCompression },
+  { "SetFilterProfiling", "[]b[log]s", SetFilterProfiling },
+  { "FilterProfile", "", FilterProfileReport },
+  { "SetFrameTracing", "[]s", SetFrameTracing },
+  { "SetMaxCPU", "s", SetMaxCPU },
+  { "SetAccessLog", "[]s", SetAccessLog },
+  { "SetCacheElision", "b", SetCacheElision },
 
   { "SetWorkingDir", "s", SetWorkingDir },
   { "Exist", "s", Exist },
@@ -229,7 +237,7 @@ extern const AVSFunction Script_functions[] = {
   { "InternalFunctionExists",  "s", InternalFunctionExists  },
 
   { "SetFilterMTMode",  "si[force]b", SetFilterMTMode  },
-  { "Prefetch",  "c[threads]i", Prefetcher::Create  },
+  { "Prefetch",  "c[threads]i[shards]i", Prefetcher::Create  },
  
   { 0 }
 };
@@ -388,6 +396,7 @@ AVSValue Import(AVSValue args, void*, IScriptEnvironment* env)
 
   IScriptEnvironment2 *env2 = static_cast<IScriptEnvironment2*>(env);
   const bool MainScript = (env2->IncrImportDepth() == 1);
+  void* first_cache = MainScript ? env->ManageCache(MC_MarkCaches, NULL) : NULL;
 
   AVSValue lastScriptName = GetVar(env, "$ScriptName$");
   AVSValue lastScriptFile = GetVar(env, "$ScriptFile$");
@@ -457,6 +466,16 @@ AVSValue Import(AVSValue args, void*, IScriptEnvironment* env)
   env->SetGlobalVar("$ScriptDir$",  lastScriptDir);
   env2->DecrImportDepth();
 
+  // Now that the filter graph is complete, caches that serve a single
+  // filter, which asked for no caching, can stop storing frames
+  if (MainScript && result.IsClip())
+    env->ManageCache(MC_ElideCaches, first_cache);
+
+  // Log what the host asks of the main script
+  const char* access_log = reinterpret_cast<const char*>(env->ManageCache(MC_GetAccessLog, NULL));
+  if (MainScript && (access_log != NULL) && result.IsClip())
+    result = new AccessRecorder(result.AsClip(), access_log, env);
+
   return result;
 }
 
@@ -466,8 +485,82 @@ AVSValue ScriptFile(AVSValue args, void*, IScriptEnvironment* env) { return GetV
 AVSValue ScriptDir (AVSValue args, void*, IScriptEnvironment* env) { return GetVar(env, "$ScriptDir$" ); }
 
 AVSValue SetMemoryMax(AVSValue args, void*, IScriptEnvironment* env) { return env->SetMemoryMax(args[0].AsInt(0)); }
+AVSValue SetCacheCompression(AVSValue args, void*, IScriptEnvironment* env) { return (int)reinterpret_cast<intptr_t>(env->ManageCache(MC_SetCompressedCacheMax, reinterpret_cast<void*>((intptr_t)args[0].AsInt(0)))); }
 AVSValue SetWorkingDir(AVSValue args, void*, IScriptEnvironment* env) { return env->SetWorkingDir(args[0].AsString()); }
 
+// Filters created after SetFilterProfiling(true) are profiled. The report is
+// written to 'log' when the environment is deleted, or to the debugger output.
+AVSValue SetFilterProfiling(AVSValue args, void*, IScriptEnvironment* env)
+{
+  const bool enable = args[0].AsBool(true);
+  env->ManageCache(MC_SetProfiling, reinterpret_cast<void*>((intptr_t)enable));
+  if (args[1].Defined())
+    env->ManageCache(MC_SetProfileLog, const_cast<char*>(args[1].AsString()));
+  return enable;
+}
+
+// Records a timeline of the frame requests on all threads and writes it to
+// 'file' in the Chrome trace event format when the environment is deleted.
+// An empty string stops the recording.
+AVSValue SetFrameTracing(AVSValue args, void*, IScriptEnvironment* env)
+{
+  const char* path = args[0].AsString("");
+  env->ManageCache(MC_SetTracing, (*path != 0) ? const_cast<char*>(path) : NULL);
+  return AVSValue();
+}
+
+// Makes filters see only the instruction sets up to the given one, so that
+// their plain C and older SIMD paths can be timed and compared to the
+// faster ones. Most filters check the flags on every frame and follow the
+// change at once, but those that pick their path in the constructor keep
+// it, so the call belongs at the top of the script.
+AVSValue SetMaxCPU(AVSValue args, void*, IScriptEnvironment* env)
+{
+  static const struct { const char* name; int flags; } levels[] = {
+    { "none",   CPUF_FPU },
+    { "mmx",    CPUF_MMX },
+    { "isse",   CPUF_INTEGER_SSE | CPUF_SSE },
+    { "sse2",   CPUF_SSE2 },
+    { "sse3",   CPUF_SSE3 },
+    { "ssse3",  CPUF_SSSE3 },
+    { "sse4.1", CPUF_SSE4_1 },
+    { "sse4.2", CPUF_SSE4_2 },
+    { "avx",    ~0 }
+  };
+
+  const char* level = args[0].AsString();
+  int mask = 0;
+  for (size_t i = 0; i < sizeof(levels)/sizeof(levels[0]); ++i)
+  {
+    mask |= levels[i].flags;
+    if (!lstrcmpi(level, levels[i].name))
+      return (int)reinterpret_cast<intptr_t>(env->ManageCache(MC_SetCPUFlagsMask, reinterpret_cast<void*>((intptr_t)mask)));
+  }
+
+  env->ThrowError("SetMaxCPU: unknown instruction set \"%s\".", level);
+  return AVSValue();
+}
+
+// Logs the frame and audio requests of the host to the main script in
+// 'file', for replaying them with AvsBench. An empty string stops logging
+// for scripts imported later.
+AVSValue SetAccessLog(AVSValue args, void*, IScriptEnvironment* env)
+{
+  const char* path = args[0].AsString("");
+  env->ManageCache(MC_SetAccessLog, (*path != 0) ? const_cast<char*>(path) : NULL);
+  return AVSValue();
+}
+
+// Turns the elision of caches on linear filter chains by Import() on or off.
+// It is on by default.
+AVSValue SetCacheElision(AVSValue args, void*, IScriptEnvironment* env)
+{
+  env->ManageCache(MC_SetCacheElision, reinterpret_cast<void*>((intptr_t)args[0].AsBool()));
+  return AVSValue();
+}
+
+AVSValue FilterProfileReport(AVSValue args, void*, IScriptEnvironment* env) { return reinterpret_cast<const char*>(env->ManageCache(MC_GetProfileReport, NULL)); }
+
 AVSValue Muldiv(AVSValue args, void*,IScriptEnvironment* env) { return int(MulDiv(args[0].AsInt(), args[1].AsInt(), args[2].AsInt())); }
 
 AVSValue Floor(AVSValue args, void*,IScriptEnvironment* env) { return int(floor(args[0].AsFloat())); }
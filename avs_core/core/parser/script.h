@@ -81,6 +81,13 @@ AVSValue Apply(AVSValue args, void*, IScriptEnvironment* env) ;
 AVSValue Import(AVSValue args, void*, IScriptEnvironment* env);
 
 AVSValue SetMemoryMax(AVSValue args, void*, IScriptEnvironment* env);
+AVSValue SetCacheCompression(AVSValue args, void*, IScriptEnvironment* env);
+AVSValue SetFilterProfiling(AVSValue args, void*, IScriptEnvironment* env);
+AVSValue FilterProfileReport(AVSValue args, void*, IScriptEnvironment* env);
+AVSValue SetFrameTracing(AVSValue args, void*, IScriptEnvironment* env);
+AVSValue SetMaxCPU(AVSValue args, void*, IScriptEnvironment* env);
+AVSValue SetAccessLog(AVSValue args, void*, IScriptEnvironment* env);
+AVSValue SetCacheElision(AVSValue args, void*, IScriptEnvironment* env);
 
 AVSValue SetWorkingDir(AVSValue args, void*, IScriptEnvironment* env);
 
@@ -671,6 +671,22 @@ void AVISource::GetAudio(void* buf, __int64 start, __int64 count, IScriptEnviron
     memset((char*)buf + bytes_read, 0, (size_t)(vi.BytesFromAudioSamples(count) - bytes_read));
 }
 
+// Decodes the batch in ascending order whatever its stride, so the range
+// costs one seek to the key frame before its lowest frame, and every frame
+// after that continues from the one before it. Frames between the
+// requested ones are decoded as preroll.
+void __stdcall AVISource::GetFrames(int start, int count, int stride, PVideoFrame* frames, IScriptEnvironment* env)
+{
+  if (stride > 0) {
+    for (int i = 0; i < count; ++i)
+      frames[i] = GetFrame(start + i*stride, env);
+  }
+  else {
+    for (int i = count; i-- > 0; /* empty */)
+      frames[i] = GetFrame(start + i*stride, env);
+  }
+}
+
 bool AVISource::GetParity(int n) { return false; }
 
 int __stdcall AVISource::SetCacheHints(int cachehints,int frame_range)
@@ -678,7 +694,9 @@ int __stdcall AVISource::SetCacheHints(int cachehints,int frame_range)
   switch(cachehints)
   {
   case CACHE_GET_MTMODE:
-    return MT_SERIALIZED;
+    return MT_SERIALIZED_ORDERED;   // Decoding has to start at a key frame, so random order is slow
+  case CACHE_HAS_FRAME_BATCHES_REQ:
+    return CACHE_HAS_FRAME_BATCHES_ANS;
   default:
     return 0;
   }
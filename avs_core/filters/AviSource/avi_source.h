@@ -37,7 +37,7 @@
 #include "AVIReadHandler.h"
 
 
-class AVISource : public IClip {
+class AVISource : public IClip, public IFrameBatch {
   IAVIReadHandler *pfile;
   IAVIReadStream *pvideo;
   HIC hic;
@@ -82,6 +82,7 @@ public:
   void __stdcall GetAudio(void* buf, __int64 start, __int64 count, IScriptEnvironment* env) ;
   bool __stdcall GetParity(int n);
   int __stdcall SetCacheHints(int cachehints,int frame_range);
+  void __stdcall GetFrames(int start, int count, int stride, PVideoFrame* frames, IScriptEnvironment* env);
 
   static AVSValue __cdecl Create(AVSValue args, void* user_data, IScriptEnvironment* env) {
     const int mode = int(user_data);
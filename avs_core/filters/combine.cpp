@@ -34,6 +34,7 @@
 
 #include "combine.h"
 #include "../core/internal.h"
+#include "../core/FrameScheduler.h"
 #include <avs/win.h>
 #include <avs/minmax.h>
 #include <cmath>
@@ -91,12 +92,14 @@ StackVertical::StackVertical(const std::vector<PClip>& child_array, IScriptEnvir
 PVideoFrame __stdcall StackVertical::GetFrame(int n, IScriptEnvironment* env) 
 {
   const size_t nClips = children.size();
-  auto frames = static_cast<PVideoFrame*>(alloca(sizeof(PVideoFrame)*nClips));
+  std::vector<PVideoFrame> frames(nClips);
+  std::vector<FrameRequest> requests(nClips);
 
   for (size_t i = 0; i < nClips; ++i) {
-    new(frames+i) PVideoFrame;
-    frames[i] = children[i]->GetFrame(n, env);
+    requests[i].clip = children[i];
+    requests[i].n = n;
   }
+  GetFrames(requests.data(), frames.data(), (int)nClips, env);
 
   PVideoFrame dst = env->NewVideoFrame(vi);
 
@@ -148,9 +151,6 @@ PVideoFrame __stdcall StackVertical::GetFrame(int n, IScriptEnvironment* env)
     }
   }
 
-  for (size_t i = 0; i < nClips; ++i)
-    frames[i] = nullptr;
-
   return dst;
 }
 
@@ -209,12 +209,14 @@ StackHorizontal::StackHorizontal(const std::vector<PClip>& child_array, IScriptE
 PVideoFrame __stdcall StackHorizontal::GetFrame(int n, IScriptEnvironment* env) 
 {
   const size_t nClips = children.size();
-  auto frames = static_cast<PVideoFrame*>(alloca(sizeof(PVideoFrame)*nClips));
+  std::vector<PVideoFrame> frames(nClips);
+  std::vector<FrameRequest> requests(nClips);
 
   for (size_t i = 0; i < nClips; ++i) {
-    new(frames+i) PVideoFrame;
-    frames[i] = children[i]->GetFrame(n, env);
+    requests[i].clip = children[i];
+    requests[i].n = n;
   }
+  GetFrames(requests.data(), frames.data(), (int)nClips, env);
 
   PVideoFrame dst = env->NewVideoFrame(vi);
   const int dst_pitch = dst->GetPitch();
@@ -251,9 +253,6 @@ PVideoFrame __stdcall StackHorizontal::GetFrame(int n, IScriptEnvironment* env)
     }
   }
 
-  for (size_t i = 0; i < nClips; ++i)
-    frames[i] = nullptr;
-
   return dst;
 }
 
@@ -34,6 +34,7 @@
 // import and export plugins, or graphical user interfaces.
 
 #include "conditional_functions.h"
+#include "conditional_kernels.h"
 #include "../../core/internal.h"
 #include <avs/config.h>
 #include <avs/minmax.h>
@@ -286,148 +287,6 @@ AVSValue __cdecl ComparePlane::Create_next_rgb(AVSValue args, void* user_data, I
 }
 
 
-
-static size_t get_sad_c(const BYTE* c_plane, const BYTE* tplane, size_t height, size_t width, size_t c_pitch, size_t t_pitch) {
-  size_t accum = 0;
-  for (size_t y = 0; y < height; y++) {
-    for (size_t x = 0; x < width; x++) {
-      accum += abs(tplane[x] - c_plane[x]);
-    }
-    c_plane += c_pitch;
-    tplane += t_pitch;
-  }
-  return accum;
-
-}
-
-static size_t get_sad_rgb_c(const BYTE* c_plane, const BYTE* tplane, size_t height, size_t width, size_t c_pitch, size_t t_pitch) {
-  size_t accum = 0;
-  for (size_t y = 0; y < height; y++) {
-    for (size_t x = 0; x < width; x+=4) {
-      accum += abs(tplane[x] - c_plane[x]);
-      accum += abs(tplane[x+1] - c_plane[x+1]);
-      accum += abs(tplane[x+2] - c_plane[x+2]);
-    }
-    c_plane += c_pitch;
-    tplane += t_pitch;
-  }
-  return accum;
-
-}
-
-static size_t get_sad_sse2(const BYTE* src_ptr, const BYTE* other_ptr, size_t height, size_t width, size_t src_pitch, size_t other_pitch) {
-  size_t mod16_width = width / 16 * 16;
-  size_t result = 0;
-  __m128i sum = _mm_setzero_si128();
-  for (size_t y = 0; y < height; ++y) {
-    for (size_t x = 0; x < mod16_width; x+=16) {
-      __m128i src = _mm_load_si128(reinterpret_cast<const __m128i*>(src_ptr + x));
-      __m128i other = _mm_load_si128(reinterpret_cast<const __m128i*>(other_ptr + x));
-      __m128i sad = _mm_sad_epu8(src, other);
-      sum = _mm_add_epi32(sum, sad);
-    }
-
-    for (size_t x = mod16_width; x < width; ++x) {
-      result += std::abs(src_ptr[x] - other_ptr[x]);
-    }
-
-    src_ptr += src_pitch;
-    other_ptr += other_pitch;
-  }
-  __m128i upper = _mm_castps_si128(_mm_movehl_ps(_mm_setzero_ps(), _mm_castsi128_ps(sum)));
-  sum = _mm_add_epi32(sum, upper);
-  result += _mm_cvtsi128_si32(sum);
-  return result;
-}
-
-static size_t get_sad_rgb_sse2(const BYTE* src_ptr, const BYTE* other_ptr, size_t height, size_t width, size_t src_pitch, size_t other_pitch) {
-  size_t mod16_width = width / 16 * 16;
-  size_t result = 0;
-  __m128i sum = _mm_setzero_si128();
-  __m128i rgb_mask = _mm_set1_epi32(0x00FFFFFF);
-
-  for (size_t y = 0; y < height; ++y) {
-    for (size_t x = 0; x < mod16_width; x+=16) {
-      __m128i src = _mm_load_si128(reinterpret_cast<const __m128i*>(src_ptr + x));
-      __m128i other = _mm_load_si128(reinterpret_cast<const __m128i*>(other_ptr + x));
-      src = _mm_and_si128(src, rgb_mask);
-      other = _mm_and_si128(other, rgb_mask);
-      __m128i sad = _mm_sad_epu8(src, other);
-      sum = _mm_add_epi32(sum, sad);
-    }
-
-    for (size_t x = mod16_width; x < width; ++x) {
-      result += std::abs(src_ptr[x] - other_ptr[x]);
-    }
-
-    src_ptr += src_pitch;
-    other_ptr += other_pitch;
-  }
-  __m128i upper = _mm_castps_si128(_mm_movehl_ps(_mm_setzero_ps(), _mm_castsi128_ps(sum)));
-  sum = _mm_add_epi32(sum, upper);
-  result += _mm_cvtsi128_si32(sum);
-  return result;
-}
-
-#ifdef X86_32
-
-static size_t get_sad_isse(const BYTE* src_ptr, const BYTE* other_ptr, size_t height, size_t width, size_t src_pitch, size_t other_pitch) {
-  size_t mod8_width = width / 8 * 8;
-  size_t result = 0;
-  __m64 sum = _mm_setzero_si64();
-
-  for (size_t y = 0; y < height; ++y) {
-    for (size_t x = 0; x < mod8_width; x+=8) {
-      __m64 src = *reinterpret_cast<const __m64*>(src_ptr + x);
-      __m64 other = *reinterpret_cast<const __m64*>(other_ptr + x);
-      __m64 sad = _mm_sad_pu8(src, other);
-      sum = _mm_add_pi32(sum, sad);
-    }
-
-    for (size_t x = mod8_width; x < width; ++x) {
-      result += abs(src_ptr[x] - other_ptr[x]);
-    }
-
-    src_ptr += src_pitch;
-    other_ptr += other_pitch;
-  }
-  result += _mm_cvtsi64_si32(sum);
-  _mm_empty();
-  return result;
-}
-
-static size_t get_sad_rgb_isse(const BYTE* src_ptr, const BYTE* other_ptr, size_t height, size_t width, size_t src_pitch, size_t other_pitch) {
-  size_t mod8_width = width / 8 * 8;
-  size_t result = 0;
-  __m64 rgb_mask = _mm_set1_pi32(0x00FFFFFF);
-  __m64 sum = _mm_setzero_si64();
-
-  for (size_t y = 0; y < height; ++y) {
-    for (size_t x = 0; x < mod8_width; x+=8) {
-      __m64 src = *reinterpret_cast<const __m64*>(src_ptr + x);
-      __m64 other = *reinterpret_cast<const __m64*>(other_ptr + x);
-      src = _mm_and_si64(src, rgb_mask);
-      other = _mm_and_si64(other, rgb_mask);
-      __m64 sad = _mm_sad_pu8(src, other);
-      sum = _mm_add_pi32(sum, sad);
-    }
-
-    for (size_t x = mod8_width; x < width; ++x) {
-      result += abs(src_ptr[x] - other_ptr[x]);
-    }
-
-    src_ptr += src_pitch;
-    other_ptr += other_pitch;
-  }
-  result += _mm_cvtsi64_si32(sum);
-  _mm_empty();
-  return result;
-}
-
-#endif
-
-
-
 AVSValue ComparePlane::CmpPlane(AVSValue clip, AVSValue clip2, void* user_data, int plane, IScriptEnvironment* env)
 {
   if (!clip.IsClip())
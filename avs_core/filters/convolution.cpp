@@ -42,6 +42,7 @@
 
 #include "Convolution.h"
 #include "../core/internal.h"
+#include "../core/SliceThreading.h"
 
 
 /********************************************************************
@@ -149,36 +150,30 @@ __forceinline int static_clip(int value) {
   return value;
 }
 
-PVideoFrame __stdcall GeneralConvolution::GetFrame(int n, IScriptEnvironment* env)
+struct GeneralConvolution::FrameData
 {
-  auto env2 = static_cast<IScriptEnvironment2*>(env);
-  auto pbyA = static_cast<uint8_t*>(env2->Allocate(vi.width*vi.height, 8, AVS_POOLED_ALLOC));
-  auto pbyR = static_cast<uint8_t*>(env2->Allocate(vi.width*vi.height, 8, AVS_POOLED_ALLOC));
-  auto pbyG = static_cast<uint8_t*>(env2->Allocate(vi.width*vi.height, 8, AVS_POOLED_ALLOC));
-  auto pbyB = static_cast<uint8_t*>(env2->Allocate(vi.width*vi.height, 8, AVS_POOLED_ALLOC));
-
-  if (pbyA == nullptr || pbyR == nullptr || pbyG == nullptr || pbyB == nullptr) {
-    env->ThrowError("GeneralConvolution: out of memory");
-  }
-
-  int h = vi.height;
-  int w = vi.width;
-
-  PVideoFrame src = child->GetFrame(n, env);
-  PVideoFrame dst = env->NewVideoFrame(vi);
-  char *dstStart = (char *) dst->GetWritePtr();
-
-  const int pitch = dst->GetPitch();
-  const int modulo = src->GetPitch() - src->GetRowSize();
+  const GeneralConvolution* filter;
+  const BYTE* srcp;
+  int src_pitch;
+  char* dstStart;
+  int pitch;
+  uint8_t *pbyA, *pbyR, *pbyG, *pbyB;
+  int iCountDiv;
+};
 
-  Pixel32* srcp = (Pixel32*)src->GetReadPtr();
-  uint8_t *pbyA0 = pbyA;
-  uint8_t *pbyR0 = pbyR;
-  uint8_t *pbyG0 = pbyG;
-  uint8_t *pbyB0 = pbyB;
+void GeneralConvolution::UnpackSlice(int begin, int end, void* data, IScriptEnvironment*)
+{
+  const FrameData* d = reinterpret_cast<const FrameData*>(data);
+  const int w = d->filter->vi.width;
 
-  for(int y = 0; y < h; y++)
+  for(int y = begin; y < end; y++)
   {
+    const Pixel32* srcp = (const Pixel32*)(d->srcp + y * d->src_pitch);
+    uint8_t *pbyA0 = d->pbyA + y * w;
+    uint8_t *pbyR0 = d->pbyR + y * w;
+    uint8_t *pbyG0 = d->pbyG + y * w;
+    uint8_t *pbyB0 = d->pbyB + y * w;
+
     for(int x = 0; x < w; x++)
     {
       *pbyA0++ = (uint8_t)((*srcp &  0xff000000) >> 24);
@@ -186,34 +181,35 @@ PVideoFrame __stdcall GeneralConvolution::GetFrame(int n, IScriptEnvironment* en
       *pbyG0++ = (uint8_t)((*srcp &  0x0000ff00) >> 8);
       *pbyB0++ = (uint8_t)(*srcp++ & 0x000000ff);
     }
-    srcp = (Pixel32 *)((char *)srcp + modulo);
   }
+}
 
-  int iA, iR, iG, iB, x0, x1, x2, x3, x4;
+void GeneralConvolution::ConvolveSlice(int begin, int end, void* data, IScriptEnvironment*)
+{
+  const FrameData* d = reinterpret_cast<const FrameData*>(data);
+  const GeneralConvolution& f = *d->filter;
+  const int h = f.vi.height;
+  const int w = f.vi.width;
+
+  const int i00 = f.i00, i10 = f.i10, i20 = f.i20, i30 = f.i30, i40 = f.i40;
+  const int i01 = f.i01, i11 = f.i11, i21 = f.i21, i31 = f.i31, i41 = f.i41;
+  const int i02 = f.i02, i12 = f.i12, i22 = f.i22, i32 = f.i32, i42 = f.i42;
+  const int i03 = f.i03, i13 = f.i13, i23 = f.i23, i33 = f.i33, i43 = f.i43;
+  const int i04 = f.i04, i14 = f.i14, i24 = f.i24, i34 = f.i34, i44 = f.i44;
+  const size_t nSize = f.nSize;
+  const int nBias = f.nBias;
 
-  int iCountT;
-  if (autoscale) {
-    iCountT = i00 + i01 + i02 + i03 + i04 +
-              i10 + i11 + i12 + i13 + i14 +
-              i20 + i21 + i22 + i23 + i24 +
-              i30 + i31 + i32 + i33 + i34 +
-              i40 + i41 + i42 + i43 + i44;
-  } else {
-    iCountT = 0;
-  }
-    
-  // Truncate instead of round - keep in the spirit of the original code
-  int iCountDiv = (int)(0x100000 / (iCountT == 0 ? divisor : iCountT * divisor));
+  int iA, iR, iG, iB, x0, x1, x2, x3, x4;
 
-  for(int y = 0; y < h; y++)
+  for(int y = begin; y < end; y++)
   {
-    uint8_t *pbyR1, *pbyG1, *pbyB1, *pbyR2, *pbyG2, *pbyB2,
+    uint8_t *pbyA0, *pbyR0, *pbyG0, *pbyB0, *pbyR1, *pbyG1, *pbyB1, *pbyR2, *pbyG2, *pbyB2,
       *pbyR3, *pbyG3, *pbyB3, *pbyR4, *pbyG4, *pbyB4;
 
-    pbyA0                                 = pbyA + y * w;
-    pbyR0 = pbyR1 = pbyR2 = pbyR3 = pbyR4 = pbyR + y * w;
-    pbyG0 = pbyG1 = pbyG2 = pbyG3 = pbyG4 = pbyG + y * w;
-    pbyB0 = pbyB1 = pbyB2 = pbyB3 = pbyB4 = pbyB + y * w;
+    pbyA0                                 = d->pbyA + y * w;
+    pbyR0 = pbyR1 = pbyR2 = pbyR3 = pbyR4 = d->pbyR + y * w;
+    pbyG0 = pbyG1 = pbyG2 = pbyG3 = pbyG4 = d->pbyG + y * w;
+    pbyB0 = pbyB1 = pbyB2 = pbyB3 = pbyB4 = d->pbyB + y * w;
 
     if(y > 0)
     {
@@ -237,7 +233,7 @@ PVideoFrame __stdcall GeneralConvolution::GetFrame(int n, IScriptEnvironment* en
       }
     }
 
-    Pixel32* dstp = (Pixel32 *)(dstStart + y * pitch);
+    Pixel32* dstp = (Pixel32 *)(d->dstStart + y * d->pitch);
     for(x2 = 0; x2 < w; x2++)
     {
       x0 = x2 > 2 ? x2 - 2 : 0;
@@ -280,9 +276,9 @@ PVideoFrame __stdcall GeneralConvolution::GetFrame(int n, IScriptEnvironment* en
               i04 * pbyB4[x0] + i14 * pbyB4[x1] + i24 * pbyB4[x2] + i34 * pbyB4[x3] + i44 * pbyB4[x4];
       }
 
-      iR = ((iR * iCountDiv) >> 20) + nBias;
-      iG = ((iG * iCountDiv) >> 20) + nBias;
-      iB = ((iB * iCountDiv) >> 20) + nBias;
+      iR = ((iR * d->iCountDiv) >> 20) + nBias;
+      iG = ((iG * d->iCountDiv) >> 20) + nBias;
+      iB = ((iB * d->iCountDiv) >> 20) + nBias;
 
       iR = static_clip<0, 255>(iR);
       iG = static_clip<0, 255>(iG);
@@ -291,6 +287,51 @@ PVideoFrame __stdcall GeneralConvolution::GetFrame(int n, IScriptEnvironment* en
       *dstp++ = (iA << 24) + (iR << 16) + (iG << 8) + iB;
     }
   }
+}
+
+PVideoFrame __stdcall GeneralConvolution::GetFrame(int n, IScriptEnvironment* env)
+{
+  auto env2 = static_cast<IScriptEnvironment2*>(env);
+  auto pbyA = static_cast<uint8_t*>(env2->Allocate(vi.width*vi.height, 8, AVS_POOLED_ALLOC));
+  auto pbyR = static_cast<uint8_t*>(env2->Allocate(vi.width*vi.height, 8, AVS_POOLED_ALLOC));
+  auto pbyG = static_cast<uint8_t*>(env2->Allocate(vi.width*vi.height, 8, AVS_POOLED_ALLOC));
+  auto pbyB = static_cast<uint8_t*>(env2->Allocate(vi.width*vi.height, 8, AVS_POOLED_ALLOC));
+
+  if (pbyA == nullptr || pbyR == nullptr || pbyG == nullptr || pbyB == nullptr) {
+    env->ThrowError("GeneralConvolution: out of memory");
+  }
+
+  PVideoFrame src = child->GetFrame(n, env);
+  PVideoFrame dst = env->NewVideoFrame(vi);
+
+  int iCountT;
+  if (autoscale) {
+    iCountT = i00 + i01 + i02 + i03 + i04 +
+              i10 + i11 + i12 + i13 + i14 +
+              i20 + i21 + i22 + i23 + i24 +
+              i30 + i31 + i32 + i33 + i34 +
+              i40 + i41 + i42 + i43 + i44;
+  } else {
+    iCountT = 0;
+  }
+    
+  FrameData d;
+  d.filter = this;
+  d.srcp = src->GetReadPtr();
+  d.src_pitch = src->GetPitch();
+  d.dstStart = (char *) dst->GetWritePtr();
+  d.pitch = dst->GetPitch();
+  d.pbyA = pbyA;
+  d.pbyR = pbyR;
+  d.pbyG = pbyG;
+  d.pbyB = pbyB;
+  // Truncate instead of round - keep in the spirit of the original code
+  d.iCountDiv = (int)(0x100000 / (iCountT == 0 ? divisor : iCountT * divisor));
+
+  // Every row of the convolution reads up to two unpacked rows above and below,
+  // so all rows are unpacked before the first one is filtered.
+  ParallelSlices(vi.height, 1, vi.width * 4, UnpackSlice, &d, env);
+  ParallelSlices(vi.height, 1, vi.width * 4 * nSize, ConvolveSlice, &d, env);
 
   env2->Free(pbyA);
   env2->Free(pbyR);
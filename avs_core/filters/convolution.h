@@ -66,6 +66,11 @@ public:
 protected:
     void setMatrix(const char * _matrix, IScriptEnvironment* env);
 
+    // Bands of rows of one frame, run through ParallelSlices
+    struct FrameData;
+    static void UnpackSlice(int begin, int end, void* data, IScriptEnvironment* env);
+    static void ConvolveSlice(int begin, int end, void* data, IScriptEnvironment* env);
+
 private:      
     double divisor;
     size_t nSize;
@@ -267,6 +267,18 @@ bool Trim::GetParity(int n)
   return child->GetParity(n+firstframe); 
 }
 
+void Trim::GetFrames(int start, int count, int stride, PVideoFrame* frames, IScriptEnvironment* env)
+{
+  GetFrameBatch(child, start+firstframe, count, stride, frames, env);
+}
+
+int Trim::SetCacheHints(int cachehints, int frame_range)
+{
+  if (cachehints == CACHE_HAS_FRAME_BATCHES_REQ)
+    return CACHE_HAS_FRAME_BATCHES_ANS;
+  return NonCachedGenericVideoFilter::SetCacheHints(cachehints, frame_range);
+}
+
 
 AVSValue __cdecl Trim::Create(AVSValue args, void* mode, IScriptEnvironment* env) 
 {
@@ -643,6 +655,24 @@ bool Dissolve::GetParity(int n)
 }
 
 
+int __stdcall Dissolve::GetFrameDependencies(int n, FrameDependency* deps, int max_deps)
+{
+  FrameDependency all[2];
+  int count = 0;
+  if (n <= video_fade_end) {
+    all[count].clip = child.operator->();
+    all[count++].n = n;
+  }
+  if (n >= video_fade_start) {
+    all[count].clip = child2.operator->();
+    all[count++].n = n - video_fade_start;
+  }
+
+  for (int i = 0; i < min(count, max_deps); i++)
+    deps[i] = all[i];
+  return count;
+}
+
 PVideoFrame Dissolve::GetFrame(int n, IScriptEnvironment* env) 
 {
   if (n < video_fade_start)
@@ -41,7 +41,7 @@
 /********************************************************************
 ********************************************************************/
 
-class Trim : public NonCachedGenericVideoFilter 
+class Trim : public NonCachedGenericVideoFilter, public IFrameBatch
 /**
   * Class to select a range of frames from a longer clip
  **/
@@ -52,6 +52,8 @@ public:
   PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
   void __stdcall GetAudio(void* buf, __int64 start, __int64 count, IScriptEnvironment* env);
   bool __stdcall GetParity(int n);
+  void __stdcall GetFrames(int start, int count, int stride, PVideoFrame* frames, IScriptEnvironment* env);
+  int __stdcall SetCacheHints(int cachehints, int frame_range);
 
   static AVSValue __cdecl Create(AVSValue args, void* mode, IScriptEnvironment* env);  
   static AVSValue __cdecl CreateA(AVSValue args, void* mode, IScriptEnvironment* env);  
@@ -147,7 +149,7 @@ private:
 
 
 
-class Dissolve : public GenericVideoFilter 
+class Dissolve : public GenericVideoFilter, public IFrameDependencies
 /**
   * Class to smoothly transition from one video clip to another
  **/
@@ -157,6 +159,11 @@ public:
   PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
   void __stdcall GetAudio(void* buf, __int64 start, __int64 count, IScriptEnvironment* env);
   bool __stdcall GetParity(int n);
+  int __stdcall GetFrameDependencies(int n, FrameDependency* deps, int max_deps);
+
+  int __stdcall SetCacheHints(int cachehints, int frame_range) override {
+    return cachehints == CACHE_HAS_FRAME_DEPENDENCIES_REQ ? CACHE_HAS_FRAME_DEPENDENCIES_ANS : 0;
+  }
 
   static AVSValue __cdecl Create(AVSValue args, void*, IScriptEnvironment* env);
 
@@ -623,6 +623,8 @@ int __stdcall Interleave::SetCacheHints(int cachehints,int frame_range)
     return 1;
   case CACHE_GET_MTMODE:
     return MT_NICE_FILTER;
+  case CACHE_HAS_FRAME_DEPENDENCIES_REQ:
+    return CACHE_HAS_FRAME_DEPENDENCIES_ANS;
   default:
     return 0;
   }
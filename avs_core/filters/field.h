@@ -307,7 +307,7 @@ public:
 };
 
 
-class Interleave : public IClip
+class Interleave : public IClip, public IFrameDependencies
   /**
     * Class to interleave several clips frame-by-frame
     **/
@@ -331,6 +331,14 @@ public:
     return child_array[n % num_children]->GetParity(n / num_children);
   }
 
+  int __stdcall GetFrameDependencies(int n, FrameDependency* deps, int max_deps) {
+    if (max_deps > 0) {
+      deps[0].clip = child_array[n % num_children].operator->();
+      deps[0].n = n / num_children;
+    }
+    return 1;
+  }
+
   virtual ~Interleave() {
     delete[] child_array;
   }
@@ -346,7 +354,7 @@ private:
 };
 
 
-class SelectEvery : public NonCachedGenericVideoFilter
+class SelectEvery : public NonCachedGenericVideoFilter, public IFrameDependencies, public IFrameBatch
   /**
     * Class to perform generalized pulldown (patterned frame removal)
     **/
@@ -362,6 +370,26 @@ public:
     return child->GetParity(n*every+from);
   }
 
+  int __stdcall GetFrameDependencies(int n, FrameDependency* deps, int max_deps) {
+    if (max_deps > 0) {
+      deps[0].clip = child.operator->();
+      deps[0].n = n*every+from;
+    }
+    return 1;
+  }
+
+  void __stdcall GetFrames(int start, int count, int stride, PVideoFrame* frames, IScriptEnvironment* env) {
+    GetFrameBatch(child, start*every+from, count, stride*every, frames, env);
+  }
+
+  int __stdcall SetCacheHints(int cachehints, int frame_range) {
+    if (cachehints == CACHE_HAS_FRAME_DEPENDENCIES_REQ)
+      return CACHE_HAS_FRAME_DEPENDENCIES_ANS;
+    if (cachehints == CACHE_HAS_FRAME_BATCHES_REQ)
+      return CACHE_HAS_FRAME_BATCHES_ANS;
+    return NonCachedGenericVideoFilter::SetCacheHints(cachehints, frame_range);
+  }
+
   static AVSValue __cdecl Create(AVSValue args, void*, IScriptEnvironment* env);
 
   inline static AVSValue __cdecl Create_SelectEven(AVSValue args, void*, IScriptEnvironment* env) {
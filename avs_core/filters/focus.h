@@ -80,7 +80,7 @@ AVSValue __cdecl Create_Blur(AVSValue args, void*, IScriptEnvironment* env);
 
 /*** Soften classes ***/
 
-class TemporalSoften : public GenericVideoFilter 
+class TemporalSoften : public GenericVideoFilter, public IFrameDependencies
 /**
   * Class to soften the focus on the temporal axis
  **/
@@ -88,10 +88,19 @@ class TemporalSoften : public GenericVideoFilter
 public:
   TemporalSoften( PClip _child, unsigned radius, unsigned luma_thresh, unsigned chroma_thresh,int _scenechange, IScriptEnvironment* env );
   PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
+  int __stdcall GetFrameDependencies(int n, FrameDependency* deps, int max_deps);
   static AVSValue __cdecl Create(AVSValue args, void*, IScriptEnvironment* env);
 
   int __stdcall SetCacheHints(int cachehints, int frame_range) override {
-    return cachehints == CACHE_GET_MTMODE ? MT_NICE_FILTER : 0;
+    switch (cachehints)
+    {
+    case CACHE_GET_MTMODE:
+      return MT_NICE_FILTER;
+    case CACHE_HAS_FRAME_DEPENDENCIES_REQ:
+      return CACHE_HAS_FRAME_DEPENDENCIES_ANS;
+    default:
+      return 0;
+    }
   }
 
 private:
@@ -531,6 +531,17 @@ PVideoFrame __stdcall ChangeFPS::GetFrame(int n, IScriptEnvironment* env)
 }
 
 
+int __stdcall ChangeFPS::GetFrameDependencies(int n, FrameDependency* deps, int max_deps)
+{
+  // The frames decoded in linear mode depend on the previous request, only the result frame is listed
+  if (max_deps > 0) {
+    deps[0].clip = child.operator->();
+    deps[0].n = int((n * a) / b);
+  }
+  return 1;
+}
+
+
 bool __stdcall ChangeFPS::GetParity(int n)
 {
   return child->GetParity( int((n * a) / b) ); // Use Floor!
@@ -586,6 +597,9 @@ ConvertFPS::ConvertFPS( PClip _child, unsigned new_numerator, unsigned new_denom
                         int _vbi, IScriptEnvironment* env )
 	: GenericVideoFilter(_child), zone(_zone), vbi(_vbi), lps(0)
 {
+  // Output frames blend source frames nsrc and nsrc+1
+  child->SetCacheHints(CACHE_WINDOW, 2);
+
   if (zone >= 0 && !vi.IsYUY2()) // Tritical Jan 2006
    env->ThrowError("ConvertFPS: zone >= 0 requires YUY2 input");
 
@@ -740,6 +754,38 @@ loop:
 }
 
 
+int __stdcall ConvertFPS::GetFrameDependencies(int n, FrameDependency* deps, int max_deps)
+{
+	static const int resolution =10; // Same as in GetFrame()
+	static const int threshold  = 1<<(resolution-4);
+	static const int one        = 1<<resolution;
+
+	const int nsrc = int( n * fa / fb );
+	const int frac = int( (((n*fa) % fb) << resolution) / fb );
+
+	int first = nsrc, last = nsrc+1;
+	if( zone < 0 ) {
+		if( frac < threshold )
+			last = nsrc;
+		else if( frac > (one - threshold) )
+			first = nsrc+1;
+	} else if( nsrc > 0 ) {
+		// A transition from the previous frame may still be in progress
+		first = nsrc-1;
+	}
+
+	int count = 0;
+	for (int i = first; i <= last; i++) {
+		if (count < max_deps) {
+			deps[count].clip = child.operator->();
+			deps[count].n = i;
+		}
+		count++;
+	}
+	return count;
+}
+
+
 bool __stdcall ConvertFPS::GetParity(int n)
 {
 	if( vi.IsFieldBased())
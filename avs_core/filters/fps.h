@@ -72,7 +72,7 @@ public:
 };
 
 
-class ChangeFPS : public GenericVideoFilter 
+class ChangeFPS : public GenericVideoFilter, public IFrameDependencies
 /**
   * Class to change the framerate, deleting or adding frames as necessary
  **/
@@ -81,10 +81,19 @@ public:
   ChangeFPS(PClip _child, unsigned new_numerator, unsigned new_denominator, bool linear, IScriptEnvironment* env);
   PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
   bool __stdcall GetParity(int n);
+  int __stdcall GetFrameDependencies(int n, FrameDependency* deps, int max_deps);
 
   int __stdcall SetCacheHints(int cachehints, int frame_range) override {
-    //todo: not really sure if it has to be serialized or can do with multiple instances
-    return cachehints == CACHE_GET_MTMODE ? MT_SERIALIZED : 0; 
+    switch (cachehints)
+    {
+    case CACHE_GET_MTMODE:
+      //todo: not really sure if it has to be serialized or can do with multiple instances
+      return MT_SERIALIZED;
+    case CACHE_HAS_FRAME_DEPENDENCIES_REQ:
+      return CACHE_HAS_FRAME_DEPENDENCIES_ANS;
+    default:
+      return 0;
+    }
   }
 
   static AVSValue __cdecl Create(AVSValue args, void*, IScriptEnvironment* env);
@@ -100,7 +109,7 @@ private:
 
 
 
-class ConvertFPS : public GenericVideoFilter 
+class ConvertFPS : public GenericVideoFilter, public IFrameDependencies
 /**
   * Class to change the framerate, attempting to smooth the transitions
  **/
@@ -110,9 +119,18 @@ public:
               int _vbi, IScriptEnvironment* env );
   PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
   bool __stdcall GetParity(int n);
+  int __stdcall GetFrameDependencies(int n, FrameDependency* deps, int max_deps);
 
   int __stdcall SetCacheHints(int cachehints, int frame_range) override {
-    return cachehints == CACHE_GET_MTMODE ? MT_NICE_FILTER : 0;
+    switch (cachehints)
+    {
+    case CACHE_GET_MTMODE:
+      return MT_NICE_FILTER;
+    case CACHE_HAS_FRAME_DEPENDENCIES_REQ:
+      return CACHE_HAS_FRAME_DEPENDENCIES_ANS;
+    default:
+      return 0;
+    }
   }
 
   static AVSValue __cdecl Create(AVSValue args, void*, IScriptEnvironment* env);
@@ -42,6 +42,7 @@
 #include <avs/minmax.h>
 #include <avs/alignment.h>
 #include "../core/internal.h"
+#include "../core/FrameScheduler.h"
 #include <emmintrin.h>
 
 
@@ -208,8 +209,11 @@ static void mask_c(BYTE *srcp, const BYTE *alphap, int src_pitch, int alpha_pitc
 
 PVideoFrame __stdcall Mask::GetFrame(int n, IScriptEnvironment* env)
 {
-  PVideoFrame src1 = child1->GetFrame(n, env);
-  PVideoFrame src2 = child2->GetFrame(min(n,mask_frames-1), env);
+  FrameRequest requests[2] = { { child1, n }, { child2, min(n,mask_frames-1) } };
+  PVideoFrame frames[2];
+  GetFrames(requests, frames, 2, env);
+  PVideoFrame& src1 = frames[0];
+  PVideoFrame& src2 = frames[1];
 
 
   env->MakeWritable(&src1);
@@ -964,10 +968,13 @@ MergeRGB::MergeRGB(PClip _child, PClip _blue, PClip _green, PClip _red, PClip _a
 
 PVideoFrame MergeRGB::GetFrame(int n, IScriptEnvironment* env)
 {
-  PVideoFrame B = blue->GetFrame(n, env);
-  PVideoFrame G = green->GetFrame(n, env);
-  PVideoFrame R = red->GetFrame(n, env);
-  PVideoFrame A = (alpha) ? alpha->GetFrame(n, env) : 0;
+  FrameRequest requests[4] = { { blue, n }, { green, n }, { red, n }, { alpha, n } };
+  PVideoFrame frames[4];
+  GetFrames(requests, frames, (alpha) ? 4 : 3, env);
+  PVideoFrame& B = frames[0];
+  PVideoFrame& G = frames[1];
+  PVideoFrame& R = frames[2];
+  PVideoFrame& A = frames[3];
 
   PVideoFrame dst = env->NewVideoFrame(vi);
 
@@ -2232,11 +2239,13 @@ static void layer_rgb32_lighten_darken_c(BYTE* dstp, const BYTE* ovrp, int dst_p
 
 PVideoFrame __stdcall Layer::GetFrame(int n, IScriptEnvironment* env)
 {
-  PVideoFrame src1 = child1->GetFrame(n, env);
+  if (xcount<=0 || ycount<=0) return child1->GetFrame(n, env);
 
-  if (xcount<=0 || ycount<=0) return src1;
-
-  PVideoFrame src2 = child2->GetFrame(min(n,overlay_frames-1), env);
+  FrameRequest requests[2] = { { child1, n }, { child2, min(n,overlay_frames-1) } };
+  PVideoFrame frames[2];
+  GetFrames(requests, frames, 2, env);
+  PVideoFrame& src1 = frames[0];
+  PVideoFrame& src2 = frames[1];
 
   env->MakeWritable(&src1);
 
@@ -2671,8 +2680,11 @@ Subtract::Subtract(PClip _child1, PClip _child2, IScriptEnvironment* env)
 
 PVideoFrame __stdcall Subtract::GetFrame(int n, IScriptEnvironment* env)
 {
-  PVideoFrame src1 = child1->GetFrame(n, env);
-  PVideoFrame src2 = child2->GetFrame(n, env);
+  FrameRequest requests[2] = { { child1, n }, { child2, n } };
+  PVideoFrame frames[2];
+  GetFrames(requests, frames, 2, env);
+  PVideoFrame& src1 = frames[0];
+  PVideoFrame& src2 = frames[1];
 
   env->MakeWritable(&src1);
 
@@ -42,6 +42,7 @@
 #define __Merge_H__
 
 #include <avisynth.h>
+#include "merge_kernels.h"
 
 
 /****************************************************
@@ -109,8 +110,4 @@ private:
   float weight;
 };
 
-void weighted_merge_planar_sse2(BYTE *p1,const BYTE *p2, int p1_pitch, int p2_pitch,int rowsize, int height, int weight, int invweight);
-void weighted_merge_planar_mmx(BYTE *p1,const BYTE *p2, int p1_pitch, int p2_pitch,int rowsize, int height, int weight, int invweight);
-void weighted_merge_planar_c(BYTE *p1,const BYTE *p2, int p1_pitch, int p2_pitch,int rowsize, int height, int weight, int invweight);
-
 #endif  // __Merge_H__
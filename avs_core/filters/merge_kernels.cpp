@@ -0,0 +1,159 @@
+// Avisynth v2.5.  Copyright 2002 Ben Rudiak-Gould et al.
+// http://www.avisynth.org
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA, or visit
+// http://www.gnu.org/copyleft/gpl.html .
+//
+// Linking Avisynth statically or dynamically with other modules is making a
+// combined work based on Avisynth.  Thus, the terms and conditions of the GNU
+// General Public License cover the whole combination.
+//
+// As a special exception, the copyright holders of Avisynth give you
+// permission to link Avisynth with independent modules that communicate with
+// Avisynth solely through the interfaces defined in avisynth.h, regardless of the license
+// terms of these independent modules, and to copy and distribute the
+// resulting combined work under terms of your choice, provided that
+// every copy of the combined work is accompanied by a complete copy of
+// the source code of Avisynth (the version of Avisynth used to produce the
+// combined work), being distributed under the terms of the GNU General
+// Public License plus this exception.  An independent module is a module
+// which is not derived from or based on Avisynth, such as 3rd-party filters,
+// import and export plugins, or graphical user interfaces.
+
+#include "merge_kernels.h"
+#include <emmintrin.h>
+
+
+/* -----------------------------------
+ *       weighted_merge_planar
+ * -----------------------------------
+ */
+void weighted_merge_planar_sse2(BYTE *p1, const BYTE *p2, int p1_pitch, int p2_pitch, int width, int height, int weight, int invweight) {
+  __m128i round_mask = _mm_set1_epi32(0x4000);
+  __m128i zero = _mm_setzero_si128();
+  __m128i mask = _mm_set_epi16(weight, invweight, weight, invweight, weight, invweight, weight, invweight);
+
+  int wMod16 = (width/16) * 16;
+
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < wMod16; x += 16) {
+      __m128i px1 = _mm_load_si128(reinterpret_cast<const __m128i*>(p1+x)); //y7y6 y5y4 y3y2 y1y0
+      __m128i px2 = _mm_load_si128(reinterpret_cast<const __m128i*>(p2+x)); //Y7Y6 Y5Y4 Y3Y2 Y1Y0
+
+      __m128i p0123 = _mm_unpacklo_epi8(px1, px2); //Y3y3 Y2y2 Y1y1 Y0y0
+      __m128i p4567 = _mm_unpackhi_epi8(px1, px2); //Y7y7 Y6y6 Y5y5 Y4y4
+
+      __m128i p01 = _mm_unpacklo_epi8(p0123, zero); //00Y1 00y1 00Y0 00y0
+      __m128i p23 = _mm_unpackhi_epi8(p0123, zero); //00Y3 00y3 00Y2 00y2
+      __m128i p45 = _mm_unpacklo_epi8(p4567, zero); //00Y5 00y5 00Y4 00y4
+      __m128i p67 = _mm_unpackhi_epi8(p4567, zero); //00Y7 00y7 00Y6 00y6
+
+      p01 = _mm_madd_epi16(p01, mask);
+      p23 = _mm_madd_epi16(p23, mask);
+      p45 = _mm_madd_epi16(p45, mask);
+      p67 = _mm_madd_epi16(p67, mask);
+
+      p01 = _mm_add_epi32(p01, round_mask);
+      p23 = _mm_add_epi32(p23, round_mask);
+      p45 = _mm_add_epi32(p45, round_mask);
+      p67 = _mm_add_epi32(p67, round_mask);
+
+      p01 = _mm_srli_epi32(p01, 15);
+      p23 = _mm_srli_epi32(p23, 15);
+      p45 = _mm_srli_epi32(p45, 15);
+      p67 = _mm_srli_epi32(p67, 15);
+
+      p0123 = _mm_packs_epi32(p01, p23);
+      p4567 = _mm_packs_epi32(p45, p67);
+
+      __m128i result = _mm_packus_epi16(p0123, p4567);
+
+      _mm_store_si128(reinterpret_cast<__m128i*>(p1+x), result);
+    }
+
+    for (int x = wMod16; x < width; x++) {
+      p1[x] = (p1[x]*invweight + p2[x]*weight + 16384) >> 15;
+    }
+
+    p1 += p1_pitch;
+    p2 += p2_pitch;
+  }
+}
+
+#ifdef X86_32
+void weighted_merge_planar_mmx(BYTE *p1, const BYTE *p2, int p1_pitch, int p2_pitch, int width, int height, int weight, int invweight) {
+  __m64 round_mask = _mm_set1_pi32(0x4000);
+  __m64 zero = _mm_setzero_si64();
+  __m64 mask = _mm_set_pi16(weight, invweight, weight, invweight);
+
+  int wMod8 = (width/8) * 8;
+
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < wMod8; x += 8) {
+      __m64 px1 = *(reinterpret_cast<const __m64*>(p1+x)); //y7y6 y5y4 y3y2 y1y0
+      __m64 px2 = *(reinterpret_cast<const __m64*>(p2+x)); //Y7Y6 Y5Y4 Y3Y2 Y1Y0
+
+      __m64 p0123 = _mm_unpacklo_pi8(px1, px2); //Y3y3 Y2y2 Y1y1 Y0y0
+      __m64 p4567 = _mm_unpackhi_pi8(px1, px2); //Y7y7 Y6y6 Y5y5 Y4y4
+
+      __m64 p01 = _mm_unpacklo_pi8(p0123, zero); //00Y1 00y1 00Y0 00y0
+      __m64 p23 = _mm_unpackhi_pi8(p0123, zero); //00Y3 00y3 00Y2 00y2
+      __m64 p45 = _mm_unpacklo_pi8(p4567, zero); //00Y5 00y5 00Y4 00y4
+      __m64 p67 = _mm_unpackhi_pi8(p4567, zero); //00Y7 00y7 00Y6 00y6
+
+      p01 = _mm_madd_pi16(p01, mask);
+      p23 = _mm_madd_pi16(p23, mask);
+      p45 = _mm_madd_pi16(p45, mask);
+      p67 = _mm_madd_pi16(p67, mask);
+
+      p01 = _mm_add_pi32(p01, round_mask);
+      p23 = _mm_add_pi32(p23, round_mask);
+      p45 = _mm_add_pi32(p45, round_mask);
+      p67 = _mm_add_pi32(p67, round_mask);
+
+      p01 = _mm_srli_pi32(p01, 15);
+      p23 = _mm_srli_pi32(p23, 15);
+      p45 = _mm_srli_pi32(p45, 15);
+      p67 = _mm_srli_pi32(p67, 15);
+
+      p0123 = _mm_packs_pi32(p01, p23);
+      p4567 = _mm_packs_pi32(p45, p67);
+
+      __m64 result = _mm_packs_pu16(p0123, p4567);
+
+      *reinterpret_cast<__m64*>(p1+x) = result;
+    }
+
+    for (int x = wMod8; x < width; x++) {
+      p1[x] = (p1[x]*invweight + p2[x]*weight + 16384) >> 15;
+    }
+
+    p1 += p1_pitch;
+    p2 += p2_pitch;
+  }
+  _mm_empty();
+}
+#endif
+
+void weighted_merge_planar_c(BYTE *p1, const BYTE *p2, int p1_pitch, int p2_pitch,int rowsize, int height, int weight, int invweight) {
+
+  for (int y=0;y<height;y++) {
+    for (int x=0;x<rowsize;x++) {
+      p1[x] = (p1[x]*invweight + p2[x]*weight + 32768) >> 16;
+    }
+    p2+=p2_pitch;
+    p1+=p1_pitch;
+  }
+}
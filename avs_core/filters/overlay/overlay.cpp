@@ -38,6 +38,7 @@
 #include <stdlib.h>
 #include "overlay.h"
 #include "../core/internal.h"
+#include "../core/FrameScheduler.h"
 
 /********************************************************************
 ***** Declare index of new filters for Avisynth's filter engine *****
@@ -175,8 +176,11 @@ PVideoFrame __stdcall Overlay::GetFrame(int n, IScriptEnvironment *env) {
   // Output frame
   PVideoFrame f = env->NewVideoFrame(vi);
 
-    // Fetch current frame and convert it.
-  PVideoFrame frame = child->GetFrame(n, env);
+  // Fetch current frame and overlay
+  FrameRequest requests[2] = { { child, n }, { overlay, n } };
+  PVideoFrame frames[2];
+  GetFrames(requests, frames, 2, env);
+  PVideoFrame& frame = frames[0];
 
   // Image444 initialization
   Image444* img = new Image444(vi.width, vi.height, env);
@@ -189,10 +193,10 @@ PVideoFrame __stdcall Overlay::GetFrame(int n, IScriptEnvironment *env) {
     maskImg->SetPtr(maskImg->GetPtr(PLANAR_Y), PLANAR_V);
   }
 
+  // Convert current frame and overlay
   inputConv->ConvertImage(frame, img, env);
 
-  // Fetch current overlay and convert it
-  PVideoFrame Oframe = overlay->GetFrame(n, env);
+  PVideoFrame& Oframe = frames[1];
   overlayConv->ConvertImage(Oframe, overlayImg, env);
 
   // Clip overlay to original image
@@ -0,0 +1,581 @@
+// Avisynth v2.5.  Copyright 2002 Ben Rudiak-Gould et al.
+// http://www.avisynth.org
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA, or visit
+// http://www.gnu.org/copyleft/gpl.html .
+//
+// Linking Avisynth statically or dynamically with other modules is making a
+// combined work based on Avisynth.  Thus, the terms and conditions of the GNU
+// General Public License cover the whole combination.
+//
+// As a special exception, the copyright holders of Avisynth give you
+// permission to link Avisynth with independent modules that communicate with
+// Avisynth solely through the interfaces defined in avisynth.h, regardless of the license
+// terms of these independent modules, and to copy and distribute the
+// resulting combined work under terms of your choice, provided that
+// every copy of the combined work is accompanied by a complete copy of
+// the source code of Avisynth (the version of Avisynth used to produce the
+// combined work), being distributed under the terms of the GNU General
+// Public License plus this exception.  An independent module is a module
+// which is not derived from or based on Avisynth, such as 3rd-party filters,
+// import and export plugins, or graphical user interfaces.
+
+#include "resample_kernels.h"
+#include <avs/alignment.h>
+
+
+/***************************************
+ ***** Vertical Resizer Assembly *******
+ ***************************************/
+
+void resize_v_planar_pointresize(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int target_height, const int* pitch_table, const void* storage)
+{
+  int filter_size = program->filter_size;
+
+  for (int y = 0; y < target_height; y++) {
+    int offset = program->pixel_offset[y];
+    const BYTE* src_ptr = src + pitch_table[offset];
+
+    memcpy(dst, src_ptr, width);
+
+    dst += dst_pitch;
+  }
+}
+
+void resize_v_c_planar(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int target_height, const int* pitch_table, const void* storage)
+{
+  int filter_size = program->filter_size;
+  short* current_coeff = program->pixel_coefficient;
+
+  for (int y = 0; y < target_height; y++) {
+    int offset = program->pixel_offset[y];
+    const BYTE* src_ptr = src + pitch_table[offset];
+
+    for (int x = 0; x < width; x++) {
+      int result = 0;
+      for (int i = 0; i < filter_size; i++) {
+        result += (src_ptr+pitch_table[i])[x] * current_coeff[i];
+      }
+      result = ((result+8192)/16384);
+      result = result > 255 ? 255 : result < 0 ? 0 : result;
+      dst[x] = (BYTE) result;
+    }
+
+    dst += dst_pitch;
+    current_coeff += filter_size;
+  }
+}
+
+#ifdef X86_32
+void resize_v_mmx_planar(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int target_height, const int* pitch_table, const void* storage)
+{
+  int filter_size = program->filter_size;
+  short* current_coeff = program->pixel_coefficient;
+
+  int wMod8 = (width / 8) * 8;
+  int sizeMod2 = (filter_size/2) * 2;
+  bool notMod2 = sizeMod2 < filter_size;
+
+  __m64 zero = _mm_setzero_si64();
+
+  for (int y = 0; y < target_height; y++) {
+    int offset = program->pixel_offset[y];
+    const BYTE* src_ptr = src + pitch_table[offset];
+
+    for (int x = 0; x < wMod8; x += 8) {
+      __m64 result_1 = _mm_set1_pi32(8192); // Init. with rounder (16384/2 = 8192)
+      __m64 result_2 = result_1;
+      __m64 result_3 = result_1;
+      __m64 result_4 = result_1;
+
+      for (int i = 0; i < sizeMod2; i += 2) {
+        __m64 src_p1 = *(reinterpret_cast<const __m64*>(src_ptr+pitch_table[i]+x));   // For detailed explanation please see SSE2 version.
+        __m64 src_p2 = *(reinterpret_cast<const __m64*>(src_ptr+pitch_table[i+1]+x));
+
+        __m64 src_l = _mm_unpacklo_pi8(src_p1, src_p2);                                   
+        __m64 src_h = _mm_unpackhi_pi8(src_p1, src_p2);                                   
+
+        __m64 src_1 = _mm_unpacklo_pi8(src_l, zero);                                      
+        __m64 src_2 = _mm_unpackhi_pi8(src_l, zero);                                      
+        __m64 src_3 = _mm_unpacklo_pi8(src_h, zero);                                      
+        __m64 src_4 = _mm_unpackhi_pi8(src_h, zero);                                      
+
+        __m64 coeff = _mm_cvtsi32_si64(*reinterpret_cast<const int*>(current_coeff+i));   
+        coeff = _mm_unpacklo_pi32(coeff, coeff);                                               
+
+        __m64 dst_1 = _mm_madd_pi16(src_1, coeff);                                        
+        __m64 dst_2 = _mm_madd_pi16(src_2, coeff);                                        
+        __m64 dst_3 = _mm_madd_pi16(src_3, coeff);
+        __m64 dst_4 = _mm_madd_pi16(src_4, coeff);
+
+        result_1 = _mm_add_pi32(result_1, dst_1);
+        result_2 = _mm_add_pi32(result_2, dst_2);
+        result_3 = _mm_add_pi32(result_3, dst_3);
+        result_4 = _mm_add_pi32(result_4, dst_4);
+      }
+
+      if (notMod2) { // do last odd row
+        __m64 src_p = *(reinterpret_cast<const __m64*>(src_ptr+pitch_table[sizeMod2]+x));
+
+        __m64 src_l = _mm_unpacklo_pi8(src_p, zero);
+        __m64 src_h = _mm_unpackhi_pi8(src_p, zero);
+
+        __m64 coeff = _mm_set1_pi16(current_coeff[sizeMod2]);
+
+        __m64 dst_ll = _mm_mullo_pi16(src_l, coeff);   // Multiply by coefficient
+        __m64 dst_lh = _mm_mulhi_pi16(src_l, coeff);
+        __m64 dst_hl = _mm_mullo_pi16(src_h, coeff);
+        __m64 dst_hh = _mm_mulhi_pi16(src_h, coeff);
+
+        __m64 dst_1 = _mm_unpacklo_pi16(dst_ll, dst_lh); // Unpack to 32-bit integer
+        __m64 dst_2 = _mm_unpackhi_pi16(dst_ll, dst_lh);
+        __m64 dst_3 = _mm_unpacklo_pi16(dst_hl, dst_hh);
+        __m64 dst_4 = _mm_unpackhi_pi16(dst_hl, dst_hh);
+
+        result_1 = _mm_add_pi32(result_1, dst_1);
+        result_2 = _mm_add_pi32(result_2, dst_2);
+        result_3 = _mm_add_pi32(result_3, dst_3);
+        result_4 = _mm_add_pi32(result_4, dst_4);
+      }
+
+      // Divide by 16348 (FPRound)
+      result_1  = _mm_srai_pi32(result_1, 14);
+      result_2  = _mm_srai_pi32(result_2, 14);
+      result_3  = _mm_srai_pi32(result_3, 14);
+      result_4  = _mm_srai_pi32(result_4, 14);
+
+      // Pack and store
+      __m64 result_l = _mm_packs_pi32(result_1, result_2);
+      __m64 result_h = _mm_packs_pi32(result_3, result_4);
+      __m64 result   = _mm_packs_pu16(result_l, result_h);
+
+      *(reinterpret_cast<__m64*>(dst+x)) = result;
+    }
+
+    // Leftover
+    for (int x = wMod8; x < width; x++) {
+      int result = 0;
+      for (int i = 0; i < filter_size; i++) {
+        result += (src_ptr+pitch_table[i])[x] * current_coeff[i];
+      }
+      result = ((result+8192)/16384);
+      result = result > 255 ? 255 : result < 0 ? 0 : result;
+      dst[x] = (BYTE) result;
+    }
+
+    dst += dst_pitch;
+    current_coeff += filter_size;
+  }
+
+  _mm_empty();
+}
+#endif
+
+template<SSELoader load>
+void resize_v_sse2_planar(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int target_height, const int* pitch_table, const void* storage)
+{
+  int filter_size = program->filter_size;
+  short* current_coeff = program->pixel_coefficient;
+  
+  int wMod16 = (width / 16) * 16;
+  int sizeMod2 = (filter_size/2) * 2;
+  bool notMod2 = sizeMod2 < filter_size;
+
+  __m128i zero = _mm_setzero_si128();
+
+  for (int y = 0; y < target_height; y++) {
+    int offset = program->pixel_offset[y];
+    const BYTE* src_ptr = src + pitch_table[offset];
+
+    for (int x = 0; x < wMod16; x += 16) {
+      __m128i result_1 = _mm_set1_epi32(8192); // Init. with rounder (16384/2 = 8192)
+      __m128i result_2 = result_1;
+      __m128i result_3 = result_1;
+      __m128i result_4 = result_1;
+      
+      for (int i = 0; i < sizeMod2; i += 2) {
+        __m128i src_p1 = load(reinterpret_cast<const __m128i*>(src_ptr+pitch_table[i]+x));   // p|o|n|m|l|k|j|i|h|g|f|e|d|c|b|a
+        __m128i src_p2 = load(reinterpret_cast<const __m128i*>(src_ptr+pitch_table[i+1]+x)); // P|O|N|M|L|K|J|I|H|G|F|E|D|C|B|A
+         
+        __m128i src_l = _mm_unpacklo_epi8(src_p1, src_p2);                                   // Hh|Gg|Ff|Ee|Dd|Cc|Bb|Aa
+        __m128i src_h = _mm_unpackhi_epi8(src_p1, src_p2);                                   // Pp|Oo|Nn|Mm|Ll|Kk|Jj|Ii
+
+        __m128i src_1 = _mm_unpacklo_epi8(src_l, zero);                                      // .D|.d|.C|.c|.B|.b|.A|.a
+        __m128i src_2 = _mm_unpackhi_epi8(src_l, zero);                                      // .H|.h|.G|.g|.F|.f|.E|.e
+        __m128i src_3 = _mm_unpacklo_epi8(src_h, zero);                                      // etc.
+        __m128i src_4 = _mm_unpackhi_epi8(src_h, zero);                                      // etc.
+
+        __m128i coeff = _mm_cvtsi32_si128(*reinterpret_cast<const int*>(current_coeff+i));   // XX|XX|XX|XX|XX|XX|CO|co
+        coeff = _mm_shuffle_epi32(coeff, 0);                                                 // CO|co|CO|co|CO|co|CO|co
+        
+        __m128i dst_1 = _mm_madd_epi16(src_1, coeff);                                         // CO*D+co*d | CO*C+co*c | CO*B+co*b | CO*A+co*a
+        __m128i dst_2 = _mm_madd_epi16(src_2, coeff);                                         // etc.
+        __m128i dst_3 = _mm_madd_epi16(src_3, coeff);
+        __m128i dst_4 = _mm_madd_epi16(src_4, coeff);
+
+        result_1 = _mm_add_epi32(result_1, dst_1);
+        result_2 = _mm_add_epi32(result_2, dst_2);
+        result_3 = _mm_add_epi32(result_3, dst_3);
+        result_4 = _mm_add_epi32(result_4, dst_4);
+      }
+      
+      if (notMod2) { // do last odd row
+        __m128i src_p = load(reinterpret_cast<const __m128i*>(src_ptr+pitch_table[sizeMod2]+x));
+
+        __m128i src_l = _mm_unpacklo_epi8(src_p, zero);
+        __m128i src_h = _mm_unpackhi_epi8(src_p, zero);
+
+        __m128i coeff = _mm_set1_epi16(current_coeff[sizeMod2]);
+
+        __m128i dst_ll = _mm_mullo_epi16(src_l, coeff);   // Multiply by coefficient
+        __m128i dst_lh = _mm_mulhi_epi16(src_l, coeff);
+        __m128i dst_hl = _mm_mullo_epi16(src_h, coeff);
+        __m128i dst_hh = _mm_mulhi_epi16(src_h, coeff);
+
+        __m128i dst_1 = _mm_unpacklo_epi16(dst_ll, dst_lh); // Unpack to 32-bit integer
+        __m128i dst_2 = _mm_unpackhi_epi16(dst_ll, dst_lh);
+        __m128i dst_3 = _mm_unpacklo_epi16(dst_hl, dst_hh);
+        __m128i dst_4 = _mm_unpackhi_epi16(dst_hl, dst_hh);
+
+        result_1 = _mm_add_epi32(result_1, dst_1);
+        result_2 = _mm_add_epi32(result_2, dst_2);
+        result_3 = _mm_add_epi32(result_3, dst_3);
+        result_4 = _mm_add_epi32(result_4, dst_4);
+      }
+      
+      // Divide by 16348 (FPRound)
+      result_1  = _mm_srai_epi32(result_1, 14);
+      result_2  = _mm_srai_epi32(result_2, 14);
+      result_3  = _mm_srai_epi32(result_3, 14);
+      result_4  = _mm_srai_epi32(result_4, 14);
+
+      // Pack and store
+      __m128i result_l = _mm_packs_epi32(result_1, result_2);
+      __m128i result_h = _mm_packs_epi32(result_3, result_4);
+      __m128i result   = _mm_packus_epi16(result_l, result_h);
+
+      _mm_store_si128(reinterpret_cast<__m128i*>(dst+x), result);
+    }
+
+    // Leftover
+    for (int x = wMod16; x < width; x++) {
+      int result = 0;
+      for (int i = 0; i < filter_size; i++) {
+        result += (src_ptr+pitch_table[i])[x] * current_coeff[i];
+      }
+      result = ((result+8192)/16384);
+      result = result > 255 ? 255 : result < 0 ? 0 : result;
+      dst[x] = (BYTE) result;
+    }
+
+    dst += dst_pitch;
+    current_coeff += filter_size;
+  }
+}
+
+template<SSELoader load>
+void resize_v_ssse3_planar(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int target_height, const int* pitch_table, const void* storage)
+{
+  int filter_size = program->filter_size;
+  short* current_coeff = program->pixel_coefficient;
+  
+  int wMod16 = (width / 16) * 16;
+
+  __m128i zero = _mm_setzero_si128();
+  __m128i coeff_unpacker = _mm_set_epi8(1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0);
+
+  for (int y = 0; y < target_height; y++) {
+    int offset = program->pixel_offset[y];
+    const BYTE* src_ptr = src + pitch_table[offset];
+
+    for (int x = 0; x < wMod16; x+=16) {
+      __m128i result_l = _mm_set1_epi16(32); // Init. with rounder ((1 << 6)/2 = 32)
+      __m128i result_h = result_l;
+
+      const BYTE* src2_ptr = src_ptr+x;
+      
+      for (int i = 0; i < filter_size; i++) {
+        __m128i src_p = load(reinterpret_cast<const __m128i*>(src2_ptr));
+
+        __m128i src_l = _mm_unpacklo_epi8(src_p, zero);
+        __m128i src_h = _mm_unpackhi_epi8(src_p, zero);
+
+        src_l = _mm_slli_epi16(src_l, 7);
+        src_h = _mm_slli_epi16(src_h, 7);
+
+        __m128i coeff = _mm_cvtsi32_si128(*reinterpret_cast<const int*>(current_coeff+i));
+                coeff = _mm_shuffle_epi8(coeff, coeff_unpacker);
+
+        __m128i dst_l = _mm_mulhrs_epi16(src_l, coeff);   // Multiply by coefficient (SSSE3)
+        __m128i dst_h = _mm_mulhrs_epi16(src_h, coeff);
+
+        result_l = _mm_add_epi16(result_l, dst_l);
+        result_h = _mm_add_epi16(result_h, dst_h);
+
+        src2_ptr += src_pitch;
+      }
+
+      // Divide by 64
+      result_l  = _mm_srai_epi16(result_l, 6);
+      result_h  = _mm_srai_epi16(result_h, 6);
+
+      // Pack and store
+      __m128i result   = _mm_packus_epi16(result_l, result_h);
+
+      _mm_store_si128(reinterpret_cast<__m128i*>(dst+x), result);
+    }
+
+    // Leftover
+    for (int x = wMod16; x < width; x++) {
+      int result = 0;
+      for (int i = 0; i < filter_size; i++) {
+        result += (src_ptr+pitch_table[i])[x] * current_coeff[i];
+      }
+      result = ((result+8192)/16384);
+      result = result > 255 ? 255 : result < 0 ? 0 : result;
+      dst[x] = (BYTE) result;
+    }
+
+    dst += dst_pitch;
+    current_coeff += filter_size;
+  }
+}
+
+template void resize_v_sse2_planar<simd_load_aligned>(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int target_height, const int* pitch_table, const void* storage);
+template void resize_v_sse2_planar<simd_load_unaligned>(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int target_height, const int* pitch_table, const void* storage);
+template void resize_v_sse2_planar<simd_load_unaligned_sse3>(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int target_height, const int* pitch_table, const void* storage);
+template void resize_v_sse2_planar<simd_load_streaming>(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int target_height, const int* pitch_table, const void* storage);
+template void resize_v_ssse3_planar<simd_load_aligned>(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int target_height, const int* pitch_table, const void* storage);
+template void resize_v_ssse3_planar<simd_load_unaligned>(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int target_height, const int* pitch_table, const void* storage);
+template void resize_v_ssse3_planar<simd_load_unaligned_sse3>(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int target_height, const int* pitch_table, const void* storage);
+template void resize_v_ssse3_planar<simd_load_streaming>(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int target_height, const int* pitch_table, const void* storage);
+
+
+
+
+/***************************************
+ ********* Horizontal Resizer** ********
+ ***************************************/
+
+void resize_h_pointresize(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int height) {
+  int wMod4 = width/4 * 4;
+
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < wMod4; x+=4) {
+#define pixel(a) src[program->pixel_offset[x+a]]
+      unsigned int data = (pixel(3) << 24) + (pixel(2) << 16) + (pixel(1) << 8) + pixel(0);
+#undef pixel
+      *((unsigned int *)(dst+x)) = data;
+    }
+
+    for (int x = wMod4; x < width; x++) {
+      dst[x] = src[program->pixel_offset[x]];
+    }
+
+    dst += dst_pitch;
+    src += src_pitch;
+  }
+}
+
+void resize_h_prepare_coeff_8(ResamplingProgram* p, IScriptEnvironment2* env) {
+  int filter_size = AlignNumber(p->filter_size, 8);
+  short* new_coeff = (short*) env->Allocate(sizeof(short) * p->target_size * filter_size, 64, AVS_NORMAL_ALLOC);
+  memset(new_coeff, 0, sizeof(short) * p->target_size * filter_size);
+
+  // Copy coeff
+  short *dst = new_coeff, *src = p->pixel_coefficient;
+  for (int i = 0; i < p->target_size; i++) {
+    for (int j = 0; j < p->filter_size; j++) {
+      dst[j] = src[j];
+    }
+
+    dst += filter_size;
+    src += p->filter_size;
+  }
+
+  env->Free(p->pixel_coefficient);
+  p->pixel_coefficient = new_coeff;
+}
+
+void resize_h_c_planar(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int height) {
+  int filter_size = program->filter_size;
+  short* current = program->pixel_coefficient;
+
+  for (int x = 0; x < width; x++) {
+    int begin = program->pixel_offset[x];
+    for (int y = 0; y < height; y++) {
+      int result = 0;
+      for (int i = 0; i < filter_size; i++) {
+        result += (src+y*src_pitch)[(begin+i)] * current[i];
+      }
+      result = ((result+8192)/16384);
+      result = result > 255 ? 255 : result < 0 ? 0 : result;
+      (dst+y*dst_pitch)[x] = (BYTE)result;
+    }
+    current += filter_size;
+  }
+}
+
+void resizer_h_ssse3_generic(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int height) {
+  int filter_size = AlignNumber(program->filter_size, 8) / 8;
+  __m128i zero = _mm_setzero_si128();
+
+  for (int y = 0; y < height; y++) {
+    short* current_coeff = program->pixel_coefficient;
+    for (int x = 0; x < width; x+=4) {
+      __m128i result1 = _mm_setr_epi32(8192, 0, 0, 0);
+      __m128i result2 = _mm_setr_epi32(8192, 0, 0, 0);
+      __m128i result3 = _mm_setr_epi32(8192, 0, 0, 0);
+      __m128i result4 = _mm_setr_epi32(8192, 0, 0, 0);
+
+      int begin1 = program->pixel_offset[x+0];
+      int begin2 = program->pixel_offset[x+1];
+      int begin3 = program->pixel_offset[x+2];
+      int begin4 = program->pixel_offset[x+3];
+
+      for (int i = 0; i < filter_size; i++) {
+        __m128i data, coeff, current_result;
+        data = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src+begin1+i*8));
+        data = _mm_unpacklo_epi8(data, zero);
+        coeff = _mm_load_si128(reinterpret_cast<const __m128i*>(current_coeff));
+        current_result = _mm_madd_epi16(data, coeff);
+        result1 = _mm_add_epi32(result1, current_result);
+
+        current_coeff += 8;
+      }
+
+      for (int i = 0; i < filter_size; i++) {
+        __m128i data, coeff, current_result;
+        data = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src+begin2+i*8));
+        data = _mm_unpacklo_epi8(data, zero);
+        coeff = _mm_load_si128(reinterpret_cast<const __m128i*>(current_coeff));
+        current_result = _mm_madd_epi16(data, coeff);
+        result2 = _mm_add_epi32(result2, current_result);
+
+        current_coeff += 8;
+      }
+
+      for (int i = 0; i < filter_size; i++) {
+        __m128i data, coeff, current_result;
+        data = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src+begin3+i*8));
+        data = _mm_unpacklo_epi8(data, zero);
+        coeff = _mm_load_si128(reinterpret_cast<const __m128i*>(current_coeff));
+        current_result = _mm_madd_epi16(data, coeff);
+        result3 = _mm_add_epi32(result3, current_result);
+
+        current_coeff += 8;
+      }
+
+      for (int i = 0; i < filter_size; i++) {
+        __m128i data, coeff, current_result;
+        data = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src+begin4+i*8));
+        data = _mm_unpacklo_epi8(data, zero);
+        coeff = _mm_load_si128(reinterpret_cast<const __m128i*>(current_coeff));
+        current_result = _mm_madd_epi16(data, coeff);
+        result4 = _mm_add_epi32(result4, current_result);
+
+        current_coeff += 8;
+      }
+
+      __m128i result12 = _mm_hadd_epi32(result1, result2);
+      __m128i result34 = _mm_hadd_epi32(result3, result4);
+      __m128i result = _mm_hadd_epi32(result12, result34);
+
+      result = _mm_srai_epi32(result, 14);
+
+      result = _mm_packs_epi32(result, zero);
+      result = _mm_packus_epi16(result, zero);
+
+      *((int*)(dst+x)) = _mm_cvtsi128_si32(result);
+    }
+
+    dst += dst_pitch;
+    src += src_pitch;
+  }
+}
+
+void resizer_h_ssse3_8(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int height) {
+  int filter_size = AlignNumber(program->filter_size, 8) / 8;
+
+  __m128i zero = _mm_setzero_si128();
+
+  for (int y = 0; y < height; y++) {
+    short* current_coeff = program->pixel_coefficient;
+    for (int x = 0; x < width; x+=4) {
+      __m128i result1 = _mm_setr_epi32(8192, 0, 0, 0);
+      __m128i result2 = _mm_setr_epi32(8192, 0, 0, 0);
+      __m128i result3 = _mm_setr_epi32(8192, 0, 0, 0);
+      __m128i result4 = _mm_setr_epi32(8192, 0, 0, 0);
+
+      int begin1 = program->pixel_offset[x+0];
+      int begin2 = program->pixel_offset[x+1];
+      int begin3 = program->pixel_offset[x+2];
+      int begin4 = program->pixel_offset[x+3];
+
+      __m128i data, coeff, current_result;
+
+      // Unroll 1
+      data = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src+begin1));
+      data = _mm_unpacklo_epi8(data, zero);
+      coeff = _mm_load_si128(reinterpret_cast<const __m128i*>(current_coeff));
+      current_result = _mm_madd_epi16(data, coeff);
+      result1 = _mm_add_epi32(result1, current_result);
+
+      current_coeff += 8;
+
+      // Unroll 2
+      data = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src+begin2));
+      data = _mm_unpacklo_epi8(data, zero);
+      coeff = _mm_load_si128(reinterpret_cast<const __m128i*>(current_coeff));
+      current_result = _mm_madd_epi16(data, coeff);
+      result2 = _mm_add_epi32(result2, current_result);
+
+      current_coeff += 8;
+
+      // Unroll 3
+      data = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src+begin3));
+      data = _mm_unpacklo_epi8(data, zero);
+      coeff = _mm_load_si128(reinterpret_cast<const __m128i*>(current_coeff));
+      current_result = _mm_madd_epi16(data, coeff);
+      result3 = _mm_add_epi32(result3, current_result);
+
+      current_coeff += 8;
+
+      // Unroll 4
+      data = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src+begin4));
+      data = _mm_unpacklo_epi8(data, zero);
+      coeff = _mm_load_si128(reinterpret_cast<const __m128i*>(current_coeff));
+      current_result = _mm_madd_epi16(data, coeff);
+      result4 = _mm_add_epi32(result4, current_result);
+
+      current_coeff += 8;
+
+      // Combine
+      __m128i result12 = _mm_hadd_epi32(result1, result2);
+      __m128i result34 = _mm_hadd_epi32(result3, result4);
+      __m128i result = _mm_hadd_epi32(result12, result34);
+
+      result = _mm_srai_epi32(result, 14);
+
+      result = _mm_packs_epi32(result, zero);
+      result = _mm_packus_epi16(result, zero);
+
+      *((int*)(dst+x)) = _mm_cvtsi128_si32(result);
+    }
+
+    dst += dst_pitch;
+    src += src_pitch;
+  }
+}
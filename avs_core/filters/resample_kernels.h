@@ -0,0 +1,103 @@
+// Avisynth v2.5.  Copyright 2002 Ben Rudiak-Gould et al.
+// http://www.avisynth.org
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA, or visit
+// http://www.gnu.org/copyleft/gpl.html .
+//
+// Linking Avisynth statically or dynamically with other modules is making a
+// combined work based on Avisynth.  Thus, the terms and conditions of the GNU
+// General Public License cover the whole combination.
+//
+// As a special exception, the copyright holders of Avisynth give you
+// permission to link Avisynth with independent modules that communicate with
+// Avisynth solely through the interfaces defined in avisynth.h, regardless of the license
+// terms of these independent modules, and to copy and distribute the
+// resulting combined work under terms of your choice, provided that
+// every copy of the combined work is accompanied by a complete copy of
+// the source code of Avisynth (the version of Avisynth used to produce the
+// combined work), being distributed under the terms of the GNU General
+// Public License plus this exception.  An independent module is a module
+// which is not derived from or based on Avisynth, such as 3rd-party filters,
+// import and export plugins, or graphical user interfaces.
+
+#ifndef __Resample_Kernels_H__
+#define __Resample_Kernels_H__
+
+#include <avisynth.h>
+#include "resample_functions.h"
+
+// Intrinsics for SSE4.1, SSSE3, SSE3, SSE2, ISSE and MMX
+#include <smmintrin.h>
+
+/***************************************
+ ********* Templated SSE Loader ********
+ ***************************************/
+
+typedef __m128i (SSELoader)(const __m128i*);
+
+__forceinline __m128i simd_load_aligned(const __m128i* adr)
+{
+  return _mm_load_si128(adr);
+}
+
+__forceinline __m128i simd_load_unaligned(const __m128i* adr)
+{
+  return _mm_loadu_si128(adr);
+}
+
+__forceinline __m128i simd_load_unaligned_sse3(const __m128i* adr)
+{
+  return _mm_lddqu_si128(adr);
+}
+
+__forceinline __m128i simd_load_streaming(const __m128i* adr)
+{
+  return _mm_stream_load_si128(const_cast<__m128i*>(adr));
+}
+
+__forceinline static void resize_v_create_pitch_table(int* table, int pitch, int height) {
+  table[0] = 0;
+  for (int i = 1; i < height; i++) {
+    table[i] = table[i-1]+pitch;
+  }
+}
+
+
+void resize_v_planar_pointresize(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int target_height, const int* pitch_table, const void* storage);
+
+void resize_v_c_planar(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int target_height, const int* pitch_table, const void* storage);
+
+#ifdef X86_32
+void resize_v_mmx_planar(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int target_height, const int* pitch_table, const void* storage);
+#endif
+
+template<SSELoader load>
+void resize_v_sse2_planar(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int target_height, const int* pitch_table, const void* storage);
+
+template<SSELoader load>
+void resize_v_ssse3_planar(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int target_height, const int* pitch_table, const void* storage);
+
+
+void resize_h_pointresize(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int height);
+
+void resize_h_prepare_coeff_8(ResamplingProgram* p, IScriptEnvironment2* env);
+
+void resize_h_c_planar(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int height);
+
+void resizer_h_ssse3_generic(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int height);
+
+void resizer_h_ssse3_8(BYTE* dst, const BYTE* src, int dst_pitch, int src_pitch, ResamplingProgram* program, int width, int height);
+
+#endif  // __Resample_Kernels_H__
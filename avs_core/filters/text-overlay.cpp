@@ -35,6 +35,7 @@
 
 #include "text-overlay.h"
 #include "../convert/convert.h"  // for RGB2YUV
+#include "../core/FrameScheduler.h"
 #include <avs/win.h>
 #include <sstream>
 #include <avs/config.h>
@@ -1584,8 +1585,11 @@ static void compare_isse(DWORD mask, int increment,
 
 PVideoFrame __stdcall Compare::GetFrame(int n, IScriptEnvironment* env)
 {
-  PVideoFrame f1 = child->GetFrame(n, env);
-  PVideoFrame f2 = child2->GetFrame(n, env);
+  FrameRequest requests[2] = { { child, n }, { child2, n } };
+  PVideoFrame frames[2];
+  GetFrames(requests, frames, 2, env);
+  PVideoFrame& f1 = frames[0];
+  PVideoFrame& f2 = frames[1];
 
   int SD = 0;
   int SAD = 0;
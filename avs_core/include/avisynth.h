@@ -654,6 +654,26 @@ enum CachePolicyHint {
   CACHE_IS_MTGUARD_REQ,
   CACHE_IS_MTGUARD_ANS,
 
+  CACHE_GET_AUDIO_HITS,             // Number of audio requests served entirely from the cache
+  CACHE_GET_AUDIO_PARTIAL_HITS,     // Number of audio requests where only the head or tail had to be fetched
+  CACHE_GET_AUDIO_MISSES,           // Number of audio requests passed to the child in full
+
+  CACHE_SET_REPLACEMENT_POLICY,     // Select how video frames are evicted, one of:
+    CACHE_REPLACEMENT_LRU,          // Least recently used frames first (default)
+    CACHE_REPLACEMENT_ARC,          // Adaptive, scan-resistant balance of recently and frequently used frames
+  CACHE_GET_REPLACEMENT_POLICY,     // Get the current replacement policy
+
+  CACHE_GET_COMPRESSED_HITS,        // Number of frames restored from the compressed tier
+  CACHE_GET_COMPRESSED_STORES,      // Number of evicted frames moved to the compressed tier
+  CACHE_GET_COMPRESSION_RATIO,      // Average compressed size of stored frames, in percent of their raw size
+  CACHE_GET_DECOMPRESSION_TIME,     // Average time to restore a frame from the compressed tier, in microseconds
+
+  CACHE_HAS_FRAME_DEPENDENCIES_REQ, // Filters implementing IFrameDependencies answer with CACHE_HAS_FRAME_DEPENDENCIES_ANS
+  CACHE_HAS_FRAME_DEPENDENCIES_ANS,
+
+  CACHE_HAS_FRAME_BATCHES_REQ,      // Filters implementing IFrameBatch answer with CACHE_HAS_FRAME_BATCHES_ANS
+  CACHE_HAS_FRAME_BATCHES_ANS,
+
   CACHE_USER_CONSTANTS = 1000       // Smaller values are reserved for the core
 
 };
@@ -678,6 +698,37 @@ public:
 }; // end class IClip
 
 
+// A frame of a child clip that a filter needs to produce one of its frames
+struct FrameDependency {
+  IClip* clip;
+  int n;
+};
+
+// Optional extension of IClip for filters that know in advance which child
+// frames an output frame is made of. The engine requests these frames in
+// parallel before it calls GetFrame. A filter that implements it must also
+// answer CACHE_HAS_FRAME_DEPENDENCIES_REQ with CACHE_HAS_FRAME_DEPENDENCIES_ANS.
+class IFrameDependencies {
+public:
+  // Stores up to max_deps child frames needed for frame n in deps and returns
+  // their total number. Listing a frame that GetFrame ends up not using only costs time.
+  virtual int __stdcall GetFrameDependencies(int n, FrameDependency* deps, int max_deps) = 0;
+  virtual __stdcall ~IFrameDependencies() {}
+};
+
+// Optional extension of IClip for filters that can produce a run of frames
+// more efficiently than one GetFrame call at a time, e.g. sources that decode
+// ahead. A filter that implements it must also answer CACHE_HAS_FRAME_BATCHES_REQ
+// with CACHE_HAS_FRAME_BATCHES_ANS.
+class IFrameBatch {
+public:
+  // Stores frames start, start+stride, ... into frames[0..count-1].
+  // stride is never zero, and all frames are within the clip.
+  virtual void __stdcall GetFrames(int start, int count, int stride, PVideoFrame* frames, IScriptEnvironment* env) = 0;
+  virtual __stdcall ~IFrameBatch() {}
+};
+
+
 // smart pointer to IClip
 class PClip {
 
@@ -1009,7 +1060,8 @@ enum MtMode
   MT_NICE_FILTER = 1,
   MT_MULTI_INSTANCE = 2,
   MT_SERIALIZED = 3,
-  MT_MODE_COUNT = 4
+  MT_SERIALIZED_ORDERED = 4,  // Like MT_SERIALIZED, but concurrent requests reach the filter in ascending frame order
+  MT_MODE_COUNT = 5
 };
 
 class IJobCompletion
@@ -1025,6 +1077,35 @@ public:
   virtual void __stdcall Destroy() = 0;
 };
 
+class IFrameRequest;
+
+// Called on a worker thread when an asynchronous frame request has finished,
+// successfully or not. Not called for requests that were cancelled.
+typedef void (__stdcall *FrameReadyCallback)(IFrameRequest* request, void* user_data);
+
+class IFrameRequest
+{
+public:
+
+  virtual __stdcall ~IFrameRequest() {}
+
+  // True once the frame or an error is available, or the request was cancelled
+  virtual bool __stdcall IsReady() = 0;
+  virtual void __stdcall Wait() = 0;
+
+  // Waits for the frame. Throws AvisynthError if producing the frame failed
+  // or the request was cancelled.
+  virtual PVideoFrame __stdcall GetResult() = 0;
+
+  // Returns true if the request was cancelled before it started. A request
+  // that is already running completes normally.
+  virtual bool __stdcall Cancel() = 0;
+
+  // Cancels the request if it has not started yet, waits for it and its
+  // callback if it is running, and frees it. May be called from within the callback.
+  virtual void __stdcall Destroy() = 0;
+};
+
 class IScriptEnvironment2;
 class Prefetcher;
 typedef AVSValue (*ThreadWorkerFuncPtr)(IScriptEnvironment2* env, void* data);
@@ -1036,7 +1117,11 @@ enum AvsEnvProperty
   AEP_THREADPOOL_THREADS = 3,
   AEP_FILTERCHAIN_THREADS = 4,
   AEP_THREAD_ID = 5,
-  AEP_VERSION = 6
+  AEP_VERSION = 6,
+  AEP_MEMORY_USED = 7,      // Bytes of frame buffers currently allocated
+  AEP_MEMORY_PEAK = 8,      // Highest AEP_MEMORY_USED so far
+  AEP_FRAME_COPIES = 9,     // Frames MakeWritable() had to copy so far
+  AEP_CACHES_ELIDED = 10    // Caches that currently pass frames through without storing them
 };
 
 enum AvsAllocType
@@ -1100,6 +1185,12 @@ public:
   virtual void __stdcall AdjustMemoryConsumption(size_t amount, bool minus) = 0;
   virtual void __stdcall SetPrefetcher(Prefetcher *p) = 0;
 
+  // Requests frame n of clip on the thread pool and returns immediately. The
+  // callback is optional. Requests must be destroyed before the environment.
+  // Throws unless the script called Prefetch(), because without it the filter
+  // graph does not expect to be entered by two threads at once.
+  virtual IFrameRequest* __stdcall GetFrameAsync(const PClip& clip, int n, FrameReadyCallback callback, void* user_data) = 0;
+
   // These lines are needed so that we can overload the older functions from IScriptEnvironment.
   using IScriptEnvironment::Invoke;
   using IScriptEnvironment::AddFunction;
@@ -515,6 +515,39 @@ AVSC_API(int, avs_get_audio)(AVS_Clip *, void * buf,
 AVSC_API(int, avs_set_cache_hints)(AVS_Clip *, 
                                    int cachehints, int frame_range);
 
+/////////////////////////////////////////////////////////////////////
+//
+// AVS_FrameRequest
+//
+// Frame requests that are served by the thread pool, so that a host can keep
+// several frames in flight without threads of its own.
+
+typedef struct AVS_FrameRequest AVS_FrameRequest;
+
+// Called on a worker thread when a request has finished, successfully or not.
+// Not called for requests that were cancelled.
+typedef void (AVSC_CC * AVS_FrameReadyCallback)
+                        (AVS_FrameRequest *, void * user_data);
+
+AVSC_API(AVS_FrameRequest *, avs_get_frame_async)(AVS_Clip *, int n,
+                                   AVS_FrameReadyCallback callback, void * user_data);
+// callback may be 0. The request must be released with avs_release_frame_request
+// before the script environment is deleted. Fails unless the script called Prefetch()
+
+AVSC_API(int, avs_frame_request_is_ready)(AVS_FrameRequest *);
+
+AVSC_API(AVS_VideoFrame *, avs_frame_request_get_frame)(AVS_FrameRequest *);
+// Waits for the frame. Returns 0 on error or if the request was cancelled.
+// The returned video frame must be released with avs_release_video_frame
+
+AVSC_API(const char *, avs_frame_request_get_error)(AVS_FrameRequest *); // return 0 if no error
+
+AVSC_API(int, avs_cancel_frame_request)(AVS_FrameRequest *);
+// return 1 if the request was cancelled before it started
+
+AVSC_API(void, avs_release_frame_request)(AVS_FrameRequest *);
+// cancels a pending request, waits for a running one; may be called from the callback
+
 // This is the callback type used by avs_add_function
 typedef AVS_Value (AVSC_CC * AVS_ApplyFunc)
                         (AVS_ScriptEnvironment *, AVS_Value args, void * user_data);
@@ -715,6 +748,12 @@ struct AVS_Library {
   AVSC_DECLARE_FUNC(avs_take_clip);
   AVSC_DECLARE_FUNC(avs_vsprintf);
   AVSC_DECLARE_FUNC(avs_get_error);
+  AVSC_DECLARE_FUNC(avs_get_frame_async);
+  AVSC_DECLARE_FUNC(avs_frame_request_is_ready);
+  AVSC_DECLARE_FUNC(avs_frame_request_get_frame);
+  AVSC_DECLARE_FUNC(avs_frame_request_get_error);
+  AVSC_DECLARE_FUNC(avs_cancel_frame_request);
+  AVSC_DECLARE_FUNC(avs_release_frame_request);
 };
 
 #undef AVSC_DECLARE_FUNC
@@ -774,6 +813,12 @@ AVSC_INLINE AVS_Library * avs_load_library() {
   AVSC_LOAD_FUNC(avs_take_clip);
   AVSC_LOAD_FUNC(avs_vsprintf);
   AVSC_LOAD_FUNC(avs_get_error);
+  AVSC_LOAD_FUNC(avs_get_frame_async);
+  AVSC_LOAD_FUNC(avs_frame_request_is_ready);
+  AVSC_LOAD_FUNC(avs_frame_request_get_frame);
+  AVSC_LOAD_FUNC(avs_frame_request_get_error);
+  AVSC_LOAD_FUNC(avs_cancel_frame_request);
+  AVSC_LOAD_FUNC(avs_release_frame_request);
 
 #undef __AVSC_STRINGIFY
 #undef AVSC_STRINGIFY